@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "arena.h"
+
+/* Every allocation is aligned to this. Large enough for doubles, pointers and MPNumber. */
+#define ARENA_ALIGNMENT 16
+
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~((gsize) ARENA_ALIGNMENT - 1))
+
+/* Offset of usable memory from the start of a block. */
+#define ARENA_BLOCK_HEADER ARENA_ALIGN(sizeof(ArenaBlock))
+
+/* Default block size, enough for the nodes and tokens of a typical equation. */
+#define ARENA_DEFAULT_BLOCK_SIZE 4096
+
+/* Counters are only folded in when an arena is destroyed, so allocation itself stays free of atomics. */
+static gsize stat_arenas = 0;
+static gsize stat_blocks = 0;
+static gsize stat_allocations = 0;
+static gsize stat_bytes = 0;
+
+static inline guint8*
+a_block_data(ArenaBlock* block)
+{
+    return (guint8 *) block + ARENA_BLOCK_HEADER;
+}
+
+/* Allocate a new block with at least `size` usable bytes and make it the current one. */
+static ArenaBlock*
+a_new_block(Arena* arena, gsize size)
+{
+    ArenaBlock* block;
+    if(size < arena->block_size)
+        size = arena->block_size;
+    block = (ArenaBlock *) malloc(ARENA_BLOCK_HEADER + size);
+    assert(block != NULL);
+    block->next = arena->head;
+    block->size = size;
+    block->used = 0;
+    arena->head = block;
+    arena->total_size += size;
+    arena->blocks++;
+    return block;
+}
+
+/* Create an arena. The arena structure lives at the start of its own first block. */
+Arena*
+a_create_arena(gsize block_size)
+{
+    Arena* arena;
+    ArenaBlock* block;
+    if(block_size == 0)
+        block_size = ARENA_DEFAULT_BLOCK_SIZE;
+    block_size = ARENA_ALIGN(block_size);
+    block = (ArenaBlock *) malloc(ARENA_BLOCK_HEADER + block_size);
+    assert(block != NULL);
+    block->next = NULL;
+    block->size = block_size;
+    block->used = ARENA_ALIGN(sizeof(Arena));
+    assert(block->used <= block->size);
+    arena = (Arena *) a_block_data(block);
+    arena->head = block;
+    arena->block_size = block_size;
+    arena->total_size = block_size;
+    arena->blocks = 1;
+    arena->allocations = 0;
+    arena->bytes = 0;
+    return arena;
+}
+
+/* Destroy arena. The block holding the arena structure is the last one in the list. */
+void
+a_destroy_arena(Arena* arena)
+{
+    ArenaBlock *block, *next;
+    if(arena == NULL)
+        return;
+    g_atomic_pointer_add(&stat_arenas, 1);
+    g_atomic_pointer_add(&stat_blocks, arena->blocks);
+    g_atomic_pointer_add(&stat_allocations, arena->allocations);
+    g_atomic_pointer_add(&stat_bytes, arena->bytes);
+    for(block = arena->head; block; block = next)
+    {
+        next = block->next;
+        free(block);
+    }
+}
+
+gpointer
+a_alloc(Arena* arena, gsize size)
+{
+    ArenaBlock* block = arena->head;
+    gpointer ret;
+    size = ARENA_ALIGN(size);
+    if(block->size - block->used < size)
+        block = a_new_block(arena, size);
+    ret = a_block_data(block) + block->used;
+    block->used += size;
+    arena->allocations++;
+    arena->bytes += size;
+    return ret;
+}
+
+gpointer
+a_alloc0(Arena* arena, gsize size)
+{
+    gpointer ret = a_alloc(arena, size);
+    memset(ret, 0, size);
+    return ret;
+}
+
+gchar*
+a_strndup(Arena* arena, const gchar* str, gsize length)
+{
+    gchar* ret = (gchar *) a_alloc(arena, length + 1);
+    memcpy(ret, str, length);
+    ret[length] = '\0';
+    return ret;
+}
+
+gsize
+a_get_size(Arena* arena)
+{
+    return arena->total_size;
+}
+
+void
+a_get_statistics(ArenaStatistics* stats)
+{
+    stats->arenas = g_atomic_pointer_get(&stat_arenas);
+    stats->blocks = g_atomic_pointer_get(&stat_blocks);
+    stats->allocations = g_atomic_pointer_get(&stat_allocations);
+    stats->bytes = g_atomic_pointer_get(&stat_bytes);
+}
+
+void
+a_reset_statistics(void)
+{
+    g_atomic_pointer_set(&stat_arenas, 0);
+    g_atomic_pointer_set(&stat_blocks, 0);
+    g_atomic_pointer_set(&stat_allocations, 0);
+    g_atomic_pointer_set(&stat_bytes, 0);
+}
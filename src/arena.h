@@ -0,0 +1,58 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <glib.h>
+
+/* Single chunk of memory, arena hands out allocations from. */
+typedef struct arena_block
+{
+    struct arena_block *next;		/* Previously filled block. */
+    gsize size;				/* Usable bytes in this block. */
+    gsize used;				/* Bytes already handed out. */
+} ArenaBlock;
+
+/* Bump allocator. Everything allocated from it is released at once by a_destroy_arena(). */
+typedef struct
+{
+    ArenaBlock *head;			/* Block currently being filled. */
+    gsize block_size;			/* Default size of new blocks. */
+    gsize total_size;			/* Bytes held by all blocks. */
+    gsize blocks;			/* Blocks requested from malloc() by this arena. */
+    gsize allocations;			/* Allocations served by this arena. */
+    gsize bytes;			/* Bytes served by this arena. */
+} Arena;
+
+/* Allocation counters, summed over all destroyed arenas. Used by benchmarks. */
+typedef struct
+{
+    gsize arenas;			/* Number of arenas destroyed. */
+    gsize blocks;			/* Number of blocks requested from malloc(). */
+    gsize allocations;			/* Number of allocations served from blocks. */
+    gsize bytes;			/* Bytes served from blocks. */
+} ArenaStatistics;
+
+/* Create a new arena. The arena and its first block share a single malloc(). */
+Arena* a_create_arena(gsize block_size);
+
+/* Destroy arena and free every allocation made from it. */
+void a_destroy_arena(Arena*);
+
+/* Allocate `size` bytes, aligned for any type. Never returns NULL. */
+gpointer a_alloc(Arena*, gsize size);
+
+/* Allocate `size` zero filled bytes. */
+gpointer a_alloc0(Arena*, gsize size);
+
+/* Copy `length` bytes of `str` into the arena and NUL terminate them. */
+gchar* a_strndup(Arena*, const gchar* str, gsize length);
+
+/* Return bytes held by the arena. */
+gsize a_get_size(Arena*);
+
+/* Read global allocation counters. */
+void a_get_statistics(ArenaStatistics*);
+
+/* Reset global allocation counters. */
+void a_reset_statistics(void);
+
+#endif /* ARENA_H */
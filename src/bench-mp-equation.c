@@ -0,0 +1,138 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+/* Parses a sample of the test-mp-equation inputs repeatedly and reports how
+ * many allocations the parser makes per equation. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+
+#include "mp-equation.h"
+#include "arena.h"
+
+static MPEquationOptions options;
+
+static const char *equations[] =
+{
+    "2₁₀",
+    "FF₁₆",
+    "18364758544493064720₁₀",
+    "−−1",
+    "1½",
+    "0°0'0.1\"",
+    "2×10^−3",
+    "2y²",
+    "x²yx²y",
+    "x³+2x²−5",
+    "(x+3y)(2x-4y)",
+    "2x²+2xy−12y²",
+    "π",
+    "c₀",
+    "1+2×3−4÷5",
+    "(1+2)×(3−4)÷5",
+    "2^3^2",
+    "|−3.5|+⌊2.7⌋+⌈2.2⌉",
+    "5!",
+    "3√8+∜16",
+    "√2×√2",
+    "₃√27",
+    "sin 30",
+    "cos²(60)+sin²(60)",
+    "ln e",
+    "log₂ 1024",
+    "12 mod 5",
+    "2^10 mod 1000",
+    "x = 5",
+    "50%",
+    "200+10%",
+    "1 xor 3",
+    "not 0",
+    "1+2+3+4+5+6+7+8+9+10+11+12+13+14+15+16",
+    "((((((1+2)×3)−4)÷5)^2)+x)×y",
+    "z",
+    "2 +",
+};
+
+static int
+variable_is_defined(const char *name, void *data)
+{
+    return strcmp (name, "x") == 0 || strcmp (name, "y") == 0;
+}
+
+static int
+get_variable(const char *name, MPNumber *z, void *data)
+{
+    if (strcmp (name, "x") == 0) {
+        mp_set_from_integer (2, z);
+        return 1;
+    }
+    if (strcmp (name, "y") == 0) {
+        mp_set_from_integer (3, z);
+        return 1;
+    }
+    return 0;
+}
+
+static void
+set_variable(const char *name, const MPNumber *x, void *data)
+{
+}
+
+int
+main (int argc, char **argv)
+{
+    int iterations = 200, i, n_equations = G_N_ELEMENTS(equations);
+    guint64 parses;
+    gint64 start, elapsed;
+    ArenaStatistics stats;
+    MPNumber result = mp_new();
+
+    setlocale(LC_ALL, "C");
+
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+    if (iterations <= 0)
+        iterations = 1;
+
+    memset(&options, 0, sizeof(options));
+    options.base = 10;
+    options.wordlen = 32;
+    options.angle_units = MP_DEGREES;
+    options.variable_is_defined = variable_is_defined;
+    options.get_variable = get_variable;
+    options.set_variable = set_variable;
+
+    a_reset_statistics();
+    start = g_get_monotonic_time();
+    for (i = 0; i < iterations; i++) {
+        int j;
+        for (j = 0; j < n_equations; j++) {
+            char *error_token = NULL;
+            mp_equation_parse(equations[j], &options, &result, &error_token);
+            g_free(error_token);
+        }
+    }
+    elapsed = g_get_monotonic_time() - start;
+    a_get_statistics(&stats);
+    mp_clear(&result);
+
+    parses = (guint64) iterations * n_equations;
+    printf("equations:                %d\n", n_equations);
+    printf("parses:                   %" G_GUINT64_FORMAT "\n", parses);
+    printf("time per parse:           %.2f us\n", (double) elapsed / parses);
+    printf("arena allocations/parse:  %.2f\n", (double) stats.allocations / parses);
+    printf("arena blocks/parse:       %.2f\n", (double) stats.blocks / parses);
+    printf("arena bytes/parse:        %.1f\n", (double) stats.bytes / parses);
+    /* Counted by the arena itself, not against malloc() calls of any other allocator */
+    printf("arena allocations served from existing blocks/parse: %.2f\n",
+           (double) (stats.allocations - stats.blocks) / parses);
+
+    return 0;
+}
@@ -0,0 +1,375 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+/* Runs a corpus of expressions through the same steps as the calculator,
+ * timing each phase on its own: the pre-lexer, the lexer, building the parse
+ * tree, evaluating it and converting the result to a string. The lexer drives
+ * the pre-lexer, so its time includes a second pre-lexer pass. Reports the
+ * mean and percentiles of every phase, as text or as JSON.
+ *
+ * Usage: bench-mp-expression [--json] [ITERATIONS] [CORPUS]
+ *
+ * CORPUS is a file with one expression per line, used instead of the built-in
+ * sample of test-mp-equation inputs and generated long expressions. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#include <time.h>
+
+#include "mp-equation.h"
+#include "mp-serializer.h"
+#include "parser.h"
+
+typedef enum
+{
+    PHASE_PRELEXER,
+    PHASE_LEXER,
+    PHASE_PARSER,
+    PHASE_EVALUATE,
+    PHASE_SERIALIZE,
+    PHASE_TOTAL,
+    N_PHASES
+} Phase;
+
+static const char *phase_names[N_PHASES] =
+{
+    "prelexer",
+    "lexer",
+    "parser",
+    "evaluate",
+    "serialize",
+    "total"
+};
+
+static MPEquationOptions options;
+
+static const char *equations[] =
+{
+    "2₁₀",
+    "FF₁₆",
+    "18364758544493064720₁₀",
+    "−−1",
+    "1½",
+    "0°0'0.1\"",
+    "2×10^−3",
+    "2c3",
+    "xy",
+    "2x²y",
+    "x(x+3y)",
+    "c₀",
+    "1000000000000000−1000000000000000",
+    "(1+2)×3",
+    "100+1%",
+    "5!",
+    "|1−3|²",
+    "(4^3)^2",
+    "₁₀√1024",
+    "4^0.5",
+    "1^0 mod 2",
+    "⌈3.5⌉",
+    "{−3.2}",
+    "abs (−1)",
+    "log₂ 2",
+    "2 ln 2",
+    "cos 180",
+    "tan 10",
+    "sinh (−10) + sinh 10",
+    "erf 0",
+    "1÷i",
+    "i⁻¹",
+    "log (−10) − (1 + πi÷ln(10))",
+    "3 xor 5",
+    "1100∧1010",
+    "x = 5",
+    "z",
+    "2 +",
+};
+
+static int
+variable_is_defined(const char *name, void *data)
+{
+    return strcmp (name, "x") == 0 || strcmp (name, "y") == 0;
+}
+
+static int
+get_variable(const char *name, MPNumber *z, void *data)
+{
+    if (strcmp (name, "x") == 0) {
+        mp_set_from_integer (2, z);
+        return 1;
+    }
+    if (strcmp (name, "y") == 0) {
+        mp_set_from_integer (3, z);
+        return 1;
+    }
+    return 0;
+}
+
+static void
+set_variable(const char *name, const MPNumber *x, void *data)
+{
+}
+
+/* Expressions much longer than anyone types, to show how each phase scales */
+static void
+add_generated_equations(GPtrArray *corpus)
+{
+    GString *text;
+    int i;
+
+    /* Long sum */
+    text = g_string_new("1");
+    for (i = 2; i <= 500; i++)
+        g_string_append_printf(text, "+%d", i);
+    g_ptr_array_add(corpus, g_string_free(text, FALSE));
+
+    /* Polynomial in x */
+    text = g_string_new("x^50");
+    for (i = 49; i >= 0; i--)
+        g_string_append_printf(text, "%s%dx^%d", i % 2 ? "−" : "+", i + 1, i);
+    g_ptr_array_add(corpus, g_string_free(text, FALSE));
+
+    /* Deeply nested brackets */
+    text = g_string_new(NULL);
+    for (i = 0; i < 100; i++)
+        g_string_append_c(text, '(');
+    g_string_append_c(text, '1');
+    for (i = 0; i < 100; i++)
+        g_string_append_printf(text, "+%d)", i);
+    g_ptr_array_add(corpus, g_string_free(text, FALSE));
+
+    /* Nested functions */
+    text = g_string_new(NULL);
+    for (i = 0; i < 20; i++)
+        g_string_append(text, i % 2 ? "cos(" : "sin(");
+    g_string_append_c(text, 'x');
+    for (i = 0; i < 20; i++)
+        g_string_append_c(text, ')');
+    g_ptr_array_add(corpus, g_string_free(text, FALSE));
+
+    /* Long numbers */
+    text = g_string_new(NULL);
+    for (i = 0; i < 250; i++)
+        g_string_append_c(text, '1' + i % 9);
+    g_string_append(text, "÷");
+    for (i = 0; i < 250; i++)
+        g_string_append_c(text, '9' - i % 9);
+    g_ptr_array_add(corpus, g_string_free(text, FALSE));
+}
+
+static GPtrArray *
+load_corpus(const char *filename)
+{
+    GPtrArray *corpus = g_ptr_array_new_with_free_func(g_free);
+    int i;
+
+    if (filename) {
+        gchar *contents, **lines;
+        GError *error = NULL;
+
+        if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+            fprintf(stderr, "Failed to read corpus: %s\n", error->message);
+            exit(1);
+        }
+        lines = g_strsplit(contents, "\n", -1);
+        for (i = 0; lines[i] != NULL; i++) {
+            g_strstrip(lines[i]);
+            if (lines[i][0] != '\0')
+                g_ptr_array_add(corpus, g_strdup(lines[i]));
+        }
+        g_strfreev(lines);
+        g_free(contents);
+    }
+    else {
+        for (i = 0; i < (int) G_N_ELEMENTS(equations); i++)
+            g_ptr_array_add(corpus, g_strdup(equations[i]));
+        add_generated_equations(corpus);
+    }
+
+    return corpus;
+}
+
+/* Monotonic time in nanoseconds, g_get_monotonic_time() is too coarse for a single phase */
+static gint64
+get_time(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (gint64) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* Run expression through every phase, adding the time each one took to samples */
+static void
+run_equation(const char *expression, MpSerializer *serializer, GArray **samples)
+{
+    PreLexerState *prelexer;
+    ParserState *state;
+    gint64 times[N_PHASES], start, t;
+    gchar *text;
+    int i;
+
+    memset(times, 0, sizeof(times));
+
+    start = get_time();
+    prelexer = pl_create_scanner(expression);
+    while (pl_get_next_token(prelexer) != PL_EOS);
+    pl_destroy_scanner(prelexer);
+    times[PHASE_PRELEXER] = get_time() - start;
+
+    /* Setting up the parser is counted as lexing */
+    t = get_time();
+    state = mp_equation_create_parser(expression, &options);
+    l_insert_all_tokens(state->lexer);
+    times[PHASE_LEXER] = get_time() - t;
+
+    mp_clear_error();
+    t = get_time();
+    if (p_parse_tokens(state) == PARSER_ERR_NONE && !state->error) {
+        times[PHASE_PARSER] = get_time() - t;
+
+        t = get_time();
+        if (p_evaluate(state) == PARSER_ERR_NONE && !state->error) {
+            times[PHASE_EVALUATE] = get_time() - t;
+
+            t = get_time();
+            text = mp_serializer_to_string(serializer, &state->ret);
+            times[PHASE_SERIALIZE] = get_time() - t;
+            g_free(text);
+        }
+        else
+            times[PHASE_EVALUATE] = get_time() - t;
+    }
+    else
+        times[PHASE_PARSER] = get_time() - t;
+
+    p_destroy_parser(state);
+
+    for (i = 0; i < PHASE_TOTAL; i++)
+        times[PHASE_TOTAL] += times[i];
+    for (i = 0; i < N_PHASES; i++)
+        g_array_append_val(samples[i], times[i]);
+}
+
+static int
+compare_times(const void *a, const void *b)
+{
+    gint64 t1 = *(const gint64 *) a, t2 = *(const gint64 *) b;
+    return t1 < t2 ? -1 : t1 > t2;
+}
+
+typedef struct
+{
+    double mean;
+    gint64 p50, p90, p99, max;
+} Summary;
+
+static void
+summarize(GArray *samples, Summary *summary)
+{
+    gint64 *times = (gint64 *) samples->data, total = 0;
+    guint i, n = samples->len;
+
+    g_array_sort(samples, compare_times);
+    for (i = 0; i < n; i++)
+        total += times[i];
+
+    summary->mean = (double) total / n;
+    summary->p50 = times[(n - 1) * 50 / 100];
+    summary->p90 = times[(n - 1) * 90 / 100];
+    summary->p99 = times[(n - 1) * 99 / 100];
+    summary->max = times[n - 1];
+}
+
+int
+main (int argc, char **argv)
+{
+    int iterations = 200, i, j;
+    gboolean json = FALSE;
+    const char *corpus_file = NULL;
+    GPtrArray *corpus;
+    GArray *samples[N_PHASES];
+    Summary summaries[N_PHASES];
+    MpSerializer *serializer;
+
+    setlocale(LC_ALL, "C");
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0)
+            json = TRUE;
+        else if (g_ascii_isdigit(argv[i][0]))
+            iterations = atoi(argv[i]);
+        else
+            corpus_file = argv[i];
+    }
+    if (iterations <= 0)
+        iterations = 1;
+
+    memset(&options, 0, sizeof(options));
+    options.base = 10;
+    options.wordlen = 32;
+    options.angle_units = MP_DEGREES;
+    options.variable_is_defined = variable_is_defined;
+    options.get_variable = get_variable;
+    options.set_variable = set_variable;
+
+    corpus = load_corpus(corpus_file);
+    if (corpus->len == 0) {
+        fprintf(stderr, "Corpus is empty\n");
+        return 1;
+    }
+    serializer = mp_serializer_new(MP_DISPLAY_FORMAT_AUTOMATIC, 10, 9);
+    for (i = 0; i < N_PHASES; i++)
+        samples[i] = g_array_sized_new(FALSE, FALSE, sizeof(gint64), corpus->len * iterations);
+
+    /* One untimed pass so constants are computed before measuring */
+    for (i = 0; i < (int) corpus->len; i++)
+        run_equation(g_ptr_array_index(corpus, i), serializer, samples);
+    for (i = 0; i < N_PHASES; i++)
+        g_array_set_size(samples[i], 0);
+
+    for (i = 0; i < iterations; i++)
+        for (j = 0; j < (int) corpus->len; j++)
+            run_equation(g_ptr_array_index(corpus, j), serializer, samples);
+
+    for (i = 0; i < N_PHASES; i++)
+        summarize(samples[i], &summaries[i]);
+
+    if (json) {
+        printf("{\n");
+        printf("  \"expressions\": %u,\n", corpus->len);
+        printf("  \"iterations\": %d,\n", iterations);
+        printf("  \"unit\": \"ns\",\n");
+        printf("  \"phases\": {\n");
+        for (i = 0; i < N_PHASES; i++)
+            printf("    \"%s\": { \"mean\": %.1f, \"p50\": %" G_GINT64_FORMAT ", \"p90\": %" G_GINT64_FORMAT
+                   ", \"p99\": %" G_GINT64_FORMAT ", \"max\": %" G_GINT64_FORMAT " }%s\n",
+                   phase_names[i], summaries[i].mean, summaries[i].p50, summaries[i].p90,
+                   summaries[i].p99, summaries[i].max, i < N_PHASES - 1 ? "," : "");
+        printf("  }\n");
+        printf("}\n");
+    }
+    else {
+        printf("expressions: %u\n", corpus->len);
+        printf("iterations:  %d\n", iterations);
+        printf("%-10s %12s %12s %12s %12s %12s\n", "phase (ns)", "mean", "p50", "p90", "p99", "max");
+        for (i = 0; i < N_PHASES; i++)
+            printf("%-10s %12.1f %12" G_GINT64_FORMAT " %12" G_GINT64_FORMAT " %12" G_GINT64_FORMAT " %12" G_GINT64_FORMAT "\n",
+                   phase_names[i], summaries[i].mean, summaries[i].p50, summaries[i].p90,
+                   summaries[i].p99, summaries[i].max);
+    }
+
+    for (i = 0; i < N_PHASES; i++)
+        g_array_free(samples[i], TRUE);
+    g_object_unref(serializer);
+    g_ptr_array_unref(corpus);
+
+    return 0;
+}
@@ -0,0 +1,276 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+/* Times the core MPNumber operations on operands of several sizes. Each case
+ * is run in batches that are doubled until they take BATCH_TIME (which also
+ * warms up caches such as MPFR's constants), then the batch is timed
+ * repeatedly and the median is reported. Cases are printed one per line in a
+ * fixed order so runs can be compared with diff.
+ *
+ * Usage: bench-mp [REPETITIONS] [OPERATION] */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#include <gmp.h>
+
+#include "mp.h"
+
+/* Shortest time a timed batch runs for, in microseconds */
+#define BATCH_TIME 20000
+
+#define DEFAULT_REPETITIONS 5
+
+/* Allocations made by GMP, which MPFR and MPC allocate all numbers through */
+static guint64 allocations = 0;
+
+static void *
+count_allocate(size_t size)
+{
+    allocations++;
+    return malloc(size);
+}
+
+static void *
+count_reallocate(void *pointer, size_t old_size, size_t new_size)
+{
+    allocations++;
+    return realloc(pointer, new_size);
+}
+
+static void
+count_free(void *pointer, size_t size)
+{
+    free(pointer);
+}
+
+static void
+run_add(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    mp_add(x, y, z);
+}
+
+static void
+run_multiply(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    mp_multiply(x, y, z);
+}
+
+static void
+run_divide(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    mp_divide(x, y, z);
+}
+
+static void
+run_sqrt(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    mp_sqrt(x, z);
+}
+
+static void
+run_ln(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    mp_ln(x, z);
+}
+
+static void
+run_xpowy(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    mp_xpowy(x, y, z);
+}
+
+static void
+run_sin(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    mp_sin(x, MP_RADIANS, z);
+}
+
+static void
+run_tan(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    mp_tan(x, MP_DEGREES, z);
+}
+
+static void
+run_atan(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    mp_atan(x, MP_RADIANS, z);
+}
+
+static void
+run_factorial(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    mp_factorial(x, z);
+}
+
+static void
+run_factorize(const MPNumber *x, const MPNumber *y, MPNumber *z)
+{
+    GList *factors, *link;
+
+    factors = mp_factorize(x);
+    for (link = factors; link; link = link->next) {
+        MPNumber *factor = link->data;
+        mp_clear(factor);
+        g_slice_free(MPNumber, factor);
+    }
+    g_list_free(factors);
+}
+
+typedef struct
+{
+    const char *operation;
+    void (*run)(const MPNumber *x, const MPNumber *y, MPNumber *z);
+
+    /* Significant digits of the generated operands, or 0 to use x */
+    int digits;
+    const char *x;
+} Case;
+
+/* Numbers hold about 300 significant digits, so the largest operands fill them */
+static const Case cases[] =
+{
+    { "add", run_add, 10 },
+    { "add", run_add, 100 },
+    { "add", run_add, 300 },
+    { "multiply", run_multiply, 10 },
+    { "multiply", run_multiply, 100 },
+    { "multiply", run_multiply, 300 },
+    { "divide", run_divide, 10 },
+    { "divide", run_divide, 100 },
+    { "divide", run_divide, 300 },
+    { "sqrt", run_sqrt, 10 },
+    { "sqrt", run_sqrt, 300 },
+    { "ln", run_ln, 10 },
+    { "ln", run_ln, 100 },
+    { "ln", run_ln, 300 },
+    { "xpowy", run_xpowy, 10 },
+    { "xpowy", run_xpowy, 300 },
+    { "sin", run_sin, 10 },
+    { "sin", run_sin, 100 },
+    { "sin", run_sin, 300 },
+    { "tan", run_tan, 10 },
+    { "tan", run_tan, 300 },
+    { "atan", run_atan, 10 },
+    { "atan", run_atan, 300 },
+    { "factorial", run_factorial, 0, "20" },
+    { "factorial", run_factorial, 0, "100" },
+    { "factorial", run_factorial, 0, "1000" },
+    { "factorize", run_factorize, 0, "600851475143" },
+    { "factorize", run_factorize, 0, "999962000357" },
+    { "factorize", run_factorize, 0, "55340232221128654848" },
+};
+
+/* Set z to a number between 1 and 10 with digits significant digits, the same on every run */
+static void
+make_operand(int digits, guint32 seed, MPNumber *z)
+{
+    GString *text = g_string_new(NULL);
+    int i;
+
+    for (i = 0; i < digits; i++) {
+        seed = seed * 1103515245 + 12345;
+        g_string_append_c(text, '1' + (seed >> 16) % 9);
+        if (i == 0)
+            g_string_append_c(text, '.');
+    }
+    mp_set_from_string(text->str, 10, z);
+    g_string_free(text, TRUE);
+}
+
+/* Time n runs of a case in microseconds */
+static gint64
+time_batch(const Case *c, const MPNumber *x, const MPNumber *y, MPNumber *z, guint64 n)
+{
+    gint64 start = g_get_monotonic_time();
+    guint64 i;
+
+    for (i = 0; i < n; i++)
+        c->run(x, y, z);
+    return g_get_monotonic_time() - start;
+}
+
+static int
+compare_times(const void *a, const void *b)
+{
+    gint64 t1 = *(const gint64 *) a, t2 = *(const gint64 *) b;
+    return t1 < t2 ? -1 : t1 > t2;
+}
+
+static void
+run_case(const Case *c, int repetitions)
+{
+    MPNumber x = mp_new(), y = mp_new(), z = mp_new();
+    gint64 *times;
+    guint64 n = 1, start_allocations;
+    double ns_per_op;
+    gchar *operand;
+    int i;
+
+    if (c->digits > 0) {
+        make_operand(c->digits, 1, &x);
+        make_operand(c->digits, 2, &y);
+        operand = g_strdup_printf("%d digits", c->digits);
+    }
+    else {
+        mp_set_from_string(c->x, 10, &x);
+        mp_set_from_integer(1, &y);
+        operand = g_strdup(c->x);
+    }
+
+    /* Warm up while finding a batch size that can be timed */
+    while (time_batch(c, &x, &y, &z, n) < BATCH_TIME)
+        n *= 2;
+
+    times = g_new(gint64, repetitions);
+    start_allocations = allocations;
+    for (i = 0; i < repetitions; i++)
+        times[i] = time_batch(c, &x, &y, &z, n);
+    qsort(times, repetitions, sizeof(gint64), compare_times);
+    ns_per_op = times[repetitions / 2] * 1000.0 / n;
+
+    printf("%-10s %-22s %10" G_GUINT64_FORMAT " %14.1f %10.2f %14.1f\n",
+           c->operation, operand, n, ns_per_op,
+           (double) (allocations - start_allocations) / (n * repetitions),
+           1e9 / ns_per_op);
+
+    g_free(times);
+    g_free(operand);
+    mp_clear(&x);
+    mp_clear(&y);
+    mp_clear(&z);
+}
+
+int
+main (int argc, char **argv)
+{
+    int repetitions = DEFAULT_REPETITIONS, i;
+    const char *operation = NULL;
+
+    /* Must be set before GMP allocates anything */
+    mp_set_memory_functions(count_allocate, count_reallocate, count_free);
+
+    setlocale(LC_ALL, "C");
+
+    if (argc > 1)
+        repetitions = atoi(argv[1]);
+    if (repetitions <= 0)
+        repetitions = 1;
+    if (argc > 2)
+        operation = argv[2];
+
+    printf("%-10s %-22s %10s %14s %10s %14s\n", "operation", "operand", "batch", "ns/op", "allocs/op", "ops/s");
+    for (i = 0; i < (int) G_N_ELEMENTS(cases); i++) {
+        if (operation == NULL || strcmp(operation, cases[i].operation) == 0)
+            run_case(&cases[i], repetitions);
+    }
+
+    return 0;
+}
@@ -64,18 +64,49 @@ l_check_if_number(LexerState* state)
     }
 }
 
+/* Make room for one more token. */
+static LexerToken*
+l_new_token(LexerState* state)
+{
+    if(state->token_count == state->token_capacity)
+    {
+        /* Grow geometrically. Old array stays in the arena until the parse is destroyed. */
+        LexerToken* tokens;
+        state->token_capacity = state->token_capacity ? state->token_capacity * 2 : 16;
+        tokens = (LexerToken *) a_alloc(state->parent->arena, state->token_capacity * sizeof(LexerToken));
+        if(state->token_count)
+            memcpy(tokens, state->tokens, state->token_count * sizeof(LexerToken));
+        state->tokens = tokens;
+    }
+    return &state->tokens[state->token_count++];
+}
+
 /* Insert generated token to the LexerState structure. */
 static LexerToken*
 l_insert_token(LexerState* state, const LexerTokenType type)
 {
-    state->tokens = (LexerToken *) realloc(state->tokens, (state->token_count + 1) * sizeof(LexerToken));
-    assert(state->tokens != NULL);
-    state->tokens[state->token_count].string = pl_get_marked_substring(state->prelexer);
-    state->tokens[state->token_count].start_index = state->prelexer->mark_index;
-    state->tokens[state->token_count].end_index = state->prelexer->next_index;
-    state->tokens[state->token_count].token_type = type;
-    state->token_count++;
-    return &state->tokens[state->token_count - 1];
+    PreLexerState* prelexer = state->prelexer;
+    LexerToken* token;
+    /* Pre-lexer steps one past the end of stream on PL_EOS. */
+    guint end_index = MIN(prelexer->next_index, prelexer->length);
+    guint start_index = MIN(prelexer->mark_index, end_index);
+    token = l_new_token(state);
+    token->string = a_strndup(state->parent->arena, prelexer->stream + start_index, end_index - start_index);
+    token->start_index = prelexer->mark_index;
+    token->end_index = prelexer->next_index;
+    token->token_type = type;
+    return token;
+}
+
+/* Insert a token scanned earlier, moved by `delta` characters. Its string already lives in the arena. */
+static void
+l_reuse_token(LexerState* state, const LexerToken* old, gint delta)
+{
+    LexerToken* token = l_new_token(state);
+    token->string = old->string;
+    token->start_index = old->start_index + delta;
+    token->end_index = old->end_index + delta;
+    token->token_type = old->token_type;
 }
 
 /* Generates next token from pre-lexer stream and call l_insert_token() to insert it at the end. */
@@ -115,7 +146,8 @@ l_insert_next_token(LexerState* lstate)
      ||type == T_ABS
      ||type == T_POWER
      ||type == T_FACTORIAL
-     ||type == T_PERCENTAGE)
+     ||type == T_PERCENTAGE
+     ||type == T_SEMICOLON)
     {
         return l_insert_token(lstate, type);
     }
@@ -542,33 +574,95 @@ l_insert_all_tokens(LexerState* state)
     }
 }
 
+/* Tokenize changed input string again. Tokens before the changed span are kept, scanning
+ * restarts after them and stops as soon as it lines up with a token after the changed span. */
+void
+l_update_tokens(LexerState* state, const gchar* input)
+{
+    PreLexerState* old_prelexer = state->prelexer;
+    LexerToken* old_tokens = state->tokens;
+    LexerToken* token;
+    guint old_count = state->token_count;
+    guint old_length = old_prelexer->length;
+    guint length = strlen(input);
+    guint prefix = 0, suffix = 0, old_end, first = 0, l;
+    gint delta = (gint) length - (gint) old_length;
+
+    /* Find changed span. */
+    while(prefix < old_length && prefix < length && old_prelexer->stream[prefix] == input[prefix])
+        prefix++;
+    /* Changed span must start at a character boundary. */
+    while(prefix > 0 && (input[prefix] & 0xC0) == 0x80)
+        prefix--;
+    while(suffix < old_length - prefix && suffix < length - prefix
+          && old_prelexer->stream[old_length - 1 - suffix] == input[length - 1 - suffix])
+        suffix++;
+    old_end = old_length - suffix;
+
+    /* Keep tokens ending before the changed span. The last of them is scanned again, as the lexer
+     * may have decided where it ends by looking at the changed text. */
+    while(first < old_count && old_tokens[first].token_type != PL_EOS && old_tokens[first].end_index < prefix)
+        first++;
+    if(first > 0)
+        first--;
+
+    state->tokens = NULL;
+    state->token_count = 0;
+    state->token_capacity = 0;
+    state->next_token = 0;
+    for(l = 0; l < first; l++)
+        l_reuse_token(state, &old_tokens[l], 0);
+
+    state->prelexer = pl_create_scanner(input);
+    pl_destroy_scanner(old_prelexer);
+    if(first > 0)
+        state->prelexer->next_index = old_tokens[first - 1].end_index;
+
+    l = first;
+    while(1)
+    {
+        token = l_insert_next_token(state);
+        assert(token != NULL);
+        if(token->token_type == PL_EOS)
+            return;
+
+        /* Find old token at the same place in the unchanged text. */
+        while(l < old_count && (gint) old_tokens[l].start_index + delta < (gint) token->start_index)
+            l++;
+        if(l < old_count
+           && old_tokens[l].start_index >= old_end
+           && (gint) old_tokens[l].start_index + delta == (gint) token->start_index
+           && (gint) old_tokens[l].end_index + delta == (gint) token->end_index
+           && old_tokens[l].token_type == token->token_type)
+        {
+            /* From here on scanning would produce the old tokens again. */
+            for(l++; l < old_count; l++)
+                l_reuse_token(state, &old_tokens[l], delta);
+            return;
+        }
+    }
+}
+
 /* Create a lexer state from given input string. This will take care of pre-lexer state. */
 LexerState*
 l_create_lexer(const gchar* input, struct parser_state* parent)
 {
     LexerState* ret;
-    ret = (LexerState *) malloc(sizeof(LexerState));
-    assert(ret != NULL);
+    ret = (LexerState *) a_alloc(parent->arena, sizeof(LexerState));
     ret->prelexer = pl_create_scanner(input);
     ret->tokens = NULL;
     ret->token_count = 0;
+    ret->token_capacity = 0;
     ret->next_token = 0;
     ret->parent = parent;
     return ret;
 }
 
-/* Destroy lexer state and free memory. */
+/* Destroy lexer state. Tokens and their strings are released together with the parser's arena. */
 void
 l_destroy_lexer(LexerState* state)
 {
-    int l;
     pl_destroy_scanner(state->prelexer);
-    for(l = 0; l < state->token_count; l++)
-    {
-        free(state->tokens[l].string);
-    }
-    free(state->tokens);
-    free(state);
 }
 
 /* Get next token interface. Will be called by parser to get pointer to next token in token stream. */
@@ -6,7 +6,7 @@
 /* Structure to hold single token. */
 typedef struct
 {
-    gchar* string;			/* Poniter to local copy of token string. */
+    gchar* string;			/* Poniter to local copy of token string, owned by the parser's arena. */
     guint start_index;			/* Start index in original stream. */
     guint end_index;			/* End index in original stream. */
     LexerTokenType token_type;		/* Type of token. */
@@ -18,6 +18,7 @@ typedef struct
     PreLexerState *prelexer;		/* Pre-lexer state. Pre-lexer is part of lexer. */
     LexerToken *tokens;			/* Pointer to the dynamic array of LexerTokens. */
     guint token_count;			/* Count of tokens in array. */
+    guint token_capacity;		/* Count of tokens array can hold before it has to grow. */
     guint next_token;			/* Index of next, to be sent, token. */
     struct parser_state *parent;	/* Pointer to the parent parser. */
 } LexerState;
@@ -31,6 +32,9 @@ void l_destroy_lexer(LexerState*);
 /* Tokanize complete string. */
 void l_insert_all_tokens(LexerState*);
 
+/* Tokanize a new version of the string, scanning only around the changed part. Old tokens stay valid. */
+void l_update_tokens(LexerState*, const gchar*);
+
 /* Return next, to be sent, token. */
 LexerToken* l_get_next_token(LexerState*);
 
@@ -0,0 +1,462 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gi18n.h>
+
+#include "libmatecalc.h"
+#include "mp-equation.h"
+#include "mp-serializer.h"
+#include "mp-tabulate.h"
+#include "unit-manager.h"
+
+/* Number of recent results kept by each context */
+#define RESULT_CACHE_SIZE 256
+
+G_STATIC_ASSERT((int) MATE_CALC_ERROR_CANCELLED == (int) PARSER_ERR_CANCELLED);
+G_STATIC_ASSERT((int) MATE_CALC_ERROR_MATH == (int) PARSER_ERR_MP);
+G_STATIC_ASSERT((int) MATE_CALC_GRADIANS == (int) MP_GRADIANS);
+
+struct MateCalcContext
+{
+    int base;
+    int wordlen;
+    MPAngleUnit angle_units;
+    gboolean unit_conversions;
+    gint64 timeout;
+    guint64 max_steps;
+    MpSerializer *serializer;
+    GHashTable *variables;      /* Variable name -> MPNumber */
+    MPResultCache *cache;
+};
+
+static int
+variable_is_defined(const char *name, void *data)
+{
+    MateCalcContext *context = data;
+
+    return g_ascii_strcasecmp(name, "rand") == 0 || g_hash_table_contains(context->variables, name);
+}
+
+static int
+get_variable(const char *name, MPNumber *z, void *data)
+{
+    MateCalcContext *context = data;
+    MPNumber *t;
+
+    if (g_ascii_strcasecmp(name, "rand") == 0) {
+        mp_set_from_random(z);
+        return 1;
+    }
+
+    t = g_hash_table_lookup(context->variables, name);
+    if (t == NULL)
+        return 0;
+    mp_set_from_mp(t, z);
+
+    return 1;
+}
+
+static int
+variable_is_volatile(const char *name, void *data)
+{
+    return g_ascii_strcasecmp(name, "rand") == 0;
+}
+
+static void
+set_variable(const char *name, const MPNumber *x, void *data)
+{
+    MateCalcContext *context = data;
+    MPNumber *t;
+
+    t = mp_new_ptr();
+    mp_set_from_mp(x, t);
+    g_hash_table_insert(context->variables, g_strdup(name), t);
+}
+
+/* The unit and currency managers are shared by all contexts and aren't thread safe */
+static GMutex convert_lock;
+
+static int
+convert(const MPNumber *x, const char *x_units, const char *z_units, MPNumber *z, void *data)
+{
+    int result;
+
+    g_mutex_lock(&convert_lock);
+    result = unit_manager_convert_by_symbol(unit_manager_get_default(), x, x_units, z_units, z);
+    g_mutex_unlock(&convert_lock);
+
+    return result;
+}
+
+MateCalcContext *
+mate_calc_context_new(void)
+{
+    MateCalcContext *context;
+
+    context = g_new0(MateCalcContext, 1);
+    context->base = 10;
+    context->wordlen = 32;
+    context->angle_units = MP_DEGREES;
+    context->serializer = mp_serializer_new(MP_DISPLAY_FORMAT_AUTOMATIC, 10, 9);
+    context->variables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) mp_free);
+    context->cache = mp_result_cache_new(RESULT_CACHE_SIZE);
+
+    return context;
+}
+
+void
+mate_calc_context_free(MateCalcContext *context)
+{
+    if (context == NULL)
+        return;
+
+    g_object_unref(context->serializer);
+    g_hash_table_unref(context->variables);
+    mp_result_cache_free(context->cache);
+    g_free(context);
+}
+
+void
+mate_calc_context_set_base(MateCalcContext *context, int base)
+{
+    g_return_if_fail(context != NULL);
+    g_return_if_fail(base >= 2 && base <= 16);
+
+    context->base = base;
+    mp_serializer_set_base(context->serializer, base);
+}
+
+void
+mate_calc_context_set_angle_units(MateCalcContext *context, MateCalcAngleUnit units)
+{
+    g_return_if_fail(context != NULL);
+
+    context->angle_units = (MPAngleUnit) units;
+}
+
+void
+mate_calc_context_set_word_length(MateCalcContext *context, int word_length)
+{
+    g_return_if_fail(context != NULL);
+
+    context->wordlen = word_length;
+}
+
+void
+mate_calc_context_set_accuracy(MateCalcContext *context, int accuracy)
+{
+    g_return_if_fail(context != NULL);
+
+    mp_serializer_set_trailing_digits(context->serializer, accuracy);
+}
+
+void
+mate_calc_context_set_unit_conversions(MateCalcContext *context, int enabled)
+{
+    g_return_if_fail(context != NULL);
+
+    context->unit_conversions = enabled != 0;
+}
+
+void
+mate_calc_context_set_limits(MateCalcContext *context, int64_t timeout, uint64_t max_steps)
+{
+    g_return_if_fail(context != NULL);
+
+    context->timeout = timeout;
+    context->max_steps = max_steps;
+}
+
+static void
+init_options(MateCalcContext *context, MPEquationOptions *options, MPEvalContext *eval_context)
+{
+    memset(options, 0, sizeof(MPEquationOptions));
+    options->base = context->base;
+    options->wordlen = context->wordlen;
+    options->angle_units = context->angle_units;
+    options->accuracy = mp_serializer_get_trailing_digits(context->serializer);
+    options->variable_is_defined = variable_is_defined;
+    options->get_variable = get_variable;
+    options->variable_is_volatile = variable_is_volatile;
+    options->set_variable = set_variable;
+    if (context->unit_conversions)
+        options->convert = convert;
+    options->callback_data = context;
+    options->context = eval_context;
+
+    mp_eval_context_init(eval_context, NULL, context->timeout, context->max_steps);
+}
+
+/* Returns a newly allocated string describing an error, or NULL for no error */
+static gchar *
+get_error_message(MPErrorCode error, const char *error_token)
+{
+    switch (error) {
+    case PARSER_ERR_NONE:
+        return NULL;
+    case PARSER_ERR_OVERFLOW:
+        return g_strdup(_("Overflow. Try a bigger word size"));
+    case PARSER_ERR_UNKNOWN_VARIABLE:
+        return g_strdup_printf(_("Unknown variable '%s'"), error_token);
+    case PARSER_ERR_UNKNOWN_FUNCTION:
+        return g_strdup_printf(_("Function '%s' is not defined"), error_token);
+    case PARSER_ERR_UNKNOWN_CONVERSION:
+        return g_strdup(_("Unknown conversion"));
+    case PARSER_ERR_CANCELLED:
+        return g_strdup(_("Calculation cancelled"));
+    case PARSER_ERR_MP:
+        if (mp_get_error())
+            return g_strdup(mp_get_error());
+        return g_strdup(_("Malformed expression"));
+    default:
+        return g_strdup(_("Malformed expression"));
+    }
+}
+
+static void
+set_error_message(char **error_message, MPErrorCode error, const char *error_token)
+{
+    gchar *message;
+
+    if (error_message == NULL)
+        return;
+
+    message = get_error_message(error, error_token);
+    *error_message = message != NULL ? strdup(message) : NULL;
+    g_free(message);
+}
+
+static MateCalcError
+evaluate(MateCalcContext *context, const char *expression, MPNumber *z, char **error_message)
+{
+    MPEquationOptions options;
+    MPEvalContext eval_context;
+    MPErrorCode result;
+    char *error_token = NULL;
+
+    init_options(context, &options, &eval_context);
+    result = mp_result_cache_parse(context->cache, expression, &options, z, &error_token);
+    mp_eval_context_clear(&eval_context);
+
+    set_error_message(error_message, result, error_token);
+    g_free(error_token);
+
+    return (MateCalcError) result;
+}
+
+MateCalcError
+mate_calc_context_set_variable(MateCalcContext *context, const char *name, const char *expression)
+{
+    MPNumber z = mp_new();
+    MateCalcError result;
+
+    g_return_val_if_fail(context != NULL, MATE_CALC_ERROR_INVALID);
+    g_return_val_if_fail(name != NULL, MATE_CALC_ERROR_INVALID);
+    g_return_val_if_fail(expression != NULL, MATE_CALC_ERROR_INVALID);
+
+    result = evaluate(context, expression, &z, NULL);
+    if (result == MATE_CALC_ERROR_NONE)
+        set_variable(name, &z, context);
+    mp_clear(&z);
+
+    return result;
+}
+
+void
+mate_calc_context_unset_variable(MateCalcContext *context, const char *name)
+{
+    g_return_if_fail(context != NULL);
+    g_return_if_fail(name != NULL);
+
+    g_hash_table_remove(context->variables, name);
+}
+
+MateCalcError
+mate_calc_evaluate(MateCalcContext *context, const char *expression, char **result, char **error_message)
+{
+    MPNumber z = mp_new();
+    MateCalcError error;
+
+    g_return_val_if_fail(context != NULL, MATE_CALC_ERROR_INVALID);
+    g_return_val_if_fail(expression != NULL, MATE_CALC_ERROR_INVALID);
+
+    if (result != NULL)
+        *result = NULL;
+
+    error = evaluate(context, expression, &z, error_message);
+    if (error == MATE_CALC_ERROR_NONE) {
+        set_variable("ans", &z, context);
+        if (result != NULL) {
+            gchar *text = mp_serializer_to_string(context->serializer, &z);
+            *result = strdup(text);
+            g_free(text);
+        }
+    }
+    mp_clear(&z);
+
+    return error;
+}
+
+/* Evaluate the limits of a range */
+static MateCalcError
+init_range(MateCalcContext *context, MPRange *range, const char *variable,
+           const char *start, const char *end, const char *step, char **error_message)
+{
+    MateCalcError error;
+
+    range->variable = variable;
+    range->start = mp_new();
+    range->end = mp_new();
+    range->step = mp_new();
+
+    error = evaluate(context, start, &range->start, error_message);
+    if (error == MATE_CALC_ERROR_NONE)
+        error = evaluate(context, end, &range->end, error_message);
+    if (error == MATE_CALC_ERROR_NONE && step != NULL)
+        error = evaluate(context, step, &range->step, error_message);
+    else if (error == MATE_CALC_ERROR_NONE)
+        mp_set_from_integer(1, &range->step);
+
+    return error;
+}
+
+static void
+clear_range(MPRange *range)
+{
+    mp_clear(&range->start);
+    mp_clear(&range->end);
+    mp_clear(&range->step);
+}
+
+/* Conversion tables aren't thread safe */
+static int
+get_thread_count(MateCalcContext *context, int n_threads)
+{
+    return context->unit_conversions ? 1 : n_threads;
+}
+
+/* Decimal places shown in results, used to decide if a value computed in double precision is good enough */
+static int
+get_digits(MateCalcContext *context)
+{
+    if (context->base != 10)
+        return -1;
+    return mp_serializer_get_trailing_digits(context->serializer);
+}
+
+typedef struct
+{
+    MateCalcContext *context;
+    MateCalcRowFunc row_func;
+    void *data;
+} RowData;
+
+static void
+tabulate_row_cb(const MPNumber *x, MPErrorCode error, const MPNumber *value, void *data)
+{
+    RowData *row_data = data;
+    gchar *x_text, *text = NULL;
+
+    x_text = mp_serializer_to_string(row_data->context->serializer, x);
+    if (value != NULL)
+        text = mp_serializer_to_string(row_data->context->serializer, value);
+    row_data->row_func(x_text, text, (MateCalcError) error, row_data->data);
+    g_free(x_text);
+    g_free(text);
+}
+
+MateCalcError
+mate_calc_tabulate(MateCalcContext *context, const char *expression, const char *variable,
+                   const char *start, const char *end, const char *step, int n_threads,
+                   MateCalcRowFunc row_func, void *data, char **error_message)
+{
+    MPEquationOptions options;
+    MPEvalContext eval_context;
+    MPRange range;
+    RowData row_data;
+    MPErrorCode error;
+    char *error_token = NULL;
+
+    g_return_val_if_fail(context != NULL, MATE_CALC_ERROR_INVALID);
+    g_return_val_if_fail(expression != NULL, MATE_CALC_ERROR_INVALID);
+    g_return_val_if_fail(variable != NULL, MATE_CALC_ERROR_INVALID);
+    g_return_val_if_fail(start != NULL && end != NULL, MATE_CALC_ERROR_INVALID);
+    g_return_val_if_fail(row_func != NULL, MATE_CALC_ERROR_INVALID);
+
+    error = (MPErrorCode) init_range(context, &range, variable, start, end, step, error_message);
+    if (error == PARSER_ERR_NONE) {
+        row_data.context = context;
+        row_data.row_func = row_func;
+        row_data.data = data;
+
+        init_options(context, &options, &eval_context);
+        error = mp_tabulate(expression, &range, &options, get_digits(context), get_thread_count(context, n_threads),
+                            tabulate_row_cb, &row_data, &error_token);
+        mp_eval_context_clear(&eval_context);
+
+        set_error_message(error_message, error, error_token);
+        g_free(error_token);
+    }
+    clear_range(&range);
+
+    return (MateCalcError) error;
+}
+
+MateCalcError
+mate_calc_reduce(MateCalcContext *context, MateCalcReduction reduction, const char *expression,
+                 const char *variable, const char *start, const char *end, const char *step,
+                 int n_threads, char **result, char **error_message)
+{
+    MPEquationOptions options;
+    MPEvalContext eval_context;
+    MPRange range;
+    MPNumber z = mp_new();
+    MPErrorCode error;
+    char *error_token = NULL;
+
+    g_return_val_if_fail(context != NULL, MATE_CALC_ERROR_INVALID);
+    g_return_val_if_fail(expression != NULL, MATE_CALC_ERROR_INVALID);
+    g_return_val_if_fail(variable != NULL, MATE_CALC_ERROR_INVALID);
+    g_return_val_if_fail(start != NULL && end != NULL, MATE_CALC_ERROR_INVALID);
+
+    if (result != NULL)
+        *result = NULL;
+
+    error = (MPErrorCode) init_range(context, &range, variable, start, end, step, error_message);
+    if (error == PARSER_ERR_NONE) {
+        init_options(context, &options, &eval_context);
+        error = mp_tabulate_reduce(expression, &range,
+                                   reduction == MATE_CALC_PRODUCT ? MP_REDUCE_PRODUCT : MP_REDUCE_SUM,
+                                   &options, get_thread_count(context, n_threads), &z, &error_token);
+        mp_eval_context_clear(&eval_context);
+
+        set_error_message(error_message, error, error_token);
+        g_free(error_token);
+    }
+    if (error == PARSER_ERR_NONE) {
+        set_variable("ans", &z, context);
+        if (result != NULL) {
+            gchar *text = mp_serializer_to_string(context->serializer, &z);
+            *result = strdup(text);
+            g_free(text);
+        }
+    }
+    clear_range(&range);
+    mp_clear(&z);
+
+    return (MateCalcError) error;
+}
+
+const char *
+mate_calc_error_to_string(MateCalcError error)
+{
+    return mp_error_code_to_string((MPErrorCode) error);
+}
@@ -0,0 +1,110 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef LIBMATECALC_H
+#define LIBMATECALC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Errors returned when evaluating, these match the codes used by mate-calc */
+typedef enum
+{
+    MATE_CALC_ERROR_NONE = 0,
+    MATE_CALC_ERROR_INVALID,
+    MATE_CALC_ERROR_OVERFLOW,
+    MATE_CALC_ERROR_UNKNOWN_VARIABLE,
+    MATE_CALC_ERROR_UNKNOWN_FUNCTION,
+    MATE_CALC_ERROR_UNKNOWN_CONVERSION,
+    MATE_CALC_ERROR_MATH,
+    MATE_CALC_ERROR_CANCELLED
+} MateCalcError;
+
+typedef enum
+{
+    MATE_CALC_RADIANS,
+    MATE_CALC_DEGREES,
+    MATE_CALC_GRADIANS
+} MateCalcAngleUnit;
+
+/* Settings and variables used for evaluating. A context can be used by one
+ * thread at a time, different contexts can be used by different threads. */
+typedef struct MateCalcContext MateCalcContext;
+
+MateCalcContext *mate_calc_context_new(void);
+
+void mate_calc_context_free(MateCalcContext *context);
+
+/* Default number base for numbers and results, 10 by default */
+void mate_calc_context_set_base(MateCalcContext *context, int base);
+
+/* Units for angles in trigonometric functions, degrees by default */
+void mate_calc_context_set_angle_units(MateCalcContext *context, MateCalcAngleUnit units);
+
+/* Word length in bits for binary operations, 32 by default */
+void mate_calc_context_set_word_length(MateCalcContext *context, int word_length);
+
+/* Number of digits after the radix point in results, 9 by default */
+void mate_calc_context_set_accuracy(MateCalcContext *context, int accuracy);
+
+/* Enable unit and currency conversions (e.g. "5 in to cm"), disabled by default.
+ * Conversion tables are shared by all contexts and must only be used by one thread at a time. */
+void mate_calc_context_set_unit_conversions(MateCalcContext *context, int enabled);
+
+/* Give up on an evaluation after timeout microseconds or max_steps, 0 for no limit */
+void mate_calc_context_set_limits(MateCalcContext *context, int64_t timeout, uint64_t max_steps);
+
+/* Set variable name to the value of expression */
+MateCalcError mate_calc_context_set_variable(MateCalcContext *context, const char *name, const char *expression);
+
+void mate_calc_context_unset_variable(MateCalcContext *context, const char *name);
+
+/* Evaluate expression, on success result is set to a newly allocated string
+ * with the result. Assignments (e.g. "x=2") set variables in the context and
+ * the last result is available as "ans". On failure error_message is set to a
+ * newly allocated description if not NULL. Strings are freed with free(). */
+MateCalcError mate_calc_evaluate(MateCalcContext *context, const char *expression, char **result, char **error_message);
+
+typedef enum
+{
+    MATE_CALC_SUM,
+    MATE_CALC_PRODUCT
+} MateCalcReduction;
+
+/* Called with the value of the index variable and the result, or NULL and an error */
+typedef void (*MateCalcRowFunc)(const char *x, const char *result, MateCalcError error, void *data);
+
+/* Evaluate expression with variable set to start, start + step, ... up to end,
+ * where start, end and step are expressions (step may be NULL for 1). The
+ * expression is compiled once and evaluated on n_threads threads (0 for one
+ * per processor), and row_func is called on the calling thread for each value
+ * in order as soon as it is ready. Variables must not be changed from other
+ * threads and assignments in expression are ignored. Returns an error if the
+ * expression can't be evaluated at all. In base 10, values are computed in
+ * double precision where that is certain to give the same result. */
+MateCalcError mate_calc_tabulate(MateCalcContext *context, const char *expression, const char *variable,
+                                 const char *start, const char *end, const char *step, int n_threads,
+                                 MateCalcRowFunc row_func, void *data, char **error_message);
+
+/* Sum or multiply the values of expression over a range as for mate_calc_tabulate(),
+ * with the result set as for mate_calc_evaluate(). Stops at the first error. */
+MateCalcError mate_calc_reduce(MateCalcContext *context, MateCalcReduction reduction, const char *expression,
+                               const char *variable, const char *start, const char *end, const char *step,
+                               int n_threads, char **result, char **error_message);
+
+/* Name of an error code, e.g. "PARSER_ERR_INVALID" */
+const char *mate_calc_error_to_string(MateCalcError error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBMATECALC_H */
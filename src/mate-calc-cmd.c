@@ -14,39 +14,288 @@
 #include <sys/types.h>
 #include <time.h>
 #include <locale.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <gio/gunixsocketaddress.h>
 
 #include "mp-equation.h"
+#include "mp-history.h"
 #include "mp-serializer.h"
+#include "mp-stats.h"
+#include "mp-tabulate.h"
+#include "unit-manager.h"
+#include "currency-manager.h"
 
 #define MAXLINE 1024
 
+/* Number of lines read ahead of the output, per worker thread */
+#define BATCH_LINES_PER_THREAD 64
+
+/* Size of the output buffer used for machine readable formats */
+#define OUTPUT_BUFFER_SIZE 65536
+
+/* Digits after the point for the full precision result, PRECISION bits are about 301 digits */
+#define EXACT_DIGITS 300
+
+/* Most calculations listed by --history */
+#define HISTORY_RESULTS 100
+
+typedef enum
+{
+    OUTPUT_FORMAT_TEXT,
+    OUTPUT_FORMAT_JSONL,
+    OUTPUT_FORMAT_CSV
+} OutputFormat;
+
+/* Number of recent results kept, repeated lines are answered from the cache */
+#define RESULT_CACHE_SIZE 4096
+
+/* Connections served at the same time by the daemon, per processor */
+#define DAEMON_THREADS_PER_PROCESSOR 4
+
+/* Longest line the daemon reads, clients sending longer ones are disconnected */
+#define DAEMON_MAX_REQUEST 65536
+
 static MpSerializer *result_serializer;
+static MpSerializer *exact_serializer;
+static OutputFormat output_format = OUTPUT_FORMAT_TEXT;
+static MPResultCache *result_cache;
+
+/* Unit conversions are only enabled in the daemon, the managers are shared by all connections */
+static gboolean convert_units = FALSE;
+static GMutex convert_lock;
+
+/* Lines evaluated in batch mode, written out in input order */
+typedef struct
+{
+    gchar *equation;
+    gchar *output;      /* NULL until solved, or for blank lines in machine readable formats */
+    gboolean solved;
+} BatchLine;
+
+typedef struct
+{
+    GMutex lock;
+    GCond solved;
+    GQueue lines;       /* Lines read but not written yet, oldest first */
+} Batch;
+
+static int
+convert(const MPNumber *x, const char *x_units, const char *z_units, MPNumber *z, void *data)
+{
+    int result;
+
+    /* The currency manager loads its rates on first use */
+    g_mutex_lock(&convert_lock);
+    result = unit_manager_convert_by_symbol(unit_manager_get_default(), x, x_units, z_units, z);
+    g_mutex_unlock(&convert_lock);
+
+    return result;
+}
 
 static void
-solve(const char *equation)
+init_options(MPEquationOptions *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->base = 10;
+    options->wordlen = 32;
+    options->angle_units = MP_DEGREES;
+    options->accuracy = mp_serializer_get_trailing_digits(result_serializer);
+    if (convert_units)
+        options->convert = convert;
+}
+
+/* Returns an error message for a failed evaluation */
+static gchar *
+get_error_string(MPErrorCode error)
+{
+    if (error == PARSER_ERR_MP)
+        return g_strdup_printf("Error %s", mp_get_error());
+    else
+        return g_strdup_printf("Error %d", error);
+}
+
+/* Returns result of equation as a string, or an error message if it can't be solved */
+static gchar *
+solve_to_string(const char *equation, gboolean *is_error)
 {
     int ret;
     MPEquationOptions options;
     MPNumber z = mp_new();
-    gchar *result_str = NULL;
+    gchar *result_str;
 
-    memset(&options, 0, sizeof(options));
-    options.base = 10;
-    options.wordlen = 32;
-    options.angle_units = MP_DEGREES;
+    init_options(&options);
 
-    ret = mp_equation_parse(equation, &options, &z, NULL);
+    ret = mp_result_cache_parse(result_cache, equation, &options, &z, NULL);
 
-    if (ret == PARSER_ERR_MP)
-        fprintf(stderr, "Error %s\n", mp_get_error());
-    else if (ret)
-        fprintf(stderr, "Error %d\n", ret);
-    else {
+    *is_error = ret != PARSER_ERR_NONE;
+    if (ret)
+        result_str = get_error_string(ret);
+    else
         result_str = mp_serializer_to_string(result_serializer, &z);
-        printf("%s\n", result_str);
+    mp_clear(&z);
+
+    return result_str;
+}
+
+/* Append str to record as a JSON string */
+static void
+append_json_string(GString *record, const gchar *str)
+{
+    const gchar *c;
+
+    if (str == NULL) {
+        g_string_append(record, "null");
+        return;
     }
-    g_free(result_str);
+
+    g_string_append_c(record, '"');
+    for (c = str; *c != '\0'; c++) {
+        switch (*c) {
+        case '"':
+            g_string_append(record, "\\\"");
+            break;
+        case '\\':
+            g_string_append(record, "\\\\");
+            break;
+        case '\n':
+            g_string_append(record, "\\n");
+            break;
+        case '\r':
+            g_string_append(record, "\\r");
+            break;
+        case '\t':
+            g_string_append(record, "\\t");
+            break;
+        default:
+            if ((guchar) *c < 0x20)
+                g_string_append_printf(record, "\\u%04x", (guchar) *c);
+            else
+                g_string_append_c(record, *c);
+            break;
+        }
+    }
+    g_string_append_c(record, '"');
+}
+
+/* Append str to record as a CSV field, quoted only when required */
+static void
+append_csv_field(GString *record, const gchar *str)
+{
+    const gchar *c;
+
+    if (str == NULL)
+        return;
+
+    if (strpbrk(str, ",\"\r\n") == NULL) {
+        g_string_append(record, str);
+        return;
+    }
+
+    g_string_append_c(record, '"');
+    for (c = str; *c != '\0'; c++) {
+        if (*c == '"')
+            g_string_append_c(record, '"');
+        g_string_append_c(record, *c);
+    }
+    g_string_append_c(record, '"');
+}
+
+/* Returns a machine readable record for equation in the selected output format */
+static gchar *
+solve_to_record(const char *equation)
+{
+    MPErrorCode ret;
+    MPEquationOptions options;
+    MPNumber z = mp_new();
+    gchar *result_str = NULL, *exact_str = NULL, *message = NULL;
+    gint64 start_time, time_us;
+    GString *record;
+
+    init_options(&options);
+
+    start_time = g_get_monotonic_time();
+    ret = mp_result_cache_parse(result_cache, equation, &options, &z, NULL);
+    time_us = g_get_monotonic_time() - start_time;
+
+    if (ret == PARSER_ERR_NONE) {
+        result_str = mp_serializer_to_string(result_serializer, &z);
+        exact_str = mp_serializer_to_string(exact_serializer, &z);
+    }
+    else if (ret == PARSER_ERR_MP)
+        message = g_strdup(mp_get_error());
     mp_clear(&z);
+
+    record = g_string_new(NULL);
+    if (output_format == OUTPUT_FORMAT_JSONL) {
+        g_string_append(record, "{\"input\":");
+        append_json_string(record, equation);
+        g_string_append(record, ",\"result\":");
+        append_json_string(record, result_str);
+        g_string_append(record, ",\"exact\":");
+        append_json_string(record, exact_str);
+        g_string_append(record, ",\"error\":");
+        append_json_string(record, mp_error_code_to_string(ret));
+        g_string_append(record, ",\"message\":");
+        append_json_string(record, message);
+        g_string_append_printf(record, ",\"time_us\":%" G_GINT64_FORMAT "}", time_us);
+    }
+    else {
+        append_csv_field(record, equation);
+        g_string_append_c(record, ',');
+        append_csv_field(record, result_str);
+        g_string_append_c(record, ',');
+        append_csv_field(record, exact_str);
+        g_string_append_c(record, ',');
+        append_csv_field(record, mp_error_code_to_string(ret));
+        g_string_append_c(record, ',');
+        append_csv_field(record, message);
+        g_string_append_printf(record, ",%" G_GINT64_FORMAT, time_us);
+    }
+
+    g_free(result_str);
+    g_free(exact_str);
+    g_free(message);
+
+    return g_string_free(record, FALSE);
+}
+
+/* Write the statistics gathered since the last reset to standard error */
+static void
+print_statistics(void)
+{
+    MPStatistics stats;
+    gchar *text;
+
+    if (!mp_stats_get_enabled())
+        return;
+
+    mp_stats_get(&stats);
+    text = mp_stats_to_string(&stats);
+    fprintf(stderr, "%s\n", text);
+    g_free(text);
+}
+
+static void
+solve(const char *equation)
+{
+    gboolean is_error;
+    gchar *result_str;
+
+    if (mp_stats_get_enabled())
+        mp_stats_reset();
+
+    result_str = solve_to_string(equation, &is_error);
+    if (is_error)
+        fprintf(stderr, "%s\n", result_str);
+    else
+        printf("%s\n", result_str);
+    g_free(result_str);
+
+    print_statistics();
 }
 
 /* Adjust user input equation string before solving it. */
@@ -54,8 +303,10 @@ static void
 str_adjust(char *str)
 {
     int i, j = 0;
+    size_t len = strlen(str);
 
-    str[strlen(str)-1] = '\0';        /* Remove newline at end of string. */
+    if (len > 0 && str[len-1] == '\n')    /* Remove newline at end of string. */
+        str[len-1] = '\0';
     for (i = 0; str[i] != '\0'; i++) {        /* Remove whitespace. */
         if (str[i] != ' ' && str[i] != '\t')
             str[j++] = str[i];
@@ -65,17 +316,858 @@ str_adjust(char *str)
         str[j-1] = '\0';
 }
 
+/* Returns the output for a line of input in the selected format, or NULL if nothing is to be written */
+static gchar *
+solve_line(const char *equation)
+{
+    gboolean is_error;
+
+    /* Text output keeps one line per input line, records are only written for equations */
+    if (equation[0] == '\0')
+        return output_format == OUTPUT_FORMAT_TEXT ? g_strdup("") : NULL;
+    else if (output_format == OUTPUT_FORMAT_TEXT)
+        return solve_to_string(equation, &is_error);
+    else
+        return solve_to_record(equation);
+}
+
+static void
+log_cache_statistics(void)
+{
+    guint64 hits, misses;
+
+    mp_result_cache_get_statistics(result_cache, &hits, &misses);
+    g_debug("Result cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses (%.1f%% hit rate)",
+            hits, misses, hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0);
+}
+
+/* Executed in worker threads. */
+static void
+batch_solve(gpointer data, gpointer user_data)
+{
+    BatchLine *line = data;
+    Batch *batch = user_data;
+    gchar *output;
+
+    output = solve_line(line->equation);
+
+    g_mutex_lock(&batch->lock);
+    line->output = output;
+    line->solved = TRUE;
+    g_cond_broadcast(&batch->solved);
+    g_mutex_unlock(&batch->lock);
+}
+
+/* Write lines that have been solved and aren't waiting for an earlier one. Called with batch->lock held. */
+static void
+batch_write_solved(Batch *batch)
+{
+    BatchLine *line;
+
+    while ((line = g_queue_peek_head(&batch->lines)) != NULL && line->solved) {
+        g_queue_pop_head(&batch->lines);
+        if (line->output != NULL) {
+            fputs(line->output, stdout);
+            fputc('\n', stdout);
+        }
+        g_free(line->equation);
+        g_free(line->output);
+        g_slice_free(BatchLine, line);
+    }
+}
+
+/* Solve every line of file on a pool of threads, results are written in input order. */
+static void
+batch_run(FILE *file, gint n_threads)
+{
+    Batch batch;
+    GThreadPool *pool;
+    BatchLine *line;
+    char *buffer = NULL;
+    size_t buffer_size = 0;
+    guint max_lines;
+
+    if (n_threads <= 0)
+        n_threads = g_get_num_processors();
+    max_lines = n_threads * BATCH_LINES_PER_THREAD;
+
+    g_mutex_init(&batch.lock);
+    g_cond_init(&batch.solved);
+    g_queue_init(&batch.lines);
+    pool = g_thread_pool_new(batch_solve, &batch, n_threads, TRUE, NULL);
+
+    if (output_format == OUTPUT_FORMAT_CSV)
+        printf("input,result,exact,error,message,time_us\n");
+
+    while (getline(&buffer, &buffer_size, file) != -1) {
+        str_adjust(buffer);
+        line = g_slice_new(BatchLine);
+        line->equation = g_strdup(buffer);
+        line->output = NULL;
+        line->solved = FALSE;
+
+        g_mutex_lock(&batch.lock);
+        g_queue_push_tail(&batch.lines, line);
+        batch_write_solved(&batch);
+        /* Don't read too far ahead of a slow line */
+        while (g_queue_get_length(&batch.lines) > max_lines) {
+            g_cond_wait(&batch.solved, &batch.lock);
+            batch_write_solved(&batch);
+        }
+        g_mutex_unlock(&batch.lock);
+
+        g_thread_pool_push(pool, line, NULL);
+    }
+    free(buffer);
+
+    g_mutex_lock(&batch.lock);
+    batch_write_solved(&batch);
+    while (!g_queue_is_empty(&batch.lines)) {
+        g_cond_wait(&batch.solved, &batch.lock);
+        batch_write_solved(&batch);
+    }
+    g_mutex_unlock(&batch.lock);
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+    g_cond_clear(&batch.solved);
+    g_mutex_clear(&batch.lock);
+    fflush(stdout);
+
+    log_cache_statistics();
+}
+
+/* Returns the next line sent to the daemon without the newline, or NULL at
+ * the end of input, on error, or with too_long set if the line is longer than
+ * DAEMON_MAX_REQUEST. The input buffer holds one more byte than that. */
+static gchar *
+daemon_read_request(GBufferedInputStream *input, gboolean *too_long, GError **error)
+{
+    const gchar *buffer, *end;
+    gsize available;
+    gssize n_read;
+    gchar *line;
+
+    *too_long = FALSE;
+    while (TRUE) {
+        buffer = g_buffered_input_stream_peek_buffer(input, &available);
+        end = memchr(buffer, '\n', available);
+        if (end != NULL) {
+            line = g_strndup(buffer, end - buffer);
+            g_input_stream_skip(G_INPUT_STREAM(input), end - buffer + 1, NULL, NULL);
+            return line;
+        }
+        if (available > DAEMON_MAX_REQUEST) {
+            *too_long = TRUE;
+            return NULL;
+        }
+
+        n_read = g_buffered_input_stream_fill(input, -1, NULL, error);
+        if (n_read < 0)
+            return NULL;
+        if (n_read == 0) {
+            /* The last line may not end with a newline */
+            if (available == 0)
+                return NULL;
+            line = g_strndup(buffer, available);
+            g_input_stream_skip(G_INPUT_STREAM(input), available, NULL, NULL);
+            return line;
+        }
+    }
+}
+
+/* Returns the response to a line longer than DAEMON_MAX_REQUEST in the selected output format */
+static gchar *
+request_too_long_response(void)
+{
+    gchar *message;
+    GString *record;
+
+    message = g_strdup_printf("Request longer than %d bytes", DAEMON_MAX_REQUEST);
+    if (output_format == OUTPUT_FORMAT_TEXT) {
+        record = g_string_new("Error: ");
+        g_string_append(record, message);
+    }
+    else if (output_format == OUTPUT_FORMAT_JSONL) {
+        record = g_string_new("{\"input\":null,\"result\":null,\"exact\":null,\"error\":");
+        append_json_string(record, mp_error_code_to_string(PARSER_ERR_INVALID));
+        g_string_append(record, ",\"message\":");
+        append_json_string(record, message);
+        g_string_append(record, ",\"time_us\":0}");
+    }
+    else {
+        record = g_string_new(",,,");
+        append_csv_field(record, mp_error_code_to_string(PARSER_ERR_INVALID));
+        g_string_append_c(record, ',');
+        append_csv_field(record, message);
+        g_string_append(record, ",0");
+    }
+    g_free(message);
+
+    return g_string_free(record, FALSE);
+}
+
+/* Executed in a service thread for each client, answers every line it sends until it disconnects. */
+static gboolean
+daemon_run_cb(GThreadedSocketService *service, GSocketConnection *connection, GObject *source_object, gpointer user_data)
+{
+    GInputStream *input;
+    GOutputStream *output;
+    gchar *line;
+    gboolean too_long;
+    GError *error = NULL;
+
+    input = g_buffered_input_stream_new_sized(g_io_stream_get_input_stream(G_IO_STREAM(connection)), DAEMON_MAX_REQUEST + 1);
+    output = g_buffered_output_stream_new(g_io_stream_get_output_stream(G_IO_STREAM(connection)));
+
+    while ((line = daemon_read_request(G_BUFFERED_INPUT_STREAM(input), &too_long, &error)) != NULL) {
+        gchar *response;
+        gboolean written = TRUE;
+
+        str_adjust(line);
+        response = solve_line(line);
+        g_free(line);
+
+        if (response != NULL) {
+            written = g_output_stream_write_all(output, response, strlen(response), NULL, NULL, &error) &&
+                      g_output_stream_write_all(output, "\n", 1, NULL, NULL, &error);
+            g_free(response);
+        }
+
+        /* Pipelined requests are answered together */
+        if (written && g_buffered_input_stream_get_available(G_BUFFERED_INPUT_STREAM(input)) == 0)
+            written = g_output_stream_flush(output, NULL, &error);
+        if (!written)
+            break;
+    }
+    if (too_long) {
+        gchar *response = request_too_long_response();
+
+        /* There's no telling where the next request starts, so the connection is closed */
+        if (g_output_stream_write_all(output, response, strlen(response), NULL, NULL, NULL) &&
+            g_output_stream_write_all(output, "\n", 1, NULL, NULL, NULL))
+            g_output_stream_flush(output, NULL, NULL);
+        g_free(response);
+        g_debug("Connection closed: request longer than %d bytes", DAEMON_MAX_REQUEST);
+    }
+    if (error != NULL) {
+        g_debug("Connection closed: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_object_unref(output);
+    g_object_unref(input);
+
+    return TRUE;
+}
+
+static gboolean
+daemon_quit_cb(gpointer user_data)
+{
+    g_main_loop_quit(user_data);
+    return G_SOURCE_REMOVE;
+}
+
+/* Answer equations sent by clients on a Unix socket at path, one line per equation. */
+static int
+daemon_run(const gchar *path, gint n_threads)
+{
+    GSocketService *service;
+    GSocketAddress *address;
+    GMainLoop *loop;
+    GStatBuf buf;
+    GError *error = NULL;
+    gboolean listening;
+    mode_t old_umask;
+
+    if (n_threads <= 0)
+        n_threads = g_get_num_processors() * DAEMON_THREADS_PER_PROCESSOR;
+
+    /* Replace a socket left by a previous run, but nothing else */
+    if (g_lstat(path, &buf) == 0 && S_ISSOCK(buf.st_mode))
+        g_unlink(path);
+
+    service = g_threaded_socket_service_new(n_threads);
+    address = g_unix_socket_address_new(path);
+    /* Only the user running the daemon may connect, the socket is made with mode 0600 */
+    old_umask = umask(0177);
+    listening = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address, G_SOCKET_TYPE_STREAM,
+                                              G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error);
+    umask(old_umask);
+    g_object_unref(address);
+    if (!listening) {
+        fprintf(stderr, "Failed to listen on '%s': %s\n", path, error->message);
+        g_error_free(error);
+        g_object_unref(service);
+        return 1;
+    }
+
+    /* Build the unit tables and load the currency rates before the first request */
+    convert_units = TRUE;
+    unit_manager_get_default();
+    currency_manager_get_value(currency_manager_get_default(), "EUR");
+
+    loop = g_main_loop_new(NULL, FALSE);
+    g_unix_signal_add(SIGINT, daemon_quit_cb, loop);
+    g_unix_signal_add(SIGTERM, daemon_quit_cb, loop);
+    g_signal_connect(service, "run", G_CALLBACK(daemon_run_cb), NULL);
+    g_socket_service_start(service);
+
+    /* Runs the currency downloads as well */
+    g_main_loop_run(loop);
+
+    g_socket_service_stop(service);
+    g_socket_listener_close(G_SOCKET_LISTENER(service));
+    g_unlink(path);
+    g_object_unref(service);
+    g_main_loop_unref(loop);
+
+    log_cache_statistics();
+
+    return 0;
+}
+
+/* Parse a range in the form VAR:START:END[:STEP], where the limits are equations */
+static gboolean
+parse_range(const gchar *spec, MPRange *range)
+{
+    MPEquationOptions options;
+    gchar **parts;
+    guint n_parts;
+    MPErrorCode error = PARSER_ERR_NONE;
+
+    parts = g_strsplit(spec, ":", 4);
+    n_parts = g_strv_length(parts);
+    if (n_parts < 3 || parts[0][0] == '\0') {
+        fprintf(stderr, "Invalid range '%s', expected VAR:START:END[:STEP]\n", spec);
+        g_strfreev(parts);
+        return FALSE;
+    }
+
+    init_options(&options);
+    range->variable = g_strdup(parts[0]);
+    error = mp_equation_parse(parts[1], &options, &range->start, NULL);
+    if (error == PARSER_ERR_NONE)
+        error = mp_equation_parse(parts[2], &options, &range->end, NULL);
+    if (error == PARSER_ERR_NONE && n_parts > 3)
+        error = mp_equation_parse(parts[3], &options, &range->step, NULL);
+    else if (error == PARSER_ERR_NONE)
+        mp_set_from_integer(1, &range->step);
+    if (error != PARSER_ERR_NONE) {
+        gchar *message = get_error_string(error);
+        fprintf(stderr, "Invalid range '%s': %s\n", spec, message);
+        g_free(message);
+    }
+    g_strfreev(parts);
+
+    return error == PARSER_ERR_NONE;
+}
+
+static void
+table_write_row(const MPNumber *x, MPErrorCode error, const MPNumber *value, void *data)
+{
+    gchar *x_str, *result_str = NULL, *exact_str = NULL, *message = NULL;
+    GString *record;
+
+    x_str = mp_serializer_to_string(result_serializer, x);
+    if (value != NULL) {
+        result_str = mp_serializer_to_string(result_serializer, value);
+        if (output_format != OUTPUT_FORMAT_TEXT)
+            exact_str = mp_serializer_to_string(exact_serializer, value);
+    }
+    else if (output_format == OUTPUT_FORMAT_TEXT)
+        result_str = get_error_string(error);
+    else if (error == PARSER_ERR_MP)
+        message = g_strdup(mp_get_error());
+
+    record = g_string_new(NULL);
+    if (output_format == OUTPUT_FORMAT_JSONL) {
+        g_string_append(record, "{\"x\":");
+        append_json_string(record, x_str);
+        g_string_append(record, ",\"result\":");
+        append_json_string(record, result_str);
+        g_string_append(record, ",\"exact\":");
+        append_json_string(record, exact_str);
+        g_string_append(record, ",\"error\":");
+        append_json_string(record, mp_error_code_to_string(error));
+        g_string_append(record, ",\"message\":");
+        append_json_string(record, message);
+        g_string_append_c(record, '}');
+    }
+    else if (output_format == OUTPUT_FORMAT_CSV) {
+        append_csv_field(record, x_str);
+        g_string_append_c(record, ',');
+        append_csv_field(record, result_str);
+        g_string_append_c(record, ',');
+        append_csv_field(record, exact_str);
+        g_string_append_c(record, ',');
+        append_csv_field(record, mp_error_code_to_string(error));
+        g_string_append_c(record, ',');
+        append_csv_field(record, message);
+    }
+    else
+        g_string_append_printf(record, "%s\t%s", x_str, result_str);
+    printf("%s\n", record->str);
+
+    g_string_free(record, TRUE);
+    g_free(x_str);
+    g_free(result_str);
+    g_free(exact_str);
+    g_free(message);
+}
+
+/* Evaluate equation over range, writing a row for each value or reducing them to one result */
+static int
+table_run(const char *equation, const MPRange *range, gboolean reduce, MPReduction reduction, gint n_threads)
+{
+    MPEquationOptions options;
+    MPErrorCode error;
+    int digits;
+
+    init_options(&options);
+
+    if (reduce) {
+        MPNumber z = mp_new();
+
+        error = mp_tabulate_reduce(equation, range, reduction, &options, n_threads, &z, NULL);
+        if (error == PARSER_ERR_NONE) {
+            gchar *result_str = mp_serializer_to_string(result_serializer, &z);
+            printf("%s\n", result_str);
+            g_free(result_str);
+        }
+        mp_clear(&z);
+    }
+    else {
+        if (output_format == OUTPUT_FORMAT_CSV)
+            printf("x,result,exact,error,message\n");
+        /* Values are computed in double precision where that shows the same result,
+         * machine readable formats include the full precision value */
+        digits = output_format == OUTPUT_FORMAT_TEXT ? mp_serializer_get_trailing_digits(result_serializer) : -1;
+        error = mp_tabulate(equation, range, &options, digits, n_threads, table_write_row, NULL, NULL);
+    }
+
+    if (error != PARSER_ERR_NONE) {
+        gchar *message = get_error_string(error);
+        fprintf(stderr, "%s\n", message);
+        g_free(message);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Variables of a replayed session, name to MPNumber */
+static GHashTable *replay_variables;
+
+static int
+replay_variable_is_defined(const char *name, void *data)
+{
+    return g_hash_table_lookup(replay_variables, name) != NULL;
+}
+
+static int
+replay_get_variable(const char *name, MPNumber *z, void *data)
+{
+    MPNumber *value = g_hash_table_lookup(replay_variables, name);
+
+    if (!value)
+        return 0;
+    mp_set_from_mp(value, z);
+    return 1;
+}
+
+static void
+replay_set_variable(const char *name, const MPNumber *x, void *data)
+{
+    MPNumber *value = g_slice_new(MPNumber);
+
+    *value = mp_new();
+    mp_set_from_mp(x, value);
+    g_hash_table_insert(replay_variables, g_strdup(name), value);
+}
+
+static void
+replay_free_variable(gpointer data)
+{
+    MPNumber *value = data;
+
+    mp_clear(value);
+    g_slice_free(MPNumber, value);
+}
+
+/* Set options from the arguments of an options record */
+static void
+replay_set_options(MPEquationOptions *options, const gchar *text)
+{
+    gchar **values;
+    int i;
+
+    values = g_strsplit(text, " ", -1);
+    for (i = 0; values[i] != NULL; i++) {
+        if (g_str_has_prefix(values[i], "base="))
+            options->base = atoi(values[i] + strlen("base="));
+        else if (g_str_has_prefix(values[i], "wordlen="))
+            options->wordlen = atoi(values[i] + strlen("wordlen="));
+        else if (g_str_has_prefix(values[i], "accuracy="))
+            options->accuracy = atoi(values[i] + strlen("accuracy="));
+        else if (strcmp(values[i], "angle=radians") == 0)
+            options->angle_units = MP_RADIANS;
+        else if (strcmp(values[i], "angle=degrees") == 0)
+            options->angle_units = MP_DEGREES;
+        else if (strcmp(values[i], "angle=gradians") == 0)
+            options->angle_units = MP_GRADIANS;
+    }
+    g_strfreev(values);
+}
+
+/* Read a value written to the log by mp_to_exact_string() */
+static gboolean
+replay_parse_value(MPEquationOptions *options, const gchar *text, MPNumber *z)
+{
+    MPEquationOptions value_options;
+
+    if (mp_set_from_exact_string(text, z))
+        return TRUE;
+
+    /* Older logs have values in base 10, whatever base the session used */
+    value_options = *options;
+    value_options.base = 10;
+    return mp_equation_parse(text, &value_options, z, NULL) == PARSER_ERR_NONE;
+}
+
+/* Returns the result of a replayed request as text, or NULL if the record is not a request */
+static gchar *
+replay_record(MPEquationOptions *options, const gchar *command, const gchar *argument, MpSerializer *serializer)
+{
+    MPNumber z = mp_new();
+    MPErrorCode error;
+    gchar *result = NULL;
+
+    if (strcmp(command, "options") == 0)
+        replay_set_options(options, argument);
+    else if (strcmp(command, "unset") == 0)
+        g_hash_table_remove(replay_variables, argument);
+    else if (strcmp(command, "set") == 0) {
+        const gchar *value = strchr(argument, '=');
+
+        if (value && replay_parse_value(options, value + 1, &z)) {
+            gchar *name = g_strndup(argument, value - argument);
+            replay_set_variable(name, &z, NULL);
+            g_free(name);
+        }
+        else
+            fprintf(stderr, "Invalid value in '%s'\n", argument);
+    }
+    else if (strcmp(command, "solve") == 0) {
+        error = mp_equation_parse(argument, options, &z, NULL);
+        if (error == PARSER_ERR_NONE) {
+            result = mp_serializer_to_string(serializer, &z);
+            replay_set_variable("ans", &z, NULL);
+        }
+        else
+            result = get_error_string(error);
+    }
+    else if (strcmp(command, "factorize") == 0) {
+        if (replay_parse_value(options, argument, &z)) {
+            GString *text = g_string_new(NULL);
+            GList *factors, *link;
+
+            factors = mp_factorize(&z);
+            for (link = factors; link; link = link->next) {
+                gchar *factor = mp_serializer_to_string(serializer, link->data);
+                g_string_append_printf(text, "%s%s", link == factors ? "" : "×", factor);
+                g_free(factor);
+                replay_free_variable(link->data);
+            }
+            g_list_free(factors);
+            result = g_string_free(text, FALSE);
+        }
+        else
+            result = g_strdup("Error");
+    }
+    else
+        fprintf(stderr, "Unknown record '%s'\n", command);
+
+    mp_clear(&z);
+
+    return result;
+}
+
+/* Re-run a session recorded by mate-calc --record, timing each solve and factorize request */
+static int
+replay_run(const char *filename)
+{
+    MPEquationOptions options;
+    MpSerializer *serializer;
+    gchar *contents, **lines;
+    GError *error = NULL;
+    gint64 total = 0;
+    int i, n_requests = 0;
+
+    if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+        fprintf(stderr, "Failed to read '%s': %s\n", filename, error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    replay_variables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, replay_free_variable);
+    init_options(&options);
+    options.variable_is_defined = replay_variable_is_defined;
+    options.get_variable = replay_get_variable;
+    options.set_variable = replay_set_variable;
+    serializer = mp_serializer_new(MP_DISPLAY_FORMAT_AUTOMATIC, 10, options.accuracy);
+
+    if (mp_stats_get_enabled())
+        mp_stats_reset();
+
+    lines = g_strsplit(contents, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++) {
+        gchar *argument, *result;
+        gint64 start, time;
+
+        if (lines[i][0] == '\0' || lines[i][0] == '#')
+            continue;
+
+        argument = strchr(lines[i], ' ');
+        if (argument)
+            *argument++ = '\0';
+        else
+            argument = lines[i] + strlen(lines[i]);
+
+        /* Results are shown as the session showed them */
+        if (strcmp(lines[i], "options") == 0) {
+            replay_record(&options, lines[i], argument, serializer);
+            mp_serializer_set_base(serializer, options.base);
+            mp_serializer_set_trailing_digits(serializer, options.accuracy);
+            continue;
+        }
+
+        start = g_get_monotonic_time();
+        result = replay_record(&options, lines[i], argument, serializer);
+        time = g_get_monotonic_time() - start;
+        if (result) {
+            printf("%10" G_GINT64_FORMAT " µs  %s %s = %s\n", time, lines[i], argument, result);
+            total += time;
+            n_requests++;
+            g_free(result);
+        }
+    }
+    printf("%10" G_GINT64_FORMAT " µs  total for %d requests\n", total, n_requests);
+
+    g_strfreev(lines);
+    g_free(contents);
+    g_object_unref(serializer);
+    g_hash_table_unref(replay_variables);
+
+    return 0;
+}
+
+static gboolean
+history_print_cb(guint64 index, const MPHistoryEntry *entry, gpointer data)
+{
+    gchar *answer, time_text[64];
+    GDateTime *time;
+
+    time = g_date_time_new_from_unix_local(entry->time);
+    if (time) {
+        gchar *text = g_date_time_format(time, "%Y-%m-%d %H:%M");
+        g_strlcpy(time_text, text, sizeof(time_text));
+        g_free(text);
+        g_date_time_unref(time);
+    }
+    else
+        time_text[0] = '\0';
+
+    answer = mp_serializer_to_string(result_serializer, &entry->answer);
+    printf("%s  %s = %s\n", time_text, entry->equation, answer);
+    g_free(answer);
+
+    return TRUE;
+}
+
+/* List the newest calculations saved by mate-calc that contain text */
+static int
+history_run(const char *text)
+{
+    MPHistory *history;
+    gchar *filename;
+
+    filename = g_build_filename(g_get_user_data_dir(), "mate-calc", "history", NULL);
+    history = mp_history_open(filename);
+    g_free(filename);
+    if (!history) {
+        fprintf(stderr, "Failed to open the history\n");
+        return 1;
+    }
+
+    mp_history_search(history, text, FALSE, HISTORY_RESULTS, history_print_cb, NULL);
+    mp_history_free(history);
+
+    return 0;
+}
+
+static void
+usage(const gchar *progname)
+{
+    fprintf(stderr,
+            "Usage:\n"
+            "  %s [OPTION...] [FILE]\n"
+            "  %s [OPTION...] --range=VAR:START:END[:STEP] EQUATION\n"
+            "  %s [OPTION...] --replay=FILE\n"
+            "\n"
+            "Options:\n"
+            "  -b, --batch                     Solve every line of FILE (or standard input) and exit\n"
+            "  -j, --jobs=N                    Number of threads used in batch mode (default: one per processor)\n"
+            "  -f, --format=FORMAT             Write results as text, jsonl or csv records (implies --batch)\n"
+            "  -l, --listen=PATH               Answer equations sent on the Unix socket PATH\n"
+            "  -r, --range=VAR:START:END[:STEP]\n"
+            "                                  Solve the EQUATION argument for each value of VAR\n"
+            "  -s, --sum                       Add up the values of EQUATION over the range\n"
+            "  -p, --product                   Multiply the values of EQUATION over the range\n"
+            "      --replay=FILE               Re-run a session recorded with mate-calc --record, timing each request\n"
+            "      --history=TEXT              List the newest calculations in the mate-calc history containing TEXT\n"
+            "      --stats                     Write operation counts and timings to standard error\n"
+            "                                  (also enabled by setting MATE_CALC_STATS)\n"
+            "  -h, --help                      Show help options\n",
+            progname, progname, progname);
+}
+
 int
-main(void)
+main(int argc, char *argv[])
 {
     char *equation, *line;
+    const char *filename = NULL, *socket_path = NULL, *range_spec = NULL, *replay_file = NULL, *history_text = NULL;
+    gboolean batch_mode = FALSE, reduce = FALSE, show_stats = FALSE;
+    MPReduction reduction = MP_REDUCE_SUM;
+    gint n_threads = 0;
+    int i;
 
     /* Seed random number generator. */
     srand48((long) time((time_t *) 0));
 
     setlocale(LC_ALL, "");
 
+    for (i = 1; i < argc; i++) {
+        char *arg = argv[i];
+
+        if (strcmp(arg, "-b") == 0 || strcmp(arg, "--batch") == 0)
+            batch_mode = TRUE;
+        else if (strcmp(arg, "-j") == 0 && i + 1 < argc)
+            n_threads = atoi(argv[++i]);
+        else if (g_str_has_prefix(arg, "--jobs="))
+            n_threads = atoi(arg + strlen("--jobs="));
+        else if ((strcmp(arg, "-f") == 0 && i + 1 < argc) || g_str_has_prefix(arg, "--format=")) {
+            const char *format = arg[1] == 'f' ? argv[++i] : arg + strlen("--format=");
+
+            if (strcmp(format, "text") == 0)
+                output_format = OUTPUT_FORMAT_TEXT;
+            else if (strcmp(format, "jsonl") == 0)
+                output_format = OUTPUT_FORMAT_JSONL;
+            else if (strcmp(format, "csv") == 0)
+                output_format = OUTPUT_FORMAT_CSV;
+            else {
+                fprintf(stderr, "Unknown format '%s'\n", format);
+                usage(argv[0]);
+                return 1;
+            }
+            batch_mode = batch_mode || output_format != OUTPUT_FORMAT_TEXT;
+        }
+        else if (strcmp(arg, "-l") == 0 && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (g_str_has_prefix(arg, "--listen="))
+            socket_path = arg + strlen("--listen=");
+        else if (strcmp(arg, "-r") == 0 && i + 1 < argc)
+            range_spec = argv[++i];
+        else if (g_str_has_prefix(arg, "--range="))
+            range_spec = arg + strlen("--range=");
+        else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--sum") == 0) {
+            reduce = TRUE;
+            reduction = MP_REDUCE_SUM;
+        }
+        else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--product") == 0) {
+            reduce = TRUE;
+            reduction = MP_REDUCE_PRODUCT;
+        }
+        else if (g_str_has_prefix(arg, "--replay="))
+            replay_file = arg + strlen("--replay=");
+        else if (g_str_has_prefix(arg, "--history="))
+            history_text = arg + strlen("--history=");
+        else if (strcmp(arg, "--stats") == 0)
+            show_stats = TRUE;
+        else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        }
+        else if (arg[0] != '-' && filename == NULL)
+            filename = arg;
+        else {
+            fprintf(stderr, "Unknown argument '%s'\n", arg);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    mp_stats_init(show_stats);
+
     result_serializer = mp_serializer_new(MP_DISPLAY_FORMAT_AUTOMATIC, 10, 9);
+    exact_serializer = mp_serializer_new(MP_DISPLAY_FORMAT_SCIENTIFIC, 10, EXACT_DIGITS);
+    mp_serializer_set_radix(exact_serializer, '.');
+    result_cache = mp_result_cache_new(RESULT_CACHE_SIZE);
+
+    /* Records are flushed in large blocks rather than per line */
+    if (output_format != OUTPUT_FORMAT_TEXT)
+        setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+    if (socket_path != NULL)
+        return daemon_run(socket_path, n_threads);
+
+    if (history_text != NULL)
+        return history_run(history_text);
+
+    if (replay_file != NULL) {
+        int status = replay_run(replay_file);
+        print_statistics();
+        return status;
+    }
+
+    /* The argument is the equation to tabulate rather than a file */
+    if (range_spec != NULL || reduce) {
+        MPRange range;
+        int status = 1;
+
+        if (range_spec == NULL || filename == NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        range.variable = NULL;
+        range.start = mp_new();
+        range.end = mp_new();
+        range.step = mp_new();
+        if (parse_range(range_spec, &range))
+            status = table_run(filename, &range, reduce, reduction, n_threads);
+        print_statistics();
+        g_free((gchar *) range.variable);
+        mp_clear(&range.start);
+        mp_clear(&range.end);
+        mp_clear(&range.step);
+
+        return status;
+    }
+
+    if (batch_mode || filename != NULL) {
+        FILE *file = stdin;
+
+        if (filename != NULL && (file = fopen(filename, "r")) == NULL) {
+            fprintf(stderr, "Failed to open '%s': %s\n", filename, g_strerror(errno));
+            return 1;
+        }
+        batch_run(file, n_threads);
+        if (file != stdin)
+            fclose(file);
+        print_statistics();
+
+        return 0;
+    }
 
     equation = (char *) malloc(MAXLINE * sizeof(char));
     while (1) {
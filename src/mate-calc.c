@@ -17,11 +17,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <locale.h>
+#include <errno.h>
 #include <glib/gi18n.h>
 
 #include "math-window.h"
 #include "math-preferences.h"
 #include "mp-equation.h"
+#include "mp-stats.h"
 #include "unit-manager.h"
 #include "utility.h"
 
@@ -29,6 +31,9 @@ GSettings *g_settings_var = NULL;
 
 static MathWindow *window;
 
+/* Session log given with --record, or NULL */
+static const gchar *record_filename = NULL;
+
 static void
 version(const gchar *progname)
 {
@@ -42,8 +47,9 @@ do_convert(const MPNumber *x, const char *x_units, const char *z_units, MPNumber
     return unit_manager_convert_by_symbol(unit_manager_get_default(), x, x_units, z_units, z);
 }
 
-static void
-solve(const char *equation)
+/* Print the result of equation, returns FALSE if it can't be solved */
+static gboolean
+solve_equation(MpSerializer *serializer, const char *equation)
 {
     MPEquationOptions options;
     MPErrorCode error;
@@ -54,25 +60,70 @@ solve(const char *equation)
     options.base = 10;
     options.wordlen = 32;
     options.angle_units = MP_DEGREES;
+    /* The unit and currency managers are only created if the equation converts units */
     options.convert = do_convert;
 
     error = mp_equation_parse(equation, &options, &result, NULL);
-    if(error == PARSER_ERR_MP) {
+    if(error == PARSER_ERR_MP)
         fprintf(stderr, "Error: %s\n", mp_get_error());
-        mp_clear(&result);
-        exit(1);
-    }
-    else if(error != 0) {
+    else if(error != 0)
         fprintf(stderr, "Error: %s\n", mp_error_code_to_string(error));
-        mp_clear(&result);
-        exit(1);
-    }
     else {
-        result_str = mp_serializer_to_string(mp_serializer_new(MP_DISPLAY_FORMAT_AUTOMATIC, 10, 9), &result);
+        result_str = mp_serializer_to_string(serializer, &result);
         printf("%s\n", result_str);
-        mp_clear(&result);
-        exit(0);
+        g_free(result_str);
+    }
+    mp_clear(&result);
+
+    return error == PARSER_ERR_NONE;
+}
+
+static void
+solve(const char *equation)
+{
+    MpSerializer *serializer;
+    gboolean solved;
+
+    serializer = mp_serializer_new(MP_DISPLAY_FORMAT_AUTOMATIC, 10, 9);
+    solved = solve_equation(serializer, equation);
+    g_object_unref(serializer);
+
+    exit(solved ? 0 : 1);
+}
+
+/* Solve each line of a file, or standard input if filename is "-" */
+static void
+solve_file(const char *filename)
+{
+    MpSerializer *serializer;
+    FILE *file = stdin;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    gboolean solved = TRUE;
+
+    if (strcmp(filename, "-") != 0 && (file = fopen(filename, "r")) == NULL) {
+        fprintf(stderr,
+                /* Error printed to stderr when the file given to --solve-file can't be read */
+                _("Failed to open '%s': %s"), filename, g_strerror(errno));
+        fprintf(stderr, "\n");
+        exit(1);
+    }
+
+    serializer = mp_serializer_new(MP_DISPLAY_FORMAT_AUTOMATIC, 10, 9);
+    while ((length = getline(&line, &line_size, file)) != -1) {
+        if (length > 0 && line[length - 1] == '\n')
+            line[length - 1] = '\0';
+        if (line[0] == '\0')
+            continue;
+        solved = solve_equation(serializer, line) && solved;
     }
+    free(line);
+    g_object_unref(serializer);
+    if (file != stdin)
+        fclose(file);
+
+    exit(solved ? 0 : 1);
 }
 
 static void
@@ -114,14 +165,19 @@ usage(const gchar *progname, gboolean show_application, gboolean show_gtk)
         fprintf(stderr,
                 /* Description on mate-calc application options displayed on command-line */
                 _("Application Options:\n"
-                  "  -s, --solve <equation>          Solve the given equation"));
+                  "  -s, --solve <equation>          Solve the given equation\n"
+                  "  -f, --solve-file <file>         Solve each line of the given file (- for standard input)\n"
+                  "  --stats                         Show operation counts and timings of each calculation\n"
+                  "  --record <file>                 Append each calculation to a file for mate-calc-cmd --replay"));
         fprintf(stderr,
                 "\n\n");
     }
 }
 
+/* Options are read before GTK+ is started so they work without a display,
+ * unknown arguments are only reported once GTK+ has removed its own. */
 static void
-get_options(int argc, char *argv[])
+get_options(int argc, char *argv[], gboolean before_gtk)
 {
     int i;
     char *progname, *arg;
@@ -168,7 +224,36 @@ get_options(int argc, char *argv[])
             else
                 solve(argv[i]);
         }
-        else {
+        else if (strcmp(arg, "-f") == 0 ||
+            strcmp(arg, "--solve-file") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr,
+                        /* Error printed to stderr when user uses --solve-file argument without a file */
+                        _("Argument --solve-file requires a file to solve"));
+                fprintf(stderr, "\n");
+                g_free(progname);
+                exit(1);
+            }
+            else
+                solve_file(argv[i]);
+        }
+        else if (strcmp(arg, "--stats") == 0)
+            mp_stats_init(TRUE);
+        else if (strcmp(arg, "--record") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr,
+                        /* Error printed to stderr when user uses --record argument without a file */
+                        _("Argument --record requires a file to record to"));
+                fprintf(stderr, "\n");
+                g_free(progname);
+                exit(1);
+            }
+            else
+                record_filename = argv[i];
+        }
+        else if (!before_gtk) {
             fprintf(stderr,
                     /* Error printed to stderr when user provides an unknown command-line argument */
                     _("Unknown argument '%s'"), arg);
@@ -192,8 +277,8 @@ int main(int argc, char **argv)
 {
     MathEquation *equation;
     MathButtons *buttons;
-    int accuracy = 9, word_size = 64, base = 10;
-    gboolean show_tsep = FALSE, show_zeroes = FALSE, show_hist = FALSE;
+    int accuracy = 9, word_size = 64, base = 10, undo_limit;
+    gboolean show_tsep = FALSE, show_zeroes = FALSE, show_hist = FALSE, live_preview = FALSE, track_dependencies = FALSE;
     MpDisplayFormat number_format;
     MPAngleUnit angle_units;
     ButtonMode button_mode;
@@ -208,8 +293,13 @@ int main(int argc, char **argv)
     /* Seed random number generator. */
     srand48((long) time((time_t *) 0));
 
+    mp_stats_init(FALSE);
+    get_options(argc, argv, TRUE);
+
     gtk_init(&argc, &argv);
 
+    get_options(argc, argv, FALSE);
+
     g_settings_var = g_settings_new ("org.mate.calc");
     accuracy = g_settings_get_int(g_settings_var, "accuracy");
     word_size = g_settings_get_int(g_settings_var, "word-size");
@@ -217,6 +307,9 @@ int main(int argc, char **argv)
     show_tsep = g_settings_get_boolean(g_settings_var, "show-thousands");
     show_zeroes = g_settings_get_boolean(g_settings_var, "show-zeroes");
     show_hist = g_settings_get_boolean(g_settings_var, "show-history");
+    live_preview = g_settings_get_boolean(g_settings_var, "live-preview");
+    track_dependencies = g_settings_get_boolean(g_settings_var, "track-dependencies");
+    undo_limit = g_settings_get_int(g_settings_var, "undo-limit");
     number_format = g_settings_get_enum(g_settings_var, "number-format");
     angle_units = g_settings_get_enum(g_settings_var, "angle-units");
     button_mode = g_settings_get_enum(g_settings_var, "button-mode");
@@ -230,6 +323,9 @@ int main(int argc, char **argv)
     math_equation_set_word_size(equation, word_size);
     math_equation_set_show_thousands_separators(equation, show_tsep);
     math_equation_set_show_trailing_zeroes(equation, show_zeroes);
+    math_equation_set_live_preview(equation, live_preview);
+    math_equation_set_track_dependencies(equation, track_dependencies);
+    math_equation_set_undo_limit(equation, undo_limit);
     math_equation_set_number_format(equation, number_format);
     math_equation_set_angle_units(equation, angle_units);
     math_equation_set_source_currency(equation, source_currency);
@@ -241,7 +337,11 @@ int main(int argc, char **argv)
     g_free(source_units);
     g_free(target_units);
 
-    get_options(argc, argv);
+    if (!record_filename)
+        record_filename = g_getenv("MATE_CALC_RECORD");
+    if (record_filename && record_filename[0] != '\0' &&
+        !math_equation_start_recording(equation, record_filename))
+        fprintf(stderr, "Failed to open %s for recording\n", record_filename);
 
     //gtk_window_set_default_icon_name("accessories-calculator");
 
@@ -255,5 +355,7 @@ int main(int argc, char **argv)
     gtk_widget_show(GTK_WIDGET(window));
     gtk_main();
 
+    math_variables_save(math_equation_get_variables(equation));
+
     return 0;
 }
@@ -13,6 +13,7 @@
 #include <gdk/gdkkeysyms.h>
 
 #include "math-display.h"
+#include "mp-stats.h"
 
 enum {
     PROP_0,
@@ -32,6 +33,9 @@ struct MathDisplayPrivate
 
     /* Spinner widget that shows if we're calculating a response */
     GtkWidget *spinner;
+
+    /* Debug panel showing what the last calculation did, NULL unless statistics are enabled */
+    GtkWidget *statistics_label;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (MathDisplay, math_display, GTK_TYPE_VIEWPORT);
@@ -119,6 +123,12 @@ display_key_press_cb(GtkWidget *widget, GdkEventKey *event, MathDisplay *display
         return TRUE;
     }
 
+    /* Stop calculation on escape */
+    if (event->keyval == GDK_KEY_Escape && state == 0 && math_equation_in_solve(display->priv->equation)) {
+        math_equation_cancel(display->priv->equation);
+        return TRUE;
+    }
+
     /* Clear on escape */
     if ((event->keyval == GDK_KEY_Escape && state == 0) ||
         (event->keyval == GDK_KEY_BackSpace && state == GDK_CONTROL_MASK) ||
@@ -316,6 +326,17 @@ status_changed_cb(MathEquation *equation, GParamSpec *spec, MathDisplay *display
     }
 }
 
+static void
+statistics_changed_cb(MathEquation *equation, GParamSpec *spec, MathDisplay *display)
+{
+    const gchar *statistics = math_equation_get_statistics(equation);
+    gchar *markup;
+
+    markup = g_markup_printf_escaped("<small><tt>%s</tt></small>", statistics ? statistics : "");
+    gtk_label_set_markup(GTK_LABEL(display->priv->statistics_label), markup);
+    g_free(markup);
+}
+
 static void _text_view_override_font (GtkWidget *widget, PangoFontDescription *font)
 {
     GtkCssProvider *provider;
@@ -410,6 +431,19 @@ create_gui(MathDisplay *display)
 
     g_signal_connect(display->priv->equation, "notify::status", G_CALLBACK(status_changed_cb), display);
     status_changed_cb(display->priv->equation, NULL, display);
+
+    if (mp_stats_get_enabled()) {
+        display->priv->statistics_label = gtk_label_new(NULL);
+        gtk_label_set_selectable(GTK_LABEL(display->priv->statistics_label), TRUE);
+        gtk_label_set_xalign(GTK_LABEL(display->priv->statistics_label), 0.0);
+        gtk_widget_set_margin_start(display->priv->statistics_label, 6);
+        gtk_widget_set_margin_bottom(display->priv->statistics_label, 6);
+        gtk_box_pack_start(GTK_BOX(main_box), display->priv->statistics_label, FALSE, TRUE, 0);
+        gtk_widget_show(display->priv->statistics_label);
+
+        g_signal_connect(display->priv->equation, "notify::statistics", G_CALLBACK(statistics_changed_cb), display);
+        statistics_changed_cb(display->priv->equation, NULL, display);
+    }
 }
 
 static void
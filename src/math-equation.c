@@ -22,7 +22,9 @@
 
 #include "mp.h"
 #include "mp-equation.h"
+#include "mp-dependencies.h"
 #include "mp-serializer.h"
+#include "mp-stats.h"
 #include "mp-enums.h"
 #include "unit-manager.h"
 #include "utility.h"
@@ -36,6 +38,9 @@ enum {
     PROP_ACCURACY,
     PROP_SHOW_THOUSANDS_SEPARATORS,
     PROP_SHOW_TRAILING_ZEROES,
+    PROP_LIVE_PREVIEW,
+    PROP_TRACK_DEPENDENCIES,
+    PROP_UNDO_LIMIT,
     PROP_NUMBER_FORMAT,
     PROP_BASE,
     PROP_WORD_SIZE,
@@ -44,7 +49,8 @@ enum {
     PROP_TARGET_CURRENCY,
     PROP_SOURCE_UNITS,
     PROP_TARGET_UNITS,
-    PROP_SERIALIZER
+    PROP_SERIALIZER,
+    PROP_STATISTICS
 };
 
 static GType number_mode_type, number_format_type, angle_unit_type;
@@ -61,6 +67,22 @@ typedef struct {
     gchar *status;             /* Equation status */
 } MathEquationState;
 
+/* Undo or redo entry. Only the newest entry in a stack holds the whole
+ * expression, older ones hold the text that replaces part of the expression of
+ * the entry above them. */
+typedef struct {
+    gboolean is_delta;
+    gchar *text;               /* Expression, or text replacing delta_length bytes at delta_offset */
+    gsize delta_offset, delta_length;
+    MPNumber *ans;             /* NULL in a delta if ans is unchanged */
+    gint ans_start, ans_end;
+    gint cursor;
+    NumberMode number_mode;
+    gboolean can_super_minus;
+    gboolean entered_multiply;
+    gchar *status;
+} UndoEntry;
+
 struct MathEquationPrivate
 {
     GtkTextTag *ans_tag;
@@ -79,8 +101,12 @@ struct MathEquationPrivate
     GtkTextMark *ans_start, *ans_end;
 
     MathEquationState state;  /* Equation state */
-    GList *undo_stack;        /* History of expression mode states */
-    GList *redo_stack;
+    GQueue undo_stack;        /* History of expression mode states, newest first */
+    GQueue redo_stack;
+    gsize undo_size;          /* Memory used by both stacks */
+    gsize undo_limit;         /* Oldest undo entries are dropped above this size */
+    GtkTextMark *typing_end;  /* End of the word being typed, inserting here doesn't add an undo entry */
+    gboolean typing;
     gboolean in_undo_operation;
 
     gboolean in_reformat;
@@ -88,19 +114,81 @@ struct MathEquationPrivate
     gboolean in_delete;
 
     gboolean in_solve;
+    GCancellable *solve_cancellable; /* Cancels the running solve or factorize */
 
     MathVariables *variables;
     MpSerializer *serializer;
 
-    GAsyncQueue *queue;
+    GThreadPool *solve_pool;  /* Single persistent thread solving and factorizing */
+
+    MPCompiledEquation *compiled; /* Last solved equation, edits are compiled incrementally */
+    MPResultCache *result_cache;  /* Results of recent equations, shared with the preview thread */
+    guint ans_version;            /* Incremented whenever ans changes */
+
+    gint track_dependencies;      /* Recalculate variables assigned from others when those change, read by the solve thread */
+    MPDependencies *dependencies; /* Equations of the variables assigned from others */
+
+    gboolean live_preview;    /* Evaluate the equation in the background while it is edited */
+    guint preview_timeout;    /* Waits for the user to pause typing */
+    gint preview_generation;  /* Incremented on every edit, previews of older versions are dropped */
+    gboolean showing_preview; /* Status contains a preview and not a message */
+    GCancellable *preview_cancellable;    /* Cancels the latest preview */
+    GThreadPool *preview_pool;            /* Single thread evaluating previews */
+    MPCompiledEquation *preview_compiled; /* Only used by the preview thread */
+
+    gchar *statistics;        /* Counts and timings of the last calculation, NULL unless enabled */
+
+    FILE *record_file;               /* Log of solve and factorize requests, NULL unless recording */
+    gchar *recorded_options;         /* Options line last written to the log */
+    GHashTable *recorded_variables;  /* Values of variables as last written to the log */
 };
 
+/* Time to wait after the last edit before starting a preview, in milliseconds */
+#define PREVIEW_DELAY 150
+
+/* Previews taking longer than this are abandoned */
+#define PREVIEW_BUDGET (250 * G_TIME_SPAN_MILLISECOND)
+
+/* Number of recent results kept */
+#define RESULT_CACHE_SIZE 64
+
+/* Default memory kept for undo in bytes */
+#define DEFAULT_UNDO_LIMIT (1024 * 1024)
+
+typedef enum {
+    SOLVE_JOB_SOLVE,
+    SOLVE_JOB_FACTORIZE,
+    SOLVE_JOB_UPDATE
+} SolveJobType;
+
+/* Work for the solve thread, everything it needs is copied in the main thread */
 typedef struct {
+    MathEquation *equation;
+    SolveJobType type;
+    gchar *text;                /* Equation to solve, or variable that changed */
+    MPNumber x;                 /* Number to factorize */
+    GCancellable *cancellable;
+} SolveJob;
+
+typedef struct {
+    MathEquation *equation;
     MPNumber *number_result;
     gchar *text_result;
     gchar *error;
 } SolveData;
 
+typedef struct {
+    gint generation;
+    gchar *text;
+    GCancellable *cancellable;
+} PreviewJob;
+
+typedef struct {
+    MathEquation *equation;
+    gint generation;
+    MPNumber *number_result;
+} PreviewData;
+
 G_DEFINE_TYPE_WITH_PRIVATE (MathEquation, math_equation, GTK_TYPE_TEXT_BUFFER);
 
 MathEquation *
@@ -169,106 +257,165 @@ reformat_ans(MathEquation *equation)
     g_free(ans_text);
 }
 
-static gint
-count_digits(MathEquation *equation, const gchar *text)
+/* Returns TRUE if the character at iter can be part of a number, ans is left alone */
+static gboolean
+is_number_char(MathEquation *equation, const GtkTextIter *iter, gint ans_start, gint ans_end)
 {
-    const gchar *read_iter;
-    gint count = 0;
+    gint offset = gtk_text_iter_get_offset(iter);
+    gunichar c = gtk_text_iter_get_char(iter);
+
+    if (offset >= ans_start && offset <= ans_end)
+        return FALSE;
+
+    return g_unichar_isdigit(c) ||
+           c == mp_serializer_get_radix(equation->priv->serializer) ||
+           c == mp_serializer_get_thousands_separator(equation->priv->serializer);
+}
+
+/* Put thousands separators in the right places in the number between offsets
+ * start and end. Only the part that changes is replaced, as a single edit.
+ * Returns the offset of the end of the number afterwards. */
+static gint
+reformat_number(MathEquation *equation, gint start, gint end)
+{
+    GtkTextBuffer *buffer = GTK_TEXT_BUFFER(equation);
+    GtkTextIter start_iter, end_iter;
+    GString *new_text;
+    gchar *text, *c, *old_start, *old_end, *new_start, *new_end;
+    gunichar radix, tsep;
+    gint count = 0, n_digits = 0, cursor, new_cursor = -1, new_length = 0, prefix = 0, suffix = 0, i;
+    gboolean in_number = FALSE, in_radix = FALSE;
+
+    radix = mp_serializer_get_radix(equation->priv->serializer);
+    tsep = mp_serializer_get_thousands_separator(equation->priv->serializer);
+    if (math_equation_get_base(equation) == 10 &&
+        mp_serializer_get_show_thousands_separators(equation->priv->serializer))
+        count = mp_serializer_get_thousands_separator_count(equation->priv->serializer);
+
+    gtk_text_buffer_get_iter_at_offset(buffer, &start_iter, start);
+    gtk_text_buffer_get_iter_at_offset(buffer, &end_iter, end);
+    text = gtk_text_buffer_get_text(buffer, &start_iter, &end_iter, FALSE);
+
+    /* Separators are counted from the last digit before the radix */
+    for (c = text; *c != '\0' && g_utf8_get_char(c) != radix; c = g_utf8_next_char(c)) {
+        if (g_unichar_isdigit(g_utf8_get_char(c)))
+            n_digits++;
+    }
 
-    read_iter = text;
-    while (*read_iter != '\0') {
-        if (!g_unichar_isdigit(g_utf8_get_char(read_iter)))
-            return count;
+    /* Keep the cursor between the same digits */
+    g_object_get(G_OBJECT(equation), "cursor-position", &cursor, NULL);
+    cursor -= start;
 
-        read_iter = g_utf8_next_char(read_iter);
+    new_text = g_string_sized_new(strlen(text) + 16);
+    for (c = text, i = 0; *c != '\0'; c = g_utf8_next_char(c), i++) {
+        gunichar ch = g_utf8_get_char(c);
 
-        /* Allow a thousands separator between digits follow a digit */
-        if (g_utf8_get_char(read_iter) == mp_serializer_get_thousands_separator(equation->priv->serializer)) {
-            read_iter = g_utf8_next_char(read_iter);
-            if (!g_unichar_isdigit(g_utf8_get_char(read_iter)))
-                return count;
+        if (g_unichar_isdigit(ch)) {
+            if (count > 0 && in_number && !in_radix && n_digits % count == 0) {
+                g_string_append_unichar(new_text, tsep);
+                new_length++;
+            }
+            in_number = TRUE;
+            n_digits--;
+        }
+        else if (ch == radix)
+            in_number = in_radix = TRUE;
+        /* Existing separators are dropped and put back where they belong */
+        else if (ch == tsep && in_number) {
+            if (i == cursor)
+                new_cursor = new_length;
+            continue;
         }
 
-        count++;
+        if (i == cursor)
+            new_cursor = new_length;
+        g_string_append_unichar(new_text, ch);
+        new_length++;
     }
+    if (i == cursor)
+        new_cursor = new_length;
+
+    /* Only replace what differs */
+    old_start = text;
+    new_start = new_text->str;
+    while (*old_start != '\0' && *new_start != '\0' && g_utf8_get_char(old_start) == g_utf8_get_char(new_start)) {
+        old_start = g_utf8_next_char(old_start);
+        new_start = g_utf8_next_char(new_start);
+        prefix++;
+    }
+    old_end = text + strlen(text);
+    new_end = new_text->str + new_text->len;
+    while (old_end > old_start && new_end > new_start &&
+           g_utf8_get_char(g_utf8_prev_char(old_end)) == g_utf8_get_char(g_utf8_prev_char(new_end))) {
+        old_end = g_utf8_prev_char(old_end);
+        new_end = g_utf8_prev_char(new_end);
+        suffix++;
+    }
+
+    if (old_start != old_end || new_start != new_end) {
+        gtk_text_buffer_begin_user_action(buffer);
+        gtk_text_buffer_get_iter_at_offset(buffer, &start_iter, start + prefix);
+        gtk_text_buffer_get_iter_at_offset(buffer, &end_iter, end - suffix);
+        gtk_text_buffer_delete(buffer, &start_iter, &end_iter);
+        gtk_text_buffer_insert(buffer, &start_iter, new_start, new_end - new_start);
+        gtk_text_buffer_end_user_action(buffer);
+
+        if (new_cursor >= 0) {
+            gtk_text_buffer_get_iter_at_offset(buffer, &start_iter, start + new_cursor);
+            gtk_text_buffer_place_cursor(buffer, &start_iter);
+        }
+    }
+
+    g_free(text);
+    g_string_free(new_text, TRUE);
 
-    return count;
+    return start + new_length;
 }
 
+/* Update the thousands separators of the numbers between offsets start and
+ * end, or to the end of the display if end is -1. Numbers that are only partly
+ * in the range are done in full. */
 static void
-reformat_separators(MathEquation *equation)
+reformat_separators(MathEquation *equation, gint start, gint end)
 {
-    gchar *text, *read_iter;
-    gint ans_start, ans_end;
-    gint offset, digit_offset = 0;
-    gboolean in_number = FALSE, in_radix = FALSE, last_is_tsep = FALSE;
+    GtkTextBuffer *buffer = GTK_TEXT_BUFFER(equation);
+    GtkTextIter iter;
+    gint ans_start, ans_end, number_start, number_end;
 
     equation->priv->in_undo_operation = TRUE;
     equation->priv->in_reformat = TRUE;
 
-    text = math_equation_get_display(equation);
+    if (end < 0)
+        end = gtk_text_buffer_get_char_count(buffer);
     get_ans_offsets(equation, &ans_start, &ans_end);
-    for (read_iter = text, offset = 0; *read_iter != '\0'; read_iter = g_utf8_next_char(read_iter), offset++) {
-        gunichar c;
-        gboolean expect_tsep;
-
-        /* See what digit this character is */
-        c = g_utf8_get_char(read_iter);
 
-        expect_tsep = math_equation_get_base(equation) == 10 &&
-                      mp_serializer_get_show_thousands_separators(equation->priv->serializer) &&
-                      in_number && !in_radix && !last_is_tsep &&
-                      digit_offset > 0 && digit_offset % mp_serializer_get_thousands_separator_count(equation->priv->serializer) == 0;
-        last_is_tsep = FALSE;
+    /* Go back to the start of the number the range starts in */
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, start);
+    while (gtk_text_iter_backward_char(&iter)) {
+        if (!is_number_char(equation, &iter, ans_start, ans_end)) {
+            gtk_text_iter_forward_char(&iter);
+            break;
+        }
+    }
 
-        /* Don't mess with ans */
-        if (offset >= ans_start && offset <= ans_end) {
-            in_number = in_radix = FALSE;
+    while (!gtk_text_iter_is_end(&iter) && gtk_text_iter_get_offset(&iter) <= end) {
+        if (!is_number_char(equation, &iter, ans_start, ans_end)) {
+            gtk_text_iter_forward_char(&iter);
             continue;
         }
-        if (g_unichar_isdigit(c)) {
-            if (!in_number)
-                digit_offset = count_digits(equation, read_iter);
-            in_number = TRUE;
 
-            /* Expected a thousands separator between these digits - insert it */
-            if (expect_tsep) {
-                GtkTextIter iter;
-                gchar buffer[7];
-                gint len;
-
-                gtk_text_buffer_get_iter_at_offset(GTK_TEXT_BUFFER(equation), &iter, offset);
-                len = g_unichar_to_utf8(mp_serializer_get_thousands_separator(equation->priv->serializer), buffer);
-                buffer[len] = '\0';
-                gtk_text_buffer_insert(GTK_TEXT_BUFFER(equation), &iter, buffer, -1);
-                offset++;
-                last_is_tsep = TRUE;
-            }
+        number_start = gtk_text_iter_get_offset(&iter);
+        while (!gtk_text_iter_is_end(&iter) && is_number_char(equation, &iter, ans_start, ans_end))
+            gtk_text_iter_forward_char(&iter);
+        number_end = gtk_text_iter_get_offset(&iter);
 
-            digit_offset--;
-        }
-        else if (c == mp_serializer_get_radix(equation->priv->serializer)) {
-            in_number = in_radix = TRUE;
-        }
-        else if (c == mp_serializer_get_thousands_separator(equation->priv->serializer)) {
-            /* Didn't expect thousands separator - delete it */
-            if (!expect_tsep && in_number) {
-                GtkTextIter start, end;
-                gtk_text_buffer_get_iter_at_offset(GTK_TEXT_BUFFER(equation), &start, offset);
-                gtk_text_buffer_get_iter_at_offset(GTK_TEXT_BUFFER(equation), &end, offset + 1);
-                gtk_text_buffer_delete(GTK_TEXT_BUFFER(equation), &start, &end);
-                offset--;
-            }
-            else
-                last_is_tsep = TRUE;
-        }
-        else {
-            in_number = in_radix = FALSE;
-        }
+        /* Following text moves when separators are added or removed */
+        number_end = reformat_number(equation, number_start, number_end);
+        end += number_end - gtk_text_iter_get_offset(&iter);
+        get_ans_offsets(equation, &ans_start, &ans_end);
+        gtk_text_buffer_get_iter_at_offset(buffer, &iter, number_end);
     }
 
-    g_free(text);
-
     equation->priv->in_reformat = FALSE;
     equation->priv->in_undo_operation = FALSE;
 }
@@ -280,7 +427,7 @@ reformat_display(MathEquation *equation)
     reformat_ans(equation);
 
     /* Add/remove thousands separators */
-    reformat_separators(equation);
+    reformat_separators(equation, 0, -1);
 
     g_signal_emit_by_name(equation, "display-changed");
 }
@@ -319,32 +466,226 @@ get_current_state(MathEquation *equation)
 static void
 free_state(MathEquationState *state)
 {
+    mp_clear(&state->ans);
     g_free(state->expression);
     g_free(state->status);
     g_free(state);
 }
 
+static UndoEntry *
+undo_entry_new(MathEquation *equation)
+{
+    UndoEntry *entry;
+
+    entry = g_slice_new0(UndoEntry);
+    entry->text = math_equation_get_display(equation);
+    entry->ans = g_slice_new(MPNumber);
+    *entry->ans = mp_new();
+    mp_set_from_mp(&equation->priv->state.ans, entry->ans);
+    get_ans_offsets(equation, &entry->ans_start, &entry->ans_end);
+    g_object_get(G_OBJECT(equation), "cursor-position", &entry->cursor, NULL);
+    entry->number_mode = equation->priv->number_mode;
+    entry->can_super_minus = equation->priv->can_super_minus;
+    entry->entered_multiply = equation->priv->state.entered_multiply;
+    entry->status = g_strdup(equation->priv->state.status);
+
+    return entry;
+}
+
 static void
-math_equation_push_undo_stack(MathEquation *equation)
+undo_entry_free(UndoEntry *entry)
 {
-    GList *link;
-    MathEquationState *state;
+    if (entry->ans) {
+        mp_clear(entry->ans);
+        g_slice_free(MPNumber, entry->ans);
+    }
+    g_free(entry->text);
+    g_free(entry->status);
+    g_slice_free(UndoEntry, entry);
+}
+
+/* Approximate memory used by an entry */
+static gsize
+undo_entry_get_size(UndoEntry *entry)
+{
+    gsize size = sizeof(UndoEntry) + strlen(entry->text) + strlen(entry->status) + 2;
+
+    if (entry->ans)
+        size += sizeof(MPNumber) + 2 * PRECISION / 8; /* Real and imaginary parts */
+
+    return size;
+}
+
+/* Replace the expression in entry with how it differs from next, the entry that will be above it */
+static void
+undo_entry_make_delta(UndoEntry *entry, UndoEntry *next)
+{
+    gsize length, next_length, prefix = 0, suffix = 0;
+    gchar *text;
+
+    length = strlen(entry->text);
+    next_length = strlen(next->text);
+    while (prefix < length && prefix < next_length && entry->text[prefix] == next->text[prefix])
+        prefix++;
+    while (suffix < length - prefix && suffix < next_length - prefix &&
+           entry->text[length - suffix - 1] == next->text[next_length - suffix - 1])
+        suffix++;
+
+    /* Don't split UTF-8 characters */
+    while (prefix > 0 && ((entry->text[prefix] & 0xC0) == 0x80 || (next->text[prefix] & 0xC0) == 0x80))
+        prefix--;
+    while (suffix > 0 && ((entry->text[length - suffix] & 0xC0) == 0x80 || (next->text[next_length - suffix] & 0xC0) == 0x80))
+        suffix--;
+
+    text = g_strndup(entry->text + prefix, length - prefix - suffix);
+    g_free(entry->text);
+    entry->text = text;
+    entry->delta_offset = prefix;
+    entry->delta_length = next_length - prefix - suffix;
+    entry->is_delta = TRUE;
+
+    if (mp_is_equal(entry->ans, next->ans)) {
+        mp_clear(entry->ans);
+        g_slice_free(MPNumber, entry->ans);
+        entry->ans = NULL;
+    }
+}
 
+/* Restore the whole expression of entry from previous, the entry that was above it */
+static void
+undo_entry_apply_delta(UndoEntry *entry, UndoEntry *previous)
+{
+    GString *text;
+
+    text = g_string_new_len(previous->text, entry->delta_offset);
+    g_string_append(text, entry->text);
+    g_string_append(text, previous->text + entry->delta_offset + entry->delta_length);
+    g_free(entry->text);
+    entry->text = g_string_free(text, FALSE);
+    entry->is_delta = FALSE;
+
+    if (!entry->ans) {
+        entry->ans = g_slice_new(MPNumber);
+        *entry->ans = mp_new();
+        mp_set_from_mp(previous->ans, entry->ans);
+    }
+}
+
+static void
+undo_stack_push(MathEquation *equation, GQueue *stack, UndoEntry *entry)
+{
+    UndoEntry *top = g_queue_peek_head(stack);
+
+    if (top) {
+        equation->priv->undo_size -= undo_entry_get_size(top);
+        undo_entry_make_delta(top, entry);
+        equation->priv->undo_size += undo_entry_get_size(top);
+    }
+    g_queue_push_head(stack, entry);
+    equation->priv->undo_size += undo_entry_get_size(entry);
+}
+
+static UndoEntry *
+undo_stack_pop(MathEquation *equation, GQueue *stack)
+{
+    UndoEntry *entry, *top;
+
+    entry = g_queue_pop_head(stack);
+    equation->priv->undo_size -= undo_entry_get_size(entry);
+    top = g_queue_peek_head(stack);
+    if (top) {
+        equation->priv->undo_size -= undo_entry_get_size(top);
+        undo_entry_apply_delta(top, entry);
+        equation->priv->undo_size += undo_entry_get_size(top);
+    }
+
+    return entry;
+}
+
+static void
+undo_stack_clear(MathEquation *equation, GQueue *stack)
+{
+    UndoEntry *entry;
+
+    while ((entry = g_queue_pop_head(stack)) != NULL) {
+        equation->priv->undo_size -= undo_entry_get_size(entry);
+        undo_entry_free(entry);
+    }
+}
+
+/* Drop the oldest undo entries until under the memory limit, always keeping the latest */
+static void
+undo_stack_trim(MathEquation *equation)
+{
+    while (equation->priv->undo_size > equation->priv->undo_limit && equation->priv->undo_stack.length > 1) {
+        UndoEntry *entry = g_queue_pop_tail(&equation->priv->undo_stack);
+        equation->priv->undo_size -= undo_entry_get_size(entry);
+        undo_entry_free(entry);
+    }
+}
+
+static void
+math_equation_push_undo_stack(MathEquation *equation)
+{
     if (equation->priv->in_undo_operation)
         return;
 
     math_equation_set_status(equation, "");
 
     /* Can't redo anymore */
-    for (link = equation->priv->redo_stack; link; link = link->next) {
-        state = link->data;
-        free_state(state);
+    undo_stack_clear(equation, &equation->priv->redo_stack);
+
+    undo_stack_push(equation, &equation->priv->undo_stack, undo_entry_new(equation));
+    undo_stack_trim(equation);
+}
+
+/* Returns TRUE if inserting text at location continues the word being typed,
+ * which is undone in one step rather than a character at a time */
+static gboolean
+continues_typing(MathEquation *equation, GtkTextIter *location, const gchar *text, gint len)
+{
+    GtkTextIter end;
+    gboolean continues = FALSE;
+
+    /* Only single letters and digits are grouped */
+    if (g_utf8_next_char(text) != text + len || !g_unichar_isalnum(g_utf8_get_char(text))) {
+        equation->priv->typing = FALSE;
+        return FALSE;
     }
-    g_list_free(equation->priv->redo_stack);
-    equation->priv->redo_stack = NULL;
 
-    state = get_current_state(equation);
-    equation->priv->undo_stack = g_list_prepend(equation->priv->undo_stack, state);
+    if (!equation->priv->typing_end)
+        equation->priv->typing_end = gtk_text_buffer_create_mark(GTK_TEXT_BUFFER(equation), NULL, location, FALSE);
+    else {
+        gtk_text_buffer_get_iter_at_mark(GTK_TEXT_BUFFER(equation), &end, equation->priv->typing_end);
+        continues = equation->priv->typing && gtk_text_iter_equal(&end, location) &&
+                    !g_queue_is_empty(&equation->priv->undo_stack);
+
+        /* The mark moves to after the inserted character */
+        gtk_text_buffer_move_mark(GTK_TEXT_BUFFER(equation), equation->priv->typing_end, location);
+    }
+    equation->priv->typing = TRUE;
+
+    return continues;
+}
+
+void
+math_equation_set_undo_limit(MathEquation *equation, gint limit)
+{
+    g_return_if_fail(equation != NULL);
+
+    if (equation->priv->undo_limit == (gsize) limit * 1024)
+        return;
+
+    equation->priv->undo_limit = (gsize) limit * 1024;
+    undo_stack_trim(equation);
+    g_object_notify(G_OBJECT(equation), "undo-limit");
+}
+
+gint
+math_equation_get_undo_limit(MathEquation *equation)
+{
+    g_return_val_if_fail(equation != NULL, 0);
+    return equation->priv->undo_limit / 1024;
 }
 
 static void
@@ -368,16 +709,17 @@ clear_ans(MathEquation *equation, gboolean remove_tag)
 }
 
 static void
-apply_state(MathEquation *equation, MathEquationState *state)
+apply_state(MathEquation *equation, UndoEntry *state)
 {
     GtkTextIter cursor;
 
     /* Disable undo detection */
     equation->priv->in_undo_operation = TRUE;
 
-    mp_set_from_mp(&state->ans, &equation->priv->state.ans);
+    mp_set_from_mp(state->ans, &equation->priv->state.ans);
+    equation->priv->ans_version++;
 
-    gtk_text_buffer_set_text(GTK_TEXT_BUFFER(equation), state->expression, -1);
+    gtk_text_buffer_set_text(GTK_TEXT_BUFFER(equation), state->text, -1);
     gtk_text_buffer_get_iter_at_offset(GTK_TEXT_BUFFER(equation), &cursor, state->cursor);
     gtk_text_buffer_place_cursor(GTK_TEXT_BUFFER(equation), &cursor);
     clear_ans(equation, FALSE);
@@ -433,53 +775,46 @@ math_equation_paste(MathEquation *equation)
 void
 math_equation_undo(MathEquation *equation)
 {
-    GList *link;
-    MathEquationState *state;
+    UndoEntry *state;
 
     g_return_if_fail(equation != NULL);
 
-    if (!equation->priv->undo_stack) {
+    if (g_queue_is_empty(&equation->priv->undo_stack)) {
         math_equation_set_status(equation,
                                  /* Error shown when trying to undo with no undo history */
                                  _("No undo history"));
         return;
     }
 
-    link = equation->priv->undo_stack;
-    equation->priv->undo_stack = g_list_remove_link(equation->priv->undo_stack, link);
-    state = link->data;
-    g_list_free(link);
-
-    equation->priv->redo_stack = g_list_prepend(equation->priv->redo_stack, get_current_state(equation));
+    equation->priv->typing = FALSE;
+    state = undo_stack_pop(equation, &equation->priv->undo_stack);
+    undo_stack_push(equation, &equation->priv->redo_stack, undo_entry_new(equation));
 
     apply_state(equation, state);
-    free_state(state);
+    undo_entry_free(state);
 }
 
 void
 math_equation_redo(MathEquation *equation)
 {
-    GList *link;
-    MathEquationState *state;
+    UndoEntry *state;
 
     g_return_if_fail(equation != NULL);
 
-    if (!equation->priv->redo_stack) {
+    if (g_queue_is_empty(&equation->priv->redo_stack)) {
         math_equation_set_status(equation,
                                  /* Error shown when trying to redo with no redo history */
                                  _("No redo history"));
         return;
     }
 
-    link = equation->priv->redo_stack;
-    equation->priv->redo_stack = g_list_remove_link(equation->priv->redo_stack, link);
-    state = link->data;
-    g_list_free(link);
-
-    equation->priv->undo_stack = g_list_prepend(equation->priv->undo_stack, get_current_state(equation));
+    equation->priv->typing = FALSE;
+    state = undo_stack_pop(equation, &equation->priv->redo_stack);
+    undo_stack_push(equation, &equation->priv->undo_stack, undo_entry_new(equation));
+    undo_stack_trim(equation);
 
     apply_state(equation, state);
-    free_state(state);
+    undo_entry_free(state);
 }
 
 gunichar
@@ -721,6 +1056,7 @@ math_equation_set_status(MathEquation *equation, const gchar *status)
     g_return_if_fail(equation != NULL);
     g_return_if_fail(status != NULL);
 
+    equation->priv->showing_preview = FALSE;
     if (strcmp(equation->priv->state.status, status) == 0)
         return;
 
@@ -736,6 +1072,28 @@ math_equation_get_status(MathEquation *equation)
     return equation->priv->state.status;
 }
 
+const gchar *
+math_equation_get_statistics(MathEquation *equation)
+{
+    g_return_val_if_fail(equation != NULL, NULL);
+    return equation->priv->statistics;
+}
+
+/* Show what the last calculation did, if statistics are turned on */
+static void
+update_statistics(MathEquation *equation)
+{
+    MPStatistics stats;
+
+    if (!mp_stats_get_enabled())
+        return;
+
+    mp_stats_get(&stats);
+    g_free(equation->priv->statistics);
+    equation->priv->statistics = mp_stats_to_string(&stats);
+    g_object_notify(G_OBJECT(equation), "statistics");
+}
+
 gboolean
 math_equation_is_empty(MathEquation *equation)
 {
@@ -952,6 +1310,7 @@ math_equation_set_number(MathEquation *equation, const MPNumber *x)
     text = mp_serializer_to_string(equation->priv->serializer, x);
     gtk_text_buffer_set_text(GTK_TEXT_BUFFER(equation), text, -1);
     mp_set_from_mp(x, &equation->priv->state.ans);
+    equation->priv->ans_version++;
 
     /* Mark this text as the answer variable */
     gtk_text_buffer_get_bounds(GTK_TEXT_BUFFER(equation), &start, &end);
@@ -1082,7 +1441,7 @@ variable_is_defined(const char *name, void *data)
     }
     g_free(lower_name);
 
-    return math_variables_get(equation->priv->variables, name) != NULL;
+    return math_variables_get(equation->priv->variables, name, NULL);
 }
 
 static int
@@ -1091,7 +1450,6 @@ get_variable(const char *name, MPNumber *z, void *data)
     char *c, *lower_name;
     int result = 1;
     MathEquation *equation = data;
-    MPNumber *t;
 
     lower_name = strdup(name);
     for (c = lower_name; *c; c++)
@@ -1101,18 +1459,29 @@ get_variable(const char *name, MPNumber *z, void *data)
         mp_set_from_random(z);
     else if (strcmp(lower_name, "ans") == 0)
         mp_set_from_mp(&equation->priv->state.ans, z);
-    else {
-        t = math_variables_get(equation->priv->variables, name);
-        if (t)
-            mp_set_from_mp(t, z);
-        else
-            result = 0;
-    }
+    else if (!math_variables_get(equation->priv->variables, name, z))
+        result = 0;
     free(lower_name);
 
     return result;
 }
 
+static int
+variable_is_volatile(const char *name, void *data)
+{
+    return g_ascii_strcasecmp(name, "rand") == 0;
+}
+
+static guint64
+get_variable_version(const char *name, void *data)
+{
+    MathEquation *equation = data;
+
+    if (g_ascii_strcasecmp(name, "ans") == 0)
+        return equation->priv->ans_version;
+    return math_variables_get_version(equation->priv->variables, name);
+}
+
 static void
 set_variable(const char *name, const MPNumber *x, void *data)
 {
@@ -1127,44 +1496,63 @@ convert(const MPNumber *x, const char *x_units, const char *z_units, MPNumber *z
     return unit_manager_convert_by_symbol(unit_manager_get_default(), x, x_units, z_units, z);
 }
 
+static void
+init_options(MathEquation *equation, MPEquationOptions *options, MPEvalContext *context)
+{
+    memset(options, 0, sizeof(*options));
+    options->base = mp_serializer_get_base(equation->priv->serializer);
+    options->wordlen = equation->priv->word_size;
+    options->angle_units = equation->priv->angle_units;
+    options->accuracy = mp_serializer_get_trailing_digits(equation->priv->serializer);
+    options->variable_is_defined = variable_is_defined;
+    options->get_variable = get_variable;
+    options->variable_is_volatile = variable_is_volatile;
+    options->get_variable_version = get_variable_version;
+    options->set_variable = set_variable;
+    options->convert = convert;
+    options->callback_data = equation;
+    options->context = context;
+}
+
+/* ans changes with every calculation, so variables assigned from it aren't recalculated */
+static int
+dependency_variable_is_volatile(const char *name, void *data)
+{
+    return variable_is_volatile(name, data) || g_ascii_strcasecmp(name, "ans") == 0;
+}
+
 static int
-parse(MathEquation *equation, const char *text, MPNumber *z, char **error_token)
+parse(MathEquation *equation, const char *text, MPEvalContext *context, MPNumber *z, char **error_token)
 {
     MPEquationOptions options;
 
-    memset(&options, 0, sizeof(options));
-    options.base = mp_serializer_get_base(equation->priv->serializer);
-    options.wordlen = equation->priv->word_size;
-    options.angle_units = equation->priv->angle_units;
-    options.variable_is_defined = variable_is_defined;
-    options.get_variable = get_variable;
-    options.set_variable = set_variable;
-    options.convert = convert;
-    options.callback_data = equation;
+    if (!text || strlen(text) == 0)
+        return PARSER_ERR_INVALID;
 
-    return mp_equation_parse(text, &options, z, error_token);
+    init_options(equation, &options, context);
+    if (g_atomic_int_get(&equation->priv->track_dependencies)) {
+        options.variable_is_volatile = dependency_variable_is_volatile;
+        return mp_dependencies_parse(equation->priv->dependencies, text, &options, z, error_token);
+    }
+    if (equation->priv->compiled)
+        mp_compiled_equation_update(equation->priv->compiled, text);
+    else
+        equation->priv->compiled = mp_equation_compile(text, &options);
+
+    return mp_result_cache_evaluate(equation->priv->result_cache, equation->priv->compiled, &options, z, error_token);
 }
 
-/*
- * Executed in separate thread. It is thus not a good idea to write to anything
- * in MathEquation but the async queue from here.
- */
-static gpointer
-math_equation_solve_real(gpointer data)
+/* Automatically add missing closing brackets */
+static gchar *
+complete_brackets(const gchar *text)
 {
-    MathEquation *equation = MATH_EQUATION(data);
-    SolveData *solvedata = g_slice_new0(SolveData);
-
-    gint n_brackets = 0, result;
-    gchar *c, *text, *error_token;
     GString *equation_text;
-    MPNumber z = mp_new();
+    const gchar *c;
+    gint n_brackets = 0;
 
-    text = math_equation_get_equation(equation);
     equation_text = g_string_new(text);
-    g_free(text);
-    /* Count the number of brackets and automatically add missing closing brackets */
-    for (c = equation_text->str; *c; c++) {
+    /* Count the number of brackets */
+    for (c = text; *c; c++) {
         if (*c == '(')
             n_brackets++;
         else if (*c == ')')
@@ -1175,56 +1563,252 @@ math_equation_solve_real(gpointer data)
         n_brackets--;
     }
 
-    result = parse(equation, equation_text->str, &z, &error_token);
-    g_string_free(equation_text, TRUE);
+    return g_string_free(equation_text, FALSE);
+}
 
-    switch (result) {
-        case PARSER_ERR_NONE:
-            solvedata->number_result = g_slice_new(MPNumber);
-            *solvedata->number_result = mp_new();
-            mp_set_from_mp(&z, solvedata->number_result);
-            break;
+/* Show result of math_equation_preview_real() unless it is out of date */
+static gboolean
+math_equation_show_preview(gpointer data)
+{
+    PreviewData *result = data;
+    MathEquation *equation = result->equation;
 
+    /* Equation has been edited or solved in the meantime */
+    if (result->generation == equation->priv->preview_generation &&
+        equation->priv->live_preview && !equation->priv->in_solve) {
+        gchar *text, *status;
+
+        text = mp_serializer_to_string(equation->priv->serializer, result->number_result);
+        status = g_strdup_printf("= %s", text);
+        math_equation_set_status(equation, status);
+        equation->priv->showing_preview = TRUE;
+        g_free(status);
+        g_free(text);
+    }
+
+    mp_clear(result->number_result);
+    g_slice_free(MPNumber, result->number_result);
+    g_slice_free(PreviewData, result);
+
+    return false;
+}
+
+/*
+ * Executed in the preview thread. Like math_equation_solve_real() it doesn't
+ * write to MathEquation, the result is shown from an idle callback.
+ */
+static void
+math_equation_preview_real(gpointer data, gpointer user_data)
+{
+    PreviewJob *job = data;
+    MathEquation *equation = MATH_EQUATION(user_data);
+    MPEquationOptions options;
+    MPEvalContext context;
+    MPNumber z;
+
+    /* Previews run while solves are measured, they aren't part of the last calculation */
+    mp_stats_ignore_thread(TRUE);
+    z = mp_new();
+
+    /* Jobs queued behind a slow preview are usually stale already */
+    if (!g_cancellable_is_cancelled(job->cancellable)) {
+        mp_eval_context_init(&context, job->cancellable, PREVIEW_BUDGET, 0);
+        init_options(equation, &options, &context);
+        /* Assignments are only made when solving */
+        options.set_variable = NULL;
+
+        if (equation->priv->preview_compiled)
+            mp_compiled_equation_update(equation->priv->preview_compiled, job->text);
+        else
+            equation->priv->preview_compiled = mp_equation_compile(job->text, &options);
+
+        if (mp_result_cache_evaluate(equation->priv->result_cache, equation->priv->preview_compiled, &options, &z, NULL) == PARSER_ERR_NONE) {
+            PreviewData *result = g_slice_new0(PreviewData);
+
+            result->equation = equation;
+            result->generation = job->generation;
+            result->number_result = g_slice_new(MPNumber);
+            *result->number_result = mp_new();
+            mp_set_from_mp(&z, result->number_result);
+            g_idle_add(math_equation_show_preview, result);
+        }
+        mp_eval_context_clear(&context);
+    }
+
+    mp_clear(&z);
+    g_object_unref(job->cancellable);
+    g_free(job->text);
+    g_slice_free(PreviewJob, job);
+}
+
+static gboolean
+math_equation_start_preview(gpointer data)
+{
+    MathEquation *equation = MATH_EQUATION(data);
+    PreviewJob *job;
+    gchar *text;
+
+    equation->priv->preview_timeout = 0;
+
+    if (equation->priv->in_solve || math_equation_is_empty(equation) || math_equation_is_result(equation))
+        return false;
+
+    /* One thread, so a slow preview can't pile up work on the other cores */
+    if (!equation->priv->preview_pool)
+        equation->priv->preview_pool = g_thread_pool_new(math_equation_preview_real, equation, 1, FALSE, NULL);
+
+    text = math_equation_get_equation(equation);
+    job = g_slice_new(PreviewJob);
+    job->generation = equation->priv->preview_generation;
+    job->text = complete_brackets(text);
+    equation->priv->preview_cancellable = g_cancellable_new();
+    job->cancellable = g_object_ref(equation->priv->preview_cancellable);
+    g_free(text);
+    g_thread_pool_push(equation->priv->preview_pool, job, NULL);
+
+    return false;
+}
+
+/* Drop the current preview and start a new one once the user pauses typing */
+static void
+schedule_preview(MathEquation *equation)
+{
+    equation->priv->preview_generation++;
+    if (equation->priv->preview_cancellable) {
+        g_cancellable_cancel(equation->priv->preview_cancellable);
+        g_clear_object(&equation->priv->preview_cancellable);
+    }
+    if (equation->priv->showing_preview)
+        math_equation_set_status(equation, "");
+
+    if (equation->priv->preview_timeout)
+        g_source_remove(equation->priv->preview_timeout);
+    equation->priv->preview_timeout = 0;
+    if (equation->priv->live_preview)
+        equation->priv->preview_timeout = g_timeout_add(PREVIEW_DELAY, math_equation_start_preview, equation);
+}
+
+void
+math_equation_set_live_preview(MathEquation *equation, gboolean enabled)
+{
+    g_return_if_fail(equation != NULL);
+
+    if (equation->priv->live_preview == enabled)
+        return;
+
+    equation->priv->live_preview = enabled;
+    schedule_preview(equation);
+    g_object_notify(G_OBJECT(equation), "live-preview");
+}
+
+gboolean
+math_equation_get_live_preview(MathEquation *equation)
+{
+    g_return_val_if_fail(equation != NULL, FALSE);
+    return equation->priv->live_preview;
+}
+
+void
+math_equation_set_track_dependencies(MathEquation *equation, gboolean enabled)
+{
+    g_return_if_fail(equation != NULL);
+
+    if (g_atomic_int_get(&equation->priv->track_dependencies) == enabled)
+        return;
+
+    /* Variables keep their values, but stop following the variables they were assigned from */
+    g_atomic_int_set(&equation->priv->track_dependencies, enabled);
+    if (!enabled)
+        mp_dependencies_clear(equation->priv->dependencies);
+    g_object_notify(G_OBJECT(equation), "track-dependencies");
+}
+
+gboolean
+math_equation_get_track_dependencies(MathEquation *equation)
+{
+    g_return_val_if_fail(equation != NULL, FALSE);
+    return g_atomic_int_get(&equation->priv->track_dependencies);
+}
+
+/* Returns the error shown for result, a parser error code */
+static gchar *
+get_error_message(gint result, const gchar *error_token)
+{
+    gchar *error;
+
+    switch (result) {
         case PARSER_ERR_OVERFLOW:
-            solvedata->error = g_strdup(/* Error displayed to user when they perform a bitwise operation on numbers greater than the current word */
-                               _("Overflow. Try a bigger word size"));
+            error = g_strdup(/* Error displayed to user when they perform a bitwise operation on numbers greater than the current word */
+                    _("Overflow. Try a bigger word size"));
             break;
 
         case PARSER_ERR_UNKNOWN_VARIABLE:
-            solvedata->error = g_strdup_printf(/* Error displayed to user when they an unknown variable is entered */
-                                      _("Unknown variable '%s'"), error_token);
+            error = g_strdup_printf(/* Error displayed to user when they an unknown variable is entered */
+                           _("Unknown variable '%s'"), error_token);
             break;
 
         case PARSER_ERR_UNKNOWN_FUNCTION:
-            solvedata->error = g_strdup_printf(/* Error displayed to user when an unknown function is entered */
-                                      _("Function '%s' is not defined"), error_token);
+            error = g_strdup_printf(/* Error displayed to user when an unknown function is entered */
+                           _("Function '%s' is not defined"), error_token);
             break;
 
         case PARSER_ERR_UNKNOWN_CONVERSION:
-            solvedata->error = g_strdup(/* Error displayed to user when an conversion with unknown units is attempted */
-                               _("Unknown conversion"));
+            error = g_strdup(/* Error displayed to user when an conversion with unknown units is attempted */
+                    _("Unknown conversion"));
+            break;
+
+        case PARSER_ERR_CANCELLED:
+            error = g_strdup(/* Error displayed to user when a calculation is stopped before it completes */
+                    _("Calculation cancelled"));
             break;
 
         case PARSER_ERR_MP:
             if (mp_get_error())
-                solvedata->error = g_strdup(mp_get_error());
+                error = g_strdup(mp_get_error());
             else if (error_token)
-                solvedata->error = g_strdup_printf(/* Uncategorized error. Show error token to user*/
-                                    _("Malformed expression at token '%s'"), error_token);
+                error = g_strdup_printf(/* Uncategorized error. Show error token to user*/
+                         _("Malformed expression at token '%s'"), error_token);
             else
-                solvedata->error = g_strdup (/* Unknown error. */
-                                    _("Malformed expression"));
+                error = g_strdup (/* Unknown error. */
+                         _("Malformed expression"));
             break;
 
         default:
-            solvedata->error = g_strdup(/* Error displayed to user when they enter an invalid calculation */
-                               _("Malformed expression"));
+            error = g_strdup(/* Error displayed to user when they enter an invalid calculation */
+                    _("Malformed expression"));
             break;
     }
-    g_async_queue_push(equation->priv->queue, solvedata);
-    mp_clear(&z);
 
-    return NULL;
+    return error;
+}
+
+/*
+ * Executed in the solve thread. It is thus not a good idea to write to anything
+ * in MathEquation from here, the result is returned in solvedata.
+ */
+static void
+math_equation_solve_real(MathEquation *equation, SolveJob *job, SolveData *solvedata)
+{
+    gint result;
+    gchar *equation_text, *error_token;
+    MPEvalContext context;
+    MPNumber z = mp_new();
+
+    mp_eval_context_init(&context, job->cancellable, 0, 0);
+    equation_text = complete_brackets(job->text);
+
+    result = parse(equation, equation_text, &context, &z, &error_token);
+    g_free(equation_text);
+    mp_eval_context_clear(&context);
+
+    if (result == PARSER_ERR_NONE) {
+        solvedata->number_result = g_slice_new(MPNumber);
+        *solvedata->number_result = mp_new();
+        mp_set_from_mp(&z, solvedata->number_result);
+    }
+    else
+        solvedata->error = get_error_message(result, error_token);
+    mp_clear(&z);
 }
 
 static gboolean
@@ -1236,14 +1820,12 @@ math_equation_show_in_progress(gpointer data)
     return false;
 }
 
+/* Executed in the main thread as soon as the solve thread has finished */
 static gboolean
-math_equation_look_for_answer(gpointer data)
+math_equation_show_answer(gpointer data)
 {
-    MathEquation *equation = MATH_EQUATION(data);
-    SolveData *result = g_async_queue_try_pop(equation->priv->queue);
-
-    if (result == NULL)
-        return true;
+    SolveData *result = data;
+    MathEquation *equation = result->equation;
 
     equation->priv->in_solve = false;
 
@@ -1263,52 +1845,26 @@ math_equation_look_for_answer(gpointer data)
         math_equation_set_with_history(equation, result->text_result);
         g_free(result->text_result);
     }
+    update_statistics(equation);
+    g_object_unref(equation);
     g_slice_free(SolveData, result);
 
-    return false;
-}
-
-void
-math_equation_solve(MathEquation *equation)
-{
-    g_return_if_fail(equation != NULL);
-
-    // FIXME: should replace calculation or give error message
-    if (equation->priv->in_solve)
-        return;
-
-    if (math_equation_is_empty(equation))
-        return;
-
-    /* If showing a result return to the equation that caused it */
-    // FIXME: Result may not be here due to solve (i.e. the user may have entered "ans")
-    if (math_equation_is_result(equation)) {
-        math_equation_undo(equation);
-        return;
-    }
-
-    equation->priv->in_solve = true;
-
-    math_equation_set_number_mode(equation, NORMAL);
-    g_thread_new("", math_equation_solve_real, equation);
-
-    g_timeout_add(50, math_equation_look_for_answer, equation);
-    g_timeout_add(100, math_equation_show_in_progress, equation);
+    return G_SOURCE_REMOVE;
 }
 
-static gpointer
-math_equation_factorize_real(gpointer data)
+/* Executed in the solve thread. */
+static void
+math_equation_factorize_real(MathEquation *equation, SolveJob *job, SolveData *result)
 {
     GString *text;
     GList *factors, *factor, *next_factor;
-    MPNumber x = mp_new();
-    MathEquation *equation = MATH_EQUATION(data);
-    SolveData *result = g_slice_new0(SolveData);
+    MPEvalContext context;
     MpDisplayFormat format = mp_serializer_get_number_format(equation->priv->serializer);
 
     mp_serializer_set_number_format(equation->priv->serializer, MP_DISPLAY_FORMAT_FIXED);
-    math_equation_get_number(equation, &x);
-    factors = mp_factorize(&x);
+    mp_eval_context_init(&context, job->cancellable, 0, 0);
+    mp_set_eval_context(&context);
+    factors = mp_factorize(&job->x);
 
     text = g_string_new("");
 
@@ -1320,9 +1876,11 @@ math_equation_factorize_real(gpointer data)
 
         n = factor->data;
         next_factor = factor->next;
-        if (next_factor != NULL && mp_compare(n, next_factor->data) == 0)
+        if (context.cancelled || (next_factor != NULL && mp_compare(n, next_factor->data) == 0))
         {
             e++;
+            mp_clear(n);
+            g_slice_free(MPNumber, n);
             continue;
         }
         temp = mp_serializer_to_string(equation->priv->serializer, n);
@@ -1344,20 +1902,261 @@ math_equation_factorize_real(gpointer data)
     }
     g_list_free(factors);
 
-    result->text_result = g_strndup(text->str, text->len);
-    g_async_queue_push(equation->priv->queue, result);
+    if (context.cancelled)
+        result->error = g_strdup(_("Calculation cancelled"));
+    else
+        result->text_result = g_strndup(text->str, text->len);
+    mp_set_eval_context(NULL);
+    mp_eval_context_clear(&context);
     g_string_free(text, TRUE);
-    mp_clear(&x);
 
     mp_serializer_set_number_format(equation->priv->serializer, format);
+}
+
+/* Executed in the solve thread. */
+static void
+math_equation_update_real(MathEquation *equation, SolveJob *job, SolveData *result)
+{
+    MPEquationOptions options;
+    MPEvalContext context;
+    gchar *error_token = NULL;
+    gint error;
+
+    /* Tracking may have been turned off while the job was queued */
+    if (!g_atomic_int_get(&equation->priv->track_dependencies))
+        return;
+
+    mp_eval_context_init(&context, job->cancellable, 0, 0);
+    init_options(equation, &options, &context);
+    options.variable_is_volatile = dependency_variable_is_volatile;
+    error = mp_dependencies_update(equation->priv->dependencies, job->text, &options, &error_token);
+    if (error != PARSER_ERR_NONE)
+        result->error = get_error_message(error, error_token);
+    g_free(error_token);
+    mp_eval_context_clear(&context);
+}
+
+/* Executed in the solve thread. */
+static void
+math_equation_solve_job(gpointer data, gpointer user_data)
+{
+    SolveJob *job = data;
+    SolveData *result = g_slice_new0(SolveData);
+
+    /* Counts start again for every calculation, the answer is serialized in the main thread */
+    if (mp_stats_get_enabled())
+        mp_stats_reset();
+
+    result->equation = job->equation;
+    if (job->type == SOLVE_JOB_SOLVE)
+        math_equation_solve_real(job->equation, job, result);
+    else if (job->type == SOLVE_JOB_FACTORIZE)
+        math_equation_factorize_real(job->equation, job, result);
+    else
+        math_equation_update_real(job->equation, job, result);
+
+    /* Hand the result over to the main loop without waiting for it to poll */
+    g_main_context_invoke(NULL, math_equation_show_answer, result);
+
+    g_free(job->text);
+    if (job->type == SOLVE_JOB_FACTORIZE)
+        mp_clear(&job->x);
+    g_object_unref(job->cancellable);
+    g_slice_free(SolveJob, job);
+}
+
+static void
+math_equation_push_job(MathEquation *equation, SolveJob *job)
+{
+    job->equation = g_object_ref(equation);
+    job->cancellable = g_object_ref(equation->priv->solve_cancellable);
+
+    /* The thread is started on the first solve and kept for the next ones */
+    if (!equation->priv->solve_pool)
+        equation->priv->solve_pool = g_thread_pool_new(math_equation_solve_job, NULL, 1, TRUE, NULL);
+    g_thread_pool_push(equation->priv->solve_pool, job, NULL);
+
+    g_timeout_add(100, math_equation_show_in_progress, equation);
+}
+
+void
+math_equation_variable_changed(MathEquation *equation, const gchar *name)
+{
+    SolveJob *job;
+
+    g_return_if_fail(equation != NULL);
+    g_return_if_fail(name != NULL);
+
+    if (!g_atomic_int_get(&equation->priv->track_dependencies))
+        return;
+
+    /* Queued behind a running solve, and cancelled with it */
+    if (!equation->priv->in_solve) {
+        equation->priv->in_solve = true;
+        g_clear_object(&equation->priv->solve_cancellable);
+        equation->priv->solve_cancellable = g_cancellable_new();
+    }
+
+    job = g_slice_new0(SolveJob);
+    job->type = SOLVE_JOB_UPDATE;
+    job->text = g_strdup(name);
+    math_equation_push_job(equation, job);
+}
+
+gboolean
+math_equation_start_recording(MathEquation *equation, const gchar *filename)
+{
+    FILE *file;
+
+    g_return_val_if_fail(equation != NULL, FALSE);
+    g_return_val_if_fail(filename != NULL, FALSE);
+
+    file = fopen(filename, "a");
+    if (!file)
+        return FALSE;
+
+    if (equation->priv->record_file)
+        fclose(equation->priv->record_file);
+    equation->priv->record_file = file;
+    if (!equation->priv->recorded_variables)
+        equation->priv->recorded_variables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    /* Each session starts with everything it depends on */
+    g_clear_pointer(&equation->priv->recorded_options, g_free);
+    g_hash_table_remove_all(equation->priv->recorded_variables);
+    fprintf(file, "# mate-calc session\n");
+    fflush(file);
+
+    return TRUE;
+}
+
+/* Write name=value to the log if it has changed since it was last written */
+static void
+record_variable(MathEquation *equation, const gchar *name, const MPNumber *value)
+{
+    gchar *text;
+
+    text = mp_to_exact_string(value);
+    if (g_strcmp0(g_hash_table_lookup(equation->priv->recorded_variables, name), text) == 0) {
+        g_free(text);
+        return;
+    }
+    fprintf(equation->priv->record_file, "set %s=%s\n", name, text);
+    g_hash_table_insert(equation->priv->recorded_variables, g_strdup(name), text);
+}
+
+static gboolean
+variable_was_deleted(gpointer key, gpointer value, gpointer data)
+{
+    MathEquation *equation = data;
+    const gchar *name = key;
+
+    if (strcmp(name, "ans") == 0 || math_variables_get(equation->priv->variables, name, NULL))
+        return FALSE;
+
+    fprintf(equation->priv->record_file, "unset %s\n", name);
+    return TRUE;
+}
+
+/* Append a request to the session log, preceded by the options and variables
+ * that changed since the last one. Values are written exactly with
+ * mp_to_exact_string(). The log is line based:
+ *
+ *   options base=10 wordlen=32 accuracy=9 angle=degrees
+ *   set x=0x1.8p+0
+ *   unset y
+ *   solve 2x+ans
+ *   factorize 0x1.68p+8
+ */
+static void
+record_request(MathEquation *equation, const gchar *command, const gchar *argument)
+{
+    static const char *angle_names[] = { "radians", "degrees", "gradians" };
+    gchar *options, **names;
+    MPNumber value;
+    int i;
+
+    if (!equation->priv->record_file)
+        return;
+
+    options = g_strdup_printf("base=%d wordlen=%d accuracy=%d angle=%s",
+                              mp_serializer_get_base(equation->priv->serializer),
+                              equation->priv->word_size,
+                              mp_serializer_get_trailing_digits(equation->priv->serializer),
+                              angle_names[equation->priv->angle_units]);
+    if (g_strcmp0(options, equation->priv->recorded_options) != 0) {
+        fprintf(equation->priv->record_file, "options %s\n", options);
+        g_free(equation->priv->recorded_options);
+        equation->priv->recorded_options = options;
+    }
+    else
+        g_free(options);
+
+    g_hash_table_foreach_remove(equation->priv->recorded_variables, variable_was_deleted, equation);
+    names = math_variables_get_names(equation->priv->variables);
+    value = mp_new();
+    for (i = 0; names[i] != NULL; i++) {
+        if (math_variables_get(equation->priv->variables, names[i], &value))
+            record_variable(equation, names[i], &value);
+    }
+    g_strfreev(names);
+    mp_clear(&value);
+    record_variable(equation, "ans", &equation->priv->state.ans);
+
+    fprintf(equation->priv->record_file, "%s %s\n", command, argument);
+    fflush(equation->priv->record_file);
+}
+
+void
+math_equation_solve(MathEquation *equation)
+{
+    SolveJob *job;
+
+    g_return_if_fail(equation != NULL);
+
+    // FIXME: should replace calculation or give error message
+    if (equation->priv->in_solve)
+        return;
 
-    return NULL;
+    if (math_equation_is_empty(equation))
+        return;
+
+    /* If showing a result return to the equation that caused it */
+    // FIXME: Result may not be here due to solve (i.e. the user may have entered "ans")
+    if (math_equation_is_result(equation)) {
+        math_equation_undo(equation);
+        return;
+    }
+
+    equation->priv->in_solve = true;
+    g_clear_object(&equation->priv->solve_cancellable);
+    equation->priv->solve_cancellable = g_cancellable_new();
+    /* Abandon preview, the result is on its way */
+    schedule_preview(equation);
+
+    math_equation_set_number_mode(equation, NORMAL);
+
+    job = g_slice_new0(SolveJob);
+    job->type = SOLVE_JOB_SOLVE;
+    job->text = math_equation_get_equation(equation);
+    record_request(equation, "solve", job->text);
+    math_equation_push_job(equation, job);
+}
+
+void
+math_equation_cancel(MathEquation *equation)
+{
+    g_return_if_fail(equation != NULL);
+
+    if (equation->priv->in_solve)
+        g_cancellable_cancel(equation->priv->solve_cancellable);
 }
 
 void
 math_equation_factorize(MathEquation *equation)
 {
     MPNumber x = mp_new();
+    SolveJob *job;
 
     g_return_if_fail(equation != NULL);
 
@@ -1371,13 +2170,19 @@ math_equation_factorize(MathEquation *equation)
         mp_clear(&x);
         return;
     }
-    mp_clear(&x);
     equation->priv->in_solve = true;
-
-    g_thread_new("", math_equation_factorize_real, equation);
-
-    g_timeout_add(50, math_equation_look_for_answer, equation);
-    g_timeout_add(100, math_equation_show_in_progress, equation);
+    g_clear_object(&equation->priv->solve_cancellable);
+    equation->priv->solve_cancellable = g_cancellable_new();
+
+    job = g_slice_new0(SolveJob);
+    job->type = SOLVE_JOB_FACTORIZE;
+    job->x = x;
+    if (equation->priv->record_file) {
+        gchar *text = mp_to_exact_string(&x);
+        record_request(equation, "factorize", text);
+        g_free(text);
+    }
+    math_equation_push_job(equation, job);
 }
 
 void
@@ -1511,6 +2316,15 @@ math_equation_set_property(GObject      *object,
     case PROP_SHOW_TRAILING_ZEROES:
         math_equation_set_show_trailing_zeroes(self, g_value_get_boolean(value));
         break;
+    case PROP_LIVE_PREVIEW:
+        math_equation_set_live_preview(self, g_value_get_boolean(value));
+        break;
+    case PROP_TRACK_DEPENDENCIES:
+        math_equation_set_track_dependencies(self, g_value_get_boolean(value));
+        break;
+    case PROP_UNDO_LIMIT:
+        math_equation_set_undo_limit(self, g_value_get_int(value));
+        break;
     case PROP_NUMBER_FORMAT:
         math_equation_set_number_format(self, g_value_get_int(value));
         break;
@@ -1578,6 +2392,15 @@ math_equation_get_property(GObject    *object,
     case PROP_SHOW_TRAILING_ZEROES:
         g_value_set_boolean(value, mp_serializer_get_show_trailing_zeroes(self->priv->serializer));
         break;
+    case PROP_LIVE_PREVIEW:
+        g_value_set_boolean(value, self->priv->live_preview);
+        break;
+    case PROP_TRACK_DEPENDENCIES:
+        g_value_set_boolean(value, g_atomic_int_get(&self->priv->track_dependencies));
+        break;
+    case PROP_UNDO_LIMIT:
+        g_value_set_int(value, math_equation_get_undo_limit(self));
+        break;
     case PROP_NUMBER_FORMAT:
         g_value_set_enum(value, mp_serializer_get_number_format(self->priv->serializer));
         break;
@@ -1605,6 +2428,9 @@ math_equation_get_property(GObject    *object,
     case PROP_SERIALIZER:
         g_value_set_object(value, self->priv->serializer);
         break;
+    case PROP_STATISTICS:
+        g_value_set_string(value, self->priv->statistics);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
         break;
@@ -1699,6 +2525,27 @@ math_equation_class_init(MathEquationClass *klass)
                                                          "Show trailing zeroes",
                                                          FALSE,
                                                          G_PARAM_READWRITE));
+    g_object_class_install_property(object_class,
+                                    PROP_LIVE_PREVIEW,
+                                    g_param_spec_boolean("live-preview",
+                                                         "live-preview",
+                                                         "Show result while editing",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE));
+    g_object_class_install_property(object_class,
+                                    PROP_TRACK_DEPENDENCIES,
+                                    g_param_spec_boolean("track-dependencies",
+                                                         "track-dependencies",
+                                                         "Recalculate variables when the variables they were assigned from change",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE));
+    g_object_class_install_property(object_class,
+                                    PROP_UNDO_LIMIT,
+                                    g_param_spec_int("undo-limit",
+                                                     "undo-limit",
+                                                     "Memory kept for undo in kilobytes",
+                                                     16, G_MAXINT / 1024, DEFAULT_UNDO_LIMIT / 1024,
+                                                     G_PARAM_READWRITE));
     g_object_class_install_property(object_class,
                                     PROP_NUMBER_FORMAT,
                                     g_param_spec_enum("number-format",
@@ -1764,6 +2611,13 @@ math_equation_class_init(MathEquationClass *klass)
                                                         "Serializer",
                                                         MP_TYPE_SERIALIZER,
                                                         G_PARAM_READABLE));
+    g_object_class_install_property(object_class,
+                                    PROP_STATISTICS,
+                                    g_param_spec_string("statistics",
+                                                        "statistics",
+                                                        "Counts and timings of the last calculation",
+                                                        NULL,
+                                                        G_PARAM_READABLE));
 
     GType param_types[2] = {G_TYPE_STRING, G_TYPE_POINTER};
     g_signal_newv("history",
@@ -1804,7 +2658,7 @@ pre_insert_text_cb(MathEquation  *equation,
 
     /* If following a delete then have already pushed undo stack (GtkTextBuffer
        doesn't indicate replace operations so we have to infer them) */
-    if (!equation->priv->in_delete)
+    if (!continues_typing(equation, location, text, len) && !equation->priv->in_delete)
         math_equation_push_undo_stack(equation);
 
     /* Clear result on next digit entered if cursor at end of line */
@@ -1847,6 +2701,7 @@ pre_delete_range_cb(MathEquation  *equation,
     if (equation->priv->in_reformat)
         return;
 
+    equation->priv->typing = FALSE;
     math_equation_push_undo_stack(equation);
 
     equation->priv->in_delete = TRUE;
@@ -1873,13 +2728,21 @@ insert_text_cb(MathEquation  *equation,
                gint           len,
                gpointer       user_data)
 {
+    gint end;
+
     if (equation->priv->in_reformat)
         return;
 
+    /* Result of the running calculation is of no use anymore */
+    math_equation_cancel(equation);
+
     equation->priv->state.entered_multiply = strcmp(text, "×") == 0;
 
-    /* Update thousands separators */
-    reformat_separators(equation);
+    /* Update thousands separators of the numbers around the inserted text */
+    end = gtk_text_iter_get_offset(location);
+    reformat_separators(equation, end - g_utf8_strlen(text, len), end);
+
+    schedule_preview(equation);
 
     g_object_notify(G_OBJECT(equation), "display");
 }
@@ -1890,13 +2753,20 @@ delete_range_cb(MathEquation  *equation,
                 GtkTextIter   *end,
                 gpointer       user_data)
 {
+    gint offset;
+
     if (equation->priv->in_reformat)
         return;
 
+    math_equation_cancel(equation);
+
     equation->priv->state.entered_multiply = FALSE;
 
-    /* Update thousands separators */
-    reformat_separators(equation);
+    /* Update thousands separators of the number the deletion was in */
+    offset = gtk_text_iter_get_offset(start);
+    reformat_separators(equation, offset, offset);
+
+    schedule_preview(equation);
 
     // FIXME: A replace will emit this both for delete-range and insert-text, can it be avoided?
     g_object_notify(G_OBJECT(equation), "display");
@@ -1944,7 +2814,11 @@ math_equation_init(MathEquation *equation)
     equation->priv->source_units = g_strdup("");
     equation->priv->target_units = g_strdup("");
     equation->priv->serializer = mp_serializer_new(MP_DISPLAY_FORMAT_AUTOMATIC, 10, 9);
-    equation->priv->queue = g_async_queue_new();
+    equation->priv->result_cache = mp_result_cache_new(RESULT_CACHE_SIZE);
+    equation->priv->dependencies = mp_dependencies_new();
+    g_queue_init(&equation->priv->undo_stack);
+    g_queue_init(&equation->priv->redo_stack);
+    equation->priv->undo_limit = DEFAULT_UNDO_LIMIT;
 
     mp_set_from_integer(0, &equation->priv->state.ans);
 }
@@ -54,6 +54,9 @@ gunichar math_equation_get_digit_text(MathEquation *equation, guint digit);
 void math_equation_set_status(MathEquation *equation, const gchar *status);
 const gchar *math_equation_get_status(MathEquation *equation);
 
+/* Counts and timings of the last calculation, NULL unless statistics are enabled */
+const gchar *math_equation_get_statistics(MathEquation *equation);
+
 gboolean math_equation_is_empty(MathEquation *equation);
 gboolean math_equation_is_result(MathEquation *equation);
 gchar *math_equation_get_display(MathEquation *equation);
@@ -72,6 +75,23 @@ gboolean math_equation_get_show_thousands_separators(MathEquation *equation);
 void math_equation_set_show_trailing_zeroes(MathEquation *equation, gboolean visible);
 gboolean math_equation_get_show_trailing_zeroes(MathEquation *equation);
 
+void math_equation_set_live_preview(MathEquation *equation, gboolean enabled);
+gboolean math_equation_get_live_preview(MathEquation *equation);
+
+/* Keep the equations variables are assigned with, e.g. b=a×2, and
+ * recalculate them when the variables they read change */
+void math_equation_set_track_dependencies(MathEquation *equation, gboolean enabled);
+gboolean math_equation_get_track_dependencies(MathEquation *equation);
+
+/* Recalculate the variables assigned from name after it was set or deleted
+ * other than by an equation. Runs in the background like a solve and can be
+ * cancelled with math_equation_cancel() */
+void math_equation_variable_changed(MathEquation *equation, const gchar *name);
+
+/* Memory kept for undo and redo in kilobytes */
+void math_equation_set_undo_limit(MathEquation *equation, gint limit);
+gint math_equation_get_undo_limit(MathEquation *equation);
+
 void math_equation_set_number_format(MathEquation *equation, MpDisplayFormat format);
 MpDisplayFormat math_equation_get_number_format(MathEquation *equation);
 
@@ -115,8 +135,13 @@ void math_equation_insert_numeric_point(MathEquation *equation);
 void math_equation_insert_number(MathEquation *equation, const MPNumber *x);
 void math_equation_insert_subtract(MathEquation *equation);
 void math_equation_insert_exponent(MathEquation *equation);
+/* Append every solve and factorize request to filename, with the options and
+ * variables it used, so the session can be replayed with mate-calc-cmd --replay */
+gboolean math_equation_start_recording(MathEquation *equation, const gchar *filename);
+
 void math_equation_solve(MathEquation *equation);
 void math_equation_factorize(MathEquation *equation);
+void math_equation_cancel(MathEquation *equation);
 void math_equation_delete(MathEquation *equation);
 void math_equation_backspace(MathEquation *equation);
 void math_equation_clear(MathEquation *equation);
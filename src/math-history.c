@@ -15,6 +15,19 @@
 #include <gdk/gdkkeysyms.h>
 
 #include "math-history.h"
+#include "mp-history.h"
+
+/* Oldest calculations are dropped beyond this, and no more are read back from the log */
+#define MAX_HISTORY_ROWS 10000
+
+/* Calculations read from the log at startup, and each time the view is scrolled to the top */
+#define HISTORY_PAGE_ROWS 500
+
+enum {
+    COLUMN_EQUATION,
+    COLUMN_ANSWER,   /* MPNumber, formatted only when the row is drawn */
+    N_COLUMNS
+};
 
 struct MathHistoryPrivate
 {
@@ -24,7 +37,13 @@ struct MathHistoryPrivate
     gchar *last_equation;
     int current; /* 0 is the first entry, rows-1 the most recent entry */
     int rows;
-    GtkWidget *listbox;
+    GtkListStore *store;
+    GtkWidget *treeview;
+    GtkTreeViewColumn *equation_column;
+    GtkTreeViewColumn *answer_column;
+
+    MPHistory *log;           /* Calculations from all sessions, NULL if it can't be opened */
+    guint64 first_loaded;     /* Log entry shown in the first row */
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(MathHistory, math_history, GTK_TYPE_SCROLLED_WINDOW);
@@ -40,60 +59,177 @@ math_history_new(MathEquation *equation)
 static void
 scroll_bottom_cb(MathHistory *history, gpointer data)
 {
-    GtkAdjustment *adjustment;
-    // TODO make this dynamic, do not hardcode listbox_height_request/number_of_rows
-    int width, height;
+    GtkTreePath *path;
+
+    if (history->priv->rows == 0)
+        return;
+
+    path = gtk_tree_path_new_from_indices(history->priv->rows - 1, -1);
+    gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(history->priv->treeview), path, NULL, FALSE, 0, 0);
+    gtk_tree_path_free(path);
+}
+
+/* Free the answer in a row before it is removed */
+static void
+free_answer(GtkTreeModel *model, GtkTreeIter *iter)
+{
+    MPNumber *answer;
+
+    gtk_tree_model_get(model, iter, COLUMN_ANSWER, &answer, -1);
+    mp_free(answer);
+}
+
+static void
+insert_row(MathHistory *history, gint position, const gchar *equation, const MPNumber *answer)
+{
+    MPNumber *number;
+
+    number = mp_new_ptr();
+    mp_set_from_mp(answer, number);
+    gtk_list_store_insert_with_values(history->priv->store, NULL, position,
+                                      COLUMN_EQUATION, equation,
+                                      COLUMN_ANSWER, number,
+                                      -1);
+    history->priv->rows++;
+}
+
+typedef struct
+{
+    MathHistory *history;
+    gint position;
+} LoadData;
+
+static gboolean
+load_entry_cb(guint64 index, const MPHistoryEntry *entry, gpointer data)
+{
+    LoadData *load = data;
+
+    insert_row(load->history, load->position, entry->equation, &entry->answer);
+    load->position++;
+
+    return TRUE;
+}
+
+/* Add up to n calculations from the log before the first row, without going over
+ * MAX_HISTORY_ROWS, returns the number of rows added */
+static gint
+load_older(MathHistory *history, guint64 n)
+{
+    LoadData load;
+    guint64 start;
+
+    if (history->priv->rows >= MAX_HISTORY_ROWS)
+        return 0;
+    n = MIN(n, (guint64) (MAX_HISTORY_ROWS - history->priv->rows));
+
+    if (!history->priv->log || history->priv->first_loaded == 0)
+        return 0;
+
+    start = history->priv->first_loaded > n ? history->priv->first_loaded - n : 0;
+    load.history = history;
+    load.position = 0;
+    mp_history_foreach(history->priv->log, start, history->priv->first_loaded - start, load_entry_cb, &load);
+    history->priv->first_loaded = start;
+    history->priv->current += load.position;
+
+    return load.position;
+}
+
+/* Read older calculations from the log when scrolled to the top */
+static void
+scroll_cb(GtkAdjustment *adjustment, MathHistory *history)
+{
+    GtkTreePath *path;
+    gint added;
+
+    if (gtk_adjustment_get_value(adjustment) > gtk_adjustment_get_lower(adjustment) || history->priv->rows == 0)
+        return;
+
+    added = load_older(history, HISTORY_PAGE_ROWS);
+    if (added == 0)
+        return;
 
-    adjustment = gtk_list_box_get_adjustment(GTK_LIST_BOX(history->priv->listbox));
-    gtk_widget_get_size_request(GTK_WIDGET(history), &width, &height);
-    gtk_adjustment_set_page_size(adjustment, height / 3);
-    gtk_adjustment_set_value (adjustment, gtk_adjustment_get_upper (adjustment)
-                                          - gtk_adjustment_get_page_size (adjustment));
+    /* Keep the row that was at the top in place */
+    path = gtk_tree_path_new_from_indices(added, -1);
+    gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(history->priv->treeview), path, NULL, TRUE, 0, 0);
+    gtk_tree_path_free(path);
 }
 
 void
 math_history_insert_entry (MathHistory *history, char *equation, MPNumber *answer)
 {
+    GtkTreeIter iter;
+
     if (g_strcmp0(history->priv->last_equation, equation) == 0 && history->priv->rows >= 1)
     {
         return;
     }
 
-    MathHistoryEntry *entry = math_history_entry_new(history->priv->equation);
+    if (history->priv->log) {
+        MPHistoryEntry entry;
+
+        entry.time = 0;
+        entry.base = math_equation_get_base(history->priv->equation);
+        entry.wordlen = math_equation_get_word_size(history->priv->equation);
+        entry.angle_units = math_equation_get_angle_units(history->priv->equation);
+        entry.equation = equation;
+        entry.answer = *answer;
+        mp_history_append(history->priv->log, &entry);
+    }
 
-    math_history_entry_insert_entry(entry, equation, answer, history->priv->serializer);
+    /* Dropped rows can be read back from the log by scrolling up */
+    if (history->priv->rows >= MAX_HISTORY_ROWS &&
+        gtk_tree_model_get_iter_first(GTK_TREE_MODEL(history->priv->store), &iter)) {
+        free_answer(GTK_TREE_MODEL(history->priv->store), &iter);
+        gtk_list_store_remove(history->priv->store, &iter);
+        history->priv->rows--;
+        history->priv->first_loaded++;
+    }
 
-    gtk_list_box_insert(GTK_LIST_BOX(history->priv->listbox), GTK_WIDGET(entry), -1);
-    gtk_widget_set_can_focus(GTK_WIDGET(entry), FALSE);
-    gtk_widget_show(GTK_WIDGET(entry));
+    insert_row(history, -1, equation, answer);
 
     g_free(history->priv->last_equation);
 
     history->priv->last_equation = g_strdup(equation);
-    history->priv->rows++;
     history->priv->current = history->priv->rows;
     g_signal_emit_by_name(history, "row-added");
 }
 
-void
-math_history_clear(MathHistory *history)
+static void
+clear_rows(MathHistory *history)
 {
-    GList *children, *iter;
+    GtkTreeModel *model = GTK_TREE_MODEL(history->priv->store);
+    GtkTreeIter iter;
+    gboolean valid;
 
     history->priv->rows = 0;
     history->priv->current = 0;
-    children = gtk_container_get_children(GTK_CONTAINER(history->priv->listbox));
-    for (iter = children; iter != NULL; iter = g_list_next(iter))
-          gtk_widget_destroy(GTK_WIDGET(iter->data));
-    g_list_free(children);
+    for (valid = gtk_tree_model_get_iter_first(model, &iter); valid; valid = gtk_tree_model_iter_next(model, &iter))
+        free_answer(model, &iter);
+    gtk_list_store_clear(history->priv->store);
+}
+
+void
+math_history_clear(MathHistory *history)
+{
+    clear_rows(history);
+    history->priv->first_loaded = 0;
+    if (history->priv->log)
+        mp_history_clear(history->priv->log);
 }
 
-gpointer
-math_history_get_entry_at(MathHistory *history, int index)
+gchar *
+math_history_get_equation_at(MathHistory *history, int index)
 {
-    if (index >= 0 && index < history->priv->rows)
-        return MATH_HISTORY_ENTRY(gtk_list_box_get_row_at_index(GTK_LIST_BOX(history->priv->listbox), index));
-    return NULL;
+    GtkTreeIter iter;
+    gchar *equation;
+
+    if (index < 0 || index >= history->priv->rows ||
+        !gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(history->priv->store), &iter, NULL, index))
+        return NULL;
+
+    gtk_tree_model_get(GTK_TREE_MODEL(history->priv->store), &iter, COLUMN_EQUATION, &equation, -1);
+    return equation;
 }
 
 void
@@ -113,16 +249,125 @@ math_history_set_serializer(MathHistory *history, MpSerializer *serializer)
 {
     history->priv->serializer = serializer;
 
-    GList *children, *iter;
-    children = gtk_container_get_children(GTK_CONTAINER(history->priv->listbox));
-    for (iter = children; iter != NULL; iter = g_list_next(iter))
-          math_history_entry_redisplay(MATH_HISTORY_ENTRY(iter->data), serializer);
-    g_list_free(children);
+    /* Answers are formatted as they are drawn, so only the visible rows change */
+    gtk_widget_queue_draw(history->priv->treeview);
+}
+
+/* Returns the answer in a row as it is shown */
+static gchar *
+get_answer_text(MathHistory *history, GtkTreeModel *model, GtkTreeIter *iter)
+{
+    MPNumber *answer;
+
+    if (!history->priv->serializer)
+        return NULL;
+
+    gtk_tree_model_get(model, iter, COLUMN_ANSWER, &answer, -1);
+    return mp_serializer_to_string(history->priv->serializer, answer);
+}
+
+static void
+answer_data_func(GtkTreeViewColumn *column, GtkCellRenderer *renderer, GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+    gchar *answer = get_answer_text(MATH_HISTORY(data), model, iter);
+
+    g_object_set(renderer, "text", answer, NULL);
+    g_free(answer);
+}
+
+/* Get the row and column at a point in the tree view */
+static gboolean
+get_cell_at(MathHistory *history, gint x, gint y, GtkTreeIter *iter, GtkTreeViewColumn **column)
+{
+    GtkTreePath *path;
+    gboolean found;
+
+    if (!gtk_tree_view_get_path_at_pos(GTK_TREE_VIEW(history->priv->treeview), x, y, &path, column, NULL, NULL))
+        return FALSE;
+
+    found = gtk_tree_model_get_iter(GTK_TREE_MODEL(history->priv->store), iter, path);
+    gtk_tree_path_free(path);
+
+    return found;
+}
+
+/* Clicking on an equation puts it back in the display, clicking on an answer inserts it */
+static gboolean
+button_press_cb(GtkWidget *widget, GdkEventButton *event, MathHistory *history)
+{
+    GtkTreeViewColumn *column;
+    GtkTreeIter iter;
+    gchar *text = NULL;
+
+    if (event->type != GDK_BUTTON_PRESS ||
+        !get_cell_at(history, event->x, event->y, &iter, &column))
+        return FALSE;
+
+    if (column == history->priv->equation_column) {
+        gtk_tree_model_get(GTK_TREE_MODEL(history->priv->store), &iter, COLUMN_EQUATION, &text, -1);
+        if (text != NULL)
+            math_equation_set(history->priv->equation, text);
+    }
+    else if (column == history->priv->answer_column) {
+        text = get_answer_text(history, GTK_TREE_MODEL(history->priv->store), &iter);
+        if (text != NULL)
+            math_equation_insert(history->priv->equation, text);
+    }
+    g_free(text);
+
+    return TRUE;
+}
+
+/* Show the whole equation or answer, they are ellipsized in the view */
+static gboolean
+query_tooltip_cb(GtkWidget *widget, gint x, gint y, gboolean keyboard_mode, GtkTooltip *tooltip, MathHistory *history)
+{
+    GtkTreeViewColumn *column;
+    GtkTreeIter iter;
+    gint bin_x, bin_y;
+    gchar *text = NULL;
+
+    if (keyboard_mode)
+        return FALSE;
+
+    gtk_tree_view_convert_widget_to_bin_window_coords(GTK_TREE_VIEW(widget), x, y, &bin_x, &bin_y);
+    if (!get_cell_at(history, bin_x, bin_y, &iter, &column))
+        return FALSE;
+
+    if (column == history->priv->equation_column)
+        gtk_tree_model_get(GTK_TREE_MODEL(history->priv->store), &iter, COLUMN_EQUATION, &text, -1);
+    else if (column == history->priv->answer_column)
+        text = get_answer_text(history, GTK_TREE_MODEL(history->priv->store), &iter);
+    if (text == NULL)
+        return FALSE;
+
+    gtk_tooltip_set_text(tooltip, text);
+    g_free(text);
+
+    return TRUE;
+}
+
+static void
+math_history_finalize(GObject *object)
+{
+    MathHistory *self = MATH_HISTORY(object);
+
+    clear_rows(self);
+    g_object_unref(self->priv->store);
+    mp_history_free(self->priv->log);
+    g_free(self->priv->last_equation);
+    g_clear_object(&self->priv->equation);
+
+    G_OBJECT_CLASS(math_history_parent_class)->finalize(object);
 }
 
 static void
 math_history_class_init(MathHistoryClass *klass)
 {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = math_history_finalize;
+
     g_signal_new("row-added",
                  G_TYPE_FROM_CLASS(klass),
                  G_SIGNAL_RUN_FIRST,
@@ -135,9 +380,28 @@ math_history_class_init(MathHistoryClass *klass)
                  NULL);
 }
 
+static GtkTreeViewColumn *
+add_column(MathHistory *history, GtkCellRenderer *renderer, gboolean expand)
+{
+    GtkTreeViewColumn *column;
+
+    /* Fixed sizing lets the view lay out only the rows it shows */
+    column = gtk_tree_view_column_new();
+    gtk_tree_view_column_pack_start(column, renderer, TRUE);
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_expand(column, expand);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(history->priv->treeview), column);
+
+    return column;
+}
+
 static void
 math_history_init(MathHistory *history)
 {
+    GtkCellRenderer *renderer;
+    GtkTreeViewColumn *column;
+    gchar *filename;
+
     history->priv = math_history_get_instance_private(history);
 
     gtk_scrolled_window_set_shadow_type(GTK_SCROLLED_WINDOW(history), GTK_SHADOW_IN);
@@ -148,15 +412,54 @@ math_history_init(MathHistory *history)
     history->priv->current = 0;
     history->priv->rows = 0;
     history->priv->last_equation = g_strdup("");
-    history->priv->listbox = gtk_list_box_new();
+    history->priv->store = gtk_list_store_new(N_COLUMNS, G_TYPE_STRING, G_TYPE_POINTER);
+    history->priv->treeview = gtk_tree_view_new_with_model(GTK_TREE_MODEL(history->priv->store));
 
-    gtk_list_box_set_selection_mode(GTK_LIST_BOX(history->priv->listbox), GTK_SELECTION_NONE);
-    gtk_widget_show(GTK_WIDGET(history->priv->listbox));
+    gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(history->priv->treeview), FALSE);
+    gtk_tree_view_set_enable_search(GTK_TREE_VIEW(history->priv->treeview), FALSE);
+    gtk_tree_selection_set_mode(gtk_tree_view_get_selection(GTK_TREE_VIEW(history->priv->treeview)), GTK_SELECTION_NONE);
 
-    gtk_container_add(GTK_CONTAINER(history), history->priv->listbox);
-    gtk_widget_set_valign(GTK_WIDGET(history->priv->listbox), GTK_ALIGN_END);
+    renderer = gtk_cell_renderer_text_new();
+    g_object_set(renderer, "ellipsize", PANGO_ELLIPSIZE_END, "xalign", 0.0, "size-points", 14.0, "xpad", 12, NULL);
+    history->priv->equation_column = add_column(history, renderer, TRUE);
+    gtk_tree_view_column_add_attribute(history->priv->equation_column, renderer, "text", COLUMN_EQUATION);
+
+    renderer = gtk_cell_renderer_text_new();
+    g_object_set(renderer, "text", "=", "xalign", 0.5, "size-points", 12.0, "weight", PANGO_WEIGHT_LIGHT, NULL);
+    column = add_column(history, renderer, FALSE);
+    gtk_tree_view_column_set_fixed_width(column, 24);
+
+    renderer = gtk_cell_renderer_text_new();
+    g_object_set(renderer, "ellipsize", PANGO_ELLIPSIZE_END, "xalign", 1.0, "size-points", 14.0, "weight", PANGO_WEIGHT_BOLD, "xpad", 16, NULL);
+    history->priv->answer_column = add_column(history, renderer, TRUE);
+    gtk_tree_view_column_set_cell_data_func(history->priv->answer_column, renderer, answer_data_func, history, NULL);
+
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(history->priv->treeview), TRUE);
+    gtk_widget_set_has_tooltip(history->priv->treeview, TRUE);
+    g_signal_connect(history->priv->treeview, "button-press-event", G_CALLBACK(button_press_cb), history);
+    g_signal_connect(history->priv->treeview, "query-tooltip", G_CALLBACK(query_tooltip_cb), history);
+    gtk_widget_show(history->priv->treeview);
+
+    gtk_container_add(GTK_CONTAINER(history), history->priv->treeview);
     gtk_widget_set_size_request(GTK_WIDGET(history), 100, 100);
     gtk_widget_set_can_focus(GTK_WIDGET(history), FALSE);
+    gtk_widget_set_can_focus(history->priv->treeview, FALSE);
 
     g_signal_connect(history, "row-added", G_CALLBACK(scroll_bottom_cb), NULL);
+    g_signal_connect(gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(history)), "value-changed", G_CALLBACK(scroll_cb), history);
+
+    /* Show the end of the history from previous sessions */
+    filename = g_build_filename(g_get_user_data_dir(), "mate-calc", "history", NULL);
+    history->priv->log = mp_history_open(filename);
+    g_free(filename);
+    if (history->priv->log) {
+        history->priv->first_loaded = mp_history_get_length(history->priv->log);
+        load_older(history, HISTORY_PAGE_ROWS);
+        if (history->priv->rows > 0) {
+            g_free(history->priv->last_equation);
+            history->priv->last_equation = math_history_get_equation_at(history, history->priv->rows - 1);
+        }
+        history->priv->current = history->priv->rows;
+        scroll_bottom_cb(history, NULL);
+    }
 }
@@ -16,7 +16,6 @@
 #include <glib-object.h>
 #include <gtk/gtk.h>
 
-#include "math-history-entry.h"
 #include "math-display.h"
 #include "math-equation.h"
 
@@ -45,8 +44,8 @@ math_history_new(MathEquation *equation);
 void
 math_history_insert_entry(MathHistory *history, char *equation, MPNumber *answer);
 
-gpointer
-math_history_get_entry_at(MathHistory *history, int index);
+gchar *
+math_history_get_equation_at(MathHistory *history, int index);
 
 void
 math_history_set_current(MathHistory *history, int value);
@@ -128,6 +128,28 @@ trailing_zeroes_check_toggled_cb(GtkWidget *check, MathPreferencesDialog *dialog
     math_equation_set_show_trailing_zeroes(dialog->priv->equation, value);
 }
 
+void live_preview_check_toggled_cb(GtkWidget *check, MathPreferencesDialog *dialog);
+G_MODULE_EXPORT
+void
+live_preview_check_toggled_cb(GtkWidget *check, MathPreferencesDialog *dialog)
+{
+    gboolean value;
+
+    value = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check));
+    math_equation_set_live_preview(dialog->priv->equation, value);
+}
+
+void track_dependencies_check_toggled_cb(GtkWidget *check, MathPreferencesDialog *dialog);
+G_MODULE_EXPORT
+void
+track_dependencies_check_toggled_cb(GtkWidget *check, MathPreferencesDialog *dialog)
+{
+    gboolean value;
+
+    value = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check));
+    math_equation_set_track_dependencies(dialog->priv->equation, value);
+}
+
 static void
 set_combo_box_from_int(GtkWidget *combo, int value)
 {
@@ -176,6 +198,22 @@ show_trailing_zeroes_cb(MathEquation *equation, GParamSpec *spec, MathPreference
     g_settings_set_boolean(g_settings_var, "show-zeroes", math_equation_get_show_trailing_zeroes(equation));
 }
 
+static void
+live_preview_cb(MathEquation *equation, GParamSpec *spec, MathPreferencesDialog *dialog)
+{
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gtk_builder_get_object(dialog->priv->ui, "live_preview_check")),
+                                 math_equation_get_live_preview(equation));
+    g_settings_set_boolean(g_settings_var, "live-preview", math_equation_get_live_preview(equation));
+}
+
+static void
+track_dependencies_cb(MathEquation *equation, GParamSpec *spec, MathPreferencesDialog *dialog)
+{
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gtk_builder_get_object(dialog->priv->ui, "track_dependencies_check")),
+                                 math_equation_get_track_dependencies(equation));
+    g_settings_set_boolean(g_settings_var, "track-dependencies", math_equation_get_track_dependencies(equation));
+}
+
 static void
 number_format_cb(MathEquation *equation, GParamSpec *spec, MathPreferencesDialog *dialog)
 {
@@ -305,6 +343,8 @@ create_gui(MathPreferencesDialog *dialog)
     g_signal_connect(dialog->priv->equation, "notify::accuracy", G_CALLBACK(accuracy_cb), dialog);
     g_signal_connect(dialog->priv->equation, "notify::show-thousands-separators", G_CALLBACK(show_thousands_separators_cb), dialog);
     g_signal_connect(dialog->priv->equation, "notify::show-trailing_zeroes", G_CALLBACK(show_trailing_zeroes_cb), dialog);
+    g_signal_connect(dialog->priv->equation, "notify::live-preview", G_CALLBACK(live_preview_cb), dialog);
+    g_signal_connect(dialog->priv->equation, "notify::track-dependencies", G_CALLBACK(track_dependencies_cb), dialog);
     g_signal_connect(dialog->priv->equation, "notify::number-format", G_CALLBACK(number_format_cb), dialog);
     g_signal_connect(dialog->priv->equation, "notify::word-size", G_CALLBACK(word_size_cb), dialog);
     g_signal_connect(dialog->priv->equation, "notify::angle-units", G_CALLBACK(angle_unit_cb), dialog);
@@ -312,6 +352,8 @@ create_gui(MathPreferencesDialog *dialog)
     accuracy_cb(dialog->priv->equation, NULL, dialog);
     show_thousands_separators_cb(dialog->priv->equation, NULL, dialog);
     show_trailing_zeroes_cb(dialog->priv->equation, NULL, dialog);
+    live_preview_cb(dialog->priv->equation, NULL, dialog);
+    track_dependencies_cb(dialog->priv->equation, NULL, dialog);
     number_format_cb(dialog->priv->equation, NULL, dialog);
     word_size_cb(dialog->priv->equation, NULL, dialog);
     angle_unit_cb(dialog->priv->equation, NULL, dialog);
@@ -85,6 +85,7 @@ add_variable_cb(GtkWidget *widget, MathVariablePopup *popup)
         math_variables_set(math_equation_get_variables(popup->priv->equation), name, math_equation_get_answer(popup->priv->equation));
     else
         g_warning("Can't add variable %s, the display is not a number", name);
+    math_equation_variable_changed(popup->priv->equation, name);
 
     gtk_widget_destroy(gtk_widget_get_toplevel(widget));
     mp_clear(&z);
@@ -103,6 +104,7 @@ save_variable_cb(GtkWidget *widget, MathVariablePopup *popup)
         math_variables_set(math_equation_get_variables(popup->priv->equation), name, math_equation_get_answer(popup->priv->equation));
     else
         g_warning("Can't save variable %s, the display is not a number", name);
+    math_equation_variable_changed(popup->priv->equation, name);
 
     gtk_widget_destroy(gtk_widget_get_toplevel(widget));
     mp_clear(&z);
@@ -115,6 +117,7 @@ delete_variable_cb(GtkWidget *widget, MathVariablePopup *popup)
 
     name = g_object_get_data(G_OBJECT(widget), "variable_name");
     math_variables_delete(math_equation_get_variables(popup->priv->equation), name);
+    math_equation_variable_changed(popup->priv->equation, name);
 
     gtk_widget_destroy(gtk_widget_get_toplevel(widget));
 }
@@ -195,10 +198,14 @@ math_variable_popup_set_property(GObject      *object,
 
         names = math_variables_get_names(math_equation_get_variables(self->priv->equation));
         for (i = 0; names[i]; i++) {
-            MPNumber *aux;
-
-            aux = math_variables_get(math_equation_get_variables(self->priv->equation), names[i]);
-            entry = make_variable_entry(self, names[i], aux, TRUE);
+            MPNumber aux = mp_new();
+
+            if (!math_variables_get(math_equation_get_variables(self->priv->equation), names[i], &aux)) {
+                mp_clear(&aux);
+                continue;
+            }
+            entry = make_variable_entry(self, names[i], &aux, TRUE);
+            mp_clear(&aux);
             gtk_widget_show(entry);
             gtk_box_pack_start(GTK_BOX(self->priv->vbox), entry, FALSE, TRUE, 0);
         }
@@ -8,17 +8,29 @@
  * license.
  */
 
-#include <stdio.h>
 #include <string.h>
 
 #include "math-variables.h"
-#include "mp-serializer.h"
+
+/* Seconds to wait after a change before saving, so changes made together are saved once */
+#define SAVE_DELAY 2
 
 struct MathVariablesPrivate
 {
     gchar *file_name;
+
+    /* Held while reading or changing registers, versions and save_timeout,
+     * variables are read and set by the solve thread as well as the main loop */
+    GMutex lock;
+
     GHashTable *registers;
-    MpSerializer *serializer;
+
+    /* Pending save, 0 if the file is up to date */
+    guint save_timeout;
+
+    /* Version of each variable set since loading, see math_variables_get_version() */
+    GHashTable *versions;
+    guint last_version;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (MathVariables, math_variables, G_TYPE_OBJECT);
@@ -32,32 +44,40 @@ math_variables_new()
 static void
 registers_load(MathVariables *variables)
 {
-    FILE *f;
-    char line[1024];
+    gchar *contents, **lines;
+    int i;
 
-    f = fopen(variables->priv->file_name, "r");
-    if (!f)
+    if (!g_file_get_contents(variables->priv->file_name, &contents, NULL, NULL))
         return;
 
+    g_mutex_lock(&variables->priv->lock);
     g_hash_table_remove_all(variables->priv->registers);
 
-    while (fgets(line, 1024, f) != NULL)
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+    for (i = 0; lines[i] != NULL; i++)
     {
         char *name, *value;
         MPNumber *t;
+        gboolean loaded;
 
-        value = strchr(line, '=');
+        value = strchr(lines[i], '=');
         if (!value)
             continue;
         *value = '\0';
         value = value + 1;
 
-        name = g_strstrip(line);
+        name = g_strstrip(lines[i]);
         value = g_strstrip(value);
 
+        /* Values are saved exactly, files from older versions have decimal values */
         t = g_malloc(sizeof(MPNumber));
         *t = mp_new();
-        if (mp_set_from_string(value, 10, t) == 0)
+        if (g_str_has_prefix(value, "0x") || g_str_has_prefix(value, "-0x"))
+            loaded = mp_set_from_exact_string(value, t);
+        else
+            loaded = mp_set_from_string(value, 10, t) == 0;
+        if (loaded)
             g_hash_table_insert(variables->priv->registers, g_strdup(name), t);
         else
         {
@@ -65,25 +85,26 @@ registers_load(MathVariables *variables)
             g_free(t);
         }
     }
-    fclose(f);
+    g_mutex_unlock(&variables->priv->lock);
+    g_strfreev(lines);
 }
 
 static void
 registers_save(MathVariables *variables)
 {
     gchar *dir;
-    FILE *f;
+    GString *contents;
     GHashTableIter iter;
     gpointer key, val;
+    GError *error = NULL;
 
     dir = g_path_get_dirname(variables->priv->file_name);
     g_mkdir_with_parents(dir, 0700);
     g_free(dir);
 
-    f = fopen(variables->priv->file_name, "w");
-    if (!f)
-        return;
-
+    /* Only the contents are made under the lock, the solve thread isn't held up by the write */
+    contents = g_string_new(NULL);
+    g_mutex_lock(&variables->priv->lock);
     g_hash_table_iter_init(&iter, variables->priv->registers);
     while (g_hash_table_iter_next(&iter, &key, &val))
     {
@@ -91,11 +112,61 @@ registers_save(MathVariables *variables)
         MPNumber *value = val;
         char *number;
 
-        number = mp_serializer_to_string(variables->priv->serializer, value);
-        fprintf(f, "%s=%s\n", name, number);
+        number = mp_to_exact_string(value);
+        g_string_append_printf(contents, "%s=%s\n", name, number);
         g_free(number);
     }
-    fclose(f);
+    g_mutex_unlock(&variables->priv->lock);
+
+    /* Written to a temporary file and renamed over the old one, so a crash leaves either */
+    if (!g_file_set_contents(variables->priv->file_name, contents->str, contents->len, &error))
+    {
+        g_warning("Failed to save variables: %s", error->message);
+        g_error_free(error);
+    }
+    g_string_free(contents, TRUE);
+}
+
+static gboolean
+save_timeout_cb(gpointer data)
+{
+    MathVariables *variables = data;
+
+    g_mutex_lock(&variables->priv->lock);
+    variables->priv->save_timeout = 0;
+    g_mutex_unlock(&variables->priv->lock);
+    registers_save(variables);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Called from the solve thread too, the save is always made by the main loop */
+static void
+registers_changed(MathVariables *variables)
+{
+    g_mutex_lock(&variables->priv->lock);
+    if (variables->priv->save_timeout == 0)
+        variables->priv->save_timeout = g_timeout_add_seconds(SAVE_DELAY, save_timeout_cb, variables);
+    g_mutex_unlock(&variables->priv->lock);
+}
+
+/* Save any changes not saved yet */
+void
+math_variables_save(MathVariables *variables)
+{
+    guint save_timeout;
+
+    g_return_if_fail(variables != NULL);
+
+    g_mutex_lock(&variables->priv->lock);
+    save_timeout = variables->priv->save_timeout;
+    variables->priv->save_timeout = 0;
+    g_mutex_unlock(&variables->priv->lock);
+    if (save_timeout == 0)
+        return;
+
+    g_source_remove(save_timeout);
+    registers_save(variables);
 }
 
 // FIXME: Sort
@@ -109,6 +180,7 @@ math_variables_get_names(MathVariables *variables)
 
     g_return_val_if_fail(variables != NULL, NULL);
 
+    g_mutex_lock(&variables->priv->lock);
     names = g_malloc0(sizeof(gchar *) * (g_hash_table_size(variables->priv->registers) + 1));
 
     g_hash_table_iter_init(&iter, variables->priv->registers);
@@ -119,6 +191,7 @@ math_variables_get_names(MathVariables *variables)
         i++;
     }
     names[i] = NULL;
+    g_mutex_unlock(&variables->priv->lock);
 
     return names;
 }
@@ -135,16 +208,30 @@ math_variables_set(MathVariables *variables, const char *name, const MPNumber *v
     t = g_malloc(sizeof(MPNumber));
     *t = mp_new();
     mp_set_from_mp(value, t);
+    g_mutex_lock(&variables->priv->lock);
     g_hash_table_insert(variables->priv->registers, g_strdup(name), t);
-    registers_save(variables);
+    g_hash_table_insert(variables->priv->versions, g_strdup(name), GUINT_TO_POINTER(++variables->priv->last_version));
+    g_mutex_unlock(&variables->priv->lock);
+    registers_changed(variables);
 }
 
-MPNumber *
-math_variables_get(MathVariables *variables, const char *name)
+/* Copy the value of name into z, which may be NULL to only check it is defined.
+ * Returns FALSE if name is not defined */
+gboolean
+math_variables_get(MathVariables *variables, const char *name, MPNumber *z)
 {
-    g_return_val_if_fail(variables != NULL, NULL);
-    g_return_val_if_fail(name != NULL, NULL);
-    return g_hash_table_lookup(variables->priv->registers, name);
+    MPNumber *t;
+
+    g_return_val_if_fail(variables != NULL, FALSE);
+    g_return_val_if_fail(name != NULL, FALSE);
+
+    g_mutex_lock(&variables->priv->lock);
+    t = g_hash_table_lookup(variables->priv->registers, name);
+    if (t && z)
+        mp_set_from_mp(t, z);
+    g_mutex_unlock(&variables->priv->lock);
+
+    return t != NULL;
 }
 
 void
@@ -152,22 +239,64 @@ math_variables_delete(MathVariables *variables, const char *name)
 {
     g_return_if_fail(variables != NULL);
     g_return_if_fail(name != NULL);
+    g_mutex_lock(&variables->priv->lock);
     g_hash_table_remove(variables->priv->registers, name);
-    registers_save(variables);
+    g_hash_table_remove(variables->priv->versions, name);
+    g_mutex_unlock(&variables->priv->lock);
+    registers_changed(variables);
+}
+
+/* Returns a number that changes whenever name is set or deleted, 0 if it is not defined */
+guint64
+math_variables_get_version(MathVariables *variables, const char *name)
+{
+    gpointer version;
+    guint64 result;
+
+    g_return_val_if_fail(variables != NULL, 0);
+    g_return_val_if_fail(name != NULL, 0);
+
+    g_mutex_lock(&variables->priv->lock);
+    if (g_hash_table_lookup_extended(variables->priv->versions, name, NULL, &version))
+        result = GPOINTER_TO_UINT(version);
+    /* Loaded variables that haven't been set since */
+    else
+        result = g_hash_table_contains(variables->priv->registers, name) ? 1 : 0;
+    g_mutex_unlock(&variables->priv->lock);
+
+    return result;
+}
+
+static void
+math_variables_finalize(GObject *object)
+{
+    MathVariables *variables = MATH_VARIABLES(object);
+
+    math_variables_save(variables);
+    g_hash_table_unref(variables->priv->registers);
+    g_hash_table_unref(variables->priv->versions);
+    g_free(variables->priv->file_name);
+    g_mutex_clear(&variables->priv->lock);
+
+    G_OBJECT_CLASS(math_variables_parent_class)->finalize(object);
 }
 
 static void
 math_variables_class_init (MathVariablesClass *klass)
 {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = math_variables_finalize;
 }
 
 static void
 math_variables_init(MathVariables *variables)
 {
     variables->priv = math_variables_get_instance_private (variables);
+    g_mutex_init(&variables->priv->lock);
     variables->priv->registers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    variables->priv->versions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    variables->priv->last_version = 1;
     variables->priv->file_name = g_build_filename(g_get_user_data_dir(), "mate-calc", "registers", NULL);
-    variables->priv->serializer = mp_serializer_new(MP_DISPLAY_FORMAT_SCIENTIFIC, 10, 50);
-    mp_serializer_set_radix(variables->priv->serializer, '.');
     registers_load(variables);
 }
@@ -16,7 +16,7 @@
 
 G_BEGIN_DECLS
 
-#define MATH_VARIABLES(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), math_equation_get_type(), MathVariables))
+#define MATH_VARIABLES(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), math_variables_get_type(), MathVariables))
 
 typedef struct MathVariablesPrivate MathVariablesPrivate;
 
@@ -39,10 +39,14 @@ gchar **math_variables_get_names(MathVariables *variables);
 
 void math_variables_set(MathVariables *variables, const char *name, const MPNumber *value);
 
-MPNumber *math_variables_get(MathVariables *variables, const char *name);
+gboolean math_variables_get(MathVariables *variables, const char *name, MPNumber *z);
 
 void math_variables_delete(MathVariables *variables, const char *name);
 
+guint64 math_variables_get_version(MathVariables *variables, const char *name);
+
+void math_variables_save(MathVariables *variables);
+
 G_END_DECLS
 
 #endif /* MATH_VARIABLES_H */
@@ -217,10 +217,9 @@ key_press_cb(MathWindow *window, GdkEventKey *event)
                 break;
         }
 
-        MathHistoryEntry *entry = math_history_get_entry_at(window->priv->history, math_history_get_current(window->priv->history));
-        if (entry)
+        gchar *equation_string = math_history_get_equation_at(window->priv->history, math_history_get_current(window->priv->history));
+        if (equation_string)
         {
-            gchar *equation_string = math_history_entry_get_equation(entry);
             math_equation_set(window->priv->equation, equation_string);
             g_free(equation_string);
         }
@@ -0,0 +1,644 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "mp-calculus.h"
+
+/* Digits shown when the options don't say */
+#define DEFAULT_ACCURACY 9
+
+/* Extra digits results are computed to, so they round to the digits shown */
+#define SOLVE_GUARD_DIGITS 10
+#define INTEGRATE_GUARD_DIGITS 5
+
+/* Limits on the iterations of the solver */
+#define SOLVE_MAX_ITERATIONS 200
+#define SOLVE_MAX_HALVINGS 40
+#define SOLVE_MAX_BRACKET_STEPS 64
+
+/* Step used for numerical derivatives, relative to the size of the value.
+ * Its own error is about its square, and it is large enough that values only
+ * known to the accuracy shown (e.g. integrals) still give a usable slope. */
+#define DERIVATIVE_STEP_DIGITS 10
+
+/* Levels of the tanh-sinh rule, each halves the spacing of the points */
+#define INTEGRATE_MIN_LEVEL 2
+#define INTEGRATE_MAX_LEVEL 12
+
+/* Fewest points given to each thread, smaller levels don't pay for the threads */
+#define POINTS_PER_THREAD 16
+
+static int
+get_accuracy(MPEquationOptions *options)
+{
+    return options->accuracy > 0 ? options->accuracy : DEFAULT_ACCURACY;
+}
+
+/* Set z to 10^-digits */
+static void
+get_tolerance(int digits, MPNumber *z)
+{
+    mp_set_from_integer(10, z);
+    mp_xpowy_integer(z, -digits, z);
+}
+
+/* Set z to the larger of 1 and |x|, so tolerances are absolute for small
+ * values and relative for large ones */
+static void
+get_scale(const MPNumber *x, MPNumber *z)
+{
+    MPNumber one = mp_new();
+
+    mp_set_from_integer(1, &one);
+    mp_abs(x, z);
+    if (mp_is_less_than(z, &one))
+        mp_set_from_mp(&one, z);
+    mp_clear(&one);
+}
+
+/* Check if a step of size step is small enough to stop at x */
+static gboolean
+is_converged(const MPNumber *step, const MPNumber *x, const MPNumber *tolerance)
+{
+    MPNumber size = mp_new(), limit = mp_new();
+    gboolean result;
+
+    get_scale(x, &limit);
+    mp_multiply(&limit, tolerance, &limit);
+    mp_abs(step, &size);
+    result = mp_is_less_equal(&size, &limit);
+    mp_clear(&size);
+    mp_clear(&limit);
+
+    return result;
+}
+
+/* Math errors (e.g. division by zero) only rule out the point they happened at */
+static gboolean
+is_point_error(MPErrorCode error)
+{
+    return error == PARSER_ERR_MP;
+}
+
+static MPErrorCode
+evaluate(MPEquationFunction *function, const MPNumber *x, MPNumber *z)
+{
+    MPErrorCode error;
+
+    error = mp_equation_function_evaluate(function, x, z, NULL);
+    if (is_point_error(error))
+        mp_clear_error();
+    return error;
+}
+
+/* Derivative at x from a central difference */
+static MPErrorCode
+get_derivative(MPEquationFunction *function, const MPNumber *x, MPNumber *z)
+{
+    MPNumber h = mp_new(), t = mp_new(), f1 = mp_new(), f2 = mp_new();
+    MPErrorCode error;
+
+    get_scale(x, &t);
+    get_tolerance(DERIVATIVE_STEP_DIGITS, &h);
+    mp_multiply(&h, &t, &h);
+
+    mp_add(x, &h, &t);
+    error = evaluate(function, &t, &f1);
+    if (error == PARSER_ERR_NONE) {
+        mp_subtract(x, &h, &t);
+        error = evaluate(function, &t, &f2);
+    }
+    if (error == PARSER_ERR_NONE) {
+        mp_subtract(&f1, &f2, z);
+        mp_multiply_integer(&h, 2, &h);
+        mp_divide(z, &h, z);
+    }
+
+    mp_clear(&h);
+    mp_clear(&t);
+    mp_clear(&f1);
+    mp_clear(&f2);
+
+    return error;
+}
+
+/* Newton's method from guess, halving steps that don't bring the value closer to zero */
+static MPErrorCode
+solve_newton(MPEquationFunction *function, const MPNumber *guess, const MPNumber *f_guess,
+             const MPNumber *tolerance, MPNumber *z, gboolean *found)
+{
+    MPNumber x = mp_new(), fx = mp_new(), x1 = mp_new(), fx1 = mp_new();
+    MPNumber d = mp_new(), dx = mp_new(), size = mp_new(), size1 = mp_new();
+    MPErrorCode error = PARSER_ERR_NONE;
+    int i, halvings;
+
+    mp_set_from_mp(guess, &x);
+    mp_set_from_mp(f_guess, &fx);
+    for (i = 0; i < SOLVE_MAX_ITERATIONS; i++) {
+        if (mp_is_zero(&fx)) {
+            mp_set_from_mp(&x, z);
+            *found = TRUE;
+            break;
+        }
+
+        error = get_derivative(function, &x, &d);
+        if (error != PARSER_ERR_NONE || mp_is_zero(&d))
+            break;
+        mp_divide(&fx, &d, &dx);
+        mp_subtract(&x, &dx, &x1);
+        if (is_converged(&dx, &x1, tolerance)) {
+            mp_set_from_mp(&x1, z);
+            *found = TRUE;
+            break;
+        }
+
+        mp_abs(&fx, &size);
+        for (halvings = 0; halvings < SOLVE_MAX_HALVINGS; halvings++) {
+            error = evaluate(function, &x1, &fx1);
+            if (error == PARSER_ERR_NONE) {
+                mp_abs(&fx1, &size1);
+                if (mp_is_less_than(&size1, &size))
+                    break;
+            }
+            else if (!is_point_error(error))
+                break;
+            error = PARSER_ERR_NONE;
+            mp_divide_integer(&dx, 2, &dx);
+            mp_subtract(&x, &dx, &x1);
+        }
+        if (error != PARSER_ERR_NONE || halvings == SOLVE_MAX_HALVINGS)
+            break;
+        mp_set_from_mp(&x1, &x);
+        mp_set_from_mp(&fx1, &fx);
+    }
+
+    mp_clear(&x);
+    mp_clear(&fx);
+    mp_clear(&x1);
+    mp_clear(&fx1);
+    mp_clear(&d);
+    mp_clear(&dx);
+    mp_clear(&size);
+    mp_clear(&size1);
+
+    /* Points Newton's method couldn't get past are left to the bracketing search */
+    return is_point_error(error) ? PARSER_ERR_NONE : error;
+}
+
+/* Look for a sign change on either side of guess, widening the search each step */
+static MPErrorCode
+find_bracket(MPEquationFunction *function, const MPNumber *guess, MPNumber *a, MPNumber *fa,
+             MPNumber *b, MPNumber *fb, gboolean *found)
+{
+    MPNumber width = mp_new(), x = mp_new(), fx = mp_new();
+    MPNumber last[2], f_last[2];
+    gboolean valid[2];
+    MPErrorCode error;
+    int step, side;
+
+    for (side = 0; side < 2; side++) {
+        last[side] = mp_new();
+        f_last[side] = mp_new();
+        mp_set_from_mp(guess, &last[side]);
+    }
+
+    error = evaluate(function, guess, &fx);
+    valid[0] = valid[1] = error == PARSER_ERR_NONE && !mp_is_complex(&fx);
+    if (is_point_error(error))
+        error = PARSER_ERR_NONE;
+    mp_set_from_mp(&fx, &f_last[0]);
+    mp_set_from_mp(&fx, &f_last[1]);
+
+    get_scale(guess, &width);
+    mp_divide_integer(&width, 100, &width);
+    for (step = 0; error == PARSER_ERR_NONE && step < SOLVE_MAX_BRACKET_STEPS && !*found; step++) {
+        for (side = 0; side < 2 && !*found; side++) {
+            if (side == 0)
+                mp_subtract(guess, &width, &x);
+            else
+                mp_add(guess, &width, &x);
+
+            error = evaluate(function, &x, &fx);
+            if (error != PARSER_ERR_NONE || mp_is_complex(&fx)) {
+                if (error != PARSER_ERR_NONE && !is_point_error(error))
+                    break;
+                error = PARSER_ERR_NONE;
+                valid[side] = FALSE;
+                continue;
+            }
+
+            if (valid[side] && (mp_is_zero(&fx) || mp_is_negative(&fx) != mp_is_negative(&f_last[side]))) {
+                mp_set_from_mp(&last[side], a);
+                mp_set_from_mp(&f_last[side], fa);
+                mp_set_from_mp(&x, b);
+                mp_set_from_mp(&fx, fb);
+                *found = TRUE;
+            }
+            mp_set_from_mp(&x, &last[side]);
+            mp_set_from_mp(&fx, &f_last[side]);
+            valid[side] = TRUE;
+        }
+        mp_multiply_integer(&width, 2, &width);
+    }
+
+    for (side = 0; side < 2; side++) {
+        mp_clear(&last[side]);
+        mp_clear(&f_last[side]);
+    }
+    mp_clear(&width);
+    mp_clear(&x);
+    mp_clear(&fx);
+
+    return error;
+}
+
+/* Narrow a sign change between a and b down to a root, taking Newton steps
+ * that stay inside it and halving it when they don't make progress. Sign
+ * changes at poles (e.g. 1÷x at 0) are told apart by the value growing. */
+static MPErrorCode
+solve_bracket(MPEquationFunction *function, MPNumber *a, MPNumber *fa, MPNumber *b, MPNumber *fb,
+              const MPNumber *tolerance, MPNumber *z, gboolean *found)
+{
+    MPNumber x = mp_new(), fx = mp_new(), x1 = mp_new(), d = mp_new(), dx = mp_new();
+    MPNumber width = mp_new(), last_width = mp_new(), t = mp_new(), limit = mp_new();
+    MPErrorCode error = PARSER_ERR_NONE;
+    gboolean use_newton;
+    int i;
+
+    if (mp_is_zero(fb)) {
+        mp_set_from_mp(b, z);
+        *found = TRUE;
+    }
+
+    mp_abs(fa, &limit);
+    mp_abs(fb, &t);
+    if (mp_is_less_than(&t, &limit))
+        mp_set_from_mp(&t, &limit);
+
+    mp_add(a, b, &x);
+    mp_divide_integer(&x, 2, &x);
+    mp_subtract(b, a, &last_width);
+    mp_abs(&last_width, &last_width);
+    for (i = 0; i < SOLVE_MAX_ITERATIONS && !*found; i++) {
+        error = evaluate(function, &x, &fx);
+        if (error != PARSER_ERR_NONE || mp_is_complex(&fx))
+            break;
+        if (mp_is_zero(&fx)) {
+            mp_set_from_mp(&x, z);
+            *found = TRUE;
+            break;
+        }
+
+        if (mp_is_negative(&fx) == mp_is_negative(fa)) {
+            mp_set_from_mp(&x, a);
+            mp_set_from_mp(&fx, fa);
+        }
+        else {
+            mp_set_from_mp(&x, b);
+            mp_set_from_mp(&fx, fb);
+        }
+        mp_subtract(b, a, &width);
+        mp_abs(&width, &width);
+        if (is_converged(&width, &x, tolerance)) {
+            mp_abs(&fx, &t);
+            if (mp_is_less_equal(&t, &limit)) {
+                mp_set_from_mp(&x, z);
+                *found = TRUE;
+            }
+            break;
+        }
+
+        /* Newton steps are taken while they land inside the bracket and at least halve it */
+        use_newton = FALSE;
+        mp_divide_integer(&last_width, 2, &t);
+        if (mp_is_less_equal(&width, &t)) {
+            error = get_derivative(function, &x, &d);
+            if (error == PARSER_ERR_NONE && !mp_is_zero(&d)) {
+                mp_divide(&fx, &d, &dx);
+                mp_subtract(&x, &dx, &x1);
+                if (is_converged(&dx, &x1, tolerance)) {
+                    mp_set_from_mp(&x1, z);
+                    *found = TRUE;
+                    break;
+                }
+                mp_subtract(&x1, a, &t);
+                mp_subtract(&x1, b, &d);
+                mp_multiply(&t, &d, &t);
+                use_newton = mp_is_negative(&t);
+            }
+            else if (error != PARSER_ERR_NONE && !is_point_error(error))
+                break;
+            error = PARSER_ERR_NONE;
+        }
+        mp_set_from_mp(&width, &last_width);
+
+        if (use_newton)
+            mp_set_from_mp(&x1, &x);
+        else {
+            mp_add(a, b, &x);
+            mp_divide_integer(&x, 2, &x);
+        }
+    }
+
+    mp_clear(&x);
+    mp_clear(&fx);
+    mp_clear(&x1);
+    mp_clear(&d);
+    mp_clear(&dx);
+    mp_clear(&width);
+    mp_clear(&last_width);
+    mp_clear(&t);
+    mp_clear(&limit);
+
+    return is_point_error(error) ? PARSER_ERR_NONE : error;
+}
+
+MPErrorCode
+mp_equation_solve(const char *expression, const char *variable, const MPNumber *guess,
+                  MPEquationOptions *options, MPNumber *z, char **error_token)
+{
+    MPEquationFunction *function;
+    MPNumber tolerance, fx, a, fa, b, fb;
+    MPErrorCode error;
+    gboolean found = FALSE;
+
+    if (!(expression && variable && guess && options && z))
+        return PARSER_ERR_INVALID;
+
+    function = mp_equation_function_new(expression, variable, options, NULL);
+    tolerance = mp_new();
+    fx = mp_new();
+    get_tolerance(get_accuracy(options) + SOLVE_GUARD_DIGITS, &tolerance);
+
+    /* Syntax errors and unknown names are reported, not searched past */
+    error = mp_equation_function_evaluate(function, guess, &fx, error_token);
+    if (error == PARSER_ERR_NONE)
+        error = solve_newton(function, guess, &fx, &tolerance, z, &found);
+    else if (is_point_error(error)) {
+        mp_clear_error();
+        error = PARSER_ERR_NONE;
+    }
+
+    if (error == PARSER_ERR_NONE && !found && !mp_is_complex(guess)) {
+        a = mp_new();
+        fa = mp_new();
+        b = mp_new();
+        fb = mp_new();
+        error = find_bracket(function, guess, &a, &fa, &b, &fb, &found);
+        if (error == PARSER_ERR_NONE && found) {
+            found = FALSE;
+            error = solve_bracket(function, &a, &fa, &b, &fb, &tolerance, z, &found);
+        }
+        mp_clear(&a);
+        mp_clear(&fa);
+        mp_clear(&b);
+        mp_clear(&fb);
+    }
+
+    if (error == PARSER_ERR_NONE && !found) {
+        /* Translators: Error displayed when solve() can't find where an equation is zero */
+        mperr(_("No solution found"));
+        error = PARSER_ERR_MP;
+    }
+    if (error == PARSER_ERR_CANCELLED && options->context)
+        options->context->cancelled = true;
+
+    mp_equation_function_free(function);
+    mp_clear(&tolerance);
+    mp_clear(&fx);
+
+    return error;
+}
+
+/* State shared by the threads of one integration.
+ * Points of the current level are at t = k / 2^level for k = first, first + step, ... */
+typedef struct
+{
+    MPNumber center, radius, half_pi;
+    int level;
+    long first, step;
+
+    /* Held while calling the callbacks of the caller */
+    GMutex lock;
+
+    /* Set once a thread failed, so the others stop */
+    gint failed;
+} Quadrature;
+
+/* One thread evaluating its own copy of the equation */
+typedef struct
+{
+    Quadrature *quadrature;
+    MPEquationFunction *function;
+
+    /* Points of the level handled by this thread, and the sum of their weighted values */
+    guint first, last;
+    MPNumber sum;
+    MPErrorCode error;
+    char *error_token;
+    char *error_message;
+} Worker;
+
+/* Point x and weight w of the tanh-sinh rule for t = k / 2^level:
+ * x = c + r tanh(π/2 sinh t), w = π/2 cosh t / cosh²(π/2 sinh t) */
+static void
+get_point(Quadrature *quadrature, long k, MPNumber *x, MPNumber *w)
+{
+    MPNumber t = mp_new(), u = mp_new(), s = mp_new();
+
+    mp_set_from_fraction(k, 1L << quadrature->level, &t);
+    mp_sinh(&t, &s);
+    mp_multiply(&s, &quadrature->half_pi, &u);
+    mp_cosh(&t, &t);
+
+    mp_tanh(&u, &s);
+    mp_multiply(&s, &quadrature->radius, x);
+    mp_add(x, &quadrature->center, x);
+
+    mp_cosh(&u, &s);
+    mp_multiply(&s, &s, &s);
+    mp_multiply(&t, &quadrature->half_pi, w);
+    mp_divide(w, &s, w);
+
+    mp_clear(&t);
+    mp_clear(&u);
+    mp_clear(&s);
+}
+
+static gpointer
+integrate_thread(gpointer data)
+{
+    Worker *worker = data;
+    Quadrature *quadrature = worker->quadrature;
+    MPNumber x = mp_new(), w = mp_new(), fx = mp_new();
+    guint i;
+
+    mp_set_from_integer(0, &worker->sum);
+    worker->error = PARSER_ERR_NONE;
+    for (i = worker->first; i < worker->last && !g_atomic_int_get(&quadrature->failed); i++) {
+        get_point(quadrature, quadrature->first + (long) i * quadrature->step, &x, &w);
+        worker->error = mp_equation_function_evaluate(worker->function, &x, &fx, &worker->error_token);
+        if (worker->error != PARSER_ERR_NONE) {
+            /* Math errors are kept per thread, so the message is copied for the calling thread */
+            if (worker->error == PARSER_ERR_MP)
+                worker->error_message = g_strdup(mp_get_error());
+            g_atomic_int_set(&quadrature->failed, TRUE);
+            break;
+        }
+        mp_multiply(&w, &fx, &fx);
+        mp_add(&worker->sum, &fx, &worker->sum);
+    }
+    mp_clear(&x);
+    mp_clear(&w);
+    mp_clear(&fx);
+
+    return NULL;
+}
+
+MPErrorCode
+mp_equation_integrate(const char *expression, const char *variable, const MPNumber *a, const MPNumber *b,
+                      MPEquationOptions *options, int n_threads, MPNumber *z, char **error_token)
+{
+    Quadrature quadrature;
+    Worker *workers;
+    GThread **threads;
+    MPNumber tolerance, sum, estimate, previous;
+    MPErrorCode error = PARSER_ERR_NONE;
+    gboolean converged = FALSE;
+    guint max_workers, n_workers, n_points, i;
+    double t_max;
+    int digits;
+
+    if (!(expression && variable && a && b && options && z))
+        return PARSER_ERR_INVALID;
+
+    digits = get_accuracy(options) + INTEGRATE_GUARD_DIGITS;
+    tolerance = mp_new();
+    get_tolerance(digits, &tolerance);
+
+    /* Weights fall off double exponentially; beyond t_max they are below
+     * 10^-2digits, leaving room for integrands that grow at the ends */
+    t_max = log(4 * digits * G_LN10 / G_PI);
+
+    memset(&quadrature, 0, sizeof(Quadrature));
+    quadrature.center = mp_new();
+    quadrature.radius = mp_new();
+    quadrature.half_pi = mp_new();
+    mp_add(a, b, &quadrature.center);
+    mp_divide_integer(&quadrature.center, 2, &quadrature.center);
+    mp_subtract(b, a, &quadrature.radius);
+    mp_divide_integer(&quadrature.radius, 2, &quadrature.radius);
+    mp_get_pi(&quadrature.half_pi);
+    mp_divide_integer(&quadrature.half_pi, 2, &quadrature.half_pi);
+    g_mutex_init(&quadrature.lock);
+
+    max_workers = n_threads > 0 ? (guint) n_threads : g_get_num_processors();
+    max_workers = MAX(max_workers, 1);
+    workers = g_new0(Worker, max_workers);
+    threads = g_new(GThread *, max_workers);
+    for (i = 0; i < max_workers; i++) {
+        workers[i].quadrature = &quadrature;
+        workers[i].sum = mp_new();
+    }
+
+    sum = mp_new();
+    estimate = mp_new();
+    previous = mp_new();
+    for (quadrature.level = 0; quadrature.level <= INTEGRATE_MAX_LEVEL && !converged; quadrature.level++) {
+        long n_max = (long) (t_max * (1L << quadrature.level));
+
+        /* Each level adds the points halfway between those of the level before */
+        if (quadrature.level > 0) {
+            if (n_max % 2 == 0)
+                n_max--;
+            quadrature.step = 2;
+        }
+        else
+            quadrature.step = 1;
+        quadrature.first = -n_max;
+        n_points = 2 * n_max / quadrature.step + 1;
+
+        n_workers = CLAMP(n_points / POINTS_PER_THREAD, 1, max_workers);
+        for (i = 0; i < n_workers; i++) {
+            Worker *worker = &workers[i];
+
+            if (worker->function == NULL)
+                worker->function = mp_equation_function_new(expression, variable, options, &quadrature.lock);
+            worker->first = n_points * i / n_workers;
+            worker->last = n_points * (i + 1) / n_workers;
+        }
+        if (n_workers == 1)
+            integrate_thread(&workers[0]);
+        else {
+            for (i = 0; i < n_workers; i++)
+                threads[i] = g_thread_new("mp-integrate", integrate_thread, &workers[i]);
+            for (i = 0; i < n_workers; i++)
+                g_thread_join(threads[i]);
+        }
+
+        /* Sums are added in order so the result doesn't depend on thread scheduling */
+        for (i = 0; i < n_workers && error == PARSER_ERR_NONE; i++) {
+            Worker *worker = &workers[i];
+
+            if (worker->error != PARSER_ERR_NONE) {
+                error = worker->error;
+                mp_clear_error();
+                if (worker->error_message != NULL)
+                    mperr("%s", worker->error_message);
+                if (error_token != NULL) {
+                    *error_token = worker->error_token;
+                    worker->error_token = NULL;
+                }
+            }
+            else
+                mp_add(&sum, &worker->sum, &sum);
+        }
+        if (error != PARSER_ERR_NONE)
+            break;
+
+        mp_multiply(&sum, &quadrature.radius, &estimate);
+        mp_divide_integer(&estimate, 1L << quadrature.level, &estimate);
+        if (quadrature.level >= INTEGRATE_MIN_LEVEL) {
+            mp_subtract(&estimate, &previous, &previous);
+            converged = is_converged(&previous, &estimate, &tolerance);
+        }
+        mp_set_from_mp(&estimate, &previous);
+    }
+
+    if (converged)
+        mp_set_from_mp(&estimate, z);
+    else if (error == PARSER_ERR_NONE) {
+        /* Translators: Error displayed when the value of integrate() can't be found to the accuracy shown */
+        mperr(_("Integral did not converge"));
+        error = PARSER_ERR_MP;
+    }
+    if (error == PARSER_ERR_CANCELLED && options->context)
+        options->context->cancelled = true;
+
+    for (i = 0; i < max_workers; i++) {
+        mp_equation_function_free(workers[i].function);
+        mp_clear(&workers[i].sum);
+        g_free(workers[i].error_token);
+        g_free(workers[i].error_message);
+    }
+    g_free(threads);
+    g_free(workers);
+    g_mutex_clear(&quadrature.lock);
+    mp_clear(&quadrature.center);
+    mp_clear(&quadrature.radius);
+    mp_clear(&quadrature.half_pi);
+    mp_clear(&tolerance);
+    mp_clear(&sum);
+    mp_clear(&estimate);
+    mp_clear(&previous);
+
+    return error;
+}
@@ -0,0 +1,26 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef MP_CALCULUS_H
+#define MP_CALCULUS_H
+
+#include "mp-equation.h"
+
+/* Find a value of variable near guess where expression is zero. Newton's method
+ * is tried first, falling back to bisection once a sign change is found.
+ * Results are accurate to the number of digits set in options. */
+MPErrorCode mp_equation_solve(const char *expression, const char *variable, const MPNumber *guess,
+                              MPEquationOptions *options, MPNumber *z, char **error_token);
+
+/* Integrate expression over variable from a to b with tanh-sinh quadrature,
+ * evaluating the points of each level on n_threads threads (0 for one per
+ * processor). The callbacks in options are only called from one thread at a time. */
+MPErrorCode mp_equation_integrate(const char *expression, const char *variable, const MPNumber *a, const MPNumber *b,
+                                  MPEquationOptions *options, int n_threads, MPNumber *z, char **error_token);
+
+#endif /* MP_CALCULUS_H */
@@ -107,6 +107,47 @@ mp_to_double(const MPNumber *x)
     return mpfr_get_d(mpc_realref(x->num), MPFR_RNDN);
 }
 
+/* Real part, followed by the imaginary part if not zero, e.g. "0x1.8p+1 -0x1p-2" */
+gchar *
+mp_to_exact_string(const MPNumber *x)
+{
+    char *re, *im = NULL;
+    gchar *text;
+
+    mpfr_asprintf(&re, "%Ra", mpc_realref(x->num));
+    if (!mpfr_zero_p(mpc_imagref(x->num)))
+        mpfr_asprintf(&im, "%Ra", mpc_imagref(x->num));
+    text = im ? g_strdup_printf("%s %s", re, im) : g_strdup(re);
+    mpfr_free_str(re);
+    if (im)
+        mpfr_free_str(im);
+
+    return text;
+}
+
+bool
+mp_set_from_exact_string(const char *text, MPNumber *z)
+{
+    char *end;
+
+    mpfr_strtofr(mpc_realref(z->num), text, &end, 0, MPFR_RNDN);
+    if (end == text)
+        return false;
+    while (*end == ' ')
+        end++;
+    if (*end == '\0') {
+        mpfr_set_zero(mpc_imagref(z->num), 0);
+        return true;
+    }
+
+    text = end;
+    mpfr_strtofr(mpc_imagref(z->num), text, &end, 0, MPFR_RNDN);
+    if (end == text)
+        return false;
+
+    return *end == '\0';
+}
+
 static int
 char_val(char **c, int base)
 {
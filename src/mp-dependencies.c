@@ -0,0 +1,656 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "mp-dependencies.h"
+
+/* Levels with fewer definitions are evaluated on the calling thread, starting
+ * threads for them costs more than it saves */
+#define MIN_PARALLEL_LEVEL 4
+
+/* Variable defined by an equation */
+typedef struct
+{
+    char *name;
+    char *expression;
+    MPCompiledEquation *equation;
+
+    /* Names of the variables the equation read */
+    GPtrArray *reads;
+
+    /* State while updating: number of variables read that are still to be
+     * recalculated, and the new value or the error recalculating it */
+    gboolean affected;
+    guint pending;
+    gboolean failed;
+    MPNumber value;
+    MPErrorCode error;
+    char *error_token;
+    char *error_message;
+} Definition;
+
+struct MPDependencies
+{
+    /* Protects everything below, held while updating */
+    GMutex lock;
+
+    /* Name -> Definition */
+    GHashTable *definitions;
+
+    /* Name -> GPtrArray of the Definitions that read it */
+    GHashTable *readers;
+
+    /* Threads helping evaluate large levels, started on first use and kept */
+    GThreadPool *pool;
+};
+
+/* Callbacks of the caller wrapped for one evaluation */
+typedef struct
+{
+    MPEquationOptions *parent;
+
+    /* Held while calling the callbacks of the caller, or NULL */
+    GMutex *lock;
+
+    MPEquationOptions options;
+    MPEvalContext context;
+
+    /* Names of the variables read, and if any of them change on every read (e.g. rand) */
+    GPtrArray *reads;
+    gboolean volatile_read;
+
+    /* Last variable assigned and the number of assignments */
+    char *assigned;
+    guint n_assigned;
+
+    /* Assignments are stored here instead of made if not NULL */
+    MPNumber *value;
+} Evaluation;
+
+/* Definitions evaluated together, they don't read each other */
+typedef struct
+{
+    GPtrArray *definitions;
+    gint next;
+    MPEquationOptions *options;
+    GMutex lock;
+
+    /* Pool threads still evaluating, signalled by done */
+    guint running;
+    GCond done;
+} Level;
+
+static void
+evaluation_lock(Evaluation *evaluation)
+{
+    if (evaluation->lock)
+        g_mutex_lock(evaluation->lock);
+}
+
+static void
+evaluation_unlock(Evaluation *evaluation)
+{
+    if (evaluation->lock)
+        g_mutex_unlock(evaluation->lock);
+}
+
+static int
+evaluation_variable_is_defined(const char *name, void *data)
+{
+    Evaluation *evaluation = data;
+    MPEquationOptions *options = evaluation->parent;
+    int result;
+
+    evaluation_lock(evaluation);
+    result = options->variable_is_defined(name, options->callback_data);
+    evaluation_unlock(evaluation);
+
+    return result;
+}
+
+static int
+evaluation_variable_is_volatile(const char *name, void *data)
+{
+    Evaluation *evaluation = data;
+    MPEquationOptions *options = evaluation->parent;
+    int result;
+
+    evaluation_lock(evaluation);
+    result = options->variable_is_volatile(name, options->callback_data);
+    evaluation_unlock(evaluation);
+
+    return result;
+}
+
+static int
+evaluation_get_variable(const char *name, MPNumber *z, void *data)
+{
+    Evaluation *evaluation = data;
+    MPEquationOptions *options = evaluation->parent;
+    int result;
+    guint i;
+
+    evaluation_lock(evaluation);
+    result = options->get_variable(name, z, options->callback_data);
+    if (options->variable_is_volatile && options->variable_is_volatile(name, options->callback_data))
+        evaluation->volatile_read = TRUE;
+    evaluation_unlock(evaluation);
+
+    /* Undefined variables are recorded too, the equation may work once they are defined */
+    for (i = 0; i < evaluation->reads->len; i++) {
+        if (strcmp(g_ptr_array_index(evaluation->reads, i), name) == 0)
+            return result;
+    }
+    g_ptr_array_add(evaluation->reads, g_strdup(name));
+
+    return result;
+}
+
+static void
+evaluation_set_variable(const char *name, const MPNumber *x, void *data)
+{
+    Evaluation *evaluation = data;
+    MPEquationOptions *options = evaluation->parent;
+
+    g_free(evaluation->assigned);
+    evaluation->assigned = g_strdup(name);
+    evaluation->n_assigned++;
+
+    if (evaluation->value)
+        mp_set_from_mp(x, evaluation->value);
+    else if (options->set_variable) {
+        evaluation_lock(evaluation);
+        options->set_variable(name, x, options->callback_data);
+        evaluation_unlock(evaluation);
+    }
+}
+
+static int
+evaluation_function_is_defined(const char *name, void *data)
+{
+    Evaluation *evaluation = data;
+    MPEquationOptions *options = evaluation->parent;
+    int result;
+
+    evaluation_lock(evaluation);
+    result = options->function_is_defined(name, options->callback_data);
+    evaluation_unlock(evaluation);
+
+    return result;
+}
+
+static int
+evaluation_get_function(const char *name, const MPNumber *x, MPNumber *z, void *data)
+{
+    Evaluation *evaluation = data;
+    MPEquationOptions *options = evaluation->parent;
+    int result;
+
+    evaluation_lock(evaluation);
+    result = options->get_function(name, x, z, options->callback_data);
+    evaluation_unlock(evaluation);
+
+    return result;
+}
+
+static int
+evaluation_convert(const MPNumber *x, const char *x_units, const char *z_units, MPNumber *z, void *data)
+{
+    Evaluation *evaluation = data;
+    MPEquationOptions *options = evaluation->parent;
+    int result;
+
+    evaluation_lock(evaluation);
+    result = options->convert(x, x_units, z_units, z, options->callback_data);
+    evaluation_unlock(evaluation);
+
+    return result;
+}
+
+static void
+evaluation_init(Evaluation *evaluation, MPEquationOptions *options, GMutex *lock, MPNumber *value)
+{
+    memset(evaluation, 0, sizeof(Evaluation));
+    evaluation->parent = options;
+    evaluation->lock = lock;
+    evaluation->reads = g_ptr_array_new_with_free_func(g_free);
+    evaluation->value = value;
+
+    evaluation->options.base = options->base;
+    evaluation->options.wordlen = options->wordlen;
+    evaluation->options.angle_units = options->angle_units;
+    evaluation->options.accuracy = options->accuracy;
+    evaluation->options.callback_data = evaluation;
+    if (options->variable_is_defined)
+        evaluation->options.variable_is_defined = evaluation_variable_is_defined;
+    if (options->get_variable)
+        evaluation->options.get_variable = evaluation_get_variable;
+    if (options->variable_is_volatile)
+        evaluation->options.variable_is_volatile = evaluation_variable_is_volatile;
+    evaluation->options.set_variable = evaluation_set_variable;
+    if (options->function_is_defined)
+        evaluation->options.function_is_defined = evaluation_function_is_defined;
+    if (options->get_function)
+        evaluation->options.get_function = evaluation_get_function;
+    if (options->convert)
+        evaluation->options.convert = evaluation_convert;
+
+    /* Each evaluation counts its own steps against the same limits */
+    if (options->context) {
+        mp_eval_context_init(&evaluation->context, options->context->cancellable, 0, options->context->max_steps);
+        evaluation->context.deadline = options->context->deadline;
+        evaluation->options.context = &evaluation->context;
+    }
+}
+
+static void
+evaluation_clear(Evaluation *evaluation)
+{
+    if (evaluation->options.context)
+        mp_eval_context_clear(&evaluation->context);
+    g_ptr_array_unref(evaluation->reads);
+    g_free(evaluation->assigned);
+}
+
+static void
+definition_free(Definition *definition)
+{
+    g_free(definition->name);
+    g_free(definition->expression);
+    mp_compiled_equation_free(definition->equation);
+    g_ptr_array_unref(definition->reads);
+    mp_clear(&definition->value);
+    g_free(definition->error_token);
+    g_free(definition->error_message);
+    g_free(definition);
+}
+
+static void
+remove_definition(MPDependencies *dependencies, const char *name)
+{
+    Definition *definition;
+    guint i;
+
+    definition = g_hash_table_lookup(dependencies->definitions, name);
+    if (!definition)
+        return;
+
+    for (i = 0; i < definition->reads->len; i++) {
+        const char *read = g_ptr_array_index(definition->reads, i);
+        GPtrArray *readers = g_hash_table_lookup(dependencies->readers, read);
+
+        g_ptr_array_remove_fast(readers, definition);
+        if (readers->len == 0)
+            g_hash_table_remove(dependencies->readers, read);
+    }
+    g_hash_table_remove(dependencies->definitions, name);
+}
+
+static void
+add_definition(MPDependencies *dependencies, const char *name, const char *expression,
+               MPCompiledEquation *equation, GPtrArray *reads)
+{
+    Definition *definition;
+    guint i;
+
+    remove_definition(dependencies, name);
+
+    definition = g_malloc0(sizeof(Definition));
+    definition->name = g_strdup(name);
+    definition->expression = g_strdup(expression);
+    definition->equation = equation;
+    definition->reads = g_ptr_array_ref(reads);
+    definition->value = mp_new();
+    g_hash_table_insert(dependencies->definitions, definition->name, definition);
+
+    for (i = 0; i < reads->len; i++) {
+        const char *read = g_ptr_array_index(reads, i);
+        GPtrArray *readers = g_hash_table_lookup(dependencies->readers, read);
+
+        if (!readers) {
+            readers = g_ptr_array_new();
+            g_hash_table_insert(dependencies->readers, g_strdup(read), readers);
+        }
+        g_ptr_array_add(readers, definition);
+    }
+}
+
+/* Add the definitions that depend on name to affected, each once */
+static void
+find_affected(MPDependencies *dependencies, const char *name, GPtrArray *affected)
+{
+    guint i, j;
+
+    /* Definitions already found are searched in turn for their readers */
+    for (i = affected->len; ; i++) {
+        GPtrArray *readers = g_hash_table_lookup(dependencies->readers, name);
+
+        for (j = 0; readers && j < readers->len; j++) {
+            Definition *definition = g_ptr_array_index(readers, j);
+
+            if (definition->affected)
+                continue;
+            definition->affected = TRUE;
+            g_ptr_array_add(affected, definition);
+        }
+
+        if (i >= affected->len)
+            break;
+        name = ((Definition *) g_ptr_array_index(affected, i))->name;
+    }
+}
+
+/* Check if name is read by an equation that reads, directly or not, one of reads */
+static gboolean
+makes_cycle(MPDependencies *dependencies, const char *name, GPtrArray *reads)
+{
+    GPtrArray *affected;
+    gboolean cycle = FALSE;
+    guint i, j;
+
+    affected = g_ptr_array_new();
+    find_affected(dependencies, name, affected);
+    for (i = 0; i < reads->len && !cycle; i++) {
+        const char *read = g_ptr_array_index(reads, i);
+
+        if (strcmp(read, name) == 0)
+            cycle = TRUE;
+        for (j = 0; j < affected->len && !cycle; j++)
+            cycle = strcmp(((Definition *) g_ptr_array_index(affected, j))->name, read) == 0;
+    }
+    for (i = 0; i < affected->len; i++)
+        ((Definition *) g_ptr_array_index(affected, i))->affected = FALSE;
+    g_ptr_array_free(affected, TRUE);
+
+    return cycle;
+}
+
+/* Evaluate the equation of definition into its value. Math errors are kept per
+ * thread, so they are copied to be reported on the calling thread. */
+static void
+evaluate_definition(Definition *definition, MPEquationOptions *options, GMutex *lock)
+{
+    Evaluation evaluation;
+    MPNumber result = mp_new();
+
+    /* Variables calculated from ones that failed keep their values */
+    if (definition->failed) {
+        mp_clear(&result);
+        return;
+    }
+
+    evaluation_init(&evaluation, options, lock, &definition->value);
+    definition->error = mp_compiled_equation_evaluate(definition->equation, &evaluation.options, &result, &definition->error_token);
+    if (definition->error == PARSER_ERR_NONE && evaluation.n_assigned != 1)
+        definition->error = PARSER_ERR_INVALID;
+    if (definition->error != PARSER_ERR_NONE) {
+        definition->failed = TRUE;
+        if (definition->error == PARSER_ERR_MP)
+            definition->error_message = g_strdup(mp_get_error());
+    }
+    evaluation_clear(&evaluation);
+    mp_clear(&result);
+}
+
+static void
+level_evaluate(Level *level)
+{
+    gint i;
+
+    while ((i = g_atomic_int_add(&level->next, 1)) < (gint) level->definitions->len)
+        evaluate_definition(g_ptr_array_index(level->definitions, i), level->options, &level->lock);
+}
+
+static void
+level_job(gpointer data, gpointer user_data)
+{
+    Level *level = data;
+
+    level_evaluate(level);
+
+    g_mutex_lock(&level->lock);
+    if (--level->running == 0)
+        g_cond_signal(&level->done);
+    g_mutex_unlock(&level->lock);
+}
+
+static void
+evaluate_level(MPDependencies *dependencies, GPtrArray *definitions, MPEquationOptions *options)
+{
+    Level level;
+    guint i, n_threads;
+
+    n_threads = MIN(definitions->len, g_get_num_processors());
+    if (definitions->len < MIN_PARALLEL_LEVEL || n_threads < 2) {
+        for (i = 0; i < definitions->len; i++)
+            evaluate_definition(g_ptr_array_index(definitions, i), options, NULL);
+        return;
+    }
+
+    /* The calling thread evaluates too */
+    if (!dependencies->pool)
+        dependencies->pool = g_thread_pool_new(level_job, NULL, g_get_num_processors() - 1, FALSE, NULL);
+
+    level.definitions = definitions;
+    level.next = 0;
+    level.options = options;
+    level.running = n_threads - 1;
+    g_mutex_init(&level.lock);
+    g_cond_init(&level.done);
+
+    for (i = 1; i < n_threads; i++)
+        g_thread_pool_push(dependencies->pool, &level, NULL);
+    level_evaluate(&level);
+
+    g_mutex_lock(&level.lock);
+    while (level.running > 0)
+        g_cond_wait(&level.done, &level.lock);
+    g_mutex_unlock(&level.lock);
+
+    g_cond_clear(&level.done);
+    g_mutex_clear(&level.lock);
+}
+
+/* Recalculate everything that depends on name, a level at a time */
+static MPErrorCode
+update_affected(MPDependencies *dependencies, const char *name, MPEquationOptions *options, char **error_token)
+{
+    GPtrArray *affected, *level, *next_level, *t;
+    MPErrorCode error = PARSER_ERR_NONE;
+    guint i, j;
+
+    affected = g_ptr_array_new();
+    find_affected(dependencies, name, affected);
+
+    /* Count the variables each one reads that are recalculated first */
+    level = g_ptr_array_new();
+    for (i = 0; i < affected->len; i++) {
+        Definition *definition = g_ptr_array_index(affected, i);
+
+        definition->pending = 0;
+        definition->failed = FALSE;
+        definition->error = PARSER_ERR_NONE;
+        for (j = 0; j < definition->reads->len; j++) {
+            Definition *read = g_hash_table_lookup(dependencies->definitions, g_ptr_array_index(definition->reads, j));
+            if (read && read->affected)
+                definition->pending++;
+        }
+        if (definition->pending == 0)
+            g_ptr_array_add(level, definition);
+    }
+
+    next_level = g_ptr_array_new();
+    while (level->len > 0) {
+        evaluate_level(dependencies, level, options);
+
+        /* Values are set on this thread, in the same order every time */
+        for (i = 0; i < level->len; i++) {
+            Definition *definition = g_ptr_array_index(level, i);
+            GPtrArray *readers;
+
+            if (!definition->failed) {
+                if (options->set_variable)
+                    options->set_variable(definition->name, &definition->value, options->callback_data);
+            }
+            else if (error == PARSER_ERR_NONE && definition->error != PARSER_ERR_NONE) {
+                error = definition->error;
+                if (error_token) {
+                    *error_token = definition->error_token;
+                    definition->error_token = NULL;
+                }
+                mp_clear_error();
+                if (definition->error_message)
+                    mperr("%s", definition->error_message);
+            }
+
+            readers = g_hash_table_lookup(dependencies->readers, definition->name);
+            for (j = 0; readers && j < readers->len; j++) {
+                Definition *reader = g_ptr_array_index(readers, j);
+
+                if (!reader->affected)
+                    continue;
+                if (definition->failed)
+                    reader->failed = TRUE;
+                if (--reader->pending == 0)
+                    g_ptr_array_add(next_level, reader);
+            }
+        }
+
+        t = level;
+        level = next_level;
+        next_level = t;
+        g_ptr_array_set_size(next_level, 0);
+    }
+
+    for (i = 0; i < affected->len; i++) {
+        Definition *definition = g_ptr_array_index(affected, i);
+
+        definition->affected = FALSE;
+        g_clear_pointer(&definition->error_token, g_free);
+        g_clear_pointer(&definition->error_message, g_free);
+    }
+    g_ptr_array_free(affected, TRUE);
+    g_ptr_array_free(level, TRUE);
+    g_ptr_array_free(next_level, TRUE);
+
+    return error;
+}
+
+MPDependencies *
+mp_dependencies_new(void)
+{
+    MPDependencies *dependencies;
+
+    dependencies = g_malloc0(sizeof(MPDependencies));
+    g_mutex_init(&dependencies->lock);
+    dependencies->definitions = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) definition_free);
+    dependencies->readers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+
+    return dependencies;
+}
+
+MPErrorCode
+mp_dependencies_parse(MPDependencies *dependencies, const char *expression, MPEquationOptions *options,
+                      MPNumber *result, char **error_token)
+{
+    MPCompiledEquation *equation;
+    Evaluation evaluation;
+    MPErrorCode error;
+
+    if (!(dependencies && expression && options && result) || strlen(expression) == 0)
+        return PARSER_ERR_INVALID;
+
+    evaluation_init(&evaluation, options, NULL, NULL);
+    equation = mp_equation_compile(expression, &evaluation.options);
+    error = mp_compiled_equation_evaluate(equation, &evaluation.options, result, error_token);
+
+    if (error == PARSER_ERR_NONE && evaluation.n_assigned == 1) {
+        g_mutex_lock(&dependencies->lock);
+
+        /* Keep equations that only read other variables with stable values, e.g. not x=x+1 or x=rand */
+        if (evaluation.reads->len > 0 && !evaluation.volatile_read &&
+            !makes_cycle(dependencies, evaluation.assigned, evaluation.reads)) {
+            add_definition(dependencies, evaluation.assigned, expression, equation, evaluation.reads);
+            equation = NULL;
+        }
+        else
+            remove_definition(dependencies, evaluation.assigned);
+
+        /* The assignment stands even if variables calculated from it can't be updated */
+        update_affected(dependencies, evaluation.assigned, options, NULL);
+
+        g_mutex_unlock(&dependencies->lock);
+    }
+
+    mp_compiled_equation_free(equation);
+    evaluation_clear(&evaluation);
+
+    return error;
+}
+
+MPErrorCode
+mp_dependencies_update(MPDependencies *dependencies, const char *name, MPEquationOptions *options, char **error_token)
+{
+    MPErrorCode error;
+
+    if (!(dependencies && name && options))
+        return PARSER_ERR_INVALID;
+
+    g_mutex_lock(&dependencies->lock);
+    remove_definition(dependencies, name);
+    error = update_affected(dependencies, name, options, error_token);
+    g_mutex_unlock(&dependencies->lock);
+
+    return error;
+}
+
+gchar *
+mp_dependencies_get_equation(MPDependencies *dependencies, const char *name)
+{
+    Definition *definition;
+    gchar *expression = NULL;
+
+    if (!(dependencies && name))
+        return NULL;
+
+    g_mutex_lock(&dependencies->lock);
+    definition = g_hash_table_lookup(dependencies->definitions, name);
+    if (definition)
+        expression = g_strdup(definition->expression);
+    g_mutex_unlock(&dependencies->lock);
+
+    return expression;
+}
+
+void
+mp_dependencies_clear(MPDependencies *dependencies)
+{
+    if (!dependencies)
+        return;
+
+    g_mutex_lock(&dependencies->lock);
+    g_hash_table_remove_all(dependencies->readers);
+    g_hash_table_remove_all(dependencies->definitions);
+    g_mutex_unlock(&dependencies->lock);
+}
+
+void
+mp_dependencies_free(MPDependencies *dependencies)
+{
+    if (!dependencies)
+        return;
+
+    if (dependencies->pool)
+        g_thread_pool_free(dependencies->pool, FALSE, TRUE);
+    g_hash_table_unref(dependencies->readers);
+    g_hash_table_unref(dependencies->definitions);
+    g_mutex_clear(&dependencies->lock);
+    g_free(dependencies);
+}
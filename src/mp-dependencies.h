@@ -0,0 +1,45 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef MP_DEPENDENCIES_H
+#define MP_DEPENDENCIES_H
+
+#include "mp-equation.h"
+
+/* Variables defined by the equations that assigned them, recalculated like
+ * spreadsheet cells when the variables they read change. e.g. after b=a×2,
+ * setting a also sets b. Safe to use from any thread, but the callbacks in
+ * options are only called by one thread at a time. */
+typedef struct MPDependencies MPDependencies;
+
+MPDependencies *mp_dependencies_new(void);
+
+/* Evaluate expression like mp_equation_parse(). If it assigns a variable, the
+ * equation is kept in place of any the variable had and evaluated again when a
+ * variable it read changes. Equations that read the variable they assign, or
+ * a variable calculated from it, only set a value. The variables that depend on
+ * the one assigned are then updated as by mp_dependencies_update(). */
+MPErrorCode mp_dependencies_parse(MPDependencies *dependencies, const char *expression, MPEquationOptions *options,
+                                  MPNumber *result, char **error_token);
+
+/* Recalculate the variables that depend on name, after it was set or deleted
+ * some other way, with options->set_variable called for each. Variables are
+ * set in dependency order and variables that don't depend on each other are
+ * evaluated in parallel. The equation of name is dropped. Variables depending
+ * on one that failed are left unchanged, and the first error is returned. */
+MPErrorCode mp_dependencies_update(MPDependencies *dependencies, const char *name, MPEquationOptions *options,
+                                   char **error_token);
+
+/* Returns the equation that defines name, or NULL if it is only a value. Free with g_free() */
+gchar *mp_dependencies_get_equation(MPDependencies *dependencies, const char *name);
+
+void mp_dependencies_clear(MPDependencies *dependencies);
+
+void mp_dependencies_free(MPDependencies *dependencies);
+
+#endif /* MP_DEPENDENCIES_H */
@@ -13,30 +13,56 @@
 #include <string.h>
 #include <stdlib.h>
 #include "parser.h"
+#include "parserfunc.h"
+#include "mp-stats.h"
 
+/* Built-in constants. These can't be redefined by the user. */
 static int
-variable_is_defined(ParserState *state, const char *name)
+builtin_variable_is_defined(const char *name)
 {
     /* FIXME: Make more generic */
-    if (strcmp(name, "e") == 0 ||
-        strcmp(name, "i") == 0 ||
-        strcmp(name, "π") == 0 ||
-        strcmp(name, "pi") == 0 ||
-        strcmp(name, "c₀") == 0 ||
-        strcmp(name, "μ₀") == 0 ||
-        strcmp(name, "ε₀") == 0 ||
-        strcmp(name, "G") == 0 ||
-        strcmp(name, "h") == 0 ||
-        strcmp(name, "ｅ") == 0 ||
-        strcmp(name, "mₑ") == 0 ||
-        strcmp(name, "mₚ") == 0 ||
-        strcmp(name, "Nₐ") == 0)
+    return strcmp(name, "e") == 0 ||
+           strcmp(name, "i") == 0 ||
+           strcmp(name, "π") == 0 ||
+           strcmp(name, "pi") == 0 ||
+           strcmp(name, "c₀") == 0 ||
+           strcmp(name, "μ₀") == 0 ||
+           strcmp(name, "ε₀") == 0 ||
+           strcmp(name, "G") == 0 ||
+           strcmp(name, "h") == 0 ||
+           strcmp(name, "ｅ") == 0 ||
+           strcmp(name, "mₑ") == 0 ||
+           strcmp(name, "mₚ") == 0 ||
+           strcmp(name, "Nₐ") == 0;
+}
+
+static int
+variable_is_defined(ParserState *state, const char *name)
+{
+    if (builtin_variable_is_defined(name))
         return 1;
     if (state->options->variable_is_defined)
         return state->options->variable_is_defined(name, state->options->callback_data);
     return 0;
 }
 
+/* Built-in constants always evaluate to the same value. */
+static int
+variable_is_constant(ParserState *state, const char *name)
+{
+    return builtin_variable_is_defined(name);
+}
+
+static int
+variable_is_volatile(ParserState *state, const char *name)
+{
+    if (builtin_variable_is_defined(name))
+        return 0;
+    if (state->options->variable_is_volatile)
+        return state->options->variable_is_volatile(name, state->options->callback_data);
+    return 0;
+}
+
 static int
 get_variable(ParserState *state, const char *name, MPNumber *z)
 {
@@ -78,19 +104,7 @@ static void
 set_variable(ParserState *state, const char *name, const MPNumber *x)
 {
     // Reserved words, e, π, mod, and, or, xor, not, abs, log, ln, sqrt, int, frac, sin, cos, ...
-    if (strcmp(name, "e") == 0 ||
-        strcmp(name, "i") == 0 ||
-        strcmp(name, "π") == 0 ||
-        strcmp(name, "pi") == 0 ||
-        strcmp(name, "c₀") == 0 ||
-        strcmp(name, "μ₀") == 0 ||
-        strcmp(name, "ε₀") == 0 ||
-        strcmp(name, "G") == 0 ||
-        strcmp(name, "h") == 0 ||
-        strcmp(name, "ｅ") == 0 ||
-        strcmp(name, "mₑ") == 0 ||
-        strcmp(name, "mₚ") == 0 ||
-        strcmp(name, "Nₐ") == 0)
+    if (builtin_variable_is_defined(name))
         return; // FALSE
 
     if (state->options->set_variable)
@@ -141,17 +155,19 @@ super_atoi(const char *data)
    return sign * value;
 }
 
+/* Built-in functions. These are looked up before user defined ones. */
 static int
-function_is_defined(ParserState *state, const char *name)
+builtin_function_is_defined(const char *name)
 {
     char *c, *lower_name;
+    int result;
 
     lower_name = strdup(name);
     for (c = lower_name; *c; c++)
         *c = tolower(*c);
 
     /* FIXME: Make more generic */
-    if (strcmp(lower_name, "log") == 0 ||
+    result = strcmp(lower_name, "log") == 0 ||
         (strncmp(lower_name, "log", 3) == 0 && sub_atoi(lower_name + 3) >= 0) ||
         strcmp(lower_name, "ln") == 0 ||
         strcmp(lower_name, "sqrt") == 0 ||
@@ -174,17 +190,31 @@ function_is_defined(ParserState *state, const char *name)
         strcmp(lower_name, "erf") == 0 || strcmp(lower_name, "zeta") == 0 ||
         strcmp(lower_name, "asinh") == 0 || strcmp(lower_name, "acosh") == 0 || strcmp(lower_name, "atanh") == 0 ||
         strcmp(lower_name, "ones") == 0 ||
-        strcmp(lower_name, "twos") == 0) {
-        g_free (lower_name);
-        return 1;
-    }
-    g_free (lower_name);
+        strcmp(lower_name, "twos") == 0 ||
+        strcmp(lower_name, "solve") == 0 ||
+        strcmp(lower_name, "integrate") == 0;
+    free (lower_name);
+
+    return result;
+}
 
+static int
+function_is_defined(ParserState *state, const char *name)
+{
+    if (builtin_function_is_defined(name))
+        return 1;
     if (state->options->function_is_defined)
         return state->options->function_is_defined(name, state->options->callback_data);
     return 0;
 }
 
+/* Built-in functions depend only on their argument, angle units and word length. */
+static int
+function_is_constant(ParserState *state, const char *name)
+{
+    return builtin_function_is_defined(name);
+}
+
 static int
 get_function(ParserState *state, const char *name, const MPNumber *x, MPNumber *z)
 {
@@ -285,51 +315,912 @@ convert(ParserState *state, const MPNumber *x, const char *x_units, const char *
         return 0;
 }
 
-MPErrorCode
-mp_equation_parse(const char *expression, MPEquationOptions *options, MPNumber *result, char **error_token)
+/* Parse tree of an equation, kept so it can be evaluated repeatedly */
+struct MPCompiledEquation
 {
-    int ret;
-    int err;
-    ParserState* state;
-    state = p_create_parser (expression, options);
+    /* Equation text */
+    char *expression;
 
-    if (!(expression && result) || strlen(expression) == 0)
-        return PARSER_ERR_INVALID;
+    /* Copy of the options used for the last evaluation, the parser refers to it */
+    MPEquationOptions options;
+
+    ParserState *state;
+
+    /* Error found while parsing, reported on every evaluation */
+    MPErrorCode error;
+    char *error_token;
+};
 
+ParserState *
+mp_equation_create_parser(const char *expression, MPEquationOptions *options)
+{
+    ParserState *state;
+
+    state = p_create_parser (expression, options);
     state->variable_is_defined = variable_is_defined;
     state->get_variable = get_variable;
     state->set_variable = set_variable;
     state->function_is_defined = function_is_defined;
     state->get_function = get_function;
     state->convert = convert;
+    state->variable_is_constant = variable_is_constant;
+    state->variable_is_volatile = variable_is_volatile;
+    state->function_is_constant = function_is_constant;
     state->error = 0;
+
+    return state;
+}
+
+static void
+compile(MPCompiledEquation *equation)
+{
+    ParserState *state;
+    gint64 start;
+    guint ret;
+
+    state = mp_equation_create_parser (equation->expression, &equation->options);
+    equation->state = state;
+
     mp_clear_error();
-    ret = p_parse (state);
-    if (state->error_token != NULL && error_token != NULL) {
-        *error_token = state->error_token;
-    }
-    /* Error during parsing */
-    if (state->error) {
-	err = state->error;
-        p_destroy_parser (state);
-        return err;
+    start = mp_stats_span_begin();
+    l_insert_all_tokens (state->lexer);
+    mp_stats_span_end(MP_STATS_LEX, start);
+    start = mp_stats_span_begin();
+    ret = p_parse_tokens (state);
+    mp_stats_span_end(MP_STATS_PARSE, start);
+    if (state->error)
+        equation->error = state->error;
+    else if (ret)
+        equation->error = PARSER_ERR_INVALID;
+    else
+        equation->error = PARSER_ERR_NONE;
+    equation->error_token = state->error_token;
+    state->error_token = NULL;
+}
+
+static void
+decompile(MPCompiledEquation *equation)
+{
+    if (equation->state)
+        p_destroy_parser (equation->state);
+    equation->state = NULL;
+    g_free (equation->error_token);
+    equation->error_token = NULL;
+}
+
+MPCompiledEquation *
+mp_equation_compile(const char *expression, MPEquationOptions *options)
+{
+    MPCompiledEquation *equation;
+
+    if (!expression || strlen(expression) == 0)
+        return NULL;
+
+    equation = g_malloc0(sizeof(MPCompiledEquation));
+    equation->expression = g_strdup(expression);
+    equation->options = *options;
+    compile(equation);
+
+    return equation;
+}
+
+/* Parse trees edited more than this are rebuilt from scratch, so old tokens and nodes don't pile up in the arena */
+#define MAX_UPDATE_ARENA_SIZE (256 * 1024)
+
+MPErrorCode
+mp_compiled_equation_update(MPCompiledEquation *equation, const char *expression)
+{
+    ParserState *state;
+    gint64 start;
+    guint ret;
+
+    if (!(equation && expression))
+        return PARSER_ERR_INVALID;
+
+    if (strcmp(expression, equation->expression) == 0)
+        return equation->error;
+
+    g_free(equation->expression);
+    equation->expression = g_strdup(expression);
+
+    /* Errors may have left the parse tree half built */
+    if (equation->error != PARSER_ERR_NONE || strlen(expression) == 0 ||
+        a_get_size(equation->state->arena) > MAX_UPDATE_ARENA_SIZE) {
+        decompile(equation);
+        compile(equation);
+        return equation->error;
     }
 
-    if (mp_get_error()) {
-        p_destroy_parser (state);
-        return PARSER_ERR_MP;
+    state = equation->state;
+    state->error = 0;
+    mp_clear_error();
+    /* Incremental updates are counted as parsing, they mostly reuse the tokens */
+    start = mp_stats_span_begin();
+    ret = p_update(state, expression);
+    mp_stats_span_end(MP_STATS_PARSE, start);
+    if (state->error)
+        equation->error = state->error;
+    else if (ret)
+        equation->error = PARSER_ERR_INVALID;
+    else
+        equation->error = PARSER_ERR_NONE;
+    equation->error_token = state->error_token;
+    state->error_token = NULL;
+
+    return equation->error;
+}
+
+static void
+set_options(MPCompiledEquation *equation, MPEquationOptions *options)
+{
+    /* Numbers are tokenized in the current base, other options only affect values */
+    if (options->base != equation->options.base) {
+        decompile(equation);
+        equation->options = *options;
+        compile(equation);
     }
+    else if (options->wordlen != equation->options.wordlen ||
+             options->angle_units != equation->options.angle_units)
+        p_invalidate_cache(equation->state);
+    equation->options = *options;
+}
+
+MPErrorCode
+mp_compiled_equation_evaluate(MPCompiledEquation *equation, MPEquationOptions *options, MPNumber *result, char **error_token)
+{
+    ParserState* state;
+    MPEvalContext *previous_context;
+    gint64 start;
+    int ret;
 
-    /* Failed to parse */
-    if (ret) {
-        p_destroy_parser (state);
+    if (!(equation && result))
         return PARSER_ERR_INVALID;
+
+    set_options(equation, options);
+
+    if (equation->error != PARSER_ERR_NONE) {
+        if (equation->error_token != NULL && error_token != NULL)
+            *error_token = g_strdup(equation->error_token);
+        return equation->error;
+    }
+
+    state = equation->state;
+    state->error = 0;
+    mp_clear_error();
+    previous_context = mp_set_eval_context(options->context);
+    start = mp_stats_span_begin();
+    ret = p_evaluate (state);
+    mp_stats_span_end(MP_STATS_EVALUATE, start);
+    mp_set_eval_context(previous_context);
+    if (state->error_token != NULL) {
+        if (error_token != NULL)
+            *error_token = state->error_token;
+        else
+            free(state->error_token);
+        state->error_token = NULL;
     }
+
+    /* Values computed after cancellation are meaningless, whatever error they caused */
+    if (options->context && options->context->cancelled)
+        return PARSER_ERR_CANCELLED;
+    /* Error during evaluation */
+    if (state->error)
+        return state->error;
+
+    if (mp_get_error())
+        return PARSER_ERR_MP;
+
+    /* Failed to evaluate */
+    if (ret)
+        return PARSER_ERR_INVALID;
+
     mp_set_from_mp(&state->ret, result);
-    p_destroy_parser (state);
     return PARSER_ERR_NONE;
 }
 
+gboolean
+mp_compiled_equation_evaluate_double(MPCompiledEquation *equation, MPEquationOptions *options, const char *variable,
+                                     const double *x, guint n, double *values, double *errors)
+{
+    ParserState *state;
+    MPEvalContext *previous_context;
+    PFVectorInput input;
+    gboolean result = TRUE;
+    guint i;
+
+    if (!(equation && variable && x && values && errors))
+        return FALSE;
+
+    set_options(equation, options);
+    if (equation->error != PARSER_ERR_NONE || !equation->state->root)
+        return FALSE;
+
+    state = equation->state;
+    state->error = 0;
+    mp_clear_error();
+    previous_context = mp_set_eval_context(options->context);
+    input.variable = variable;
+    for (i = 0; i < n && result; i += PF_VECTOR_SIZE) {
+        input.x = x + i;
+        input.n = MIN(n - i, PF_VECTOR_SIZE);
+        result = pf_vector_evaluate(state->root, &input, values + i, errors + i);
+    }
+    mp_set_eval_context(previous_context);
+
+    /* Constants and variables that failed to evaluate are reported by mp_compiled_equation_evaluate() */
+    if (state->error || mp_get_error())
+        result = FALSE;
+    state->error = 0;
+    free(state->error_token);
+    state->error_token = NULL;
+    mp_clear_error();
+
+    return result;
+}
+
+void
+mp_compiled_equation_free(MPCompiledEquation *equation)
+{
+    if (!equation)
+        return;
+    decompile(equation);
+    g_free(equation->expression);
+    g_free(equation);
+}
+
+MPErrorCode
+mp_equation_parse(const char *expression, MPEquationOptions *options, MPNumber *result, char **error_token)
+{
+    MPCompiledEquation *equation;
+    MPErrorCode error;
+
+    if (!(expression && result) || strlen(expression) == 0)
+        return PARSER_ERR_INVALID;
+
+    equation = mp_equation_compile(expression, options);
+    error = mp_compiled_equation_evaluate(equation, options, result, error_token);
+    mp_compiled_equation_free(equation);
+
+    return error;
+}
+
+
+/* Equation with one variable bound, other names are looked up with the options of the caller */
+struct MPEquationFunction
+{
+    char *expression;
+    char *variable;
+
+    /* Options of the caller and the lock held while calling them, or NULL */
+    MPEquationOptions *parent;
+    GMutex *lock;
+
+    MPEquationOptions options;
+    MPEvalContext context;
+    MPCompiledEquation *equation;
+
+    /* Current value of the variable */
+    MPNumber x;
+};
+
+static int
+function_variable_is_defined(const char *name, void *data)
+{
+    MPEquationFunction *function = data;
+    MPEquationOptions *options = function->parent;
+    int result;
+
+    if (strcmp(name, function->variable) == 0)
+        return 1;
+    if (!options->variable_is_defined)
+        return 0;
+    if (function->lock)
+        g_mutex_lock(function->lock);
+    result = options->variable_is_defined(name, options->callback_data);
+    if (function->lock)
+        g_mutex_unlock(function->lock);
+    return result;
+}
+
+static int
+function_get_variable(const char *name, MPNumber *z, void *data)
+{
+    MPEquationFunction *function = data;
+    MPEquationOptions *options = function->parent;
+    int result;
+
+    if (strcmp(name, function->variable) == 0) {
+        mp_set_from_mp(&function->x, z);
+        return 1;
+    }
+    if (!options->get_variable)
+        return 0;
+    if (function->lock)
+        g_mutex_lock(function->lock);
+    result = options->get_variable(name, z, options->callback_data);
+    if (function->lock)
+        g_mutex_unlock(function->lock);
+    return result;
+}
+
+static int
+function_variable_is_volatile(const char *name, void *data)
+{
+    MPEquationFunction *function = data;
+    MPEquationOptions *options = function->parent;
+    int result;
+
+    if (strcmp(name, function->variable) == 0)
+        return 0;
+    if (!options->variable_is_volatile)
+        return 0;
+    if (function->lock)
+        g_mutex_lock(function->lock);
+    result = options->variable_is_volatile(name, options->callback_data);
+    if (function->lock)
+        g_mutex_unlock(function->lock);
+    return result;
+}
+
+static int
+function_function_is_defined(const char *name, void *data)
+{
+    MPEquationFunction *function = data;
+    MPEquationOptions *options = function->parent;
+    int result;
+
+    if (function->lock)
+        g_mutex_lock(function->lock);
+    result = options->function_is_defined(name, options->callback_data);
+    if (function->lock)
+        g_mutex_unlock(function->lock);
+    return result;
+}
+
+static int
+function_get_function(const char *name, const MPNumber *x, MPNumber *z, void *data)
+{
+    MPEquationFunction *function = data;
+    MPEquationOptions *options = function->parent;
+    int result;
+
+    if (function->lock)
+        g_mutex_lock(function->lock);
+    result = options->get_function(name, x, z, options->callback_data);
+    if (function->lock)
+        g_mutex_unlock(function->lock);
+    return result;
+}
+
+static int
+function_convert(const MPNumber *x, const char *x_units, const char *z_units, MPNumber *z, void *data)
+{
+    MPEquationFunction *function = data;
+    MPEquationOptions *options = function->parent;
+    int result;
+
+    if (function->lock)
+        g_mutex_lock(function->lock);
+    result = options->convert(x, x_units, z_units, z, options->callback_data);
+    if (function->lock)
+        g_mutex_unlock(function->lock);
+    return result;
+}
+
+MPEquationFunction *
+mp_equation_function_new(const char *expression, const char *variable, MPEquationOptions *options, GMutex *lock)
+{
+    MPEquationFunction *function;
+
+    if (!(expression && variable && options))
+        return NULL;
+
+    function = g_malloc0(sizeof(MPEquationFunction));
+    function->expression = g_strdup(expression);
+    function->variable = g_strdup(variable);
+    function->parent = options;
+    function->lock = lock;
+    function->x = mp_new();
+
+    /* Assignments would race between threads, so they are dropped */
+    function->options.base = options->base;
+    function->options.wordlen = options->wordlen;
+    function->options.angle_units = options->angle_units;
+    function->options.accuracy = options->accuracy;
+    function->options.callback_data = function;
+    function->options.variable_is_defined = function_variable_is_defined;
+    function->options.get_variable = function_get_variable;
+    function->options.variable_is_volatile = function_variable_is_volatile;
+    if (options->function_is_defined)
+        function->options.function_is_defined = function_function_is_defined;
+    if (options->get_function)
+        function->options.get_function = function_get_function;
+    if (options->convert)
+        function->options.convert = function_convert;
+
+    /* Each function counts its own steps against the same limits */
+    if (options->context) {
+        mp_eval_context_init(&function->context, options->context->cancellable, 0, options->context->max_steps);
+        function->context.deadline = options->context->deadline;
+        function->options.context = &function->context;
+    }
+
+    return function;
+}
+
+static MPCompiledEquation *
+function_get_equation(MPEquationFunction *function)
+{
+    if (function->equation == NULL)
+        function->equation = mp_equation_compile(function->expression, &function->options);
+    return function->equation;
+}
+
+MPErrorCode
+mp_equation_function_evaluate(MPEquationFunction *function, const MPNumber *x, MPNumber *z, char **error_token)
+{
+    if (!(function && x && z))
+        return PARSER_ERR_INVALID;
+
+    mp_set_from_mp(x, &function->x);
+
+    /* Each evaluation gets the full number of steps */
+    function->context.steps = 0;
+
+    return mp_compiled_equation_evaluate(function_get_equation(function), &function->options, z, error_token);
+}
+
+gboolean
+mp_equation_function_evaluate_double(MPEquationFunction *function, const double *x, guint n, double *values, double *errors)
+{
+    if (!function)
+        return FALSE;
+
+    function->context.steps = 0;
+    return mp_compiled_equation_evaluate_double(function_get_equation(function), &function->options, function->variable,
+                                                x, n, values, errors);
+}
+
+void
+mp_equation_function_free(MPEquationFunction *function)
+{
+    if (!function)
+        return;
+    mp_compiled_equation_free(function->equation);
+    if (function->options.context)
+        mp_eval_context_clear(&function->context);
+    mp_clear(&function->x);
+    g_free(function->expression);
+    g_free(function->variable);
+    g_free(function);
+}
+
+/* Variable read while evaluating a cached result */
+typedef struct
+{
+    char *name;
+    int defined;
+    guint64 version;
+    MPNumber value;     /* Only used without a version callback */
+} CachedRead;
+
+typedef struct
+{
+    char *key;
+    MPNumber result;
+    GPtrArray *reads;
+
+    /* Held by the cache, and by lookups checking the entry */
+    gint ref_count;
+} CacheEntry;
+
+/* Most shards a cache is split into, keys are spread over them so threads rarely wait for each other */
+#define CACHE_SHARDS 16
+
+/* Caches are only split into shards of at least this many entries, so small
+ * caches drop exactly the least recently used result */
+#define CACHE_SHARD_MIN_ENTRIES 16
+
+typedef struct
+{
+    GMutex lock;
+    guint max_entries;
+
+    /* Key -> link in lru */
+    GHashTable *entries;
+
+    /* CacheEntry, most recently used first */
+    GQueue lru;
+
+    guint64 hits;
+    guint64 misses;
+} CacheShard;
+
+struct MPResultCache
+{
+    CacheShard *shards;
+    guint n_shards;
+};
+
+/* Records what an evaluation depends on, wraps the callbacks of the caller */
+typedef struct
+{
+    MPEquationOptions *options;
+    GPtrArray *reads;
+    gboolean cacheable;
+} CacheRecorder;
+
+static void
+cached_read_free(CachedRead *read)
+{
+    g_free(read->name);
+    mp_clear(&read->value);
+    g_free(read);
+}
+
+static void
+cache_entry_unref(CacheEntry *entry)
+{
+    if (!g_atomic_int_dec_and_test(&entry->ref_count))
+        return;
+    g_free(entry->key);
+    mp_clear(&entry->result);
+    g_ptr_array_unref(entry->reads);
+    g_free(entry);
+}
+
+static int
+recorder_variable_is_defined(const char *name, void *data)
+{
+    CacheRecorder *recorder = data;
+    return recorder->options->variable_is_defined(name, recorder->options->callback_data);
+}
+
+static int
+recorder_variable_is_volatile(const char *name, void *data)
+{
+    CacheRecorder *recorder = data;
+    return recorder->options->variable_is_volatile(name, recorder->options->callback_data);
+}
+
+static int
+recorder_get_variable(const char *name, MPNumber *z, void *data)
+{
+    CacheRecorder *recorder = data;
+    MPEquationOptions *options = recorder->options;
+    CachedRead *read;
+    int defined;
+    guint i;
+
+    defined = options->get_variable(name, z, options->callback_data);
+
+    /* Values like rand change on every read */
+    if (options->variable_is_volatile && options->variable_is_volatile(name, options->callback_data))
+        recorder->cacheable = FALSE;
+    if (!recorder->cacheable)
+        return defined;
+
+    for (i = 0; i < recorder->reads->len; i++) {
+        read = g_ptr_array_index(recorder->reads, i);
+        if (strcmp(read->name, name) == 0)
+            return defined;
+    }
+
+    /* Undefined variables are recorded too, "xy" means x×y until xy is defined */
+    read = g_malloc0(sizeof(CachedRead));
+    read->name = g_strdup(name);
+    read->defined = defined;
+    read->value = mp_new();
+    if (options->get_variable_version)
+        read->version = options->get_variable_version(name, options->callback_data);
+    else if (defined)
+        mp_set_from_mp(z, &read->value);
+    g_ptr_array_add(recorder->reads, read);
+
+    return defined;
+}
+
+static void
+recorder_set_variable(const char *name, const MPNumber *x, void *data)
+{
+    CacheRecorder *recorder = data;
+
+    /* Assignments have to be made every time */
+    recorder->cacheable = FALSE;
+    if (recorder->options->set_variable)
+        recorder->options->set_variable(name, x, recorder->options->callback_data);
+}
+
+static int
+recorder_convert(const MPNumber *x, const char *x_units, const char *z_units, MPNumber *z, void *data)
+{
+    CacheRecorder *recorder = data;
+
+    /* Currency rates change over time */
+    recorder->cacheable = FALSE;
+    return recorder->options->convert(x, x_units, z_units, z, recorder->options->callback_data);
+}
+
+static void
+recorder_init(CacheRecorder *recorder, MPEquationOptions *options, MPEquationOptions *recorder_options)
+{
+    recorder->options = options;
+    recorder->reads = g_ptr_array_new_with_free_func((GDestroyNotify) cached_read_free);
+    recorder->cacheable = TRUE;
+
+    *recorder_options = *options;
+    recorder_options->callback_data = recorder;
+    if (options->variable_is_defined)
+        recorder_options->variable_is_defined = recorder_variable_is_defined;
+    if (options->variable_is_volatile)
+        recorder_options->variable_is_volatile = recorder_variable_is_volatile;
+    if (options->get_variable)
+        recorder_options->get_variable = recorder_get_variable;
+    recorder_options->set_variable = recorder_set_variable;
+    if (options->convert)
+        recorder_options->convert = recorder_convert;
+}
+
+/* Check the variables read by a cached result still have the same values */
+static gboolean
+cache_entry_is_valid(CacheEntry *entry, MPEquationOptions *options)
+{
+    MPNumber value = mp_new();
+    gboolean valid = TRUE;
+    guint i;
+
+    for (i = 0; i < entry->reads->len && valid; i++) {
+        CachedRead *read = g_ptr_array_index(entry->reads, i);
+
+        if (!options->get_variable)
+            valid = FALSE;
+        else if (options->get_variable_version)
+            valid = options->get_variable_version(read->name, options->callback_data) == read->version;
+        else
+            valid = options->get_variable(read->name, &value, options->callback_data) == read->defined &&
+                    (!read->defined || mp_is_equal(&value, &read->value));
+    }
+    mp_clear(&value);
+
+    return valid;
+}
+
+/* Results depend on the options, and the text with spacing normalised */
+static char *
+cache_make_key(const char *expression, MPEquationOptions *options)
+{
+    GString *key;
+    const char *c;
+
+    key = g_string_new(NULL);
+    g_string_append_printf(key, "%d:%d:%d:%d:", options->base, options->wordlen, options->angle_units, options->accuracy);
+    while (g_ascii_isspace(*expression))
+        expression++;
+    for (c = expression; *c != '\0'; c++) {
+        if (!g_ascii_isspace(*c))
+            g_string_append_c(key, *c);
+        else if (c[1] != '\0' && !g_ascii_isspace(c[1]))
+            g_string_append_c(key, ' ');
+    }
+
+    return g_string_free(key, FALSE);
+}
+
+MPResultCache *
+mp_result_cache_new(guint max_entries)
+{
+    MPResultCache *cache;
+    guint i;
+
+    cache = g_malloc0(sizeof(MPResultCache));
+    cache->n_shards = CLAMP(max_entries / CACHE_SHARD_MIN_ENTRIES, 1, CACHE_SHARDS);
+    cache->shards = g_new0(CacheShard, cache->n_shards);
+    for (i = 0; i < cache->n_shards; i++) {
+        CacheShard *shard = &cache->shards[i];
+
+        g_mutex_init(&shard->lock);
+        shard->max_entries = MAX((max_entries + cache->n_shards - 1) / cache->n_shards, 1);
+        shard->entries = g_hash_table_new(g_str_hash, g_str_equal);
+        g_queue_init(&shard->lru);
+    }
+
+    return cache;
+}
+
+void
+mp_result_cache_clear(MPResultCache *cache)
+{
+    guint i;
+
+    for (i = 0; i < cache->n_shards; i++) {
+        CacheShard *shard = &cache->shards[i];
+
+        g_mutex_lock(&shard->lock);
+        g_hash_table_remove_all(shard->entries);
+        g_queue_foreach(&shard->lru, (GFunc) cache_entry_unref, NULL);
+        g_queue_clear(&shard->lru);
+        g_mutex_unlock(&shard->lock);
+    }
+}
+
+void
+mp_result_cache_free(MPResultCache *cache)
+{
+    guint i;
+
+    if (!cache)
+        return;
+    mp_result_cache_clear(cache);
+    for (i = 0; i < cache->n_shards; i++) {
+        g_hash_table_unref(cache->shards[i].entries);
+        g_mutex_clear(&cache->shards[i].lock);
+    }
+    g_free(cache->shards);
+    g_free(cache);
+}
+
+void
+mp_result_cache_get_statistics(MPResultCache *cache, guint64 *hits, guint64 *misses)
+{
+    guint64 total_hits = 0, total_misses = 0;
+    guint i;
+
+    for (i = 0; i < cache->n_shards; i++) {
+        g_mutex_lock(&cache->shards[i].lock);
+        total_hits += cache->shards[i].hits;
+        total_misses += cache->shards[i].misses;
+        g_mutex_unlock(&cache->shards[i].lock);
+    }
+    if (hits)
+        *hits = total_hits;
+    if (misses)
+        *misses = total_misses;
+}
+
+static CacheShard *
+cache_get_shard(MPResultCache *cache, const char *key)
+{
+    return &cache->shards[g_str_hash(key) % cache->n_shards];
+}
+
+static gboolean
+cache_lookup(MPResultCache *cache, const char *key, MPEquationOptions *options, MPNumber *result)
+{
+    CacheShard *shard = cache_get_shard(cache, key);
+    CacheEntry *entry = NULL;
+    GList *link;
+    gboolean found;
+
+    g_mutex_lock(&shard->lock);
+    link = g_hash_table_lookup(shard->entries, key);
+    if (link) {
+        entry = link->data;
+        g_atomic_int_inc(&entry->ref_count);
+    }
+    g_mutex_unlock(&shard->lock);
+
+    /* Entries don't change once inserted, so the variables are checked without
+     * the lock and other threads aren't held up by the callbacks */
+    found = entry && cache_entry_is_valid(entry, options);
+    if (found)
+        mp_set_from_mp(&entry->result, result);
+
+    g_mutex_lock(&shard->lock);
+    if (found) {
+        /* Unless it was replaced meanwhile */
+        link = g_hash_table_lookup(shard->entries, key);
+        if (link && link->data == entry) {
+            g_queue_unlink(&shard->lru, link);
+            g_queue_push_head_link(&shard->lru, link);
+        }
+        shard->hits++;
+    }
+    else
+        shard->misses++;
+    g_mutex_unlock(&shard->lock);
+
+    if (entry)
+        cache_entry_unref(entry);
+
+    return found;
+}
+
+static void
+cache_insert(MPResultCache *cache, char *key, CacheRecorder *recorder, const MPNumber *result)
+{
+    CacheShard *shard = cache_get_shard(cache, key);
+    CacheEntry *entry;
+    GList *link;
+
+    entry = g_malloc0(sizeof(CacheEntry));
+    entry->key = key;
+    entry->result = mp_new();
+    mp_set_from_mp(result, &entry->result);
+    entry->reads = g_ptr_array_ref(recorder->reads);
+    entry->ref_count = 1;
+
+    g_mutex_lock(&shard->lock);
+    /* Replace an outdated result */
+    link = g_hash_table_lookup(shard->entries, key);
+    if (link) {
+        g_hash_table_remove(shard->entries, key);
+        cache_entry_unref(link->data);
+        g_queue_delete_link(&shard->lru, link);
+    }
+    g_queue_push_head(&shard->lru, entry);
+    g_hash_table_insert(shard->entries, entry->key, shard->lru.head);
+
+    while (g_queue_get_length(&shard->lru) > shard->max_entries) {
+        CacheEntry *oldest = g_queue_pop_tail(&shard->lru);
+        g_hash_table_remove(shard->entries, oldest->key);
+        cache_entry_unref(oldest);
+    }
+    g_mutex_unlock(&shard->lock);
+}
+
+/* Evaluate either an existing equation or expression, using and updating cache */
+static MPErrorCode
+cache_evaluate(MPResultCache *cache, MPCompiledEquation *equation, const char *expression,
+               MPEquationOptions *options, MPNumber *result, char **error_token)
+{
+    MPEquationOptions recorder_options;
+    CacheRecorder recorder;
+    MPErrorCode error;
+    char *key;
+
+    /* Results of user defined functions can't be checked */
+    if (options->function_is_defined || options->get_function) {
+        if (equation)
+            return mp_compiled_equation_evaluate(equation, options, result, error_token);
+        return mp_equation_parse(expression, options, result, error_token);
+    }
+
+    key = cache_make_key(equation ? equation->expression : expression, options);
+    if (cache_lookup(cache, key, options, result)) {
+        g_free(key);
+        return PARSER_ERR_NONE;
+    }
+
+    recorder_init(&recorder, options, &recorder_options);
+    if (equation) {
+        error = mp_compiled_equation_evaluate(equation, &recorder_options, result, error_token);
+        /* The equation must not keep the recorder, it's only valid here */
+        equation->options = *options;
+    }
+    else
+        error = mp_equation_parse(expression, &recorder_options, result, error_token);
+
+    if (error == PARSER_ERR_NONE && recorder.cacheable)
+        cache_insert(cache, key, &recorder, result);
+    else
+        g_free(key);
+    g_ptr_array_unref(recorder.reads);
+
+    return error;
+}
+
+MPErrorCode
+mp_result_cache_parse(MPResultCache *cache, const char *expression, MPEquationOptions *options, MPNumber *result, char **error_token)
+{
+    if (!(expression && result) || strlen(expression) == 0)
+        return PARSER_ERR_INVALID;
+    if (!cache)
+        return mp_equation_parse(expression, options, result, error_token);
+
+    return cache_evaluate(cache, NULL, expression, options, result, error_token);
+}
+
+MPErrorCode
+mp_result_cache_evaluate(MPResultCache *cache, MPCompiledEquation *equation, MPEquationOptions *options, MPNumber *result, char **error_token)
+{
+    if (!(equation && result))
+        return PARSER_ERR_INVALID;
+    if (!cache)
+        return mp_compiled_equation_evaluate(equation, options, result, error_token);
+
+    return cache_evaluate(cache, equation, NULL, options, result, error_token);
+}
+
 const char *
 mp_error_code_to_string(MPErrorCode error_code)
 {
@@ -349,6 +1240,8 @@ mp_error_code_to_string(MPErrorCode error_code)
         return "PARSER_ERR_UNKNOWN_CONVERSION";
     case PARSER_ERR_MP:
         return "PARSER_ERR_MP";
+    case PARSER_ERR_CANCELLED:
+        return "PARSER_ERR_CANCELLED";
     default:
         return "Unknown parser error";
     }
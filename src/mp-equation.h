@@ -22,7 +22,8 @@ typedef enum
     PARSER_ERR_UNKNOWN_VARIABLE,
     PARSER_ERR_UNKNOWN_FUNCTION,
     PARSER_ERR_UNKNOWN_CONVERSION,
-    PARSER_ERR_MP
+    PARSER_ERR_MP,
+    PARSER_ERR_CANCELLED
 } MPErrorCode;
 
 /* Options for parser */
@@ -36,6 +37,10 @@ typedef struct {
     /* Units for angles (e.g. radians, degrees) */
     MPAngleUnit angle_units;
 
+    /* Number of digits shown after the radix point, numerical methods (e.g.
+     * integration) stop once results are this accurate. 0 uses the default of 9. */
+    int accuracy;
+
     // FIXME:
     // int enable_builtins;
 
@@ -48,6 +53,12 @@ typedef struct {
     /* Function to get variable values */
     int (*get_variable)(const char *name, MPNumber *z, void *data);
 
+    /* Function to check if a variable has a new value every time it is read (e.g. rand) */
+    int (*variable_is_volatile)(const char *name, void *data);
+
+    /* Function to get a number that changes whenever a variable is set or deleted, used to check cached results */
+    guint64 (*get_variable_version)(const char *name, void *data);
+
     /* Function to set variable values */
     void (*set_variable)(const char *name, const MPNumber *x, void *data);
 
@@ -59,11 +70,54 @@ typedef struct {
 
     /* Function to convert units */
     int (*convert)(const MPNumber *x, const char *x_units, const char *z_units, MPNumber *z, void *data);
+
+    /* Limits for evaluation, or NULL */
+    MPEvalContext *context;
 } MPEquationOptions;
 
+/* Equation parsed once and evaluated many times, e.g. with different variable values */
+typedef struct MPCompiledEquation MPCompiledEquation;
+
 MPErrorCode mp_equation_parse(const char *expression, MPEquationOptions *options, MPNumber *result, char **error_token);
+MPCompiledEquation *mp_equation_compile(const char *expression, MPEquationOptions *options);
+MPErrorCode mp_compiled_equation_update(MPCompiledEquation *equation, const char *expression);
+MPErrorCode mp_compiled_equation_evaluate(MPCompiledEquation *equation, MPEquationOptions *options, MPNumber *result, char **error_token);
+/* Evaluate equation in double precision with variable set to each of the n
+ * values in x. errors is set to a bound on the absolute error of each value,
+ * or infinity where it has to be evaluated with mp_compiled_equation_evaluate().
+ * Returns FALSE if the equation can't be evaluated in double precision. */
+gboolean mp_compiled_equation_evaluate_double(MPCompiledEquation *equation, MPEquationOptions *options, const char *variable,
+                                              const double *x, guint n, double *values, double *errors);
+void mp_compiled_equation_free(MPCompiledEquation *equation);
+/* Parser set up the way mp_equation_compile() does it, for benchmarks that run
+ * each phase on its own. Free with p_destroy_parser() */
+struct parser_state *mp_equation_create_parser(const char *expression, MPEquationOptions *options);
 const char *mp_error_code_to_string(MPErrorCode error_code);
 
+/* Equation evaluated as a function of one variable. Other names are looked up
+ * through options, which must outlive the function. If lock is not NULL it is
+ * held while calling the callbacks in options, so functions on different threads
+ * can share callbacks that aren't thread safe. Assignments are ignored. */
+typedef struct MPEquationFunction MPEquationFunction;
+
+MPEquationFunction *mp_equation_function_new(const char *expression, const char *variable, MPEquationOptions *options, GMutex *lock);
+MPErrorCode mp_equation_function_evaluate(MPEquationFunction *function, const MPNumber *x, MPNumber *z, char **error_token);
+gboolean mp_equation_function_evaluate_double(MPEquationFunction *function, const double *x, guint n, double *values, double *errors);
+void mp_equation_function_free(MPEquationFunction *function);
+
+/* Bounded cache of results, checked against the variables each result read.
+ * Results using rand, assignments, conversions or user functions aren't cached.
+ * Safe to share between threads, the variable callbacks are called without any
+ * lock held so they must be safe to call from each thread using the cache. */
+typedef struct MPResultCache MPResultCache;
+
+MPResultCache *mp_result_cache_new(guint max_entries);
+MPErrorCode mp_result_cache_parse(MPResultCache *cache, const char *expression, MPEquationOptions *options, MPNumber *result, char **error_token);
+MPErrorCode mp_result_cache_evaluate(MPResultCache *cache, MPCompiledEquation *equation, MPEquationOptions *options, MPNumber *result, char **error_token);
+void mp_result_cache_get_statistics(MPResultCache *cache, guint64 *hits, guint64 *misses);
+void mp_result_cache_clear(MPResultCache *cache);
+void mp_result_cache_free(MPResultCache *cache);
+
 int sub_atoi(const char *data);
 int super_atoi(const char *data);
 #endif
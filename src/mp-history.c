@@ -0,0 +1,525 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <glib/gstdio.h>
+
+#include "mp-history.h"
+#include "mp-equation.h"
+
+/* Entries between the offsets kept in the index */
+#define INDEX_INTERVAL 256
+
+/* Tab separated fields of a line, after the checksum */
+enum {
+    FIELD_TIME,
+    FIELD_BASE,
+    FIELD_WORDLEN,
+    FIELD_ANGLE_UNITS,
+    FIELD_EQUATION,
+    FIELD_ANSWER,
+    N_FIELDS
+};
+
+struct MPHistory
+{
+    gchar *filename;
+    gchar *index_filename;
+    int fd;                    /* Log opened for appending */
+    gsize size;                /* Bytes in the log */
+    guint64 length;            /* Lines in the log */
+    GArray *index;             /* Offset of every INDEX_INTERVAL'th line */
+    GMappedFile *map;          /* Log as of the last read, mapped again once it has grown */
+};
+
+static guint32
+checksum(const gchar *text, gsize length)
+{
+    guint32 sum = 5381;
+    gsize i;
+
+    for (i = 0; i < length; i++)
+        sum = sum * 33 + (guchar) text[i];
+
+    return sum;
+}
+
+/* Equations can't contain the characters that separate fields and lines */
+static void
+append_escaped(GString *string, const gchar *text)
+{
+    const gchar *c;
+
+    for (c = text; *c != '\0'; c++) {
+        if (*c == '\\')
+            g_string_append(string, "\\\\");
+        else if (*c == '\t')
+            g_string_append(string, "\\t");
+        else if (*c == '\n')
+            g_string_append(string, "\\n");
+        else
+            g_string_append_c(string, *c);
+    }
+}
+
+static gchar *
+unescape(const gchar *text)
+{
+    GString *string = g_string_sized_new(strlen(text));
+    const gchar *c;
+
+    for (c = text; *c != '\0'; c++) {
+        if (*c == '\\' && c[1] != '\0') {
+            c++;
+            g_string_append_c(string, *c == 't' ? '\t' : *c == 'n' ? '\n' : *c);
+        }
+        else
+            g_string_append_c(string, *c);
+    }
+
+    return g_string_free(string, FALSE);
+}
+
+/* Returns the log contents, or NULL if it is empty or can't be read */
+static const gchar *
+get_data(MPHistory *history)
+{
+    if (history->map && g_mapped_file_get_length(history->map) >= history->size)
+        return g_mapped_file_get_contents(history->map);
+
+    g_clear_pointer(&history->map, g_mapped_file_unref);
+    if (history->size == 0)
+        return NULL;
+
+    history->map = g_mapped_file_new(history->filename, FALSE, NULL);
+    if (!history->map || g_mapped_file_get_length(history->map) < history->size)
+        return NULL;
+
+    return g_mapped_file_get_contents(history->map);
+}
+
+static gsize
+write_all(int fd, const gchar *data, gsize length)
+{
+    gsize total = 0;
+
+    while (total < length) {
+        gssize written = write(fd, data + total, length - total);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        total += written;
+    }
+
+    return total;
+}
+
+static void
+save_index(MPHistory *history)
+{
+    g_file_set_contents(history->index_filename, history->index->data,
+                        history->index->len * sizeof(guint64), NULL);
+}
+
+/* Count the lines from offset, which is the start of line, to the end of the log, indexing them as needed */
+static void
+index_lines(MPHistory *history, guint64 offset, guint64 line)
+{
+    const gchar *data = get_data(history);
+
+    /* The log always ends with a newline */
+    while (data && offset < history->size) {
+        if (line % INDEX_INTERVAL == 0 && line / INDEX_INTERVAL >= history->index->len)
+            g_array_append_val(history->index, offset);
+        offset = (const gchar *) memchr(data + offset, '\n', history->size - offset) - data + 1;
+        line++;
+    }
+    history->length = line;
+}
+
+/* Read the index, dropping offsets that don't match the log, and index any lines after it */
+static void
+load_index(MPHistory *history)
+{
+    const gchar *data;
+    gchar *contents = NULL;
+    gsize length = 0, i, n;
+    guint64 offset, line;
+
+    g_array_set_size(history->index, 0);
+    data = get_data(history);
+    if (g_file_get_contents(history->index_filename, &contents, &length, NULL)) {
+        n = length / sizeof(guint64);
+        for (i = 0; i < n; i++) {
+            memcpy(&offset, contents + i * sizeof(guint64), sizeof(guint64));
+            if (!data || offset >= history->size || (i == 0) != (offset == 0) ||
+                (i > 0 && (offset <= g_array_index(history->index, guint64, i - 1) || data[offset - 1] != '\n')))
+                break;
+            g_array_append_val(history->index, offset);
+        }
+        g_free(contents);
+    }
+
+    if (history->index->len == 0) {
+        offset = 0;
+        line = 0;
+    }
+    else {
+        offset = g_array_index(history->index, guint64, history->index->len - 1);
+        line = (guint64) (history->index->len - 1) * INDEX_INTERVAL;
+    }
+    index_lines(history, offset, line);
+
+    if (history->index->len * sizeof(guint64) != length)
+        save_index(history);
+}
+
+/* Pick up lines other processes appended since the log was last read, or read
+ * it again if it was cleared. Only whole lines are read, another process may
+ * be writing the last one. */
+static void
+update_size(MPHistory *history)
+{
+    struct stat info;
+    const gchar *data;
+    gsize size, old_size;
+
+    if (fstat(history->fd, &info) != 0 || (gsize) info.st_size == history->size)
+        return;
+
+    size = info.st_size;
+    if (size < history->size) {
+        history->size = 0;
+        history->length = 0;
+        g_array_set_size(history->index, 0);
+        g_clear_pointer(&history->map, g_mapped_file_unref);
+    }
+    old_size = history->size;
+
+    history->size = size;
+    data = get_data(history);
+    while (data && size > old_size && data[size - 1] != '\n')
+        size--;
+    history->size = data ? size : old_size;
+    if (history->size == old_size)
+        return;
+
+    if (old_size == 0)
+        load_index(history);
+    else
+        index_lines(history, old_size, history->length);
+}
+
+MPHistory *
+mp_history_open(const gchar *filename)
+{
+    MPHistory *history;
+    struct stat info;
+    gchar *dir, last;
+    int fd;
+
+    dir = g_path_get_dirname(filename);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    fd = g_open(filename, O_RDWR | O_APPEND | O_CREAT, 0600);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    history = g_slice_new0(MPHistory);
+    history->filename = g_strdup(filename);
+    history->index_filename = g_strconcat(filename, ".index", NULL);
+    history->fd = fd;
+    history->size = info.st_size;
+    history->index = g_array_new(FALSE, FALSE, sizeof(guint64));
+
+    /* The log is shared by every window and mate-calc-cmd, they take turns to change it */
+    flock(fd, LOCK_EX);
+
+    /* A crash can leave part of a line, end it so it isn't joined to the next entry */
+    if (history->size > 0 && pread(fd, &last, 1, history->size - 1) == 1 && last != '\n' &&
+        write_all(fd, "\n", 1) == 1)
+        history->size++;
+
+    load_index(history);
+    flock(fd, LOCK_UN);
+
+    return history;
+}
+
+guint64
+mp_history_get_length(MPHistory *history)
+{
+    g_return_val_if_fail(history != NULL, 0);
+    update_size(history);
+    return history->length;
+}
+
+gboolean
+mp_history_append(MPHistory *history, const MPHistoryEntry *entry)
+{
+    GString *record;
+    gchar *answer, *line;
+    gsize length, written;
+    guint64 offset;
+    struct stat info;
+    gboolean result;
+    FILE *f;
+
+    g_return_val_if_fail(history != NULL, FALSE);
+    g_return_val_if_fail(entry != NULL, FALSE);
+
+    record = g_string_new(NULL);
+    g_string_append_printf(record, "%" G_GINT64_FORMAT "\t%d\t%d\t%d\t",
+                           entry->time != 0 ? entry->time : g_get_real_time() / G_USEC_PER_SEC,
+                           entry->base, entry->wordlen, entry->angle_units);
+    append_escaped(record, entry->equation);
+    answer = mp_to_exact_string(&entry->answer);
+    g_string_append_printf(record, "\t%s", answer);
+    g_free(answer);
+
+    line = g_strdup_printf("%08x\t%s\n", checksum(record->str, record->len), record->str);
+    length = strlen(line);
+    g_string_free(record, TRUE);
+
+    /* Other processes may have appended since, the entry goes after their lines */
+    flock(history->fd, LOCK_EX);
+    update_size(history);
+
+    /* Nobody else is writing, so a partial last line was torn by a crash */
+    if (fstat(history->fd, &info) == 0 && (gsize) info.st_size > history->size &&
+        write_all(history->fd, "\n", 1) == 1)
+        update_size(history);
+
+    offset = history->size;
+    written = write_all(history->fd, line, length);
+    g_free(line);
+    if (written == 0) {
+        flock(history->fd, LOCK_UN);
+        return FALSE;
+    }
+
+    /* End a partial line, the checksum stops it being read */
+    history->size += written;
+    result = written == length;
+    if (written < length) {
+        if (write_all(history->fd, "\n", 1) == 1)
+            history->size++;
+    }
+
+    /* Written after the entry, so a crash in between only leaves the index short */
+    if (history->length % INDEX_INTERVAL == 0) {
+        g_array_append_val(history->index, offset);
+        f = fopen(history->index_filename, "ab");
+        if (f) {
+            fwrite(&offset, sizeof(offset), 1, f);
+            fclose(f);
+        }
+    }
+    history->length++;
+    flock(history->fd, LOCK_UN);
+
+    return result;
+}
+
+/* Parse the line of entry number index and pass it to func. Returns FALSE if func asks to stop. */
+static gboolean
+read_entry(MPHistory *history, guint64 index, const gchar *line, gsize length, MPHistoryFunc func, gpointer data)
+{
+    MPEquationOptions options;
+    MPHistoryEntry entry;
+    gchar *text, *equation, **fields;
+    gboolean result = TRUE;
+
+    /* Eight digit checksum and a tab before the fields */
+    if (length < 10 || line[8] != '\t')
+        return TRUE;
+
+    text = g_strndup(line, length);
+    if (strtoul(text, NULL, 16) != checksum(text + 9, length - 9)) {
+        g_free(text);
+        return TRUE;
+    }
+
+    fields = g_strsplit(text + 9, "\t", N_FIELDS);
+    if (g_strv_length(fields) == N_FIELDS) {
+        memset(&options, 0, sizeof(options));
+        options.base = 10;
+        options.wordlen = 64;
+        options.angle_units = MP_DEGREES;
+
+        entry.time = g_ascii_strtoll(fields[FIELD_TIME], NULL, 10);
+        entry.base = atoi(fields[FIELD_BASE]);
+        entry.wordlen = atoi(fields[FIELD_WORDLEN]);
+        entry.angle_units = atoi(fields[FIELD_ANGLE_UNITS]);
+        equation = unescape(fields[FIELD_EQUATION]);
+        entry.equation = equation;
+        entry.answer = mp_new();
+        /* Answers are written exactly, older logs have them in decimal */
+        if (mp_set_from_exact_string(fields[FIELD_ANSWER], &entry.answer) ||
+            mp_equation_parse(fields[FIELD_ANSWER], &options, &entry.answer, NULL) == PARSER_ERR_NONE)
+            result = func(index, &entry, data);
+        mp_clear(&entry.answer);
+        g_free(equation);
+    }
+    g_strfreev(fields);
+    g_free(text);
+
+    return result;
+}
+
+void
+mp_history_foreach(MPHistory *history, guint64 start, guint64 n, MPHistoryFunc func, gpointer data)
+{
+    const gchar *contents, *line, *next, *end;
+    guint64 i;
+
+    g_return_if_fail(history != NULL);
+    g_return_if_fail(func != NULL);
+
+    update_size(history);
+    if (start >= history->length || (contents = get_data(history)) == NULL)
+        return;
+    end = contents + history->size;
+
+    /* Start from the nearest indexed line */
+    line = contents + g_array_index(history->index, guint64, start / INDEX_INTERVAL);
+    for (i = start - start % INDEX_INTERVAL; i < start; i++)
+        line = (const gchar *) memchr(line, '\n', end - line) + 1;
+
+    for (i = start; i - start < n && line < end; i++) {
+        next = memchr(line, '\n', end - line);
+        if (!read_entry(history, i, line, next - line, func, data))
+            break;
+        line = next + 1;
+    }
+}
+
+typedef struct
+{
+    guint64 index;
+    gsize offset, length;
+} Match;
+
+guint
+mp_history_search(MPHistory *history, const gchar *text, gboolean prefix, guint max_results, MPHistoryFunc func, gpointer data)
+{
+    const gchar *contents, *end, *match, *line, *line_end, *field, *field_end, *counted;
+    gsize text_length;
+    guint64 line_number = 0;
+    GArray *matches;
+    guint n_results = 0;
+    gint i;
+
+    g_return_val_if_fail(history != NULL, 0);
+    g_return_val_if_fail(text != NULL, 0);
+    g_return_val_if_fail(func != NULL, 0);
+
+    update_size(history);
+    text_length = strlen(text);
+    if (text_length == 0 || max_results == 0 || (contents = get_data(history)) == NULL)
+        return 0;
+    end = contents + history->size;
+
+    /* Search the raw log and only look at the lines that contain text */
+    matches = g_array_new(FALSE, FALSE, sizeof(Match));
+    counted = contents;
+    match = contents;
+    while (match < end && (match = g_strstr_len(match, end - match, text)) != NULL) {
+        Match m;
+        int tabs;
+
+        for (line = match; line > contents && line[-1] != '\n'; line--);
+        line_end = memchr(match, '\n', end - match);
+        if (line_end == NULL)
+            line_end = end;
+        while ((counted = memchr(counted, '\n', line - counted)) != NULL) {
+            counted++;
+            line_number++;
+        }
+        counted = line;
+
+        /* Only matches in the equation count, which may come after one in another field */
+        for (field = line, tabs = 0; field < line_end && tabs < FIELD_EQUATION + 1; field++) {
+            if (*field == '\t')
+                tabs++;
+        }
+        field_end = memchr(field, '\t', line_end - field);
+        if (field_end == NULL)
+            match = NULL;
+        else if (prefix)
+            match = (gsize) (field_end - field) >= text_length && memcmp(field, text, text_length) == 0 ? field : NULL;
+        else if (match < field || match + text_length > field_end)
+            match = g_strstr_len(field, field_end - field, text);
+        if (match) {
+            /* Keep the newest max_results */
+            if (matches->len == max_results)
+                g_array_remove_index(matches, 0);
+            m.index = line_number;
+            m.offset = line - contents;
+            m.length = line_end - line;
+            g_array_append_val(matches, m);
+        }
+
+        match = line_end + 1;
+    }
+
+    for (i = matches->len - 1; i >= 0; i--) {
+        Match *m = &g_array_index(matches, Match, i);
+        n_results++;
+        if (!read_entry(history, m->index, contents + m->offset, m->length, func, data))
+            break;
+    }
+    g_array_free(matches, TRUE);
+
+    return n_results;
+}
+
+void
+mp_history_clear(MPHistory *history)
+{
+    g_return_if_fail(history != NULL);
+
+    flock(history->fd, LOCK_EX);
+    if (ftruncate(history->fd, 0) == 0) {
+        history->size = 0;
+        history->length = 0;
+        g_clear_pointer(&history->map, g_mapped_file_unref);
+        g_array_set_size(history->index, 0);
+        save_index(history);
+    }
+    flock(history->fd, LOCK_UN);
+}
+
+void
+mp_history_free(MPHistory *history)
+{
+    if (!history)
+        return;
+
+    close(history->fd);
+    g_clear_pointer(&history->map, g_mapped_file_unref);
+    g_array_free(history->index, TRUE);
+    g_free(history->filename);
+    g_free(history->index_filename);
+    g_slice_free(MPHistory, history);
+}
@@ -0,0 +1,58 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef MP_HISTORY_H
+#define MP_HISTORY_H
+
+#include <glib.h>
+
+#include "mp.h"
+
+/* A calculation kept in the history log */
+typedef struct
+{
+    gint64 time;               /* Seconds since the epoch, 0 for now when appending */
+    gint base;                 /* Options the answer was calculated with */
+    gint wordlen;
+    MPAngleUnit angle_units;
+    const gchar *equation;
+    MPNumber answer;           /* Kept without rounding, see mp_to_exact_string() */
+} MPHistoryEntry;
+
+/* Append-only log of calculations on disk. Each entry is a line with a
+ * checksum, so a line torn by a crash is skipped rather than misread. The log
+ * is memory mapped and a small index of the offset of every few hundred entries
+ * is kept next to it, so entries can be read from anywhere without parsing the
+ * ones before them. */
+typedef struct MPHistory MPHistory;
+
+/* Called for each entry read, which is only valid during the call. Return FALSE to stop. */
+typedef gboolean (*MPHistoryFunc)(guint64 index, const MPHistoryEntry *entry, gpointer data);
+
+/* Open the log in filename, creating it if needed. Returns NULL if it can't be opened. */
+MPHistory *mp_history_open(const gchar *filename);
+
+/* Number of entries in the log, including any that can't be read */
+guint64 mp_history_get_length(MPHistory *history);
+
+gboolean mp_history_append(MPHistory *history, const MPHistoryEntry *entry);
+
+/* Read up to n entries in order from entry start */
+void mp_history_foreach(MPHistory *history, guint64 start, guint64 n, MPHistoryFunc func, gpointer data);
+
+/* Read the newest entries whose equation contains text, or starts with it if
+ * prefix is TRUE, newest first. Only matching entries are parsed. Returns the
+ * number of matches. */
+guint mp_history_search(MPHistory *history, const gchar *text, gboolean prefix, guint max_results, MPHistoryFunc func, gpointer data);
+
+/* Remove all entries */
+void mp_history_clear(MPHistory *history);
+
+void mp_history_free(MPHistory *history);
+
+#endif /* MP_HISTORY_H */
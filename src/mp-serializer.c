@@ -17,6 +17,7 @@
 
 #include "mp-serializer.h"
 #include "mp-enums.h"
+#include "mp-stats.h"
 
 enum {
     PROP_0,
@@ -117,7 +118,7 @@ mp_to_string_real(MpSerializer *serializer, const MPNumber *x, int base, gboolea
         (*n_digits)++;
 
         mp_set_from_mp(&t, &temp);
-    } while (!mp_is_zero(&temp));
+    } while (!mp_is_zero(&temp) && !mp_is_cancelled());
     mp_clear(&t);
     mp_clear(&t2);
     mp_clear(&t3);
@@ -265,24 +266,24 @@ mp_to_exponential_string_real(MpSerializer *serializer, const MPNumber *x, GStri
     mp_divide(&t, &base10, &base10inv);
 
     if (!mp_is_zero(&mantissa)) {
-        while (!eng_format && mp_is_greater_equal(&mantissa, &base10)) {
+        while (!eng_format && mp_is_greater_equal(&mantissa, &base10) && !mp_is_cancelled()) {
             exponent += 10;
             mp_multiply(&mantissa, &base10inv, &mantissa);
         }
 
-        while ((!eng_format &&  mp_is_greater_equal(&mantissa, &base)) ||
-                (eng_format && (mp_is_greater_equal(&mantissa, &base3) || exponent % 3 != 0))) {
+        while (((!eng_format &&  mp_is_greater_equal(&mantissa, &base)) ||
+                (eng_format && (mp_is_greater_equal(&mantissa, &base3) || exponent % 3 != 0))) && !mp_is_cancelled()) {
             exponent += 1;
             mp_divide(&mantissa, &base, &mantissa);
         }
 
-        while (!eng_format && mp_is_less_than(&mantissa, &base10inv)) {
+        while (!eng_format && mp_is_less_than(&mantissa, &base10inv) && !mp_is_cancelled()) {
             exponent -= 10;
             mp_multiply(&mantissa, &base10, &mantissa);
         }
 
         mp_set_from_integer(1, &t);
-        while (mp_is_less_than(&mantissa, &t) || (eng_format && exponent % 3 != 0)) {
+        while ((mp_is_less_than(&mantissa, &t) || (eng_format && exponent % 3 != 0)) && !mp_is_cancelled()) {
             exponent -= 1;
             mp_multiply(&mantissa, &base, &mantissa);
         }
@@ -386,8 +387,8 @@ mp_to_exponential_string(MpSerializer *serializer, const MPNumber *x, gboolean e
     return result;
 }
 
-gchar *
-mp_serializer_to_string(MpSerializer *serializer, const MPNumber *x)
+static gchar *
+serialize(MpSerializer *serializer, const MPNumber *x)
 {
     gchar *s0;
     int n_digits = 0;
@@ -411,6 +412,18 @@ mp_serializer_to_string(MpSerializer *serializer, const MPNumber *x)
     }
 }
 
+gchar *
+mp_serializer_to_string(MpSerializer *serializer, const MPNumber *x)
+{
+    gint64 start = mp_stats_span_begin();
+    gchar *s0;
+
+    s0 = serialize(serializer, x);
+    mp_stats_span_end(MP_STATS_SERIALIZE, start);
+
+    return s0;
+}
+
 gboolean
 mp_serializer_from_string(MpSerializer *serializer, const gchar *str, MPNumber *z)
 {
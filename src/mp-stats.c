@@ -0,0 +1,154 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+
+#include "mp-stats.h"
+
+gboolean mp_stats_enabled = FALSE;
+
+/* Protects everything below, only taken when statistics are enabled */
+static GMutex stats_lock;
+static MPStatistics stats;
+
+/* MPNumbers alive, may go below zero for numbers created before a reset */
+static gint64 live_numbers = 0;
+
+/* Set on threads whose work isn't counted */
+static GPrivate thread_ignored;
+
+static const char *operation_names[MP_STATS_N_OPERATIONS] =
+{
+    "add",
+    "multiply",
+    "divide",
+    "power",
+    "logarithm",
+    "trigonometric",
+    "factorial",
+    "factorize"
+};
+
+static const char *span_names[MP_STATS_N_SPANS] =
+{
+    "lex",
+    "parse",
+    "evaluate",
+    "serialize"
+};
+
+void
+mp_stats_init(gboolean enable)
+{
+    const gchar *value = g_getenv("MATE_CALC_STATS");
+
+    mp_stats_enabled = enable || (value != NULL && value[0] != '\0' && strcmp(value, "0") != 0);
+}
+
+gboolean
+mp_stats_get_enabled(void)
+{
+    return mp_stats_enabled;
+}
+
+void
+mp_stats_ignore_thread(gboolean ignore)
+{
+    g_private_set(&thread_ignored, GINT_TO_POINTER(ignore));
+}
+
+void
+mp_stats_count_operation(MPStatsOperation operation)
+{
+    if (g_private_get(&thread_ignored))
+        return;
+    g_mutex_lock(&stats_lock);
+    stats.operations[operation]++;
+    g_mutex_unlock(&stats_lock);
+}
+
+void
+mp_stats_count_new(void)
+{
+    if (g_private_get(&thread_ignored))
+        return;
+    g_mutex_lock(&stats_lock);
+    stats.numbers++;
+    live_numbers++;
+    if (live_numbers > stats.peak_numbers)
+        stats.peak_numbers = live_numbers;
+    g_mutex_unlock(&stats_lock);
+}
+
+void
+mp_stats_count_clear(void)
+{
+    if (g_private_get(&thread_ignored))
+        return;
+    g_mutex_lock(&stats_lock);
+    live_numbers--;
+    g_mutex_unlock(&stats_lock);
+}
+
+gint64
+mp_stats_span_begin(void)
+{
+    return mp_stats_enabled && !g_private_get(&thread_ignored) ? g_get_monotonic_time() : 0;
+}
+
+void
+mp_stats_span_end(MPStatsSpan span, gint64 start)
+{
+    gint64 time;
+
+    if (start == 0)
+        return;
+
+    time = g_get_monotonic_time() - start;
+    g_mutex_lock(&stats_lock);
+    stats.span_time[span] += time;
+    stats.span_count[span]++;
+    g_mutex_unlock(&stats_lock);
+}
+
+void
+mp_stats_get(MPStatistics *result)
+{
+    g_mutex_lock(&stats_lock);
+    *result = stats;
+    g_mutex_unlock(&stats_lock);
+}
+
+void
+mp_stats_reset(void)
+{
+    g_mutex_lock(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    stats.peak_numbers = MAX(live_numbers, 0);
+    g_mutex_unlock(&stats_lock);
+}
+
+gchar *
+mp_stats_to_string(const MPStatistics *s)
+{
+    GString *text = g_string_new(NULL);
+    int i;
+
+    for (i = 0; i < MP_STATS_N_SPANS; i++)
+        g_string_append_printf(text, "%s%s %" G_GINT64_FORMAT " µs (%" G_GUINT64_FORMAT ")",
+                               i > 0 ? ", " : "", span_names[i], s->span_time[i], s->span_count[i]);
+    g_string_append_c(text, '\n');
+    for (i = 0; i < MP_STATS_N_OPERATIONS; i++)
+        g_string_append_printf(text, "%s%s %" G_GUINT64_FORMAT,
+                               i > 0 ? ", " : "", operation_names[i], s->operations[i]);
+    g_string_append_c(text, '\n');
+    g_string_append_printf(text, "numbers created %" G_GUINT64_FORMAT ", peak alive %" G_GINT64_FORMAT,
+                           s->numbers, s->peak_numbers);
+
+    return g_string_free(text, FALSE);
+}
@@ -0,0 +1,90 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef MP_STATS_H
+#define MP_STATS_H
+
+#include <glib.h>
+
+/* Kinds of MPNumber operations counted. Operations implemented with other
+ * operations count those too, e.g. a logarithm to base n counts two natural
+ * logarithms and a division. */
+typedef enum
+{
+    MP_STATS_ADD,               /* Addition and subtraction */
+    MP_STATS_MULTIPLY,
+    MP_STATS_DIVIDE,
+    MP_STATS_POWER,             /* Powers, roots and exponentials */
+    MP_STATS_LOGARITHM,
+    MP_STATS_TRIGONOMETRIC,     /* Trigonometric and hyperbolic functions */
+    MP_STATS_FACTORIAL,
+    MP_STATS_FACTORIZE,
+    MP_STATS_N_OPERATIONS
+} MPStatsOperation;
+
+/* Stages of a calculation that are timed. Equations evaluated inside another
+ * one (e.g. by solve) add to the same spans. */
+typedef enum
+{
+    MP_STATS_LEX,
+    MP_STATS_PARSE,
+    MP_STATS_EVALUATE,
+    MP_STATS_SERIALIZE,
+    MP_STATS_N_SPANS
+} MPStatsSpan;
+
+typedef struct
+{
+    guint64 operations[MP_STATS_N_OPERATIONS];
+
+    /* MPNumbers created, and the most alive at the same time */
+    guint64 numbers;
+    gint64 peak_numbers;
+
+    /* Total time spent in each stage in microseconds, and number of times it ran */
+    gint64 span_time[MP_STATS_N_SPANS];
+    guint64 span_count[MP_STATS_N_SPANS];
+} MPStatistics;
+
+/* Only read by the macros below, use mp_stats_init() to set it */
+extern gboolean mp_stats_enabled;
+
+/* Turn statistics on if enable is TRUE or the MATE_CALC_STATS environment
+ * variable is set. Must be called before any MPNumbers are created. */
+void mp_stats_init(gboolean enable);
+
+gboolean mp_stats_get_enabled(void);
+
+/* Don't count the work of the calling thread if ignore is TRUE, e.g. for
+ * background work that isn't part of the calculations measured */
+void mp_stats_ignore_thread(gboolean ignore);
+
+/* Counters are shared by all threads that aren't ignored */
+void mp_stats_count_operation(MPStatsOperation operation);
+void mp_stats_count_new(void);
+void mp_stats_count_clear(void);
+
+/* Returns the start time of a span, or 0 if statistics are disabled */
+gint64 mp_stats_span_begin(void);
+void mp_stats_span_end(MPStatsSpan span, gint64 start);
+
+/* Counts since the last reset */
+void mp_stats_get(MPStatistics *stats);
+void mp_stats_reset(void);
+
+/* Returns stats as lines of text for showing to developers */
+gchar *mp_stats_to_string(const MPStatistics *stats);
+
+#define MP_STATS_COUNT(operation) \
+    G_STMT_START { if (G_UNLIKELY(mp_stats_enabled)) mp_stats_count_operation(operation); } G_STMT_END
+#define MP_STATS_NEW() \
+    G_STMT_START { if (G_UNLIKELY(mp_stats_enabled)) mp_stats_count_new(); } G_STMT_END
+#define MP_STATS_CLEAR() \
+    G_STMT_START { if (G_UNLIKELY(mp_stats_enabled)) mp_stats_count_clear(); } G_STMT_END
+
+#endif /* MP_STATS_H */
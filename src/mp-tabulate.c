@@ -0,0 +1,551 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "mp-tabulate.h"
+
+/* Number of rows each thread can get ahead of the rows passed to row_func */
+#define ROWS_PER_THREAD 64
+
+/* Rows evaluated at once by a thread */
+#define ROWS_PER_BATCH 16
+
+/* Double precision values are only used if their error is this much smaller
+ * than the last digit shown, so the digits don't depend on how they were computed */
+#define DIGITS_MARGIN 2
+
+/* Ranges whose length is this close to a whole number include the end value,
+ * so e.g. 0 to 0.3 in steps of 0.1 has four values despite rounding */
+#define RANGE_EPSILON_EXPONENT -100
+
+typedef struct
+{
+    MPNumber value;
+    MPErrorCode error;
+    char *error_message;
+    gboolean done;
+} Row;
+
+/* State shared by the threads of one tabulation */
+typedef struct
+{
+    const char *expression;
+    const MPRange *range;
+    MPEquationOptions *options;
+    guint64 length;
+
+    GMutex lock;
+    GCond changed;
+
+    /* Next row to evaluate and number of rows passed to row_func */
+    guint64 next;
+    guint64 written;
+
+    /* Ring of rows being evaluated or waiting to be written */
+    Row *rows;
+    guint n_rows;
+
+    /* Decimal places that must be right in double precision values, or -1 to only use MPNumber */
+    int digits;
+
+    /* Reduction to apply when reducing */
+    MPReduction reduction;
+
+    /* Set when the evaluation was cancelled, or a thread failed to reduce */
+    gboolean cancelled;
+} Tabulation;
+
+/* One thread evaluating its own copy of the equation */
+typedef struct
+{
+    Tabulation *tabulation;
+
+    /* Has its own MPEvalContext with the cancellable, deadline and max_steps of
+     * options->context, so workers don't share a step count or cancelled flag */
+    MPEquationFunction *function;
+
+    /* Current value of the index variable */
+    MPNumber x;
+
+    /* Set once the equation turned out not to have a double precision version */
+    gboolean mp_only;
+
+    /* Rows handled by this thread when reducing, and the result */
+    guint64 first, last;
+    MPNumber result;
+    MPErrorCode error;
+    char *error_token;
+    char *error_message;
+} Worker;
+
+static void
+worker_init(Worker *worker, Tabulation *tabulation)
+{
+    memset(worker, 0, sizeof(Worker));
+    worker->tabulation = tabulation;
+    worker->function = mp_equation_function_new(tabulation->expression, tabulation->range->variable, tabulation->options, NULL);
+    worker->x = mp_new();
+    worker->result = mp_new();
+}
+
+static void
+worker_clear(Worker *worker)
+{
+    mp_equation_function_free(worker->function);
+    mp_clear(&worker->x);
+    mp_clear(&worker->result);
+    g_free(worker->error_token);
+    g_free(worker->error_message);
+}
+
+/* Math errors are kept per thread, so they are copied to the thread that reports them */
+static char *
+get_error_message(MPErrorCode error)
+{
+    return error == PARSER_ERR_MP ? g_strdup(mp_get_error()) : NULL;
+}
+
+static void
+set_error_message(const char *message)
+{
+    mp_clear_error();
+    if (message != NULL)
+        mperr("%s", message);
+}
+
+/* Set the index variable to its value in row index */
+static void
+get_range_value(const MPRange *range, guint64 index, MPNumber *z)
+{
+    MPNumber t = mp_new();
+
+    /* Multiply rather than add up steps so rounding errors don't build up */
+    mp_set_from_unsigned_integer(index, &t);
+    mp_multiply(&range->step, &t, &t);
+    mp_add(&range->start, &t, z);
+    mp_clear(&t);
+}
+
+static MPErrorCode
+worker_evaluate(Worker *worker, guint64 index, MPNumber *z, char **error_token)
+{
+    get_range_value(worker->tabulation->range, index, &worker->x);
+    return mp_equation_function_evaluate(worker->function, &worker->x, z, error_token);
+}
+
+/* Check if value rounds the same way as any value within error of it, when rounded to a multiple of 1÷scale */
+static gboolean
+rounds_alike(double value, double error, double scale)
+{
+    double fraction;
+
+    fraction = value * scale - floor(value * scale);
+    return fabs(fraction - 0.5) > error * scale;
+}
+
+/* Check if value shows the same digits as the exact value it is within error of */
+static gboolean
+is_accurate(double value, double error, int digits)
+{
+    double scale;
+    int exponent;
+
+    if (error == 0)
+        return TRUE;
+
+    /* Small values are shown with the same number of significant digits */
+    scale = pow(10, digits + DIGITS_MARGIN);
+    if (!(error * scale <= MIN(1, fabs(value))))
+        return FALSE;
+
+    /* Values close to halfway between two results shown could round either way */
+    value = fabs(value);
+    if (!rounds_alike(value, error, pow(10, digits)))
+        return FALSE;
+
+    /* Very small and large values are shown in scientific notation, which
+     * rounds to digits places after the first significant digit instead */
+    exponent = floor(log10(value));
+    if (floor(log10(value - error)) != exponent || floor(log10(value + error)) != exponent)
+        return FALSE;
+    return rounds_alike(value, error, pow(10, digits - exponent));
+}
+
+/* Evaluate n rows from first, in double precision where that gives the digits
+ * asked for and with MPNumber otherwise */
+static void
+worker_evaluate_batch(Worker *worker, guint64 first, guint n, MPNumber *values, MPErrorCode *errors, char **error_messages)
+{
+    Tabulation *tabulation = worker->tabulation;
+    double x[ROWS_PER_BATCH], value[ROWS_PER_BATCH], error[ROWS_PER_BATCH];
+    gboolean in_double = FALSE;
+    guint i;
+
+    if (tabulation->digits >= 0 && !worker->mp_only) {
+        for (i = 0; i < n; i++) {
+            get_range_value(tabulation->range, first + i, &worker->x);
+            x[i] = mp_to_double(&worker->x);
+        }
+        in_double = mp_equation_function_evaluate_double(worker->function, x, n, value, error);
+        worker->mp_only = !in_double;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (in_double && is_accurate(value[i], error[i], tabulation->digits)) {
+            mp_set_from_double(value[i], &values[i]);
+            errors[i] = PARSER_ERR_NONE;
+            error_messages[i] = NULL;
+        }
+        else {
+            errors[i] = worker_evaluate(worker, first + i, &values[i], NULL);
+            error_messages[i] = get_error_message(errors[i]);
+        }
+    }
+}
+
+guint64
+mp_range_get_length(const MPRange *range)
+{
+    MPNumber t, rounded, epsilon;
+    guint64 length = 0;
+
+    if (mp_is_zero(&range->step))
+        return 0;
+
+    t = mp_new();
+    rounded = mp_new();
+    epsilon = mp_new();
+    mp_subtract(&range->end, &range->start, &t);
+    mp_divide(&t, &range->step, &t);
+    if (!mp_is_negative(&t)) {
+        mp_round(&t, &rounded);
+        mp_subtract(&t, &rounded, &epsilon);
+        mp_abs(&epsilon, &epsilon);
+        mp_set_from_integer(10, &t);
+        mp_xpowy_integer(&t, RANGE_EPSILON_EXPONENT, &t);
+        if (mp_compare(&epsilon, &t) > 0) {
+            mp_subtract(&range->end, &range->start, &t);
+            mp_divide(&t, &range->step, &t);
+            mp_floor(&t, &rounded);
+        }
+        length = mp_to_unsigned_integer(&rounded) + 1;
+    }
+
+    mp_clear(&t);
+    mp_clear(&rounded);
+    mp_clear(&epsilon);
+
+    return length;
+}
+
+/* Check the expression on the first row so syntax errors and unknown names
+ * are reported once rather than on every row */
+static MPErrorCode
+check_expression(Tabulation *tabulation, char **error_token)
+{
+    Worker worker;
+    MPNumber z = mp_new();
+    MPErrorCode error;
+
+    worker_init(&worker, tabulation);
+    error = worker_evaluate(&worker, 0, &z, error_token);
+    worker_clear(&worker);
+    mp_clear(&z);
+
+    switch (error) {
+    case PARSER_ERR_INVALID:
+    case PARSER_ERR_UNKNOWN_VARIABLE:
+    case PARSER_ERR_UNKNOWN_FUNCTION:
+    case PARSER_ERR_UNKNOWN_CONVERSION:
+        return error;
+    default:
+        /* Errors for the value of the first row are reported with the row */
+        if (error_token != NULL) {
+            g_free(*error_token);
+            *error_token = NULL;
+        }
+        return PARSER_ERR_NONE;
+    }
+}
+
+static gpointer
+tabulate_thread(gpointer data)
+{
+    Worker *worker = data;
+    Tabulation *tabulation = worker->tabulation;
+    MPNumber values[ROWS_PER_BATCH];
+    MPErrorCode errors[ROWS_PER_BATCH];
+    char *error_messages[ROWS_PER_BATCH];
+    guint i;
+
+    for (i = 0; i < ROWS_PER_BATCH; i++)
+        values[i] = mp_new();
+
+    g_mutex_lock(&tabulation->lock);
+    while (TRUE) {
+        guint64 first;
+        guint n;
+
+        /* Don't get too far ahead of the rows being written */
+        while (!tabulation->cancelled && tabulation->next < tabulation->length &&
+               tabulation->next >= tabulation->written + tabulation->n_rows)
+            g_cond_wait(&tabulation->changed, &tabulation->lock);
+        if (tabulation->cancelled || tabulation->next >= tabulation->length)
+            break;
+        first = tabulation->next;
+        n = MIN(MIN(ROWS_PER_BATCH, tabulation->length - first), tabulation->written + tabulation->n_rows - first);
+        tabulation->next += n;
+        g_mutex_unlock(&tabulation->lock);
+
+        worker_evaluate_batch(worker, first, n, values, errors, error_messages);
+
+        g_mutex_lock(&tabulation->lock);
+        for (i = 0; i < n; i++) {
+            Row *row = &tabulation->rows[(first + i) % tabulation->n_rows];
+
+            row->error = errors[i];
+            row->error_message = error_messages[i];
+            if (errors[i] == PARSER_ERR_NONE)
+                mp_set_from_mp(&values[i], &row->value);
+            row->done = TRUE;
+            if (errors[i] == PARSER_ERR_CANCELLED)
+                tabulation->cancelled = TRUE;
+        }
+        g_cond_broadcast(&tabulation->changed);
+    }
+    g_mutex_unlock(&tabulation->lock);
+
+    for (i = 0; i < ROWS_PER_BATCH; i++)
+        mp_clear(&values[i]);
+
+    return NULL;
+}
+
+static gpointer
+reduce_thread(gpointer data)
+{
+    Worker *worker = data;
+    Tabulation *tabulation = worker->tabulation;
+    MPNumber z = mp_new();
+    guint64 index;
+
+    for (index = worker->first; index < worker->last; index++) {
+        worker->error = worker_evaluate(worker, index, &z, &worker->error_token);
+        if (worker->error != PARSER_ERR_NONE) {
+            worker->error_message = get_error_message(worker->error);
+            break;
+        }
+
+        if (index == worker->first)
+            mp_set_from_mp(&z, &worker->result);
+        else if (tabulation->reduction == MP_REDUCE_PRODUCT)
+            mp_multiply(&worker->result, &z, &worker->result);
+        else
+            mp_add(&worker->result, &z, &worker->result);
+
+        /* Give up once another thread failed */
+        if (g_atomic_int_get(&tabulation->cancelled))
+            break;
+    }
+    if (worker->error != PARSER_ERR_NONE)
+        g_atomic_int_set(&tabulation->cancelled, TRUE);
+    mp_clear(&z);
+
+    return NULL;
+}
+
+static guint
+get_thread_count(int n_threads, guint64 length)
+{
+    guint count = n_threads > 0 ? (guint) n_threads : g_get_num_processors();
+
+    if (count > length)
+        count = length;
+    return MAX(count, 1);
+}
+
+static void
+tabulation_init(Tabulation *tabulation, const char *expression, const MPRange *range, MPEquationOptions *options)
+{
+    memset(tabulation, 0, sizeof(Tabulation));
+    tabulation->expression = expression;
+    tabulation->range = range;
+    tabulation->options = options;
+    tabulation->length = mp_range_get_length(range);
+    tabulation->digits = -1;
+    g_mutex_init(&tabulation->lock);
+    g_cond_init(&tabulation->changed);
+}
+
+static void
+tabulation_clear(Tabulation *tabulation)
+{
+    g_mutex_clear(&tabulation->lock);
+    g_cond_clear(&tabulation->changed);
+}
+
+MPErrorCode
+mp_tabulate(const char *expression, const MPRange *range, MPEquationOptions *options, int digits, int n_threads,
+            MPTabulateRowFunc row_func, void *data, char **error_token)
+{
+    Tabulation tabulation;
+    Worker *workers;
+    GThread **threads;
+    MPNumber x = mp_new();
+    MPErrorCode error;
+    guint n_workers, i;
+
+    if (!(expression && range && range->variable && options && row_func))
+        return PARSER_ERR_INVALID;
+
+    tabulation_init(&tabulation, expression, range, options);
+    error = check_expression(&tabulation, error_token);
+    if (error != PARSER_ERR_NONE) {
+        tabulation_clear(&tabulation);
+        return error;
+    }
+
+    /* The double precision version only has real values */
+    if (!mp_is_complex(&range->start) && !mp_is_complex(&range->step))
+        tabulation.digits = digits;
+
+    n_workers = get_thread_count(n_threads, tabulation.length);
+    tabulation.n_rows = n_workers * ROWS_PER_THREAD;
+    tabulation.rows = g_new0(Row, tabulation.n_rows);
+    for (i = 0; i < tabulation.n_rows; i++)
+        tabulation.rows[i].value = mp_new();
+
+    workers = g_new(Worker, n_workers);
+    threads = g_new(GThread *, n_workers);
+    for (i = 0; i < n_workers; i++) {
+        worker_init(&workers[i], &tabulation);
+        threads[i] = g_thread_new("mp-tabulate", tabulate_thread, &workers[i]);
+    }
+
+    /* Write out rows in order as they complete */
+    g_mutex_lock(&tabulation.lock);
+    while (tabulation.written < tabulation.length && !tabulation.cancelled) {
+        Row *row = &tabulation.rows[tabulation.written % tabulation.n_rows];
+
+        if (!row->done) {
+            g_cond_wait(&tabulation.changed, &tabulation.lock);
+            continue;
+        }
+        g_mutex_unlock(&tabulation.lock);
+
+        get_range_value(range, tabulation.written, &x);
+        set_error_message(row->error_message);
+        row_func(&x, row->error, row->error == PARSER_ERR_NONE ? &row->value : NULL, data);
+
+        g_mutex_lock(&tabulation.lock);
+        g_free(row->error_message);
+        row->error_message = NULL;
+        row->done = FALSE;
+        tabulation.written++;
+        g_cond_broadcast(&tabulation.changed);
+    }
+    g_mutex_unlock(&tabulation.lock);
+
+    for (i = 0; i < n_workers; i++) {
+        g_thread_join(threads[i]);
+        worker_clear(&workers[i]);
+    }
+    g_free(threads);
+    g_free(workers);
+
+    for (i = 0; i < tabulation.n_rows; i++) {
+        mp_clear(&tabulation.rows[i].value);
+        g_free(tabulation.rows[i].error_message);
+    }
+    g_free(tabulation.rows);
+
+    error = tabulation.cancelled ? PARSER_ERR_CANCELLED : PARSER_ERR_NONE;
+    if (error == PARSER_ERR_CANCELLED && options->context)
+        options->context->cancelled = true;
+    tabulation_clear(&tabulation);
+    mp_clear(&x);
+
+    return error;
+}
+
+MPErrorCode
+mp_tabulate_reduce(const char *expression, const MPRange *range, MPReduction reduction,
+                   MPEquationOptions *options, int n_threads, MPNumber *result, char **error_token)
+{
+    Tabulation tabulation;
+    Worker *workers;
+    GThread **threads;
+    MPErrorCode error;
+    guint n_workers, i;
+
+    if (!(expression && range && range->variable && options && result))
+        return PARSER_ERR_INVALID;
+
+    tabulation_init(&tabulation, expression, range, options);
+    error = check_expression(&tabulation, error_token);
+    if (error != PARSER_ERR_NONE) {
+        tabulation_clear(&tabulation);
+        return error;
+    }
+
+    /* The empty sum is zero and the empty product is one */
+    if (tabulation.length == 0) {
+        mp_set_from_integer(reduction == MP_REDUCE_PRODUCT ? 1 : 0, result);
+        tabulation_clear(&tabulation);
+        return PARSER_ERR_NONE;
+    }
+
+    /* Each thread reduces a contiguous block of the range, and the blocks are
+     * combined in order so the result doesn't depend on thread scheduling */
+    tabulation.reduction = reduction;
+    n_workers = get_thread_count(n_threads, tabulation.length);
+    workers = g_new(Worker, n_workers);
+    threads = g_new(GThread *, n_workers);
+    for (i = 0; i < n_workers; i++) {
+        worker_init(&workers[i], &tabulation);
+        workers[i].first = tabulation.length * i / n_workers;
+        workers[i].last = tabulation.length * (i + 1) / n_workers;
+        threads[i] = g_thread_new("mp-tabulate", reduce_thread, &workers[i]);
+    }
+    for (i = 0; i < n_workers; i++)
+        g_thread_join(threads[i]);
+
+    error = PARSER_ERR_NONE;
+    for (i = 0; i < n_workers && error == PARSER_ERR_NONE; i++) {
+        Worker *worker = &workers[i];
+
+        /* Threads stopped early by another thread's error have no result */
+        if (worker->error != PARSER_ERR_NONE) {
+            error = worker->error;
+            set_error_message(worker->error_message);
+            if (error_token != NULL) {
+                *error_token = worker->error_token;
+                worker->error_token = NULL;
+            }
+        }
+        else if (i == 0)
+            mp_set_from_mp(&worker->result, result);
+        else if (reduction == MP_REDUCE_PRODUCT)
+            mp_multiply(result, &worker->result, result);
+        else
+            mp_add(result, &worker->result, result);
+    }
+    if (error == PARSER_ERR_CANCELLED && options->context)
+        options->context->cancelled = true;
+
+    for (i = 0; i < n_workers; i++)
+        worker_clear(&workers[i]);
+    g_free(threads);
+    g_free(workers);
+    tabulation_clear(&tabulation);
+
+    return error;
+}
@@ -0,0 +1,55 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef MP_TABULATE_H
+#define MP_TABULATE_H
+
+#include "mp-equation.h"
+
+typedef enum
+{
+    MP_REDUCE_SUM,
+    MP_REDUCE_PRODUCT
+} MPReduction;
+
+/* Range of values for an index variable, start, start + step, ... up to end */
+typedef struct
+{
+    /* Name of the index variable */
+    const char *variable;
+
+    MPNumber start;
+    MPNumber end;
+    MPNumber step;
+} MPRange;
+
+/* Called for each value of the index variable in order, with the value of the
+ * expression or the error evaluating it (see mp_get_error() for PARSER_ERR_MP) */
+typedef void (*MPTabulateRowFunc)(const MPNumber *x, MPErrorCode error, const MPNumber *value, void *data);
+
+/* Number of values in range, 0 if the step doesn't lead from start to end */
+guint64 mp_range_get_length(const MPRange *range);
+
+/* Evaluate expression for each value in range using n_threads threads (0 for
+ * one per processor). The callbacks in options must be safe to call from any
+ * thread. Rows are passed to row_func on the calling thread as soon as they
+ * and all the rows before them are ready. Returns an error if the expression
+ * or range is invalid, or the evaluation was cancelled.
+ *
+ * If digits is not negative, values are computed in double precision where
+ * they are certain to be right to that many decimal places, and with MPNumber
+ * otherwise. */
+MPErrorCode mp_tabulate(const char *expression, const MPRange *range, MPEquationOptions *options, int digits,
+                        int n_threads, MPTabulateRowFunc row_func, void *data, char **error_token);
+
+/* Sum or multiply the values of expression over range using n_threads threads.
+ * Stops at the first error found. */
+MPErrorCode mp_tabulate_reduce(const char *expression, const MPRange *range, MPReduction reduction,
+                               MPEquationOptions *options, int n_threads, MPNumber *result, char **error_token);
+
+#endif /* MP_TABULATE_H */
@@ -15,6 +15,7 @@
 #include <libintl.h>
 
 #include "mp.h"
+#include "mp-stats.h"
 
 /* Convert x to radians */
 void
@@ -81,6 +82,7 @@ mp_get_pi (MPNumber *z)
 void
 mp_sin(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     if (mp_is_complex(x))
         mp_set_from_mp(x, z);
     else
@@ -91,6 +93,7 @@ mp_sin(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 void
 mp_cos(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     if (mp_is_complex(x))
         mp_set_from_mp(x, z);
     else
@@ -101,6 +104,7 @@ mp_cos(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 void
 mp_tan(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     MPNumber x_radians = mp_new();
     MPNumber pi = mp_new();
     MPNumber t1 = mp_new();
@@ -134,6 +138,7 @@ mp_tan(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 void
 mp_asin(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     MPNumber x_max = mp_new();
     MPNumber x_min = mp_new();
     mp_set_from_integer(1, &x_max);
@@ -158,6 +163,7 @@ mp_asin(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 void
 mp_acos(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     MPNumber x_max = mp_new();
     MPNumber x_min = mp_new();
     mp_set_from_integer(1, &x_max);
@@ -182,6 +188,7 @@ mp_acos(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 void
 mp_atan(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     MPNumber i = mp_new();
     MPNumber minus_i = mp_new();
     mpc_set_si_si(i.num, 0, 1, MPC_RNDNN);
@@ -207,30 +214,35 @@ mp_atan(const MPNumber *x, MPAngleUnit unit, MPNumber *z)
 void
 mp_sinh(const MPNumber *x, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     mpc_sinh(z->num, x->num, MPC_RNDNN);
 }
 
 void
 mp_cosh(const MPNumber *x, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     mpc_cosh(z->num, x->num, MPC_RNDNN);
 }
 
 void
 mp_tanh(const MPNumber *x, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     mpc_tanh(z->num, x->num, MPC_RNDNN);
 }
 
 void
 mp_asinh(const MPNumber *x, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     mpc_asinh(z->num, x->num, MPC_RNDNN);
 }
 
 void
 mp_acosh(const MPNumber *x, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     MPNumber t = mp_new();
 
     /* Check x >= 1 */
@@ -251,6 +263,7 @@ mp_acosh(const MPNumber *x, MPNumber *z)
 void
 mp_atanh(const MPNumber *x, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_TRIGONOMETRIC);
     MPNumber x_max = mp_new();
     MPNumber x_min = mp_new();
     mp_set_from_integer(1, &x_max);
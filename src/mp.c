@@ -16,8 +16,10 @@
 #include <errno.h>
 
 #include "mp.h"
+#include "mp-stats.h"
 
-char *mp_error = NULL;
+/* Last error of the calling thread, equations may be evaluated in several threads at once */
+static GPrivate mp_error = G_PRIVATE_INIT(g_free);
 
 /*  THIS ROUTINE IS CALLED WHEN AN ERROR CONDITION IS ENCOUNTERED, AND
  *  AFTER A MESSAGE HAS BEEN WRITTEN TO STDERR.
@@ -32,28 +34,77 @@ mperr(const char *format, ...)
     vsnprintf(text, 1024, format, args);
     va_end(args);
 
-    if (mp_error)
-        free(mp_error);
-    mp_error = strdup(text);
+    g_private_replace(&mp_error, g_strdup(text));
 }
 
 const char *
 mp_get_error()
 {
-    return mp_error;
+    return g_private_get(&mp_error);
 }
 
 void mp_clear_error()
 {
-    if (mp_error)
-        free(mp_error);
-    mp_error = NULL;
+    g_private_replace(&mp_error, NULL);
+}
+
+/* Evaluation context of the calling thread */
+static GPrivate mp_eval_context;
+
+void
+mp_eval_context_init(MPEvalContext *context, GCancellable *cancellable, gint64 timeout, guint64 max_steps)
+{
+    context->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+    context->deadline = timeout > 0 ? g_get_monotonic_time() + timeout : 0;
+    context->max_steps = max_steps;
+    context->steps = 0;
+    context->cancelled = false;
+}
+
+void
+mp_eval_context_clear(MPEvalContext *context)
+{
+    g_clear_object(&context->cancellable);
+}
+
+MPEvalContext *
+mp_set_eval_context(MPEvalContext *context)
+{
+    MPEvalContext *previous = g_private_get(&mp_eval_context);
+    g_private_set(&mp_eval_context, context);
+    return previous;
+}
+
+MPEvalContext *
+mp_get_eval_context(void)
+{
+    return g_private_get(&mp_eval_context);
+}
+
+bool
+mp_is_cancelled(void)
+{
+    MPEvalContext *context = g_private_get(&mp_eval_context);
+
+    if (context == NULL)
+        return false;
+    if (context->cancelled)
+        return true;
+
+    context->steps++;
+    if ((context->max_steps > 0 && context->steps > context->max_steps) ||
+        (context->cancellable != NULL && g_cancellable_is_cancelled(context->cancellable)) ||
+        (context->deadline > 0 && g_get_monotonic_time() > context->deadline))
+        context->cancelled = true;
+
+    return context->cancelled;
 }
 
 MPNumber
 mp_new(void)
 {
     MPNumber z;
+    MP_STATS_NEW();
     mpc_init2(z.num, PRECISION);
     return z;
 }
@@ -62,6 +113,7 @@ MPNumber
 mp_new_from_unsigned_integer(ulong x)
 {
     MPNumber z;
+    MP_STATS_NEW();
     mpc_init2(z.num, PRECISION);
     mpc_set_ui(z.num, x, MPC_RNDNN);
     return z;
@@ -71,6 +123,7 @@ MPNumber *
 mp_new_ptr(void)
 {
     MPNumber *z = malloc(sizeof(MPNumber));
+    MP_STATS_NEW();
     mpc_init2(z->num, PRECISION);
     return z;
 }
@@ -79,7 +132,10 @@ void
 mp_clear(MPNumber *z)
 {
     if (z != NULL)
+    {
+        MP_STATS_CLEAR();
         mpc_clear(z->num);
+    }
 }
 
 void
@@ -87,6 +143,7 @@ mp_free(MPNumber *z)
 {
     if (z != NULL)
     {
+        MP_STATS_CLEAR();
         mpc_clear(z->num);
         free(z);
     }
@@ -156,18 +213,21 @@ mp_imaginary_component(const MPNumber *x, MPNumber *z)
 void
 mp_add(const MPNumber *x, const MPNumber *y, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_ADD);
     mpc_add(z->num, x->num, y->num, MPC_RNDNN);
 }
 
 void
 mp_add_integer(const MPNumber *x, long y, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_ADD);
     mpc_add_si(z->num, x->num, y, MPC_RNDNN);
 }
 
 void
 mp_subtract(const MPNumber *x, const MPNumber *y, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_ADD);
     mpc_sub(z->num, x->num, y->num, MPC_RNDNN);
 }
 
@@ -230,6 +290,7 @@ mp_compare(const MPNumber *x, const MPNumber *y)
 void
 mp_divide(const MPNumber *x, const MPNumber *y, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_DIVIDE);
     if (mp_is_zero(y))
     {
         /* Translators: Error displayed attempted to divide by zero */
@@ -293,6 +354,7 @@ mp_is_equal(const MPNumber *x, const MPNumber *y)
 void
 mp_epowy(const MPNumber *x, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_POWER);
     mpc_exp(z->num, x->num, MPC_RNDNN);
 }
 
@@ -336,6 +398,7 @@ mp_is_less_than(const MPNumber *x, const MPNumber *y)
 void
 mp_ln(const MPNumber *x, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_LOGARITHM);
     /* ln(0) undefined */
     if (mp_is_zero(x))
     {
@@ -385,12 +448,14 @@ mp_logarithm(long n, const MPNumber *x, MPNumber *z)
 void
 mp_multiply(const MPNumber *x, const MPNumber *y, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_MULTIPLY);
     mpc_mul(z->num, x->num, y->num, MPC_RNDNN);
 }
 
 void
 mp_multiply_integer(const MPNumber *x, long y, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_MULTIPLY);
     mpc_mul_si(z->num, x->num, y, MPC_RNDNN);
 }
 
@@ -413,6 +478,7 @@ mp_reciprocal(const MPNumber *x, MPNumber *z)
 void
 mp_root(const MPNumber *x, long n, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_POWER);
     ulong p;
 
     if (n < 0)
@@ -457,9 +523,13 @@ mp_sqrt(const MPNumber *x, MPNumber *z)
     mp_root(x, 2, z);
 }
 
+/* Multiplications in a factorial charged as one evaluation step */
+#define FACTORIAL_BLOCK 4096
+
 void
 mp_factorial(const MPNumber *x, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_FACTORIAL);
     /* 0! == 1 */
     if (mp_is_zero(x))
     {
@@ -491,6 +561,16 @@ mp_factorial(const MPNumber *x, MPNumber *z)
     {
         /* Convert to integer - if couldn't be converted then the factorial would be too big anyway */
         ulong value = mp_to_unsigned_integer(x);
+
+        /* mpfr_fac_ui can't be interrupted, so check the limits for the work it will do before starting */
+        for (ulong block = value / FACTORIAL_BLOCK; block > 0; block--)
+        {
+            if (mp_is_cancelled())
+            {
+                mp_set_from_integer(0, z);
+                return;
+            }
+        }
         mpfr_fac_ui(mpc_realref(z->num), value, MPFR_RNDN);
         mpfr_set_zero(mpc_imagref(z->num), MPFR_RNDN);
     }
@@ -569,6 +649,7 @@ mp_modular_exponentiation(const MPNumber *x, const MPNumber *y, const MPNumber *
 void
 mp_xpowy(const MPNumber *x, const MPNumber *y, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_POWER);
     /* 0^-n invalid */
     if (mp_is_zero(x) && mp_is_negative(y))
     {   /* Translators: Error displayed when attempted to raise 0 to a negative exponent */
@@ -596,6 +677,7 @@ mp_xpowy(const MPNumber *x, const MPNumber *y, MPNumber *z)
 void
 mp_xpowy_integer(const MPNumber *x, long n, MPNumber *z)
 {
+    MP_STATS_COUNT(MP_STATS_POWER);
     /* 0^-n invalid */
     if (mp_is_zero(x) && n < 0)
     {   /* Translators: Error displayed when attempted to raise 0 to a negative re_exponent */
@@ -759,7 +841,7 @@ mp_pollard_rho (const MPNumber *n, ulong i, MPNumber *z)
     MPNumber y = mp_new_from_unsigned_integer(2);
     MPNumber d = mp_new_from_unsigned_integer(1);
 
-    while (mp_compare(&d, &one) == 0)
+    while (mp_compare(&d, &one) == 0 && !mp_is_cancelled())
     {
         mp_modular_exponentiation(&x, &two, n, &x);
         mp_add(&x, &one, &x);
@@ -817,6 +899,10 @@ find_big_prime_factor (const MPNumber *n, MPNumber *z)
             i++;
         }
 
+        /* No factor has been found */
+        if (mp_is_cancelled())
+            break;
+
         if (!mp_is_pprime(&tmp, 50))
         {
             mp_divide(n, &tmp, &tmp);
@@ -842,9 +928,10 @@ find_big_prime_factor (const MPNumber *n, MPNumber *z)
 GList*
 mp_factorize(const MPNumber *x)
 {
+    MP_STATS_COUNT(MP_STATS_FACTORIZE);
     GList *list = NULL;
     MPNumber *factor = g_slice_alloc0(sizeof(MPNumber));
-    mpc_init2(factor->num, PRECISION);
+    *factor = mp_new();
 
     MPNumber value = mp_new();
     mp_abs(x, &value);
@@ -895,7 +982,7 @@ mp_factorize(const MPNumber *x)
             mp_set_from_mp(&divisor, factor);
             list = g_list_append(list, factor);
             factor = g_slice_alloc0(sizeof(MPNumber));
-            mpc_init2(factor->num, PRECISION);
+            *factor = mp_new();
         }
         else
             break;
@@ -917,7 +1004,7 @@ mp_factorize(const MPNumber *x)
             mp_set_from_mp(&divisor, factor);
             list = g_list_append(list, factor);
             factor = g_slice_alloc0(sizeof(MPNumber));
-            mpc_init2(factor->num, PRECISION);
+            *factor = mp_new();
         }
         else
         {
@@ -925,9 +1012,11 @@ mp_factorize(const MPNumber *x)
         }
     }
 
-    while (!mp_is_pprime(&value, 50))
+    while (!mp_is_cancelled() && !mp_is_pprime(&value, 50))
     {
         find_big_prime_factor (&value, &divisor);
+        if (mp_is_cancelled())
+            break;
 
         mp_divide(&value, &divisor, &tmp);
         if (mp_is_integer(&tmp))
@@ -936,7 +1025,7 @@ mp_factorize(const MPNumber *x)
             mp_set_from_mp(&divisor, factor);
             list = g_list_append(list, factor);
             factor = g_slice_alloc0(sizeof(MPNumber));
-            mpc_init2(factor->num, PRECISION);
+            *factor = mp_new();
         }
     }
 
@@ -948,7 +1037,7 @@ mp_factorize(const MPNumber *x)
     }
     else
     {
-        mpc_clear(factor->num);
+        mp_clear(factor);
         g_slice_free(MPNumber, factor);
     }
 
@@ -963,12 +1052,15 @@ mp_factorize(const MPNumber *x)
     return list;
 }
 
+/* Number of trial divisions between checks for cancellation */
+#define FACTORIZE_BLOCK 65536
+
 GList*
 mp_factorize_unit64(uint64_t n)
 {
     GList *list = NULL;
     MPNumber *factor = g_slice_alloc0(sizeof(MPNumber));
-    mpc_init2(factor->num, PRECISION);
+    *factor = mp_new();
 
     MPNumber tmp = mp_new();
     mp_set_from_unsigned_integer(2, &tmp);
@@ -978,18 +1070,21 @@ mp_factorize_unit64(uint64_t n)
         mp_set_from_mp(&tmp, factor);
         list = g_list_append(list, factor);
         factor = g_slice_alloc0(sizeof(MPNumber));
-        mpc_init2(factor->num, PRECISION);
+        *factor = mp_new();
     }
 
     for (uint64_t divisor = 3; divisor <= n / divisor; divisor +=2)
     {
+        if (divisor % FACTORIZE_BLOCK == 1 && mp_is_cancelled())
+            break;
+
         while (n % divisor == 0)
         {
             n /= divisor;
             mp_set_from_unsigned_integer(divisor, factor);
             list = g_list_append(list, factor);
             factor = g_slice_alloc0(sizeof(MPNumber));
-            mpc_init2(factor->num, PRECISION);
+            *factor = mp_new();
         }
     }
 
@@ -1000,7 +1095,7 @@ mp_factorize_unit64(uint64_t n)
     }
     else
     {
-        mpc_clear(factor->num);
+        mp_clear(factor);
         g_slice_free(MPNumber, factor);
     }
     mp_clear(&tmp);
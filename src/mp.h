@@ -34,6 +34,7 @@
 #include <stdint.h>
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <gio/gio.h>
 #include <mpfr.h>
 #include <mpc.h>
 
@@ -57,8 +58,25 @@ typedef enum
     MP_GRADIANS
 } MPAngleUnit;
 
-/* Returns error string or NULL if no error */
-// FIXME: Global variable
+/* Limits for a calculation. Long running operations check the context of the
+ * calling thread and stop early (leaving an undefined result) once it is cancelled */
+typedef struct
+{
+    /* Cancelled from another thread, or NULL */
+    GCancellable *cancellable;
+
+    /* Monotonic time to give up at, or 0 for no limit */
+    gint64 deadline;
+
+    /* Number of steps to give up after, or 0 for no limit */
+    guint64 max_steps;
+    guint64 steps;
+
+    /* Set once any of the limits has been hit */
+    bool cancelled;
+} MPEvalContext;
+
+/* Returns error string of the calling thread or NULL if no error */
 const char  *mp_get_error(void);
 
 /* Clear any current error */
@@ -66,6 +84,21 @@ void        mp_clear_error(void);
 
 void        mperr(const char *format, ...) __attribute__((format(printf, 1, 2)));
 
+/* Set up an evaluation context, @timeout in microseconds (0 for none) */
+void        mp_eval_context_init(MPEvalContext *context, GCancellable *cancellable, gint64 timeout, guint64 max_steps);
+
+/* Release resources held by an evaluation context */
+void        mp_eval_context_clear(MPEvalContext *context);
+
+/* Set the evaluation context of the calling thread (NULL for none), returns the previous one */
+MPEvalContext *mp_set_eval_context(MPEvalContext *context);
+
+/* Returns the evaluation context of the calling thread, or NULL */
+MPEvalContext *mp_get_eval_context(void);
+
+/* Count a step of the current calculation, returns true if it should stop */
+bool        mp_is_cancelled(void);
+
 /* Returns initialized MPNumber object */
 MPNumber    mp_new(void);
 
@@ -218,7 +251,7 @@ void   mp_xpowy_integer(const MPNumber *x, long y, MPNumber *z);
 /* Sets z = e^x */
 void   mp_epowy(const MPNumber *x, MPNumber *z);
 
-/* Returns a list of all prime factors in x as MPNumbers */
+/* Returns a list of all prime factors in x as MPNumbers, incomplete if cancelled */
 GList* mp_factorize(const MPNumber *x);
 
 GList* mp_factorize_unit64 (uint64_t n);
@@ -255,6 +288,16 @@ void   mp_set_from_random(MPNumber *z);
  */
 bool   mp_set_from_string(const char *text, int default_base, MPNumber *z);
 
+/* Sets z from text made by mp_to_exact_string().
+ * Returns true on success.
+ */
+bool   mp_set_from_exact_string(const char *text, MPNumber *z);
+
+/* Returns x as hexadecimal floating point text that mp_set_from_exact_string()
+ * reads back without any loss of precision. Free with g_free().
+ */
+gchar *mp_to_exact_string(const MPNumber *x);
+
 /* Returns x as a native single-precision floating point number */
 float  mp_to_float(const MPNumber *x);
 
@@ -82,13 +82,12 @@ p_make_precedence_t(ParserState* state, LexerTokenType type)
     return (p_get_precedence(type) + (state->depth_level * P_Depth));
 }
 
-/* Allocate and create a new node.  `value` must be free()able */
+/* Allocate and create a new node from the parser's arena.  `value` must be free()able */
 static ParseNode*
 p_create_node(ParserState* state, LexerToken* token, guint precedence, Associativity associativity, void* value, void* (*function)(ParseNode*))
 {
     ParseNode* new;
-    new = (ParseNode*) malloc(sizeof(ParseNode));
-    assert(new != NULL);
+    new = (ParseNode*) a_alloc(state->arena, sizeof(ParseNode));
     new->parent = NULL;
     new->left = NULL;
     new->right = NULL;
@@ -98,9 +97,51 @@ p_create_node(ParserState* state, LexerToken* token, guint precedence, Associati
     new->value = value;
     new->state = state;
     new->evaluate = function;
+    new->canonical = NULL;
+    new->is_constant = FALSE;
+    new->is_cacheable = FALSE;
+    new->users = 0;
+    new->cache = NULL;
+    new->cache_epoch = 0;
     return new;
 }
 
+/* Check for functions taking an equation as an argument, e.g. solve(x²−2;x;1). Their arguments are kept as text. */
+static gboolean
+p_is_equation_function(LexerToken* token)
+{
+    return g_ascii_strcasecmp(token->string, "solve") == 0
+         ||g_ascii_strcasecmp(token->string, "integrate") == 0;
+}
+
+/* Find the bracket closing the one following token, or NULL if it isn't closed. */
+static LexerToken*
+p_find_closing_bracket(LexerState* lexer, LexerToken* token)
+{
+    LexerToken* end = lexer->tokens + lexer->token_count;
+    guint depth = 0;
+    if(token + 1 >= end || token[1].token_type != T_L_R_BRACKET)
+        return NULL;
+    for(token++; token < end && token->token_type != PL_EOS; token++)
+    {
+        if(token->token_type == T_L_R_BRACKET)
+            depth++;
+        else if(token->token_type == T_R_R_BRACKET && --depth == 0)
+            return token;
+    }
+    return NULL;
+}
+
+/* Text between the brackets following token, or NULL if they aren't closed. */
+static gchar*
+p_get_arguments(LexerState* lexer, LexerToken* token)
+{
+    LexerToken* close = p_find_closing_bracket(lexer, token);
+    if(!close)
+        return NULL;
+    return g_strndup(lexer->prelexer->stream + token[1].end_index, close->start_index - token[1].end_index);
+}
+
 /* Compares two nodes to decide, which will be parent and which willbe child. */
 static gint
 p_cmp_nodes(ParseNode* left, ParseNode* right)
@@ -209,7 +250,7 @@ p_insert_into_tree_unary(ParserState* state, ParseNode* node)
     p_insert_into_tree_all(state, node, 1);
 }
 
-/* Recursive call to free every node of parse-tree. */
+/* Recursive call to free values of every node of parse-tree. Nodes themselves belong to the arena. */
 static void
 p_destroy_all_nodes(ParseNode* node)
 {
@@ -217,11 +258,12 @@ p_destroy_all_nodes(ParseNode* node)
         return;
     p_destroy_all_nodes(node->left);
     p_destroy_all_nodes(node->right);
-    /* Don't call free for tokens, as they are allocated and freed in lexer. */
+    /* Don't call free for tokens, as they are allocated in the arena too. */
     /* WARNING: If node->value is freed elsewhere, please assign it NULL before calling p_destroy_all_nodes(). */
     if(node->value)
         free(node->value);
-    free(node);
+    if(node->cache)
+        mp_free(node->cache);
 }
 
 /* Create parser state. */
@@ -229,8 +271,10 @@ ParserState*
 p_create_parser(const gchar* input, MPEquationOptions* options)
 {
     ParserState* state;
-    state = (ParserState*) malloc(sizeof(ParserState));
-    assert(state != NULL);
+    Arena* arena;
+    arena = a_create_arena(0);
+    state = (ParserState*) a_alloc(arena, sizeof(ParserState));
+    state->arena = arena;
     state->lexer = l_create_lexer(input, state);
     state->root = NULL;
     state->depth_level = 0;
@@ -238,18 +282,215 @@ p_create_parser(const gchar* input, MPEquationOptions* options)
     state->options = options;
     state->error = 0;
     state->error_token = NULL;
+    state->ret = mp_new();
+    state->epoch = 0;
+    state->variable_is_defined = NULL;
+    state->get_variable = NULL;
+    state->set_variable = NULL;
+    state->function_is_defined = NULL;
+    state->get_function = NULL;
+    state->convert = NULL;
+    state->variable_is_constant = NULL;
+    state->variable_is_volatile = NULL;
+    state->function_is_constant = NULL;
     return state;
 }
 
+/* Evaluate node. Identical subtrees share the value of their canonical node,
+ * constant ones for the life of the parse tree, others for one evaluation. */
+void*
+p_evaluate_node(ParseNode* node)
+{
+    ParseNode* canonical = node->canonical;
+    MPEvalContext* context;
+    MPNumber* ans;
+    if(canonical && canonical->cache && (canonical->is_constant || canonical->cache_epoch == node->state->epoch))
+    {
+        ans = mp_new_ptr();
+        mp_set_from_mp(canonical->cache, ans);
+        return ans;
+    }
+    if(mp_is_cancelled())
+    {
+        set_error(node->state, PARSER_ERR_CANCELLED, NULL);
+        return NULL;
+    }
+    ans = (MPNumber *) (*(node->evaluate))(node);
+    /* Errors must be reported again on the next evaluation, so failed values are never kept.
+     * Each node counts as one step, so cancellation is checked without counting another. */
+    context = mp_get_eval_context();
+    if(ans && canonical && canonical->is_cacheable && !node->state->error && !mp_get_error() && !(context && context->cancelled))
+    {
+        if(!canonical->cache)
+            canonical->cache = mp_new_ptr();
+        mp_set_from_mp(ans, canonical->cache);
+        canonical->cache_epoch = node->state->epoch;
+    }
+    return ans;
+}
+
+/* Recursive call to drop memoised values. */
+static void
+p_invalidate_node(ParseNode* node)
+{
+    if(node == NULL)
+        return;
+    p_invalidate_node(node->left);
+    p_invalidate_node(node->right);
+    if(node->cache)
+    {
+        mp_free(node->cache);
+        node->cache = NULL;
+    }
+}
+
+void
+p_invalidate_cache(ParserState* state)
+{
+    p_invalidate_node(state->root);
+}
+
+/* Decide whether value of a node can change between evaluations. */
+static gboolean
+p_node_is_constant(ParseNode* node)
+{
+    ParserState* state = node->state;
+    if(node->left && !node->left->is_constant)
+        return FALSE;
+    if(node->right && !node->right->is_constant)
+        return FALSE;
+    if(node->evaluate == pf_set_var
+     ||node->evaluate == pf_convert_number
+     ||node->evaluate == pf_convert_1)
+        return FALSE;
+    /* Equations in the arguments may read any variable. */
+    if(node->evaluate == pf_do_solve
+     ||node->evaluate == pf_do_integrate)
+        return FALSE;
+    if(node->evaluate == pf_get_variable
+     ||node->evaluate == pf_get_variable_with_power)
+        return state->variable_is_constant && (*(state->variable_is_constant))(state, node->token->string);
+    if(node->evaluate == pf_apply_func
+     ||node->evaluate == pf_apply_func_with_power)
+        return state->function_is_constant && (*(state->function_is_constant))(state, node->token->string);
+    if(node->evaluate == pf_apply_func_with_npower)
+    {
+        /* Negative powers call the inverse function. */
+        gboolean result;
+        gchar* inv_name = g_strconcat(node->token->string, "⁻¹", NULL);
+        result = state->function_is_constant && (*(state->function_is_constant))(state, inv_name);
+        g_free(inv_name);
+        return result;
+    }
+    return TRUE;
+}
+
+/* Post-order walk. Marks constant subtrees and maps every subtree to the first identical one. */
+static void
+p_hash_cons_node(ParseNode* node, GHashTable* table, GString* key)
+{
+    ParseNode* canonical;
+    if(node == NULL)
+        return;
+    p_hash_cons_node(node->left, table, key);
+    p_hash_cons_node(node->right, table, key);
+    node->is_constant = p_node_is_constant(node);
+
+    /* Operators are identified by their evaluate function, leaves and functions need their names as well. */
+    g_string_printf(key, "%p|%s|%s|%p|%p",
+                    (gpointer) node->evaluate,
+                    node->left == NULL && node->token ? node->token->string : "",
+                    node->value ? (gchar*) node->value : "",
+                    node->left ? (gpointer) node->left->canonical : NULL,
+                    node->right ? (gpointer) node->right->canonical : NULL);
+    /* Assignments have side effects and volatile variables change on every read, these are never shared. */
+    if(node->evaluate == pf_set_var
+     ||((node->evaluate == pf_get_variable || node->evaluate == pf_get_variable_with_power)
+        && node->state->variable_is_volatile && (*(node->state->variable_is_volatile))(node->state, node->token->string)))
+        g_string_append_printf(key, "|%p", (gpointer) node);
+
+    canonical = g_hash_table_lookup(table, key->str);
+    if(canonical == NULL)
+    {
+        canonical = node;
+        g_hash_table_insert(table, a_strndup(node->state->arena, key->str, key->len), node);
+    }
+    node->canonical = canonical;
+    canonical->users++;
+}
+
+/* Decide which canonical nodes keep their value. */
+static void
+p_mark_cacheable(ParseNode* node)
+{
+    ParseNode* canonical;
+    if(node == NULL)
+        return;
+    p_mark_cacheable(node->left);
+    p_mark_cacheable(node->right);
+    canonical = node->canonical;
+    if(node->evaluate == pf_none || node->evaluate == pf_set_var)
+        return;
+    /* Keep the largest constant subtrees across evaluations; their constant children are never asked again. */
+    if(node->is_constant && (node->parent == NULL || !node->parent->is_constant))
+        canonical->is_cacheable = TRUE;
+    /* Keep shared subtrees for the rest of the evaluation. */
+    if(canonical->users > 1)
+        canonical->is_cacheable = TRUE;
+}
+
+/* Recursive call to forget results of an earlier p_optimise(). Memoised values are left alone. */
+static void
+p_reset_node(ParseNode* node)
+{
+    if(node == NULL)
+        return;
+    p_reset_node(node->left);
+    p_reset_node(node->right);
+    node->canonical = NULL;
+    node->is_constant = FALSE;
+    node->is_cacheable = FALSE;
+    node->users = 0;
+}
+
+/* Recursive call to drop memoised values no longer used after p_optimise(). */
+static void
+p_drop_unused_caches(ParseNode* node)
+{
+    if(node == NULL)
+        return;
+    p_drop_unused_caches(node->left);
+    p_drop_unused_caches(node->right);
+    if(node->cache && (node->canonical != node || !node->is_cacheable))
+    {
+        mp_free(node->cache);
+        node->cache = NULL;
+    }
+}
+
+/* Optimise parse tree. Constant subtrees get folded the first time they are evaluated,
+ * identical subtrees are evaluated only once per evaluation. */
+static void
+p_optimise(ParserState* state)
+{
+    GHashTable* table;
+    GString* key;
+    table = g_hash_table_new(g_str_hash, g_str_equal);
+    key = g_string_new(NULL);
+    p_reset_node(state->root);
+    p_hash_cons_node(state->root, table, key);
+    p_mark_cacheable(state->root);
+    g_string_free(key, TRUE);
+    g_hash_table_destroy(table);
+}
+
 static guint statement (ParserState*);
-/* Start parsing input string. And call evaluate on success. */
+/* Parse tokens already inserted by the lexer. */
 guint
-p_parse(ParserState* state)
+p_parse_tokens(ParserState* state)
 {
     guint ret;
     LexerToken* token;
-    MPNumber* ans;
-    l_insert_all_tokens(state->lexer);
     ret = statement(state);
     token = l_get_next_token(state->lexer);
     if(token->token_type == T_ASSIGN)
@@ -273,10 +514,102 @@ p_parse(ParserState* state)
     if(ret == 0)
         /* Input can't be parsed with grammar. */
         return PARSER_ERR_INVALID;
-    ans = (MPNumber *) (*(state->root->evaluate))(state->root);
+    p_optimise(state);
+    return PARSER_ERR_NONE;
+}
+
+/* Tokenize and parse input string. */
+guint
+p_compile(ParserState* state)
+{
+    l_insert_all_tokens(state->lexer);
+    return p_parse_tokens(state);
+}
+
+/* Recursive call to point nodes to the new token array. Returns TRUE if value of the subtree may have changed. */
+static gboolean
+p_remap_tokens(ParseNode* node, LexerToken* old_tokens, LexerToken* tokens)
+{
+    gboolean changed;
+    if(node == NULL)
+        return FALSE;
+    changed = p_remap_tokens(node->left, old_tokens, tokens);
+    changed = p_remap_tokens(node->right, old_tokens, tokens) || changed;
+    if(node->token)
+    {
+        LexerToken* token = &tokens[node->token - old_tokens];
+        if(strcmp(token->string, node->token->string) != 0)
+            changed = TRUE;
+        node->token = token;
+    }
+    /* Numbers in the arguments of equation functions aren't nodes of their own. */
+    if(node->evaluate == pf_do_solve
+     ||node->evaluate == pf_do_integrate)
+    {
+        gchar* arguments = p_get_arguments(node->state->lexer, node->token);
+        if(g_strcmp0(arguments, node->value) != 0)
+            changed = TRUE;
+        free(node->value);
+        node->value = arguments;
+    }
+    if(changed && node->cache)
+    {
+        mp_free(node->cache);
+        node->cache = NULL;
+    }
+    return changed;
+}
+
+/* Compile a new version of the input string, reusing as much of the previous compilation as possible.
+ * The parse tree is kept if only numbers have changed, otherwise it is built again from the tokens. */
+guint
+p_update(ParserState* state, const gchar* input)
+{
+    LexerState* lexer = state->lexer;
+    LexerToken* old_tokens = lexer->tokens;
+    guint old_count = lexer->token_count;
+    gboolean same_structure;
+    guint l;
+
+    l_update_tokens(lexer, input);
+    if(state->error)
+        return PARSER_ERR_INVALID;
+
+    /* Numbers only appear as leaves, which read their token when evaluated. */
+    same_structure = state->root != NULL && lexer->token_count == old_count;
+    for(l = 0; same_structure && l < old_count; l++)
+    {
+        if(lexer->tokens[l].token_type != old_tokens[l].token_type)
+            same_structure = FALSE;
+        else if(lexer->tokens[l].token_type != T_NUMBER && strcmp(lexer->tokens[l].string, old_tokens[l].string) != 0)
+            same_structure = FALSE;
+    }
+    if(same_structure)
+    {
+        p_remap_tokens(state->root, old_tokens, lexer->tokens);
+        p_optimise(state);
+        p_drop_unused_caches(state->root);
+        return PARSER_ERR_NONE;
+    }
+
+    /* Old nodes stay in the arena until the parser is destroyed. */
+    if(state->root)
+        p_destroy_all_nodes(state->root);
+    state->root = NULL;
+    state->right_most = NULL;
+    state->depth_level = 0;
+    return p_parse_tokens(state);
+}
+
+/* Evaluate compiled parse tree. */
+guint
+p_evaluate(ParserState* state)
+{
+    MPNumber* ans;
+    state->epoch++;
+    ans = (MPNumber *) p_evaluate_node(state->root);
     if(ans)
     {
-        state->ret = mp_new();
         mp_set_from_mp(ans, &state->ret);
         mp_free(ans);
         return PARSER_ERR_NONE;
@@ -284,6 +617,17 @@ p_parse(ParserState* state)
     return PARSER_ERR_INVALID;
 }
 
+/* Start parsing input string. And call evaluate on success. */
+guint
+p_parse(ParserState* state)
+{
+    guint ret;
+    ret = p_compile(state);
+    if(ret != PARSER_ERR_NONE)
+        return ret;
+    return p_evaluate(state);
+}
+
 /* Destroy parser state. */
 void
 p_destroy_parser(ParserState* state)
@@ -294,7 +638,9 @@ p_destroy_parser(ParserState* state)
         p_destroy_all_nodes(state->root);
     }
     l_destroy_lexer(state->lexer);
-    free(state);
+    mp_clear(&state->ret);
+    /* Releases the state itself as well. */
+    a_destroy_arena(state->arena);
 }
 
 /* LL (*) parser. Lookahead count depends on tokens. Handle with care. :P */
@@ -1052,7 +1398,21 @@ variable(ParserState* state)
     {
         token_old = token;
         token = l_get_next_token(state->lexer);
-        if(token->token_type == T_SUP_NUMBER)
+        if(p_is_equation_function(token_old))
+        {
+            /* FUNCTION ( arguments ) */
+
+            LexerToken* close = p_find_closing_bracket(state->lexer, token_old);
+            if(!close)
+                return 0;
+            while(token != close)
+                token = l_get_next_token(state->lexer);
+            node = p_create_node(state, token_old, p_make_precedence_p(state, P_NumberVariable), p_get_associativity(token_old), p_get_arguments(state->lexer, token_old),
+                                g_ascii_strcasecmp(token_old->string, "solve") == 0 ? pf_do_solve : pf_do_integrate);
+            p_insert_into_tree(state, node);
+            return 1;
+        }
+        else if(token->token_type == T_SUP_NUMBER)
         {
             /* FUNCTION SUP_NUMBER expression */
 
@@ -3,6 +3,7 @@
 
 #include <lexer.h>
 
+#include "arena.h"
 #include "mp-equation.h"
 #include "mp.h"
 
@@ -46,11 +47,19 @@ typedef struct parse_node
     void* value;
     struct parser_state* state;
     void* (*evaluate) (struct parse_node* self);
+    /* Filled in by p_optimise(). */
+    struct parse_node *canonical;	/* First node of an identical subtree. Shares its cache. */
+    gboolean is_constant;		/* Value doesn't depend on variables, user functions or conversions. */
+    gboolean is_cacheable;		/* Value of canonical node is worth keeping. */
+    guint users;			/* Number of nodes having this node as canonical. */
+    MPNumber *cache;			/* Cached value of canonical node. */
+    guint cache_epoch;			/* Evaluation the cache belongs to. Ignored for constant nodes. */
 } ParseNode;
 
 /* ParserState structure. Stores parser state. */
 typedef struct parser_state
 {
+    Arena *arena;			/* Owns the state, lexer, tokens and parse nodes. */
     ParseNode *root;
     ParseNode *right_most;
     LexerState *lexer;
@@ -59,12 +68,16 @@ typedef struct parser_state
     int error;
     char *error_token;
     MPNumber ret;
+    guint epoch;			/* Incremented on every p_evaluate(). */
     int (*variable_is_defined)(struct parser_state *state, const char *name);
     int (*get_variable)(struct parser_state *state, const char *name, MPNumber *z);
     void (*set_variable)(struct parser_state *state, const char *name, const MPNumber *x);
     int (*function_is_defined)(struct parser_state *state, const char *name);
     int (*get_function)(struct parser_state *state, const char *name, const MPNumber *x, MPNumber *z);
     int (*convert)(struct parser_state *state, const MPNumber *x, const char *x_units, const char *z_units, MPNumber *z);
+    int (*variable_is_constant)(struct parser_state *state, const char *name);
+    int (*variable_is_volatile)(struct parser_state *state, const char *name);
+    int (*function_is_constant)(struct parser_state *state, const char *name);
 } ParserState;
 
 /* Create ParserState object. */
@@ -73,7 +86,24 @@ ParserState* p_create_parser(const gchar*, MPEquationOptions*);
 /* Destroy ParserState object. */
 void p_destroy_parser(ParserState*);
 
-/* Parse string from ParserState. */
+/* Parse string from ParserState and evaluate it. */
 guint p_parse(ParserState*);
 
+/* Tokenize and parse string from ParserState, then optimise the parse tree. */
+guint p_compile(ParserState*);
+
+guint p_parse_tokens(ParserState*);
+
+/* Compile changed input string, re-lexing only the edited part. Parse tree is kept if only numbers have changed. */
+guint p_update(ParserState*, const gchar*);
+
+/* Evaluate parse tree built by p_compile(). Can be called repeatedly. */
+guint p_evaluate(ParserState*);
+
+/* Evaluate a single node, using and filling the memoised values set up by p_compile(). */
+void* p_evaluate_node(ParseNode*);
+
+/* Drop memoised values, e.g. after angle units or word length have changed. */
+void p_invalidate_cache(ParserState*);
+
 #endif /* PARSER_H */
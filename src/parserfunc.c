@@ -2,9 +2,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
+#include <float.h>
 
 #include "parser.h"
 #include "parserfunc.h"
+#include "mp-calculus.h"
 
 /* Register error variables in ParserState structure. */
 void
@@ -12,7 +15,11 @@ set_error(ParserState* state, gint errorno, const gchar *token)
 {
     state->error = errorno;
     if(token)
+    {
+        /* Keep the last reported token only. */
+        free(state->error_token);
         state->error_token = strdup(token);
+    }
 }
 
 /* Unused function pointer. This won't be called anytime. */
@@ -27,7 +34,7 @@ void*
 pf_set_var(ParseNode* self)
 {
     MPNumber* val;
-    val = (MPNumber *) (*(self->right->evaluate))(self->right);
+    val = (MPNumber *) p_evaluate_node(self->right);
     if(!val || !(self->state->set_variable))
     {
         if(val)
@@ -44,22 +51,14 @@ pf_convert_number(ParseNode* self)
 {
     gchar* from;
     gchar* to;
-    gint free_from = 0;
-    gint free_to = 0;
     MPNumber tmp = mp_new();
     MPNumber* ans = mp_new_ptr();
     if(self->left->value)
-    {
         from = (gchar*) self->left->value;
-        free_from = 1;
-    }
     else
         from = self->left->token->string;
     if(self->right->value)
-    {
         to = (gchar*) self->right->value;
-        free_to = 1;
-    }
     else
         to = self->right->token->string;
 
@@ -82,16 +81,6 @@ pf_convert_number(ParseNode* self)
         ans = NULL;
     }
 END_PF_CONVERT_NUMBER:
-    if(free_from)
-    {
-        g_free(self->left->value);
-        self->left->value = NULL;
-    }
-    if(free_to)
-    {
-        g_free(self->right->value);
-        self->right->value = NULL;
-    }
     mp_clear(&tmp);
     return ans;
 }
@@ -102,22 +91,14 @@ pf_convert_1(ParseNode* self )
 {
     gchar* from;
     gchar* to;
-    gint free_from = 0;
-    gint free_to = 0;
     MPNumber tmp = mp_new();
     MPNumber* ans = mp_new_ptr();
     if(self->left->value)
-    {
         from = (gchar*) self->left->value;
-        free_from = 1;
-    }
     else
         from = self->left->token->string;
     if(self->right->value)
-    {
         to = (gchar*) self->right->value;
-        free_to = 1;
-    }
     else
         to = self->right->token->string;
     mp_set_from_integer(1, &tmp);
@@ -132,16 +113,6 @@ pf_convert_1(ParseNode* self )
         mp_free(ans);
         ans = NULL;
     }
-    if(free_from)
-    {
-        g_free(self->left->value);
-        self->left->value = NULL;
-    }
-    if(free_to)
-    {
-        g_free(self->right->value);
-        self->right->value = NULL;
-    }
     mp_clear(&tmp);
     return ans;
 }
@@ -170,14 +141,13 @@ pf_get_variable(ParseNode* self)
 
     const gchar *c, *next;
     gchar *buffer;
-    MPNumber value = mp_new();
-
-    MPNumber t = mp_new();
+    MPNumber value;
+    MPNumber t;
     MPNumber* ans = mp_new_ptr();
 
     if(!(self->state->get_variable))
     {
-        free(ans);
+        mp_free(ans);
         return NULL;
     }
 
@@ -192,6 +162,8 @@ pf_get_variable(ParseNode* self)
     {
         result = 1;
         buffer = (gchar*) malloc(sizeof(gchar) * strlen(self->token->string));
+        value = mp_new();
+        t = mp_new();
         mp_set_from_integer(1, &value);
         for(c = self->token->string; *c != '\0'; c = next)
         {
@@ -207,10 +179,12 @@ pf_get_variable(ParseNode* self)
         free(buffer);
         if(result)
             mp_set_from_mp(&value, ans);
+        mp_clear(&value);
+        mp_clear(&t);
     }
     if(!result)
     {
-        free (ans);
+        mp_free(ans);
         ans = NULL;
         set_error(self->state, PARSER_ERR_UNKNOWN_VARIABLE, self->token->string);
     }
@@ -226,18 +200,14 @@ pf_get_variable_with_power(ParseNode* self)
 
     const gchar *c, *next;
     gchar *buffer;
-    MPNumber value = mp_new();
-
-    MPNumber t = mp_new();
+    MPNumber value;
+    MPNumber t;
     MPNumber* ans = mp_new_ptr();
     pow = super_atoi(self->value);
 
-    free(self->value);
-    self->value = NULL;
-
     if(!(self->state->get_variable))
     {
-        free(ans);
+        mp_free(ans);
         return NULL;
     }
 
@@ -253,6 +223,8 @@ pf_get_variable_with_power(ParseNode* self)
     {
         result = 1;
         buffer = (gchar*) malloc(sizeof(gchar) * strlen(self->token->string));
+        value = mp_new();
+        t = mp_new();
         mp_set_from_integer(1, &value);
         for(c = self->token->string; *c != '\0'; c = next)
         {
@@ -272,10 +244,12 @@ pf_get_variable_with_power(ParseNode* self)
         free(buffer);
         if(result)
             mp_set_from_mp(&value, ans);
+        mp_clear(&value);
+        mp_clear(&t);
     }
     if(!result)
     {
-        free(ans);
+        mp_free(ans);
         ans = NULL;
         set_error(self->state, PARSER_ERR_UNKNOWN_VARIABLE, self->token->string);
     }
@@ -288,26 +262,26 @@ pf_apply_func(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!(self->state->get_function))
     {
-        free(val);
-        free(ans);
+        mp_free(val);
+        mp_free(ans);
         return NULL;
     }
     if(!val)
     {
-        free(ans);
+        mp_free(ans);
         return NULL;
     }
     if(!(*(self->state->get_function))(self->state, self->token->string, val, ans))
     {
-        free(val);
-        free(ans);
+        mp_free(val);
+        mp_free(ans);
         set_error(self->state, PARSER_ERR_UNKNOWN_FUNCTION, self->token->string);
         return NULL;
     }
-    free(val);
+    mp_free(val);
     return ans;
 }
 
@@ -319,20 +293,18 @@ pf_apply_func_with_power(ParseNode* self)
     MPNumber* tmp = mp_new_ptr();
     MPNumber* ans = mp_new_ptr();
     gint pow;
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!(self->state->get_function))
     {
         mp_free(tmp);
         mp_free(ans);
         mp_free(val);
-        self->value = NULL;
         return NULL;
     }
     if(!val)
     {
         mp_free(tmp);
         mp_free(ans);
-        self->value = NULL;
         return NULL;
     }
     if(!(*(self->state->get_function))(self->state, self->token->string, val, tmp))
@@ -340,7 +312,6 @@ pf_apply_func_with_power(ParseNode* self)
         mp_free(tmp);
         mp_free(ans);
         mp_free(val);
-        self->value = NULL;
         set_error(self->state, PARSER_ERR_UNKNOWN_FUNCTION, self->token->string);
         return NULL;
     }
@@ -348,8 +319,6 @@ pf_apply_func_with_power(ParseNode* self)
     mp_xpowy_integer(tmp, pow, ans);
     mp_free(val);
     mp_free(tmp);
-    free(self->value);
-    self->value = NULL;
     return ans;
 }
 
@@ -365,13 +334,12 @@ pf_apply_func_with_npower(ParseNode* self)
     inv_name = (gchar*) malloc(sizeof(gchar) * strlen(self->token->string) + strlen("⁻¹") + 1);
     strcpy(inv_name, self->token->string);
     strcat(inv_name, "⁻¹");
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(tmp);
         free(inv_name);
         mp_free(ans);
-        self->value = NULL;
         return NULL;
     }
     if(!(self->state->get_function))
@@ -379,7 +347,6 @@ pf_apply_func_with_npower(ParseNode* self)
         mp_free(tmp);
         mp_free(ans);
         free(inv_name);
-        self->value = NULL;
         return NULL;
     }
     if(!(*(self->state->get_function))(self->state, inv_name, val, tmp))
@@ -388,7 +355,6 @@ pf_apply_func_with_npower(ParseNode* self)
         mp_free(ans);
         mp_free(val);
         free(inv_name);
-        self->value = NULL;
         set_error(self->state, PARSER_ERR_UNKNOWN_FUNCTION, self->token->string);
         return NULL;
     }
@@ -397,8 +363,6 @@ pf_apply_func_with_npower(ParseNode* self)
     mp_free(val);
     mp_free(tmp);
     free(inv_name);
-    free(self->value);
-    self->value = NULL;
     return ans;
 }
 
@@ -410,9 +374,7 @@ pf_do_nth_root(ParseNode* self)
     gint pow;
     MPNumber* ans = mp_new_ptr();
     pow = sub_atoi(self->value);
-    free(self->value);
-    self->value = NULL;
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -429,14 +391,14 @@ pf_do_sqrt(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
-        free(ans);
+        mp_free(ans);
         return NULL;
     }
     mp_sqrt(val, ans);
-    free(val);
+    mp_free(val);
     return ans;
 }
 
@@ -446,7 +408,7 @@ pf_do_root_3(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -463,7 +425,7 @@ pf_do_root_4(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -480,7 +442,7 @@ pf_do_floor(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -496,7 +458,7 @@ void* pf_do_ceiling (ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -513,7 +475,7 @@ pf_do_round(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -530,7 +492,7 @@ pf_do_fraction(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -547,7 +509,7 @@ pf_do_abs(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -565,8 +527,8 @@ pf_do_x_pow_y(ParseNode* self)
     MPNumber* val;
     MPNumber* pow;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->left->evaluate))(self->left);
-    pow = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->left);
+    pow = (MPNumber*) p_evaluate_node(self->right);
     if(!val || !pow)
     {
         if(val)
@@ -589,7 +551,7 @@ pf_do_x_pow_y_int(ParseNode* self)
     MPNumber* val;
     long pow;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->left->evaluate))(self->left);
+    val = (MPNumber*) p_evaluate_node(self->left);
 
     if(!val)
     {
@@ -603,7 +565,7 @@ pf_do_x_pow_y_int(ParseNode* self)
     }
     else
     {
-        MPNumber* aux = (MPNumber*) (*(self->right->evaluate))(self->right);
+        MPNumber* aux = (MPNumber*) p_evaluate_node(self->right);
         pow = mp_to_integer(aux);
         mp_free(aux);
     }
@@ -624,7 +586,7 @@ pf_do_factorial(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -641,7 +603,7 @@ pf_unary_minus(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -659,8 +621,8 @@ pf_do_divide(ParseNode* self)
     MPNumber* left;
     MPNumber* right;
     MPNumber* ans = mp_new_ptr();
-    left = (MPNumber*) (*(self->left->evaluate))(self->left);
-    right = (MPNumber*) (*(self->right->evaluate))(self->right);
+    left = (MPNumber*) p_evaluate_node(self->left);
+    right = (MPNumber*) p_evaluate_node(self->right);
     if(!left || !right)
     {
         if(left)
@@ -683,8 +645,8 @@ pf_do_mod(ParseNode* self)
     MPNumber* left;
     MPNumber* right;
     MPNumber* ans = mp_new_ptr();
-    left = (MPNumber*) (*(self->left->evaluate))(self->left);
-    right = (MPNumber*) (*(self->right->evaluate))(self->right);
+    left = (MPNumber*) p_evaluate_node(self->left);
+    right = (MPNumber*) p_evaluate_node(self->right);
     if(!left || !right)
     {
         if(left)
@@ -696,8 +658,8 @@ pf_do_mod(ParseNode* self)
     }
     if (self->left->evaluate == pf_do_x_pow_y)
     {
-        MPNumber* base_value = (MPNumber*) (*(self->left->left->evaluate))(self->left->left);
-        MPNumber* exponent = (MPNumber*) (*(self->left->right->evaluate))(self->left->right);
+        MPNumber* base_value = (MPNumber*) p_evaluate_node(self->left->left);
+        MPNumber* exponent = (MPNumber*) p_evaluate_node(self->left->right);
         if(!base_value || !exponent)
         {
             if(base_value)
@@ -726,8 +688,8 @@ pf_do_multiply(ParseNode* self)
     MPNumber* left;
     MPNumber* right;
     MPNumber* ans = mp_new_ptr();
-    left = (MPNumber*) (*(self->left->evaluate))(self->left);
-    right = (MPNumber*) (*(self->right->evaluate))(self->right);
+    left = (MPNumber*) p_evaluate_node(self->left);
+    right = (MPNumber*) p_evaluate_node(self->right);
     if(!left || !right)
     {
         if(left)
@@ -750,15 +712,15 @@ pf_do_subtract(ParseNode* self)
     MPNumber* left;
     MPNumber* right;
     MPNumber* ans = mp_new_ptr();
-    left = (MPNumber*) (*(self->left->evaluate))(self->left);
-    right = (MPNumber*) (*(self->right->evaluate))(self->right);
+    left = (MPNumber*) p_evaluate_node(self->left);
+    right = (MPNumber*) p_evaluate_node(self->right);
     if(!left || !right)
     {
         if(left)
             mp_free(left);
         if(right)
             mp_free(right);
-        free(ans);
+        mp_free(ans);
         return NULL;
     }
     mp_subtract(left, right, ans);
@@ -774,15 +736,15 @@ pf_do_add(ParseNode* self)
     MPNumber* left;
     MPNumber* right;
     MPNumber* ans = mp_new_ptr();
-    left = (MPNumber*) (*(self->left->evaluate))(self->left);
-    right = (MPNumber*) (*(self->right->evaluate))(self->right);
+    left = (MPNumber*) p_evaluate_node(self->left);
+    right = (MPNumber*) p_evaluate_node(self->right);
     if(!left || !right)
     {
         if(left)
             mp_free(left);
         if(right)
             mp_free(right);
-        free(ans);
+        mp_free(ans);
         return NULL;
     }
     mp_add(left, right, ans);
@@ -798,8 +760,8 @@ pf_do_add_percent(ParseNode* self)
     MPNumber* ans = mp_new_ptr();
     MPNumber* val;
     MPNumber* per;
-    val = (MPNumber*) (*(self->left->evaluate))(self->left);
-    per = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->left);
+    per = (MPNumber*) p_evaluate_node(self->right);
     if(!val || !per)
     {
         if(val)
@@ -824,15 +786,15 @@ pf_do_subtract_percent(ParseNode* self)
     MPNumber* ans = mp_new_ptr();
     MPNumber* val;
     MPNumber* per;
-    val = (MPNumber*) (*(self->left->evaluate))(self->left);
-    per = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->left);
+    per = (MPNumber*) p_evaluate_node(self->right);
     if(!val || !per)
     {
         if(val)
             mp_free(val);
         if(per)
             mp_free(per);
-        free(ans);
+        mp_free(ans);
         return NULL;
     }
     mp_add_integer(per, -100, per);
@@ -849,7 +811,7 @@ pf_do_percent(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -866,7 +828,7 @@ pf_do_not(ParseNode* self)
 {
     MPNumber* val;
     MPNumber* ans = mp_new_ptr();
-    val = (MPNumber*) (*(self->right->evaluate))(self->right);
+    val = (MPNumber*) p_evaluate_node(self->right);
     if(!val)
     {
         mp_free(ans);
@@ -891,8 +853,8 @@ pf_do_and(ParseNode* self)
     MPNumber* left;
     MPNumber* right;
     MPNumber* ans = mp_new_ptr();
-    left = (MPNumber*) (*(self->left->evaluate))(self->left);
-    right = (MPNumber*) (*(self->right->evaluate))(self->right);
+    left = (MPNumber*) p_evaluate_node(self->left);
+    right = (MPNumber*) p_evaluate_node(self->right);
     if(!left || !right)
     {
         if(left)
@@ -915,8 +877,8 @@ pf_do_or(ParseNode* self)
     MPNumber* left;
     MPNumber* right;
     MPNumber* ans = mp_new_ptr();
-    left = (MPNumber*) (*(self->left->evaluate))(self->left);
-    right = (MPNumber*) (*(self->right->evaluate))(self->right);
+    left = (MPNumber*) p_evaluate_node(self->left);
+    right = (MPNumber*) p_evaluate_node(self->right);
     if(!left || !right)
     {
         if(left)
@@ -939,15 +901,15 @@ pf_do_xor(ParseNode* self)
     MPNumber* left;
     MPNumber* right;
     MPNumber* ans = mp_new_ptr();
-    left = (MPNumber*) (*(self->left->evaluate))(self->left);
-    right = (MPNumber*) (*(self->right->evaluate))(self->right);
+    left = (MPNumber*) p_evaluate_node(self->left);
+    right = (MPNumber*) p_evaluate_node(self->right);
     if(!left || !right)
     {
         if(left)
             mp_free(left);
         if(right)
             mp_free(right);
-        free(ans);
+        mp_free(ans);
         return NULL;
     }
     mp_xor(left, right, ans);
@@ -972,3 +934,527 @@ pf_constant(ParseNode* self)
     return ans;
 }
 
+/* Split the arguments of an equation function at semicolons outside brackets. */
+static gchar**
+pf_split_arguments(const gchar* arguments)
+{
+    GPtrArray* list = g_ptr_array_new();
+    const gchar* start = arguments;
+    const gchar* c;
+    gint depth = 0;
+    for(c = arguments; ; c++)
+    {
+        if(*c == '(')
+            depth++;
+        else if(*c == ')')
+            depth--;
+        else if((*c == ';' && depth == 0) || *c == '\0')
+        {
+            g_ptr_array_add(list, g_strstrip(g_strndup(start, c - start)));
+            if(*c == '\0')
+                break;
+            start = c + 1;
+        }
+    }
+    g_ptr_array_add(list, NULL);
+    return (gchar**) g_ptr_array_free(list, FALSE);
+}
+
+/* Split the arguments of an equation function, reporting an error unless there are count of them. */
+static gchar**
+pf_get_arguments(ParseNode* self, guint count)
+{
+    gchar** arguments = pf_split_arguments(self->value);
+    /* The second argument names the variable. */
+    if(g_strv_length(arguments) != count || arguments[1][0] == '\0')
+    {
+        set_error(self->state, PARSER_ERR_INVALID, self->token->string);
+        g_strfreev(arguments);
+        return NULL;
+    }
+    return arguments;
+}
+
+/* Evaluate an argument of an equation function. */
+static MPNumber*
+pf_evaluate_argument(ParseNode* self, const gchar* argument)
+{
+    MPNumber* ans = mp_new_ptr();
+    gchar* error_token = NULL;
+    MPErrorCode error;
+    error = mp_equation_parse(argument, self->state->options, ans, &error_token);
+    if(error != PARSER_ERR_NONE)
+    {
+        set_error(self->state, error, error_token);
+        g_free(error_token);
+        mp_free(ans);
+        return NULL;
+    }
+    return ans;
+}
+
+/* Find where an equation is zero, solve(equation;variable;guess). */
+void*
+pf_do_solve(ParseNode* self)
+{
+    gchar** arguments;
+    gchar* error_token = NULL;
+    MPNumber* guess;
+    MPNumber* ans;
+    MPErrorCode error;
+    arguments = pf_get_arguments(self, 3);
+    if(!arguments)
+        return NULL;
+    guess = pf_evaluate_argument(self, arguments[2]);
+    if(!guess)
+    {
+        g_strfreev(arguments);
+        return NULL;
+    }
+    ans = mp_new_ptr();
+    error = mp_equation_solve(arguments[0], arguments[1], guess, self->state->options, ans, &error_token);
+    if(error != PARSER_ERR_NONE)
+    {
+        set_error(self->state, error, error_token);
+        mp_free(ans);
+        ans = NULL;
+    }
+    g_free(error_token);
+    mp_free(guess);
+    g_strfreev(arguments);
+    return ans;
+}
+
+/* Integrate an equation, integrate(equation;variable;from;to). */
+void*
+pf_do_integrate(ParseNode* self)
+{
+    gchar** arguments;
+    gchar* error_token = NULL;
+    MPNumber* a;
+    MPNumber* b = NULL;
+    MPNumber* ans = NULL;
+    MPErrorCode error;
+    arguments = pf_get_arguments(self, 4);
+    if(!arguments)
+        return NULL;
+    a = pf_evaluate_argument(self, arguments[2]);
+    if(a)
+        b = pf_evaluate_argument(self, arguments[3]);
+    if(a && b)
+    {
+        ans = mp_new_ptr();
+        error = mp_equation_integrate(arguments[0], arguments[1], a, b, self->state->options, 0, ans, &error_token);
+        if(error != PARSER_ERR_NONE)
+        {
+            set_error(self->state, error, error_token);
+            mp_free(ans);
+            ans = NULL;
+        }
+    }
+    g_free(error_token);
+    mp_free(a);
+    mp_free(b);
+    g_strfreev(arguments);
+    return ans;
+}
+
+
+/* Double precision evaluation of a batch of points.
+ *
+ * Each value comes with a bound on its absolute error, which covers the error
+ * of the inputs and the rounding of every operation. Points that can't be
+ * computed this way (e.g. complex results, or values near a pole) get an
+ * infinite bound and have to be evaluated with MPNumber. */
+
+/* Bound on the relative rounding error of arithmetic */
+#define PF_EPSILON DBL_EPSILON
+
+/* Bound on the relative error of the math library functions */
+#define PF_LIBM_EPSILON (4 * DBL_EPSILON)
+
+/* Largest integer power computed directly rather than through logarithms */
+#define PF_MAX_INTEGER_POWER 1024
+
+/* Value of a constant subtree, evaluated once with MPNumber and kept by the parse tree. */
+static gboolean
+pf_vector_constant(ParseNode* self, guint n, gdouble* value, gdouble* error)
+{
+    MPNumber* ans;
+    gdouble v;
+    guint i;
+
+    ans = (MPNumber*) p_evaluate_node(self);
+    if(!ans)
+        return FALSE;
+    if(mp_is_complex(ans))
+    {
+        mp_free(ans);
+        return FALSE;
+    }
+    v = mp_to_double(ans);
+    mp_free(ans);
+    if(!isfinite(v))
+        return FALSE;
+
+    for(i = 0; i < n; i++)
+    {
+        value[i] = v;
+        error[i] = fabs(v) * PF_EPSILON;
+    }
+    return TRUE;
+}
+
+/* x^n for integer n. */
+static void
+pf_vector_power_integer(guint n, const gdouble* x, const gdouble* x_error, gint power, gdouble* value, gdouble* error)
+{
+    guint i;
+    gdouble r;
+
+    for(i = 0; i < n; i++)
+    {
+        value[i] = pow(x[i], power);
+        if(x[i] == 0 && x_error[i] == 0 && power > 0)
+            error[i] = 0;
+        else if(fabs(x[i]) <= x_error[i] || (x[i] == 0 && power <= 0))
+            error[i] = INFINITY;
+        else
+        {
+            /* Relative error grows with the power, (1-r)^-n - 1 bounds it either way */
+            r = x_error[i] / fabs(x[i]);
+            error[i] = fabs(value[i]) * (expm1(-fabs((gdouble) power) * log1p(-r)) + PF_LIBM_EPSILON);
+        }
+    }
+}
+
+/* Variable, either the one set for each point or one with the same value for all. */
+static gboolean
+pf_vector_variable(ParseNode* self, const PFVectorInput* input, gint power, gdouble* value, gdouble* error)
+{
+    gdouble x[PF_VECTOR_SIZE], x_error[PF_VECTOR_SIZE];
+    const gchar* name = self->token->string;
+    guint i;
+
+    if(strcmp(name, input->variable) == 0)
+    {
+        for(i = 0; i < input->n; i++)
+        {
+            x[i] = input->x[i];
+            x_error[i] = fabs(input->x[i]) * PF_EPSILON / 2;
+        }
+    }
+    else
+    {
+        MPNumber t;
+        gdouble v;
+
+        /* Values that change on every read have to be read for every point */
+        if(!self->state->get_variable ||
+           (self->state->variable_is_volatile && (*(self->state->variable_is_volatile))(self->state, name)))
+            return FALSE;
+
+        t = mp_new();
+        if(!(*(self->state->get_variable))(self->state, name, &t) || mp_is_complex(&t))
+        {
+            mp_clear(&t);
+            return FALSE;
+        }
+        v = mp_to_double(&t);
+        mp_clear(&t);
+        if(!isfinite(v))
+            return FALSE;
+
+        for(i = 0; i < input->n; i++)
+        {
+            x[i] = v;
+            x_error[i] = fabs(v) * PF_EPSILON;
+        }
+    }
+
+    if(power == 1)
+    {
+        memcpy(value, x, sizeof(gdouble) * input->n);
+        memcpy(error, x_error, sizeof(gdouble) * input->n);
+    }
+    else
+        pf_vector_power_integer(input->n, x, x_error, power, value, error);
+    return TRUE;
+}
+
+/* Angle units as a multiple of radians. */
+static gdouble
+pf_vector_angle_scale(ParseNode* self)
+{
+    switch(self->state->options->angle_units)
+    {
+    case MP_DEGREES:
+        return G_PI / 180;
+    case MP_GRADIANS:
+        return G_PI / 200;
+    default:
+        return 1;
+    }
+}
+
+/* Built-in function of a real argument, FALSE for others. */
+static gboolean
+pf_vector_function(ParseNode* self, const gchar* name, guint n, const gdouble* x, const gdouble* x_error, gdouble* value, gdouble* error)
+{
+    gdouble scale = pf_vector_angle_scale(self);
+    gdouble t, t_error, c, r;
+    guint i;
+
+    if(g_ascii_strcasecmp(name, "sin") == 0 || g_ascii_strcasecmp(name, "cos") == 0)
+    {
+        gboolean is_sin = g_ascii_strcasecmp(name, "sin") == 0;
+        for(i = 0; i < n; i++)
+        {
+            t = x[i] * scale;
+            t_error = x_error[i] * scale + fabs(t) * 2 * PF_EPSILON;
+            value[i] = is_sin ? sin(t) : cos(t);
+            error[i] = t_error + fabs(value[i]) * PF_LIBM_EPSILON;
+        }
+    }
+    else if(g_ascii_strcasecmp(name, "tan") == 0)
+    {
+        for(i = 0; i < n; i++)
+        {
+            t = x[i] * scale;
+            t_error = x_error[i] * scale + fabs(t) * 2 * PF_EPSILON;
+            value[i] = tan(t);
+            /* The slope is 1/cos², unbounded near the poles */
+            c = fabs(cos(t)) - t_error - PF_LIBM_EPSILON;
+            error[i] = c > 0 ? t_error / (c * c) + fabs(value[i]) * PF_LIBM_EPSILON : INFINITY;
+        }
+    }
+    else if(g_ascii_strcasecmp(name, "asin") == 0 || strcmp(name, "sin⁻¹") == 0 ||
+            g_ascii_strcasecmp(name, "acos") == 0 || strcmp(name, "cos⁻¹") == 0)
+    {
+        gboolean is_asin = g_ascii_strcasecmp(name, "asin") == 0 || strcmp(name, "sin⁻¹") == 0;
+        for(i = 0; i < n; i++)
+        {
+            /* The slope is 1/√(1-x²), and results are complex outside -1..1 */
+            r = fabs(x[i]) + x_error[i];
+            t = is_asin ? asin(x[i]) : acos(x[i]);
+            value[i] = t / scale;
+            error[i] = r < 1 ? (x_error[i] / sqrt(1 - r * r) + fabs(t) * PF_LIBM_EPSILON) / scale + fabs(value[i]) * 2 * PF_EPSILON : INFINITY;
+        }
+    }
+    else if(g_ascii_strcasecmp(name, "atan") == 0 || strcmp(name, "tan⁻¹") == 0)
+    {
+        for(i = 0; i < n; i++)
+        {
+            t = atan(x[i]);
+            value[i] = t / scale;
+            error[i] = (x_error[i] + fabs(t) * PF_LIBM_EPSILON) / scale + fabs(value[i]) * 2 * PF_EPSILON;
+        }
+    }
+    else if(g_ascii_strcasecmp(name, "sinh") == 0 || g_ascii_strcasecmp(name, "cosh") == 0)
+    {
+        gboolean is_sinh = g_ascii_strcasecmp(name, "sinh") == 0;
+        for(i = 0; i < n; i++)
+        {
+            value[i] = is_sinh ? sinh(x[i]) : cosh(x[i]);
+            error[i] = x_error[i] * cosh(fabs(x[i]) + x_error[i]) + fabs(value[i]) * PF_LIBM_EPSILON;
+        }
+    }
+    else if(g_ascii_strcasecmp(name, "tanh") == 0)
+    {
+        for(i = 0; i < n; i++)
+        {
+            value[i] = tanh(x[i]);
+            error[i] = x_error[i] + fabs(value[i]) * PF_LIBM_EPSILON;
+        }
+    }
+    else if(g_ascii_strcasecmp(name, "ln") == 0 || g_ascii_strcasecmp(name, "log") == 0)
+    {
+        gdouble base = g_ascii_strcasecmp(name, "ln") == 0 ? 1 : G_LN10;
+        for(i = 0; i < n; i++)
+        {
+            /* Logarithms of negative numbers are complex */
+            value[i] = log(x[i]) / base;
+            error[i] = x[i] - x_error[i] > 0 ? -log1p(-x_error[i] / x[i]) / base + fabs(value[i]) * PF_LIBM_EPSILON : INFINITY;
+        }
+    }
+    else if(g_ascii_strcasecmp(name, "sqrt") == 0)
+    {
+        for(i = 0; i < n; i++)
+        {
+            /* Square roots of negative numbers are complex */
+            value[i] = sqrt(x[i]);
+            t = x[i] - x_error[i];
+            if(t < 0)
+                error[i] = INFINITY;
+            else if(x_error[i] == 0)
+                error[i] = value[i] * PF_EPSILON;
+            else
+                error[i] = x_error[i] / (sqrt(t) + value[i]) + value[i] * PF_EPSILON;
+        }
+    }
+    else if(g_ascii_strcasecmp(name, "abs") == 0)
+    {
+        for(i = 0; i < n; i++)
+        {
+            value[i] = fabs(x[i]);
+            error[i] = x_error[i];
+        }
+    }
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
+static gboolean
+pf_vector_evaluate_node(ParseNode* self, const PFVectorInput* input, gdouble* value, gdouble* error)
+{
+    gdouble left[PF_VECTOR_SIZE], left_error[PF_VECTOR_SIZE];
+    gdouble right[PF_VECTOR_SIZE], right_error[PF_VECTOR_SIZE];
+    guint i, n = input->n;
+    gdouble d;
+
+    if(self->is_constant)
+        return pf_vector_constant(self, n, value, error);
+
+    if(self->evaluate == pf_get_variable)
+        return pf_vector_variable(self, input, 1, value, error);
+    if(self->evaluate == pf_get_variable_with_power)
+        return pf_vector_variable(self, input, super_atoi(self->value), value, error);
+
+    /* Unary operations */
+    if(self->evaluate == pf_unary_minus || self->evaluate == pf_do_abs || self->evaluate == pf_do_sqrt ||
+       self->evaluate == pf_apply_func || self->evaluate == pf_apply_func_with_power)
+    {
+        if(!self->right || !pf_vector_evaluate(self->right, input, right, right_error))
+            return FALSE;
+
+        if(self->evaluate == pf_unary_minus)
+        {
+            for(i = 0; i < n; i++)
+            {
+                value[i] = -right[i];
+                error[i] = right_error[i];
+            }
+            return TRUE;
+        }
+        if(self->evaluate == pf_do_abs)
+            return pf_vector_function(self, "abs", n, right, right_error, value, error);
+        if(self->evaluate == pf_do_sqrt)
+            return pf_vector_function(self, "sqrt", n, right, right_error, value, error);
+        if(!pf_vector_function(self, self->token->string, n, right, right_error, left, left_error))
+            return FALSE;
+        if(self->evaluate == pf_apply_func)
+        {
+            memcpy(value, left, sizeof(gdouble) * n);
+            memcpy(error, left_error, sizeof(gdouble) * n);
+        }
+        else
+            pf_vector_power_integer(n, left, left_error, super_atoi(self->value), value, error);
+        return TRUE;
+    }
+
+    if(self->evaluate == pf_do_x_pow_y_int)
+    {
+        gint power;
+
+        if(!self->left || self->left->evaluate == pf_none || !pf_vector_evaluate(self->left, input, left, left_error))
+            return FALSE;
+        if(self->right->token != NULL)
+            power = super_atoi(self->right->token->string);
+        else if(self->right->is_constant && pf_vector_constant(self->right, 1, right, right_error) &&
+                right[0] == floor(right[0]) && fabs(right[0]) <= PF_MAX_INTEGER_POWER)
+            power = (gint) right[0];
+        else
+            return FALSE;
+        pf_vector_power_integer(n, left, left_error, power, value, error);
+        return TRUE;
+    }
+
+    /* Binary operations */
+    if(self->evaluate != pf_do_add && self->evaluate != pf_do_subtract && self->evaluate != pf_do_multiply &&
+       self->evaluate != pf_do_divide && self->evaluate != pf_do_x_pow_y)
+        return FALSE;
+    if(!self->left || !self->right ||
+       !pf_vector_evaluate(self->left, input, left, left_error) ||
+       !pf_vector_evaluate(self->right, input, right, right_error))
+        return FALSE;
+
+    if(self->evaluate == pf_do_add)
+    {
+        for(i = 0; i < n; i++)
+        {
+            value[i] = left[i] + right[i];
+            error[i] = left_error[i] + right_error[i] + fabs(value[i]) * PF_EPSILON;
+        }
+    }
+    else if(self->evaluate == pf_do_subtract)
+    {
+        for(i = 0; i < n; i++)
+        {
+            value[i] = left[i] - right[i];
+            error[i] = left_error[i] + right_error[i] + fabs(value[i]) * PF_EPSILON;
+        }
+    }
+    else if(self->evaluate == pf_do_multiply)
+    {
+        for(i = 0; i < n; i++)
+        {
+            value[i] = left[i] * right[i];
+            error[i] = fabs(left[i]) * right_error[i] + fabs(right[i]) * left_error[i] + left_error[i] * right_error[i] +
+                       fabs(value[i]) * PF_EPSILON;
+        }
+    }
+    else if(self->evaluate == pf_do_divide)
+    {
+        for(i = 0; i < n; i++)
+        {
+            /* Unbounded if the divisor could be zero */
+            value[i] = left[i] / right[i];
+            d = fabs(right[i]) - right_error[i];
+            error[i] = d > 0 ? (left_error[i] + fabs(value[i]) * right_error[i]) / d + fabs(value[i]) * PF_EPSILON : INFINITY;
+        }
+    }
+    else if(self->right->is_constant && right[0] == floor(right[0]) && fabs(right[0]) <= PF_MAX_INTEGER_POWER)
+        pf_vector_power_integer(n, left, left_error, (gint) right[0], value, error);
+    else
+    {
+        gdouble l, l_error, w, w_error;
+
+        /* x^y = e^(y ln x), real only for positive x */
+        for(i = 0; i < n; i++)
+        {
+            l = log(left[i]);
+            w = right[i] * l;
+            value[i] = exp(w);
+            if(left[i] - left_error[i] > 0)
+            {
+                l_error = -log1p(-left_error[i] / left[i]) + fabs(l) * PF_LIBM_EPSILON;
+                w_error = fabs(right[i]) * l_error + fabs(l) * right_error[i] + l_error * right_error[i] + fabs(w) * PF_EPSILON;
+                error[i] = value[i] * (expm1(w_error) + PF_LIBM_EPSILON);
+            }
+            else
+                error[i] = INFINITY;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Evaluate node for each point in input, FALSE if it can't be done in double precision at all. */
+gboolean
+pf_vector_evaluate(ParseNode* self, const PFVectorInput* input, gdouble* value, gdouble* error)
+{
+    guint i;
+
+    if(input->n > PF_VECTOR_SIZE || !pf_vector_evaluate_node(self, input, value, error))
+        return FALSE;
+
+    /* Overflows and invalid operations are left to MPNumber */
+    for(i = 0; i < input->n; i++)
+    {
+        if(!isfinite(value[i]) || isnan(error[i]))
+            error[i] = INFINITY;
+    }
+    return TRUE;
+}
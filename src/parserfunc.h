@@ -77,4 +77,23 @@ void* pf_do_xor(ParseNode*);
 
 void* pf_constant(ParseNode*);
 
+void* pf_do_solve(ParseNode*);
+
+void* pf_do_integrate(ParseNode*);
+
+/* Largest number of points evaluated at once by pf_vector_evaluate(). */
+#define PF_VECTOR_SIZE 64
+
+/* Points to evaluate a parse tree at in double precision. */
+typedef struct
+{
+    const gchar* variable;	/* Variable that has a value for each point. */
+    const gdouble* x;		/* Value of variable at each point. */
+    guint n;			/* Number of points, at most PF_VECTOR_SIZE. */
+} PFVectorInput;
+
+/* Evaluate node for each point in double precision. error is set to a bound on the absolute error of each value,
+ * infinite where it must be evaluated with MPNumber. Returns FALSE if the tree can't be evaluated this way. */
+gboolean pf_vector_evaluate(ParseNode*, const PFVectorInput*, gdouble* value, gdouble* error);
+
 #endif /* PARSERFUNC_H */
@@ -202,6 +202,9 @@ pl_get_next_token(PreLexerState* state)
     if(pl_compare_all(ch, 1, (gchar*[]){"%"}))
         return T_PERCENTAGE;
 
+    if(pl_compare_all(ch, 1, (gchar*[]){";"}))
+        return T_SEMICOLON;
+
     if(pl_compare_all(ch, 4, (gchar*[]){" ","\r","\t","\n"}))
     /* Gotta ignore'Em all!!! ;) */
         return PL_SKIP;
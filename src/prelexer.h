@@ -66,7 +66,8 @@ typedef enum
     T_ABS,			//|
     T_POWER,			//^
     T_FACTORIAL,		//!
-    T_PERCENTAGE	//49	//%
+    T_PERCENTAGE,	//49	//%
+    T_SEMICOLON			//;
 } LexerTokenType;
 
 /* Creates a scanner state. Useful when multiple scanners are in action. */
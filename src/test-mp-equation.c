@@ -13,9 +13,16 @@
 #include <string.h>
 #include <stdarg.h>
 #include <locale.h>
+#include <math.h>
+#include <float.h>
+#include <glib/gstdio.h>
 
+#include "libmatecalc.h"
+#include "mp-dependencies.h"
 #include "mp-equation.h"
+#include "mp-history.h"
 #include "mp-serializer.h"
+#include "mp-stats.h"
 #include "unit-manager.h"
 
 static MPEquationOptions options;
@@ -773,6 +780,924 @@ test_equations(void)
     //test("¬¬10₂", "10₂", 0);
 }
 
+static void
+test_calculus(void)
+{
+    memset(&options, 0, sizeof(options));
+    options.base = 10;
+    options.wordlen = 32;
+    options.angle_units = MP_RADIANS;
+    options.variable_is_defined = variable_is_defined;
+    options.get_variable = get_variable;
+
+    /* The variable solved for hides the one of the same name */
+    test("solve(x²−2;x;1)", "1.414213562", 0);
+    test("solve(x²−2;x;−1)", "−1.414213562", 0);
+    test("solve(x²−y;x;1)", "1.732050808", 0);
+    test("solve(x−1;x;1)", "1", 0);
+    test("solve(cos x − x;x;0)", "0.739085133", 0);
+    test("solve(x³−2x−5;x;0)", "2.094551482", 0);
+    test("2×solve(t²−2;t;1)", "2.828427125", 0);
+    test("solve(x²+1;x;1)", "", PARSER_ERR_MP);
+    test("solve(1÷x;x;1)", "", PARSER_ERR_MP);
+    test("solve(x²−2;x)", "", PARSER_ERR_INVALID);
+    test("solve(x²−z;x;1)", "", PARSER_ERR_UNKNOWN_VARIABLE);
+
+    test("integrate(x²;x;0;3)", "9", 0);
+    test("integrate(sin x;x;0;π)", "2", 0);
+    test("integrate(y;x;0;2)", "6", 0);
+    test("integrate(x;x;1;1)", "0", 0);
+    test("integrate(1÷√x;x;0;1)", "2", 0);
+    test("integrate(e^(−x²);x;−5;5)", "1.772453851", 0);
+    test("integrate(x;x;1)", "", PARSER_ERR_INVALID);
+    test("integrate(x;;0;1)", "", PARSER_ERR_INVALID);
+
+    /* Equations in the arguments are evaluated with the same options */
+    test("integrate(t;t;0;solve(x²−4;x;1))", "2", 0);
+    test("solve(integrate(t;t;0;x)−2;x;1)", "2", 0);
+}
+
+static int compiled_x = 0;
+
+static int
+compiled_variable_is_defined(const char *name, void *data)
+{
+    return strcmp (name, "x") == 0;
+}
+
+static int
+compiled_get_variable(const char *name, MPNumber *z, void *data)
+{
+    if (strcmp (name, "x") == 0) {
+        mp_set_from_integer (compiled_x, z);
+        return 1;
+    }
+    return 0;
+}
+
+static void
+TestCompiled(MPCompiledEquation *equation, const char *expression, const char *expected, int expected_error)
+{
+    MPErrorCode error;
+    char *error_token = NULL;
+    MPNumber result = mp_new();
+
+    error = mp_compiled_equation_evaluate(equation, &options, &result, &error_token);
+    if (error_token)
+        g_free (error_token);
+
+    if (error == 0) {
+        char *result_str;
+        MpSerializer *serializer;
+
+        serializer = mp_serializer_new(MP_DISPLAY_FORMAT_FIXED, 10, 9);
+        result_str = mp_serializer_to_string(serializer, &result);
+        g_object_unref(serializer);
+
+        if(expected_error != PARSER_ERR_NONE)
+            fail("'%s' (x=%d) -> %s, expected error %s", expression, compiled_x, result_str, error_code_to_string(expected_error));
+        else if(strcmp(result_str, expected) != 0)
+            fail("'%s' (x=%d) -> '%s', expected '%s'", expression, compiled_x, result_str, expected);
+        else
+            pass("'%s' (x=%d) -> '%s'", expression, compiled_x, result_str);
+        g_free(result_str);
+    }
+    else {
+        if(error == expected_error)
+            pass("'%s' (x=%d) -> error %s", expression, compiled_x, error_code_to_string(error));
+        else if(expected_error == PARSER_ERR_NONE)
+            fail("'%s' (x=%d) -> error %s, expected result %s", expression, compiled_x,
+                 error_code_to_string(error), expected);
+        else
+            fail("'%s' (x=%d) -> error %s, expected error %s", expression, compiled_x,
+                 error_code_to_string(error), error_code_to_string(expected_error));
+    }
+    mp_clear(&result);
+}
+
+/* Evaluate the same parse tree repeatedly, constant and shared subtrees are only computed once */
+static void
+test_compiled(void)
+{
+    MPCompiledEquation *equation;
+    MPEvalContext context;
+    GCancellable *cancellable;
+
+    memset(&options, 0, sizeof(options));
+    options.base = 10;
+    options.wordlen = 32;
+    options.angle_units = MP_DEGREES;
+    options.variable_is_defined = compiled_variable_is_defined;
+    options.get_variable = compiled_get_variable;
+
+    equation = mp_equation_compile("x²+2x+1", &options);
+    compiled_x = 2;
+    TestCompiled(equation, "x²+2x+1", "9", 0);
+    compiled_x = 3;
+    TestCompiled(equation, "x²+2x+1", "16", 0);
+    mp_compiled_equation_free(equation);
+
+    equation = mp_equation_compile("2^10×x+2^10×x", &options);
+    compiled_x = 1;
+    TestCompiled(equation, "2^10×x+2^10×x", "2048", 0);
+    compiled_x = 2;
+    TestCompiled(equation, "2^10×x+2^10×x", "4096", 0);
+    mp_compiled_equation_free(equation);
+
+    equation = mp_equation_compile("2^10×sin(30)+2^10×cos(60)", &options);
+    TestCompiled(equation, "2^10×sin(30)+2^10×cos(60)", "1024", 0);
+    TestCompiled(equation, "2^10×sin(30)+2^10×cos(60)", "1024", 0);
+    mp_compiled_equation_free(equation);
+
+    /* Cached values depend on the angle units */
+    equation = mp_equation_compile("sin(90)", &options);
+    TestCompiled(equation, "sin(90)", "1", 0);
+    options.angle_units = MP_RADIANS;
+    TestCompiled(equation, "sin(90)", "0.893996664", 0);
+    options.angle_units = MP_DEGREES;
+    TestCompiled(equation, "sin(90)", "1", 0);
+    mp_compiled_equation_free(equation);
+
+    /* Numbers are read in the current base */
+    equation = mp_equation_compile("10+x", &options);
+    compiled_x = 0;
+    TestCompiled(equation, "10+x", "10", 0);
+    options.base = 16;
+    TestCompiled(equation, "10+x", "16", 0);
+    options.base = 10;
+    mp_compiled_equation_free(equation);
+
+    /* Errors are reported on every evaluation */
+    equation = mp_equation_compile("1÷0+1÷0", &options);
+    TestCompiled(equation, "1÷0+1÷0", "", PARSER_ERR_MP);
+    TestCompiled(equation, "1÷0+1÷0", "", PARSER_ERR_MP);
+    mp_compiled_equation_free(equation);
+
+    equation = mp_equation_compile("1÷x", &options);
+    compiled_x = 0;
+    TestCompiled(equation, "1÷x", "", PARSER_ERR_MP);
+    compiled_x = 4;
+    TestCompiled(equation, "1÷x", "0.25", 0);
+    mp_compiled_equation_free(equation);
+
+    equation = mp_equation_compile("z+z", &options);
+    TestCompiled(equation, "z+z", "", PARSER_ERR_UNKNOWN_VARIABLE);
+    TestCompiled(equation, "z+z", "", PARSER_ERR_UNKNOWN_VARIABLE);
+    mp_compiled_equation_free(equation);
+
+    equation = mp_equation_compile("2 +", &options);
+    TestCompiled(equation, "2 +", "", PARSER_ERR_INVALID);
+    TestCompiled(equation, "2 +", "", PARSER_ERR_INVALID);
+    mp_compiled_equation_free(equation);
+
+    /* Edited equations are compiled again incrementally */
+    equation = mp_equation_compile("2^10×sin(30)+x", &options);
+    compiled_x = 1;
+    TestCompiled(equation, "2^10×sin(30)+x", "513", 0);
+    mp_compiled_equation_update(equation, "2^10×sin(90)+x");
+    TestCompiled(equation, "2^10×sin(90)+x", "1025", 0);
+    mp_compiled_equation_update(equation, "2^10×sin(90)+x+12");
+    TestCompiled(equation, "2^10×sin(90)+x+12", "1037", 0);
+    mp_compiled_equation_update(equation, "2^10×sin(90)+x+123");
+    TestCompiled(equation, "2^10×sin(90)+x+123", "1148", 0);
+    mp_compiled_equation_update(equation, "2^10×sin(90)×x+123");
+    TestCompiled(equation, "2^10×sin(90)×x+123", "1147", 0);
+    mp_compiled_equation_update(equation, "2^1×sin(90)×x+123");
+    TestCompiled(equation, "2^1×sin(90)×x+123", "125", 0);
+    mp_compiled_equation_update(equation, "2^1×sin(90)×x+");
+    TestCompiled(equation, "2^1×sin(90)×x+", "", PARSER_ERR_INVALID);
+    mp_compiled_equation_update(equation, "2^1×sin(90)×x+1");
+    TestCompiled(equation, "2^1×sin(90)×x+1", "3", 0);
+    mp_compiled_equation_update(equation, "2^1×sin(90)×z+1");
+    TestCompiled(equation, "2^1×sin(90)×z+1", "", PARSER_ERR_UNKNOWN_VARIABLE);
+    mp_compiled_equation_update(equation, "12^1×sin(90)×x+1");
+    TestCompiled(equation, "12^1×sin(90)×x+1", "13", 0);
+    mp_compiled_equation_free(equation);
+
+    /* Arguments of equation functions are read again when their numbers change */
+    equation = mp_equation_compile("solve(t²−x;t;1)", &options);
+    compiled_x = 2;
+    TestCompiled(equation, "solve(t²−x;t;1)", "1.414213562", 0);
+    compiled_x = 3;
+    TestCompiled(equation, "solve(t²−x;t;1)", "1.732050808", 0);
+    mp_compiled_equation_update(equation, "solve(t²−5;t;1)");
+    TestCompiled(equation, "solve(t²−5;t;1)", "2.236067977", 0);
+    mp_compiled_equation_free(equation);
+
+    /* Cancelled evaluations have no result, but the equation can be evaluated again */
+    equation = mp_equation_compile("1+x", &options);
+    compiled_x = 4;
+    options.context = &context;
+    mp_eval_context_init(&context, NULL, 0, 1);
+    TestCompiled(equation, "1+x", "", PARSER_ERR_CANCELLED);
+    mp_eval_context_init(&context, NULL, 0, 0);
+    TestCompiled(equation, "1+x", "5", 0);
+    mp_compiled_equation_free(equation);
+
+    /* Long calculations check for cancellation as they go */
+    equation = mp_equation_compile("100000!", &options);
+    mp_eval_context_init(&context, NULL, 0, 3);
+    TestCompiled(equation, "100000!", "", PARSER_ERR_CANCELLED);
+    mp_compiled_equation_free(equation);
+
+    cancellable = g_cancellable_new();
+    g_cancellable_cancel(cancellable);
+    equation = mp_equation_compile("99999999!", &options);
+    mp_eval_context_init(&context, cancellable, 0, 0);
+    TestCompiled(equation, "99999999!", "", PARSER_ERR_CANCELLED);
+    mp_compiled_equation_free(equation);
+    mp_eval_context_clear(&context);
+    g_object_unref(cancellable);
+    options.context = NULL;
+}
+
+static double double_x = 0;
+
+static int
+double_get_variable(const char *name, MPNumber *z, void *data)
+{
+    if (strcmp(name, "x") == 0) {
+        mp_set_from_double(double_x, z);
+        return 1;
+    }
+    return 0;
+}
+
+/* Check the double precision values of an equation are within their error bounds of the exact values */
+static void
+TestDouble(const char *expression, gboolean expected_supported, guint expected_in_double)
+{
+    static const double points[] = { -100, -2.5, -1, -0.3, 0, 0.1, 0.5, 1, 2, 3.7, 10, 1000 };
+    guint n = G_N_ELEMENTS(points), i, in_double = 0;
+    double values[G_N_ELEMENTS(points)], errors[G_N_ELEMENTS(points)];
+    MPCompiledEquation *equation;
+    MPNumber z = mp_new();
+    gboolean supported;
+
+    equation = mp_equation_compile(expression, &options);
+    supported = mp_compiled_equation_evaluate_double(equation, &options, "x", points, n, values, errors);
+    if (supported != expected_supported) {
+        fail("'%s' -> %s in double precision, expected %s", expression, supported ? "evaluated" : "not evaluated",
+             expected_supported ? "evaluated" : "not evaluated");
+        n = 0;
+    }
+    else if (!supported)
+        n = 0;
+
+    for (i = 0; i < n; i++) {
+        double exact;
+
+        if (isinf(errors[i]))
+            continue;
+        in_double++;
+
+        double_x = points[i];
+        if (mp_compiled_equation_evaluate(equation, &options, &z, NULL) != PARSER_ERR_NONE || mp_is_complex(&z)) {
+            fail("'%s' (x=%g) -> %g±%g in double precision, but no real value", expression, points[i], values[i], errors[i]);
+            break;
+        }
+        exact = mp_to_double(&z);
+        if (fabs(exact - values[i]) > errors[i] + fabs(exact) * DBL_EPSILON) {
+            fail("'%s' (x=%g) -> %.17g±%g in double precision, expected %.17g", expression, points[i], values[i], errors[i], exact);
+            break;
+        }
+    }
+    if (i == n && supported && in_double < expected_in_double)
+        fail("'%s' -> %u points in double precision, expected at least %u", expression, in_double, expected_in_double);
+    else if (i == n)
+        pass("'%s' -> %u points in double precision", expression, in_double);
+
+    mp_clear(&z);
+    mp_compiled_equation_free(equation);
+}
+
+static void
+test_double(void)
+{
+    memset(&options, 0, sizeof(options));
+    options.base = 10;
+    options.wordlen = 32;
+    options.angle_units = MP_DEGREES;
+    options.variable_is_defined = compiled_variable_is_defined;
+    options.get_variable = double_get_variable;
+
+    TestDouble("x²+2x+1", TRUE, 12);
+    TestDouble("x^3−x÷7", TRUE, 12);
+    TestDouble("1÷x", TRUE, 11);
+    TestDouble("√x", TRUE, 7);
+    TestDouble("sqrt(x+π)", TRUE, 9);
+    TestDouble("ln(x)+log(x)", TRUE, 7);
+    TestDouble("e^x", TRUE, 11);
+    TestDouble("2^(x÷3)", TRUE, 12);
+    TestDouble("sin(x)+cos(x)+tan(x)", TRUE, 12);
+    TestDouble("sin²x", TRUE, 12);
+    TestDouble("asin(x÷1000)+atan(x)", TRUE, 11);
+    TestDouble("sinh(x÷100)×tanh(x)", TRUE, 12);
+    TestDouble("|x|−x", TRUE, 12);
+
+    /* Results that can be complex need MPNumber */
+    TestDouble("(−x)^0.5", TRUE, 0);
+
+    /* as do functions without a double precision version */
+    TestDouble("x!", FALSE, 0);
+    TestDouble("floor(x)", FALSE, 0);
+
+    options.angle_units = MP_RADIANS;
+    TestDouble("sin(x)×cos(x)", TRUE, 12);
+    options.angle_units = MP_DEGREES;
+}
+
+static void
+TestCached(MPResultCache *cache, const char *expression, const char *expected, guint64 expected_hits)
+{
+    MPErrorCode error;
+    MPNumber result = mp_new();
+    MpSerializer *serializer;
+    char *result_str = NULL;
+    guint64 hits;
+
+    error = mp_result_cache_parse(cache, expression, &options, &result, NULL);
+    mp_result_cache_get_statistics(cache, &hits, NULL);
+    if (error == PARSER_ERR_NONE) {
+        serializer = mp_serializer_new(MP_DISPLAY_FORMAT_FIXED, 10, 9);
+        result_str = mp_serializer_to_string(serializer, &result);
+        g_object_unref(serializer);
+    }
+
+    if (error != PARSER_ERR_NONE)
+        fail("'%s' (x=%d) -> error %s, expected result %s", expression, compiled_x, error_code_to_string(error), expected);
+    else if (strcmp(result_str, expected) != 0)
+        fail("'%s' (x=%d) -> '%s', expected '%s'", expression, compiled_x, result_str, expected);
+    else if (hits != expected_hits)
+        fail("'%s' (x=%d) -> %" G_GUINT64_FORMAT " cache hits, expected %" G_GUINT64_FORMAT, expression, compiled_x, hits, expected_hits);
+    else
+        pass("'%s' (x=%d) -> '%s'", expression, compiled_x, result_str);
+    g_free(result_str);
+    mp_clear(&result);
+}
+
+static void
+test_result_cache(void)
+{
+    MPResultCache *cache;
+
+    memset(&options, 0, sizeof(options));
+    options.base = 10;
+    options.wordlen = 32;
+    options.angle_units = MP_DEGREES;
+    options.variable_is_defined = compiled_variable_is_defined;
+    options.get_variable = compiled_get_variable;
+
+    cache = mp_result_cache_new(2);
+    compiled_x = 2;
+    TestCached(cache, "x+1", "3", 0);
+    TestCached(cache, "x+1", "3", 1);
+    TestCached(cache, " x+1 ", "3", 2);
+
+    /* Results are checked against the variables they read */
+    compiled_x = 5;
+    TestCached(cache, "x+1", "6", 2);
+    TestCached(cache, "x+1", "6", 3);
+
+    /* and the options used */
+    options.angle_units = MP_RADIANS;
+    TestCached(cache, "x+1", "6", 3);
+    options.angle_units = MP_DEGREES;
+
+    /* Assignments are made every time */
+    TestCached(cache, "y=4", "4", 3);
+    TestCached(cache, "y=4", "4", 3);
+
+    /* Least recently used results are dropped */
+    mp_result_cache_clear(cache);
+    TestCached(cache, "1+1", "2", 3);
+    TestCached(cache, "2+2", "4", 3);
+    TestCached(cache, "1+1", "2", 4);
+    TestCached(cache, "3+3", "6", 4);
+    TestCached(cache, "2+2", "4", 4);
+    TestCached(cache, "1+1", "2", 4);
+    mp_result_cache_free(cache);
+}
+
+static void
+TestLibrary(MateCalcContext *context, const char *expression, const char *expected, MateCalcError expected_error)
+{
+    MateCalcError error;
+    char *result = NULL;
+
+    error = mate_calc_evaluate(context, expression, &result, NULL);
+    if (error != expected_error)
+        fail("'%s' -> error %s, expected error %s", expression,
+             mate_calc_error_to_string(error), mate_calc_error_to_string(expected_error));
+    else if (error == MATE_CALC_ERROR_NONE && strcmp(result, expected) != 0)
+        fail("'%s' -> '%s', expected '%s'", expression, result, expected);
+    else
+        pass("'%s' -> '%s'", expression, result ? result : mate_calc_error_to_string(error));
+    free(result);
+}
+
+static void
+test_library(void)
+{
+    MateCalcContext *context, *other;
+
+    context = mate_calc_context_new();
+    TestLibrary(context, "1+2", "3", MATE_CALC_ERROR_NONE);
+    TestLibrary(context, "ans×2", "6", MATE_CALC_ERROR_NONE);
+    TestLibrary(context, "x", "", MATE_CALC_ERROR_UNKNOWN_VARIABLE);
+    TestLibrary(context, "x=4", "4", MATE_CALC_ERROR_NONE);
+    TestLibrary(context, "x²", "16", MATE_CALC_ERROR_NONE);
+    mate_calc_context_set_variable(context, "y", "2+3");
+    TestLibrary(context, "x+y", "9", MATE_CALC_ERROR_NONE);
+    mate_calc_context_unset_variable(context, "y");
+    TestLibrary(context, "x+y", "", MATE_CALC_ERROR_UNKNOWN_VARIABLE);
+    TestLibrary(context, "1÷0", "", MATE_CALC_ERROR_MATH);
+
+    mate_calc_context_set_angle_units(context, MATE_CALC_RADIANS);
+    TestLibrary(context, "sin(90)", "0.893996664", MATE_CALC_ERROR_NONE);
+    mate_calc_context_set_accuracy(context, 2);
+    TestLibrary(context, "1÷3", "0.33", MATE_CALC_ERROR_NONE);
+    mate_calc_context_set_base(context, 16);
+    TestLibrary(context, "A+1", "B", MATE_CALC_ERROR_NONE);
+
+    mate_calc_context_set_limits(context, 0, 3);
+    TestLibrary(context, "100000!", "", MATE_CALC_ERROR_CANCELLED);
+
+    /* Variables belong to a context */
+    other = mate_calc_context_new();
+    TestLibrary(other, "x", "", MATE_CALC_ERROR_UNKNOWN_VARIABLE);
+    TestLibrary(other, "sin(90)", "1", MATE_CALC_ERROR_NONE);
+    mate_calc_context_free(other);
+
+    mate_calc_context_free(context);
+}
+
+static void
+tabulate_row_cb(const char *x, const char *result, MateCalcError error, void *data)
+{
+    GString *rows = data;
+
+    g_string_append_printf(rows, "%s:%s ", x, result ? result : mate_calc_error_to_string(error));
+}
+
+static void
+TestTabulate(MateCalcContext *context, const char *expression, const char *start, const char *end, const char *step,
+             int n_threads, const char *expected)
+{
+    MateCalcError error;
+    GString *rows = g_string_new(NULL);
+
+    error = mate_calc_tabulate(context, expression, "n", start, end, step, n_threads, tabulate_row_cb, rows, NULL);
+    g_strchomp(rows->str);
+    if (error != MATE_CALC_ERROR_NONE)
+        fail("'%s' over %s..%s (%d threads) -> error %s, expected '%s'", expression, start, end, n_threads,
+             mate_calc_error_to_string(error), expected);
+    else if (strcmp(rows->str, expected) != 0)
+        fail("'%s' over %s..%s (%d threads) -> '%s', expected '%s'", expression, start, end, n_threads, rows->str, expected);
+    else
+        pass("'%s' over %s..%s (%d threads) -> '%s'", expression, start, end, n_threads, rows->str);
+    g_string_free(rows, TRUE);
+}
+
+static void
+TestReduce(MateCalcContext *context, MateCalcReduction reduction, const char *expression, const char *start,
+           const char *end, int n_threads, const char *expected, MateCalcError expected_error)
+{
+    MateCalcError error;
+    char *result = NULL;
+
+    error = mate_calc_reduce(context, reduction, expression, "n", start, end, NULL, n_threads, &result, NULL);
+    if (error != expected_error)
+        fail("%s '%s' over %s..%s -> error %s, expected error %s", reduction == MATE_CALC_SUM ? "Σ" : "Π", expression,
+             start, end, mate_calc_error_to_string(error), mate_calc_error_to_string(expected_error));
+    else if (error == MATE_CALC_ERROR_NONE && strcmp(result, expected) != 0)
+        fail("%s '%s' over %s..%s -> '%s', expected '%s'", reduction == MATE_CALC_SUM ? "Σ" : "Π", expression,
+             start, end, result, expected);
+    else
+        pass("%s '%s' over %s..%s -> '%s'", reduction == MATE_CALC_SUM ? "Σ" : "Π", expression, start, end,
+             result ? result : mate_calc_error_to_string(error));
+    free(result);
+}
+
+static void
+test_tabulate(void)
+{
+    MateCalcContext *context;
+
+    context = mate_calc_context_new();
+    TestTabulate(context, "n²", "0", "4", NULL, 1, "0:0 1:1 2:4 3:9 4:16");
+    TestTabulate(context, "n²", "0", "4", NULL, 3, "0:0 1:1 2:4 3:9 4:16");
+    TestTabulate(context, "2n", "4", "0", "−2", 2, "4:8 2:4 0:0");
+    TestTabulate(context, "n", "0", "0.3", "0.1", 2, "0:0 0.1:0.1 0.2:0.2 0.3:0.3");
+    TestTabulate(context, "n", "0", "1", "−1", 2, "");
+
+    /* Errors for one row don't stop the others */
+    TestTabulate(context, "1÷n", "−1", "1", NULL, 2, "−1:−1 0:PARSER_ERR_MP 1:1");
+
+    /* Other variables are read from the context */
+    mate_calc_context_set_variable(context, "k", "10");
+    TestTabulate(context, "k+n", "1", "2", NULL, 2, "1:11 2:12");
+
+    TestReduce(context, MATE_CALC_SUM, "n", "1", "1000", 4, "500500", MATE_CALC_ERROR_NONE);
+    TestReduce(context, MATE_CALC_SUM, "n", "1", "1000", 1, "500500", MATE_CALC_ERROR_NONE);
+    TestReduce(context, MATE_CALC_PRODUCT, "n", "1", "10", 3, "3628800", MATE_CALC_ERROR_NONE);
+    TestReduce(context, MATE_CALC_SUM, "n", "1", "0", 2, "0", MATE_CALC_ERROR_NONE);
+    TestReduce(context, MATE_CALC_PRODUCT, "n", "1", "0", 2, "1", MATE_CALC_ERROR_NONE);
+    TestReduce(context, MATE_CALC_SUM, "1÷(n−5)", "1", "10", 3, "", MATE_CALC_ERROR_MATH);
+    TestReduce(context, MATE_CALC_SUM, "n+m", "1", "10", 3, "", MATE_CALC_ERROR_UNKNOWN_VARIABLE);
+    TestReduce(context, MATE_CALC_SUM, "n+", "1", "10", 3, "", MATE_CALC_ERROR_INVALID);
+
+    /* The step limit applies to each row, not to the whole range */
+    mate_calc_context_set_limits(context, 0, 50);
+    TestReduce(context, MATE_CALC_SUM, "n", "1", "1000", 4, "500500", MATE_CALC_ERROR_NONE);
+    TestTabulate(context, "n²", "0", "4", NULL, 3, "0:0 1:1 2:4 3:9 4:16");
+    mate_calc_context_set_limits(context, 0, 0);
+
+    mate_calc_context_free(context);
+}
+
+static void
+TestStatistics(const char *expression, MPStatsOperation operation, guint64 expected)
+{
+    MPStatistics stats;
+    MPNumber result = mp_new();
+
+    mp_stats_reset();
+    mp_equation_parse(expression, &options, &result, NULL);
+    mp_stats_get(&stats);
+    mp_clear(&result);
+
+    if (stats.operations[operation] != expected)
+        fail("'%s' -> %" G_GUINT64_FORMAT " operations, expected %" G_GUINT64_FORMAT, expression,
+             stats.operations[operation], expected);
+    else if (stats.span_count[MP_STATS_LEX] != 1 || stats.span_count[MP_STATS_PARSE] != 1 ||
+             stats.span_count[MP_STATS_EVALUATE] != 1)
+        fail("'%s' -> spans %" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT ", expected one of each",
+             expression, stats.span_count[MP_STATS_LEX], stats.span_count[MP_STATS_PARSE], stats.span_count[MP_STATS_EVALUATE]);
+    else if (stats.numbers == 0 || stats.peak_numbers <= 0)
+        fail("'%s' -> no numbers counted", expression);
+    else
+        pass("'%s' -> %" G_GUINT64_FORMAT " operations", expression, stats.operations[operation]);
+}
+
+static gpointer
+ignored_statistics_thread(gpointer data)
+{
+    MPNumber result = mp_new();
+
+    mp_stats_ignore_thread(TRUE);
+    mp_equation_parse(data, &options, &result, NULL);
+    mp_clear(&result);
+
+    return NULL;
+}
+
+/* Work on ignored threads, like previews, isn't counted */
+static void
+TestIgnoredStatistics(const char *expression)
+{
+    MPStatistics stats;
+
+    mp_stats_reset();
+    g_thread_join(g_thread_new("test-mp-stats", ignored_statistics_thread, (gpointer) expression));
+    mp_stats_get(&stats);
+
+    if (stats.operations[MP_STATS_FACTORIAL] != 0 || stats.numbers != 0 || stats.span_count[MP_STATS_EVALUATE] != 0)
+        fail("'%s' on an ignored thread -> counted", expression);
+    else
+        pass("'%s' on an ignored thread -> not counted", expression);
+}
+
+static void
+test_statistics(void)
+{
+    memset(&options, 0, sizeof(options));
+    options.base = 10;
+    options.wordlen = 32;
+    options.angle_units = MP_DEGREES;
+
+    mp_stats_init(TRUE);
+    TestStatistics("sin 30+cos 60", MP_STATS_TRIGONOMETRIC, 2);
+    TestStatistics("5!+3!", MP_STATS_FACTORIAL, 2);
+    TestStatistics("1+1", MP_STATS_FACTORIAL, 0);
+    TestIgnoredStatistics("5!+3!");
+    mp_stats_init(FALSE);
+}
+
+/* Equations read back by the history callbacks */
+static GString *history_result;
+static MpSerializer *history_serializer;
+
+static gboolean
+history_cb(guint64 index, const MPHistoryEntry *entry, gpointer data)
+{
+    gchar *answer;
+
+    answer = mp_serializer_to_string(history_serializer, &entry->answer);
+    g_string_append_printf(history_result, "%s%s=%s", history_result->len > 0 ? " " : "", entry->equation, answer);
+    g_free(answer);
+
+    return TRUE;
+}
+
+static gboolean
+history_answer_cb(guint64 index, const MPHistoryEntry *entry, gpointer data)
+{
+    const MPNumber *expected = data;
+
+    if (!mp_is_equal(&entry->answer, expected))
+        fail("history answer of '%s' changed when read back", entry->equation);
+    else
+        pass("history answer of '%s' read back exactly", entry->equation);
+
+    return TRUE;
+}
+
+static void
+TestHistoryForeach(MPHistory *history, guint64 start, guint64 n, const char *expected)
+{
+    g_string_truncate(history_result, 0);
+    mp_history_foreach(history, start, n, history_cb, NULL);
+    if (strcmp(history_result->str, expected) != 0)
+        fail("history %" G_GUINT64_FORMAT "+%" G_GUINT64_FORMAT " -> '%s', expected '%s'", start, n, history_result->str, expected);
+    else
+        pass("history %" G_GUINT64_FORMAT "+%" G_GUINT64_FORMAT " -> '%s'", start, n, history_result->str);
+}
+
+static void
+TestHistorySearch(MPHistory *history, const char *text, gboolean prefix, guint max_results, const char *expected)
+{
+    g_string_truncate(history_result, 0);
+    mp_history_search(history, text, prefix, max_results, history_cb, NULL);
+    if (strcmp(history_result->str, expected) != 0)
+        fail("search '%s' -> '%s', expected '%s'", text, history_result->str, expected);
+    else
+        pass("search '%s' -> '%s'", text, history_result->str);
+}
+
+static void
+test_history(void)
+{
+    MPHistory *history, *other;
+    MPHistoryEntry entry;
+    gchar *dir, *filename, *index_filename;
+    int i;
+
+    dir = g_dir_make_tmp("test-mp-history-XXXXXX", NULL);
+    if (dir == NULL) {
+        fail("Failed to make a directory for the history");
+        return;
+    }
+    filename = g_build_filename(dir, "history", NULL);
+    index_filename = g_strconcat(filename, ".index", NULL);
+    history_result = g_string_new(NULL);
+    history_serializer = mp_serializer_new(MP_DISPLAY_FORMAT_AUTOMATIC, 10, 9);
+
+    /* Enough entries to need the index */
+    history = mp_history_open(filename);
+    memset(&entry, 0, sizeof(entry));
+    entry.base = 10;
+    entry.wordlen = 32;
+    entry.angle_units = MP_DEGREES;
+    entry.answer = mp_new();
+    for (i = 0; i < 600; i++) {
+        gchar *equation = g_strdup_printf("%d+1", i);
+        entry.equation = equation;
+        mp_set_from_integer(i + 1, &entry.answer);
+        mp_history_append(history, &entry);
+        g_free(equation);
+    }
+    mp_clear(&entry.answer);
+    mp_history_free(history);
+
+    history = mp_history_open(filename);
+    if (mp_history_get_length(history) != 600)
+        fail("history length %" G_GUINT64_FORMAT ", expected 600", mp_history_get_length(history));
+    else
+        pass("history length 600");
+    TestHistoryForeach(history, 0, 2, "0+1=1 1+1=2");
+    TestHistoryForeach(history, 511, 3, "511+1=512 512+1=513 513+1=514");
+    TestHistoryForeach(history, 598, 10, "598+1=599 599+1=600");
+    TestHistorySearch(history, "59", TRUE, 3, "599+1=600 598+1=599 597+1=598");
+    TestHistorySearch(history, "99", FALSE, 10, "599+1=600 499+1=500 399+1=400 299+1=300 199+1=200 99+1=100");
+    TestHistorySearch(history, "600", FALSE, 10, "");
+
+    /* Answers are read back without rounding */
+    entry.equation = "1÷3";
+    entry.answer = mp_new();
+    mp_set_from_integer(1, &entry.answer);
+    mp_divide_integer(&entry.answer, 3, &entry.answer);
+    mp_history_append(history, &entry);
+    mp_history_foreach(history, 600, 1, history_answer_cb, &entry.answer);
+    mp_clear(&entry.answer);
+
+    mp_history_clear(history);
+    if (mp_history_get_length(history) != 0)
+        fail("history length %" G_GUINT64_FORMAT " after clear, expected 0", mp_history_get_length(history));
+    else
+        pass("history length 0 after clear");
+    mp_history_free(history);
+
+    /* Windows sharing the log append in turns, each sees the other's entries */
+    history = mp_history_open(filename);
+    other = mp_history_open(filename);
+    entry.answer = mp_new();
+    for (i = 0; i < 600; i++) {
+        gchar *equation = g_strdup_printf("%d+1", i);
+        entry.equation = equation;
+        mp_set_from_integer(i + 1, &entry.answer);
+        mp_history_append(i % 3 == 0 ? other : history, &entry);
+        g_free(equation);
+    }
+    mp_clear(&entry.answer);
+    TestHistoryForeach(history, 511, 3, "511+1=512 512+1=513 513+1=514");
+    TestHistoryForeach(other, 598, 10, "598+1=599 599+1=600");
+    mp_history_free(other);
+    mp_history_free(history);
+
+    /* The index written by both is right */
+    history = mp_history_open(filename);
+    TestHistoryForeach(history, 256, 2, "256+1=257 257+1=258");
+    TestHistoryForeach(history, 512, 1, "512+1=513");
+    mp_history_free(history);
+
+    g_string_free(history_result, TRUE);
+    g_object_unref(history_serializer);
+    g_remove(index_filename);
+    g_remove(filename);
+    g_rmdir(dir);
+    g_free(index_filename);
+    g_free(filename);
+    g_free(dir);
+}
+
+/* Variables set by the dependency tests, and the number of values set */
+static GHashTable *dependency_variables;
+static int dependency_sets;
+
+static int
+dependency_variable_is_defined(const char *name, void *data)
+{
+    return g_hash_table_contains(dependency_variables, name);
+}
+
+static int
+dependency_get_variable(const char *name, MPNumber *z, void *data)
+{
+    MPNumber *value = g_hash_table_lookup(dependency_variables, name);
+
+    if (!value)
+        return 0;
+    mp_set_from_mp(value, z);
+    return 1;
+}
+
+static void
+dependency_set_variable(const char *name, const MPNumber *x, void *data)
+{
+    MPNumber *value = g_malloc(sizeof(MPNumber));
+
+    *value = mp_new();
+    mp_set_from_mp(x, value);
+    g_hash_table_insert(dependency_variables, g_strdup(name), value);
+    dependency_sets++;
+}
+
+static void
+dependency_value_free(MPNumber *value)
+{
+    mp_clear(value);
+    g_free(value);
+}
+
+/* Check the values of the variables in expected, e.g. "a=1 b=2" */
+static void
+TestDependencies(MPDependencies *dependencies, const char *expression, const char *expected, int expected_sets)
+{
+    MpSerializer *serializer;
+    GString *values;
+    gchar **names;
+    MPNumber result = mp_new();
+    MPErrorCode error;
+    int i;
+
+    dependency_sets = 0;
+    error = mp_dependencies_parse(dependencies, expression, &options, &result, NULL);
+    mp_clear(&result);
+
+    serializer = mp_serializer_new(MP_DISPLAY_FORMAT_AUTOMATIC, 10, 9);
+    values = g_string_new(NULL);
+    names = g_strsplit(expected, " ", -1);
+    for (i = 0; names[i] != NULL; i++) {
+        MPNumber *value;
+        gchar *name = g_strndup(names[i], strchr(names[i], '=') - names[i]);
+
+        value = g_hash_table_lookup(dependency_variables, name);
+        if (value) {
+            gchar *text = mp_serializer_to_string(serializer, value);
+            g_string_append_printf(values, "%s%s=%s", i > 0 ? " " : "", name, text);
+            g_free(text);
+        }
+        g_free(name);
+    }
+    g_strfreev(names);
+    g_object_unref(serializer);
+
+    if (error != PARSER_ERR_NONE)
+        fail("'%s' -> error %s, expected '%s'", expression, mp_error_code_to_string(error), expected);
+    else if (strcmp(values->str, expected) != 0)
+        fail("'%s' -> '%s', expected '%s'", expression, values->str, expected);
+    else if (dependency_sets != expected_sets)
+        fail("'%s' -> %d variables set, expected %d", expression, dependency_sets, expected_sets);
+    else
+        pass("'%s' -> '%s'", expression, values->str);
+    g_string_free(values, TRUE);
+}
+
+static void
+TestDependencyEquation(MPDependencies *dependencies, const char *name, const char *expected)
+{
+    gchar *equation = mp_dependencies_get_equation(dependencies, name);
+
+    if (g_strcmp0(equation, expected) != 0)
+        fail("equation of %s -> '%s', expected '%s'", name, equation, expected);
+    else
+        pass("equation of %s -> '%s'", name, equation);
+    g_free(equation);
+}
+
+static void
+test_dependencies(void)
+{
+    MPDependencies *dependencies;
+    MPNumber *value;
+
+    memset(&options, 0, sizeof(options));
+    options.base = 10;
+    options.wordlen = 32;
+    options.angle_units = MP_DEGREES;
+    options.variable_is_defined = dependency_variable_is_defined;
+    options.get_variable = dependency_get_variable;
+    options.set_variable = dependency_set_variable;
+
+    dependency_variables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) dependency_value_free);
+    dependencies = mp_dependencies_new();
+
+    TestDependencies(dependencies, "a=5", "a=5", 1);
+    TestDependencies(dependencies, "b=a*2", "a=5 b=10", 1);
+    TestDependencies(dependencies, "c=b+a", "a=5 b=10 c=15", 1);
+    TestDependencies(dependencies, "d=a+1", "a=5 b=10 c=15 d=6", 1);
+    TestDependencyEquation(dependencies, "b", "b=a*2");
+    TestDependencyEquation(dependencies, "a", NULL);
+
+    /* Only the variables calculated from the one assigned are recalculated */
+    TestDependencies(dependencies, "a=7", "a=7 b=14 c=21 d=8", 4);
+    TestDependencies(dependencies, "b=a*3", "a=7 b=21 c=28 d=8", 2);
+    TestDependencies(dependencies, "e=10", "e=10", 1);
+    TestDependencies(dependencies, "a+1", "a=7 b=21 c=28 d=8", 0);
+
+    /* Equations that would make a cycle only set a value */
+    TestDependencies(dependencies, "x=1", "x=1", 1);
+    TestDependencies(dependencies, "x=x+1", "x=2", 1);
+    TestDependencies(dependencies, "x=x+1", "x=3", 1);
+    TestDependencyEquation(dependencies, "x", NULL);
+    TestDependencies(dependencies, "a=c+1", "a=29 b=87 c=116 d=30", 4);
+    TestDependencyEquation(dependencies, "a", NULL);
+
+    /* Values set another way */
+    value = g_hash_table_lookup(dependency_variables, "a");
+    mp_set_from_integer(1, value);
+    dependency_sets = 0;
+    if (mp_dependencies_update(dependencies, "a", &options, NULL) != PARSER_ERR_NONE || dependency_sets != 3)
+        fail("update a -> %d variables set, expected 3", dependency_sets);
+    else
+        pass("update a -> %d variables set", dependency_sets);
+    TestDependencies(dependencies, "a", "a=1 b=3 c=4 d=2", 0);
+
+    /* Assigning a value drops the equation */
+    TestDependencies(dependencies, "b=5", "a=1 b=5 c=6 d=2", 2);
+    TestDependencyEquation(dependencies, "b", NULL);
+    TestDependencies(dependencies, "a=2", "a=2 b=5 c=7 d=3", 3);
+
+    /* Variables that can't be recalculated keep their values */
+    TestDependencies(dependencies, "g=a+1", "a=2 g=3", 1);
+    TestDependencies(dependencies, "h=g÷(a−1)", "a=2 g=3 h=3", 1);
+    TestDependencies(dependencies, "i=h+1", "h=3 i=4", 1);
+    TestDependencies(dependencies, "a=1", "a=1 c=6 d=2 g=2 h=3 i=4", 4);
+
+    /* Enough variables in one level to be evaluated in parallel */
+    TestDependencies(dependencies, "q=1", "q=1", 1);
+    TestDependencies(dependencies, "j=q+1", "q=1 j=2", 1);
+    TestDependencies(dependencies, "k=q+2", "q=1 k=3", 1);
+    TestDependencies(dependencies, "l=q+3", "q=1 l=4", 1);
+    TestDependencies(dependencies, "m=q+4", "q=1 m=5", 1);
+    TestDependencies(dependencies, "n=q+5", "q=1 n=6", 1);
+    TestDependencies(dependencies, "q=10", "q=10 j=11 k=12 l=13 m=14 n=15", 6);
+
+    mp_dependencies_free(dependencies);
+    g_hash_table_unref(dependency_variables);
+}
+
 int
 main (void)
 {
@@ -781,6 +1706,15 @@ main (void)
     test_mp();
     test_conversions();
     test_equations();
+    test_calculus();
+    test_compiled();
+    test_double();
+    test_result_cache();
+    test_library();
+    test_tabulate();
+    test_statistics();
+    test_history();
+    test_dependencies();
     if (fails == 0)
         printf("Passed all %i tests\n", passes);
 
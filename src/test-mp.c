@@ -214,6 +214,51 @@ test_mp(void)
     mp_clear(&minus_one);
 }
 
+static void
+test_exact(const char *name, const MPNumber *x)
+{
+    MPNumber t = mp_new();
+    gchar *text;
+
+    text = mp_to_exact_string(x);
+    if (!mp_set_from_exact_string(text, &t))
+        fail("mp_set_from_exact_string(%s) -> failed", text);
+    else if (!mp_is_equal(x, &t) || mp_is_complex(x) != mp_is_complex(&t))
+        fail("%s -> %s, does not round-trip", name, text);
+    else
+        pass("%s -> %s", name, text);
+    g_free(text);
+    mp_clear(&t);
+}
+
+static void
+test_exact_strings(void)
+{
+    MPNumber x = mp_new();
+    MPNumber y = mp_new();
+    MPNumber z = mp_new();
+
+    mp_set_from_integer(0, &x);
+    test_exact("0", &x);
+    mp_set_from_integer(-42, &x);
+    test_exact("-42", &x);
+    mp_set_from_fraction(1, 3, &x);
+    test_exact("1/3", &x);
+    mp_get_pi(&x);
+    test_exact("π", &x);
+    mp_set_from_fraction(-5, 2, &x);
+    mp_set_from_fraction(1, 7, &y);
+    mp_set_from_complex(&x, &y, &z);
+    test_exact("-5/2+i/7", &z);
+
+    try("mp_set_from_exact_string(\"\")", mp_set_from_exact_string("", &x), false);
+    try("mp_set_from_exact_string(\"0x1p+1 x\")", mp_set_from_exact_string("0x1p+1 x", &x), false);
+
+    mp_clear(&x);
+    mp_clear(&y);
+    mp_clear(&z);
+}
+
 int
 main (void)
 {
@@ -221,6 +266,7 @@ main (void)
 
     test_mp();
     test_numbers();
+    test_exact_strings();
     if (fails == 0)
         printf("Passed all %i tests\n", passes);
 